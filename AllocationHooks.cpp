@@ -0,0 +1,29 @@
+// Replaces the global operator new and delete to count every allocation (see Profiler::RecordAllocation). Linked
+// into editor_bench, and into the editor only when built with TEXTED_PROFILE, so other builds keep the library's own.
+
+#include <cstdlib>
+#include <new>
+#include "Profiler.h"
+
+using namespace std;
+
+static void *Allocate(size_t size) {
+	Profiler::RecordAllocation(size);
+	if (auto pointer = malloc(size ? size : 1))
+		return pointer;
+	throw bad_alloc();
+}
+
+static void Free(void *pointer) {
+	if (!pointer)
+		return;
+	Profiler::RecordFree();
+	free(pointer);
+}
+
+void *operator new(size_t size) { return Allocate(size); }
+void *operator new[](size_t size) { return Allocate(size); }
+void operator delete(void *pointer) noexcept { Free(pointer); }
+void operator delete[](void *pointer) noexcept { Free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { Free(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { Free(pointer); }
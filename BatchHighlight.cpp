@@ -0,0 +1,423 @@
+// Lexes many files at once without a window, with the CppLexer the text area highlights with, e.g. to pre-render
+// highlighted sources for a review tool.
+//
+//   batch_highlight [options] <file or directory>...   directories are walked for C and C++ sources
+//   --list F           also the paths listed in F, one per line; "-" reads them from stdin
+//   --format F         stats (default): token counts and bytes per type
+//                      html: one <pre> per file, tokens in spans classed by type, in a page with a stylesheet
+//                      ansi: the files with 24-bit terminal colors
+//   --threads N        lexing threads (default: one per core)
+//
+// Binary files are skipped. A path that does not exist or cannot be read is named on stderr and the exit status is
+// non-zero, so a review tool never takes a partial run for a whole one.
+//
+// Files are lexed on a ThreadPool, each into an output chunk of its own that goes out as soon as every file before
+// it has. A file whose output outgrows the chunk before its turn waits for it, and no file is taken more than a few
+// per thread ahead of the one being written, so memory stays at a file and a chunk per thread however much is lexed.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Lexer.h"
+#include "Profiler.h"
+#include "TextFile.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+static const size_t chunkSize = 1 << 20; // output held per file before it has to wait for its turn
+static const size_t filesAheadPerThread = 4;
+static const size_t binaryProbe = 8000; // bytes looked at for a NUL, as git does
+static const int maxTokenTypes = 64;
+
+enum class Format {
+	Stats, Html, Ansi
+};
+
+struct Color {
+	unsigned char r, g, b;
+};
+
+// The text area's colors; types not listed are left plain.
+static const pair<string_view, Color> tokenColors[] = {
+	{"Keyword", {0, 0, 255}},
+	{"Literal", {0, 228, 48}},
+	{"Operator", {230, 41, 55}},
+	{"Punctuation", {80, 80, 80}},
+	{"LineComment", {130, 130, 130}},
+	{"BlockComment", {80, 80, 80}},
+	{"Directive", {128, 0, 128}},
+	{"StringLiteral", {128, 0, 0}},
+	{"CharLiteral", {128, 0, 0}},
+};
+
+// What to write around the tokens of each type, looked up by the type's number.
+struct TokenStyles {
+	int typesNum = 0;
+	array<string, maxTokenTypes> names;
+	array<string, maxTokenTypes> open;
+	array<string, maxTokenTypes> close;
+
+	TokenStyles(const Lexer& lexer, Format format) {
+		for (; typesNum < maxTokenTypes && string_view(lexer.TokenTypeName(typesNum)) != "Unknown"; typesNum++) {
+			auto type = static_cast<size_t>(typesNum);
+			names[type] = lexer.TokenTypeName(typesNum);
+			auto color = find_if(begin(tokenColors), end(tokenColors), [&](const auto& entry) { return entry.first == names[type]; });
+			if (color == end(tokenColors))
+				continue;
+			if (format == Format::Html) {
+				open[type] = "<span class=\"" + names[type] + "\">";
+				close[type] = "</span>";
+			}
+			else if (format == Format::Ansi) {
+				auto [r, g, b] = color->second;
+				open[type] = "\x1b[38;2;" + to_string(r) + ";" + to_string(g) + ";" + to_string(b) + "m";
+				close[type] = "\x1b[0m";
+			}
+		}
+	}
+
+	string StyleSheet() const {
+		auto css = string("pre.texted { font-family: monospace; }\n");
+		for (const auto& [name, color]: tokenColors)
+			css += "pre.texted ." + string(name) + " { color: rgb(" + to_string(color.r) + ", " + to_string(color.g) +
+				   ", " + to_string(color.b) + "); }\n";
+		return css;
+	}
+};
+
+// Output
+
+static void AppendEscapedHtml(string& out, string_view text) {
+	for (size_t start = 0; start < text.size();) {
+		auto special = text.find_first_of("&<>\"", start);
+		auto end = special == string_view::npos ? text.size() : special;
+		out.append(text.data() + start, end - start);
+		if (special == string_view::npos)
+			break;
+		switch (text[special]) {
+			case '&': out += "&amp;"; break;
+			case '<': out += "&lt;"; break;
+			case '>': out += "&gt;"; break;
+			default: out += "&quot;"; break;
+		}
+		start = special + 1;
+	}
+}
+
+// The outputs of files lexed in any order, written in the order of the files. The worker of the file being written
+// writes straight to `file`; the others keep their output until their turn.
+struct OrderedOutput {
+	explicit OrderedOutput(FILE *file, size_t window) : file(file), window(window) {}
+
+	// Returns once file `index` may be started: the outputs of at most `window` files wait before it.
+	void Reserve(size_t index) {
+		unique_lock lock(mutex);
+		turn.wait(lock, [&]() { return index < next + window; });
+	}
+
+	// Hands over what file `index` wrote to `text` so far, and clears it unless it is kept for later. Before its
+	// turn a chunk's worth blocks until then; the end of the file (`last`) is set aside for the file before it.
+	void Put(size_t index, string& text, bool last) {
+		unique_lock lock(mutex);
+		if (next != index) {
+			if (last) {
+				held.emplace(index, std::move(text));
+				text = string();
+				return;
+			}
+			if (text.size() < chunkSize)
+				return;
+			turn.wait(lock, [&]() { return next == index; });
+		}
+		lock.unlock();
+		Write(text);
+		text.clear();
+		if (!last)
+			return;
+		// Files set aside while this one was written go out now, up to one that is not done yet.
+		lock.lock();
+		for (next++; !held.empty() && held.begin()->first == next; next++) {
+			auto heldText = std::move(held.begin()->second);
+			held.erase(held.begin());
+			lock.unlock();
+			Write(heldText);
+			lock.lock();
+		}
+		turn.notify_all();
+	}
+
+	bool Failed() const { return failed; }
+
+private:
+	FILE *file;
+	size_t window;
+	std::mutex mutex;
+	condition_variable turn;
+	size_t next = 0; // the file being written
+	map<size_t, string> held;
+	atomic<bool> failed = false;
+
+	void Write(string_view text) {
+		if (!text.empty() && fwrite(text.data(), 1, text.size(), file) != text.size())
+			failed = true;
+	}
+};
+
+// Statistics
+
+struct TokenCounts {
+	array<uint64_t, maxTokenTypes> tokens = {};
+	array<uint64_t, maxTokenTypes> bytes = {};
+	uint64_t files = 0, skipped = 0, failed = 0, lines = 0, totalBytes = 0;
+
+	void Add(const TokenCounts& other) {
+		for (size_t i = 0; i < tokens.size(); i++) {
+			tokens[i] += other.tokens[i];
+			bytes[i] += other.bytes[i];
+		}
+		files += other.files;
+		skipped += other.skipped;
+		failed += other.failed;
+		lines += other.lines;
+		totalBytes += other.totalBytes;
+	}
+};
+
+// Lexing
+
+// What a thread keeps from file to file, so a file costs no allocations once they have grown to fit.
+struct Worker {
+	CppLexer lexer;
+	string source;
+	string output;
+	TokenCounts counts;
+};
+
+static void LexFile(Worker& worker, const string& path, size_t index, Format format, const TokenStyles& styles,
+					OrderedOutput& output) {
+	PROFILE_SCOPE("BatchHighlight::LexFile");
+	auto& out = worker.output;
+	auto& counts = worker.counts;
+	auto contents = FileContents();
+	// Read rather than mapped: the lexer owns its text, so the buffer moves into it and back without a copy.
+	auto loaded = contents.Load(path, worker.source, numeric_limits<uint64_t>::max());
+	auto data = contents.data;
+	if (!loaded) {
+		cerr << "Failed to read " << path << endl;
+		counts.failed++;
+		output.Put(index, out, true);
+		return;
+	}
+	// Binary files are left out on purpose.
+	if (!data.empty() && memchr(data.data(), 0, min(data.size(), binaryProbe))) {
+		counts.skipped++;
+		output.Put(index, out, true);
+		return;
+	}
+	worker.source.resize(data.size()); // shorter when the file was truncated while read
+	counts.files++;
+	auto endsLine = data.empty() || data.back() == '\n';
+	counts.lines += CountNewlines(data) + (endsLine ? 0 : 1);
+	counts.totalBytes += data.size();
+
+	if (format == Format::Html) {
+		out += "<pre class=\"texted\" data-path=\"";
+		AppendEscapedHtml(out, path);
+		out += "\">";
+	}
+	else if (format == Format::Ansi) {
+		out += "\x1b[1m==> ";
+		out += path;
+		out += " <==\x1b[0m\n";
+	}
+	auto& lexer = worker.lexer;
+	lexer.ResetSource(std::move(worker.source));
+	for (lexer.NextToken(); lexer.currentToken.type != EOF; lexer.NextToken()) {
+		auto type = static_cast<size_t>(clamp(lexer.currentToken.type, 0, maxTokenTypes - 1));
+		auto text = lexer.currentToken.text;
+		counts.tokens[type]++;
+		counts.bytes[type] += text.size();
+		if (format == Format::Stats)
+			continue;
+		out += styles.open[type];
+		if (format == Format::Html)
+			AppendEscapedHtml(out, text);
+		else
+			out.append(text);
+		out += styles.close[type];
+		if (out.size() >= chunkSize)
+			output.Put(index, out, false);
+	}
+	worker.source = std::move(lexer.sourceCode);
+	if (format == Format::Html)
+		out += "</pre>\n";
+	else if (format == Format::Ansi && !endsLine)
+		out += "\n";
+	output.Put(index, out, true);
+}
+
+// Files
+
+static bool IsSourceFile(const string& name) {
+	static const string extensions[] = {".c", ".cc", ".cpp", ".cxx", ".h", ".hh", ".hpp", ".hxx", ".inl", ".ipp"};
+	auto dot = name.rfind('.');
+	return dot != string::npos && find(begin(extensions), end(extensions), name.substr(dot)) != end(extensions);
+}
+
+// The C and C++ sources under `directory` in path order, without hidden entries or symbolic links. Returns false when
+// it could not be listed.
+static bool CollectSources(const filesystem::path& directory, vector<string>& paths) {
+	auto found = vector<string>();
+	auto error = error_code();
+	auto entries = filesystem::recursive_directory_iterator(directory, error);
+	for (; !error && entries != filesystem::recursive_directory_iterator(); entries.increment(error)) {
+		auto name = entries->path().filename().string();
+		auto statusError = error_code();
+		if (name.empty() || name.front() == '.') {
+			if (entries->is_directory(statusError))
+				entries.disable_recursion_pending();
+			continue;
+		}
+		if (entries->is_regular_file(statusError) && !entries->is_symlink(statusError) && IsSourceFile(name))
+			found.push_back(entries->path().string());
+	}
+	if (error)
+		cerr << "Failed to list " << directory.string() << ": " << error.message() << endl;
+	sort(found.begin(), found.end());
+	paths.insert(paths.end(), found.begin(), found.end());
+	return !error;
+}
+
+// Returns false, saying so on stderr, when `argument` names nothing that can be read.
+static bool CollectPaths(const string& argument, vector<string>& paths) {
+	auto error = error_code();
+	if (filesystem::is_directory(argument, error))
+		return CollectSources(argument, paths);
+	if (!filesystem::exists(argument, error)) {
+		cerr << "Failed to read " << argument << ": "
+			 << (error ? error.message() : make_error_code(errc::no_such_file_or_directory).message()) << endl;
+		return false;
+	}
+	paths.push_back(argument);
+	return true;
+}
+
+// Returns false when the list cannot be read or names a path that cannot be; the rest are collected all the same,
+// so every bad one is reported.
+static bool ReadList(const string& listPath, vector<string>& paths) {
+	auto file = ifstream();
+	if (listPath != "-") {
+		file.open(listPath);
+		if (!file.is_open()) {
+			cerr << "Failed to read file list: " << listPath << endl;
+			return false;
+		}
+	}
+	auto& in = listPath == "-" ? cin : file;
+	auto collected = true;
+	for (auto line = string(); getline(in, line);) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (!line.empty())
+			collected = CollectPaths(line, paths) && collected;
+	}
+	return collected;
+}
+
+static bool ParseFormat(string_view name, Format& format) {
+	if (name == "stats")
+		format = Format::Stats;
+	else if (name == "html")
+		format = Format::Html;
+	else if (name == "ansi")
+		format = Format::Ansi;
+	else
+		return false;
+	return true;
+}
+
+int main(int argc, char **argv) {
+	auto format = Format::Stats;
+	auto threadsNum = 0;
+	auto paths = vector<string>();
+	// Bad paths fail the run before anything is lexed, since whatever reads the output would be missing files.
+	auto collected = true;
+	for (auto i = 1; i < argc; i++) {
+		auto argument = string(argv[i]);
+		if (argument == "--format" && i + 1 < argc && ParseFormat(argv[i + 1], format))
+			i++;
+		else if (argument == "--threads" && i + 1 < argc)
+			threadsNum = max(1, atoi(argv[++i]));
+		else if (argument == "--list" && i + 1 < argc)
+			collected = ReadList(argv[++i], paths) && collected;
+		else if (!argument.starts_with("--"))
+			collected = CollectPaths(argument, paths) && collected;
+		else {
+			fprintf(stderr, "usage: %s [--format stats|html|ansi] [--threads N] [--list F] <file or directory>...\n", argv[0]);
+			return 1;
+		}
+	}
+	if (!collected)
+		return 1;
+	if (threadsNum == 0)
+		threadsNum = max(1, static_cast<int>(thread::hardware_concurrency()));
+
+	auto begin = chrono::steady_clock::now();
+	auto styles = TokenStyles(CppLexer(), format);
+	if (format == Format::Html)
+		printf("<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><style>\n%s</style></head><body>\n",
+			   styles.StyleSheet().c_str());
+
+	// The calling thread lexes too.
+	ThreadPool pool(max(1, threadsNum - 1));
+	auto output = OrderedOutput(stdout, filesAheadPerThread * static_cast<size_t>(threadsNum));
+	auto totals = TokenCounts();
+	auto totalsMutex = mutex();
+	pool.ForEach(paths.size(), [&](size_t index) {
+		thread_local auto worker = Worker();
+		output.Reserve(index);
+		LexFile(worker, paths[index], index, format, styles, output);
+		// Counted per file, since the pool's threads outlive this run.
+		lock_guard lock(totalsMutex);
+		totals.Add(worker.counts);
+		worker.counts = TokenCounts();
+	});
+
+	if (format == Format::Html)
+		printf("</body></html>\n");
+	if (fflush(stdout) != 0 || output.Failed()) {
+		fprintf(stderr, "Failed to write the output\n");
+		return 1;
+	}
+	auto seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+	// Statistics go to stdout only when they are the output; otherwise the summary is for whoever watches.
+	auto summary = format == Format::Stats ? stdout : stderr;
+	if (format == Format::Stats) {
+		printf("%-16s %14s %16s\n", "type", "tokens", "bytes");
+		for (auto type = 0; type < styles.typesNum; type++)
+			printf("%-16s %14llu %16llu\n", styles.names[static_cast<size_t>(type)].c_str(),
+				   static_cast<unsigned long long>(totals.tokens[static_cast<size_t>(type)]),
+				   static_cast<unsigned long long>(totals.bytes[static_cast<size_t>(type)]));
+	}
+	fprintf(summary, "%llu files (%llu skipped, %llu failed), %llu lines, %.1f MB in %.2f s: %.1f MB/s on %d threads\n",
+			static_cast<unsigned long long>(totals.files), static_cast<unsigned long long>(totals.skipped),
+			static_cast<unsigned long long>(totals.failed),
+			static_cast<unsigned long long>(totals.lines), static_cast<double>(totals.totalBytes) / (1 << 20), seconds,
+			static_cast<double>(totals.totalBytes) / (1 << 20) / max(seconds, 1e-9), threadsNum);
+	// A file that went away or could not be read after it was listed fails the run too, once the others are out.
+	return totals.failed == 0 ? 0 : 1;
+}
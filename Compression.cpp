@@ -0,0 +1,171 @@
+#include "Compression.h"
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+static const size_t minMatch = 4;
+static const size_t maxOffset = 65535;
+static const int hashBits = 14;
+// Matches stop this far from the end, so the last bytes are always literals and the match loops can read ahead.
+static const size_t endLiterals = 8;
+
+static uint32_t Load32(const char *data) {
+	auto value = uint32_t();
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static uint64_t Load64(const char *data) {
+	auto value = uint64_t();
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static uint32_t Hash(uint32_t sequence) {
+	return (sequence * 2654435761u) >> (32 - hashBits);
+}
+
+// Lengths past what the token holds continue in bytes of 255 and a final smaller one.
+static void PutLength(string& packed, size_t length) {
+	for (; length >= 255; length -= 255)
+		packed.push_back(static_cast<char>(255));
+	packed.push_back(static_cast<char>(length));
+}
+
+static void PutSequence(string& packed, const char *literals, size_t literalsLength, size_t offset, size_t matchLength) {
+	auto extraMatch = matchLength > 0 ? matchLength - minMatch : 0;
+	packed.push_back(static_cast<char>((min<size_t>(literalsLength, 15) << 4) | min<size_t>(extraMatch, 15)));
+	if (literalsLength >= 15)
+		PutLength(packed, literalsLength - 15);
+	packed.append(literals, literalsLength);
+	if (matchLength == 0)
+		return;
+	packed.push_back(static_cast<char>(offset & 0xFF));
+	packed.push_back(static_cast<char>(offset >> 8));
+	if (extraMatch >= 15)
+		PutLength(packed, extraMatch - 15);
+}
+
+// How many bytes from `a` on equal those from `b` on, without reading at or past `end`.
+static size_t MatchLength(const char *a, const char *b, const char *end) {
+	auto start = a;
+	if constexpr (endian::native == endian::little)
+		for (; a + 8 <= end; a += 8, b += 8)
+			if (auto difference = Load64(a) ^ Load64(b))
+				return static_cast<size_t>(a - start) + static_cast<size_t>(countr_zero(difference)) / 8;
+	while (a < end && *a == *b) {
+		a++;
+		b++;
+	}
+	return static_cast<size_t>(a - start);
+}
+
+void Compress(string_view data, string& packed) {
+	auto source = data.data();
+	auto size = data.size();
+	packed.reserve(packed.size() + size / 2 + 16);
+	size_t anchor = 0; // start of the literals not written yet
+	if (size > endLiterals + minMatch) {
+		// Positions where each hashed four bytes were last seen; stale or colliding ones fail the comparison.
+		thread_local uint32_t table[1 << hashBits];
+		memset(table, 0, sizeof(table));
+		auto matchEnd = source + size - endLiterals;
+		auto limit = size - endLiterals - minMatch;
+		size_t position = 1, misses = 0;
+		while (position < limit) {
+			auto sequence = Load32(source + position);
+			auto& slot = table[Hash(sequence)];
+			size_t candidate = slot;
+			slot = static_cast<uint32_t>(position);
+			if (position - candidate > maxOffset || Load32(source + candidate) != sequence) {
+				// The longer nothing matches, the further it skips, so incompressible data passes quickly.
+				position += 1 + (misses++ >> 6);
+				continue;
+			}
+			auto length = minMatch + MatchLength(source + position + minMatch, source + candidate + minMatch, matchEnd);
+			PutSequence(packed, source + anchor, position - anchor, position - candidate, length);
+			position += length;
+			anchor = position;
+			misses = 0;
+			if (position < limit)
+				table[Hash(Load32(source + position - 2))] = static_cast<uint32_t>(position - 2);
+		}
+	}
+	PutSequence(packed, source + anchor, size - anchor, 0, 0);
+}
+
+bool Decompress(string_view packed, size_t size, string& data) {
+	auto input = reinterpret_cast<const uint8_t *>(packed.data());
+	auto inputEnd = input + packed.size();
+	auto start = data.size();
+	data.resize(start + size);
+	auto output = data.data() + start;
+	auto outputStart = output;
+	auto outputEnd = output + size;
+
+	auto readLength = [&](size_t& length) {
+		while (input < inputEnd) {
+			auto byte = *input++;
+			length += byte;
+			if (byte != 255)
+				return true;
+		}
+		return false;
+	};
+	auto fail = [&]() {
+		data.resize(start);
+		return false;
+	};
+
+	while (input < inputEnd) {
+		auto token = *input++;
+		size_t literalsLength = token >> 4;
+		if (literalsLength == 15 && !readLength(literalsLength))
+			return fail();
+		if (literalsLength > static_cast<size_t>(inputEnd - input) || literalsLength > static_cast<size_t>(outputEnd - output))
+			return fail();
+		// Copies of a fixed size compile to a few moves; away from the ends they may run past what is needed.
+		if (inputEnd - input >= static_cast<ptrdiff_t>(literalsLength + 16) &&
+			outputEnd - output >= static_cast<ptrdiff_t>(literalsLength + 16))
+			for (size_t i = 0; i < literalsLength; i += 16)
+				memcpy(output + i, input + i, 16);
+		else
+			memcpy(output, input, literalsLength);
+		output += literalsLength;
+		input += literalsLength;
+		if (input == inputEnd)
+			break;
+
+		if (inputEnd - input < 2)
+			return fail();
+		auto offset = static_cast<size_t>(input[0]) | static_cast<size_t>(input[1]) << 8;
+		input += 2;
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && !readLength(matchLength))
+			return fail();
+		matchLength += minMatch;
+		if (offset == 0 || offset > static_cast<size_t>(output - outputStart) ||
+			matchLength > static_cast<size_t>(outputEnd - output))
+			return fail();
+		auto from = output - offset;
+		auto room = outputEnd - output;
+		// A chunk never reads what the same chunk writes, so the match may overlap what it copies.
+		if (offset >= 16 && room >= static_cast<ptrdiff_t>(matchLength + 16))
+			for (size_t i = 0; i < matchLength; i += 16)
+				memcpy(output + i, from + i, 16);
+		else if (offset >= 8 && room >= static_cast<ptrdiff_t>(matchLength + 8))
+			for (size_t i = 0; i < matchLength; i += 8)
+				memcpy(output + i, from + i, 8);
+		else if (offset >= matchLength)
+			memcpy(output, from, matchLength);
+		else
+			for (size_t i = 0; i < matchLength; i++)
+				output[i] = from[i];
+		output += matchLength;
+	}
+	if (output != outputEnd)
+		return fail();
+	return true;
+}
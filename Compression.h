@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// A byte-oriented LZ77 codec laid out like an LZ4 block: runs of literals and back-references of at least four
+// bytes within the last 64 KB, each introduced by one token byte, with no entropy coding. It trades ratio for
+// speed: source code shrinks to about a third, and decompression is little more than memcpy.
+
+// Appends the compressed form of `data` to `packed`.
+void Compress(std::string_view data, std::string& packed);
+// Appends the `size` bytes `packed` decompresses to to `data`. Returns false, with `data` as it was, when `packed` is
+// not the compressed form of exactly `size` bytes.
+bool Decompress(std::string_view packed, size_t size, std::string& data);
@@ -0,0 +1,341 @@
+#include "EditJournal.h"
+#include "Profiler.h"
+#include "TextFile.h"
+#include <chrono>
+#include <climits>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string_view>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char magic[4] = {'T', 'X', 'J', '1'};
+static const size_t headerSize = sizeof(magic) + 16;
+static const size_t recordHeaderSize = 8; // payload size and checksum
+static const auto syncInterval = chrono::milliseconds(200);
+
+// Encoding
+
+// Size and modified time only; the hash is left unknown.
+static optional<FileStamp> StampOf(const string& path) {
+	auto error = error_code();
+	auto size = filesystem::file_size(path, error);
+	if (error)
+		return nullopt;
+	auto time = filesystem::last_write_time(path, error);
+	if (error)
+		return nullopt;
+	return FileStamp {static_cast<int64_t>(time.time_since_epoch().count()), size};
+}
+
+static void PutFixed(string& out, uint64_t value, int bytes) {
+	for (auto i = 0; i < bytes; i++)
+		out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+static uint64_t GetFixed(string_view data, int bytes) {
+	auto value = uint64_t(0);
+	for (auto i = 0; i < bytes; i++)
+		value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+	return value;
+}
+
+static void PutVarint(string& out, uint64_t value) {
+	for (; value >= 0x80; value >>= 7)
+		out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+	out.push_back(static_cast<char>(value));
+}
+
+static bool GetVarint(string_view& data, uint64_t& value) {
+	value = 0;
+	for (auto shift = 0; shift < 64 && !data.empty(); shift += 7) {
+		auto byte = static_cast<unsigned char>(data.front());
+		data.remove_prefix(1);
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if (byte < 0x80)
+			return true;
+	}
+	return false;
+}
+
+static bool GetInt(string_view& data, int& value) {
+	auto wide = uint64_t(0);
+	if (!GetVarint(data, wide) || wide > INT_MAX)
+		return false;
+	value = static_cast<int>(wide);
+	return true;
+}
+
+static uint32_t Checksum(string_view data) {
+	auto hash = 2166136261u; // FNV-1a
+	for (auto c: data)
+		hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+	return hash;
+}
+
+static string EncodeHeader(const FileStamp& stamp) {
+	auto header = string(magic, sizeof(magic));
+	PutFixed(header, stamp.size, 8);
+	PutFixed(header, static_cast<uint64_t>(stamp.modifiedTime), 8);
+	return header;
+}
+
+static bool DecodeEdits(string_view payload, vector<TextEdit>& edits) {
+	auto editsNum = uint64_t(0);
+	if (!GetVarint(payload, editsNum) || editsNum > payload.size())
+		return false;
+	edits.resize(editsNum);
+	for (auto& edit: edits) {
+		auto textSize = uint64_t(0);
+		if (!GetInt(payload, edit.from.line) || !GetInt(payload, edit.from.column) ||
+			!GetInt(payload, edit.to.line) || !GetInt(payload, edit.to.column) ||
+			!GetVarint(payload, textSize) || textSize > payload.size())
+			return false;
+		edit.text.assign(payload.data(), textSize);
+		payload.remove_prefix(textSize);
+	}
+	return payload.empty();
+}
+
+// Whether ApplyEdits can take the batch: sorted, not overlapping, and inside the lines.
+static bool FitsLines(const vector<TextEdit>& edits, const vector<string>& lines) {
+	auto linesNum = static_cast<int>(lines.size());
+	for (size_t i = 0; i < edits.size(); i++) {
+		const auto& edit = edits[i];
+		if (edit.to < edit.from || (i > 0 && edit.from < edits[i - 1].to) || edit.to.line >= linesNum ||
+			edit.from.column > static_cast<int>(lines[edit.from.line].size()) ||
+			edit.to.column > static_cast<int>(lines[edit.to.line].size()))
+			return false;
+	}
+	return true;
+}
+
+// Applies the records of the journal at `path` to `lines` when it was written against `stamp`. Returns the size
+// of the journal up to the last record that could be applied, or 0 when it does not apply at all; a record torn
+// by a crash, and anything after it, is dropped.
+static size_t Replay(const string& path, const FileStamp& stamp, vector<string>& lines, int& recovered) {
+	PROFILE_SCOPE("EditJournal::Replay");
+	recovered = 0;
+	auto stream = ifstream(path, ios::binary);
+	if (!stream)
+		return 0;
+	auto buffer = stringstream();
+	buffer << stream.rdbuf();
+	auto contents = buffer.str();
+	auto data = string_view(contents);
+	if (data.size() < headerSize || data.substr(0, headerSize) != EncodeHeader(stamp))
+		return 0;
+
+	auto validSize = headerSize;
+	auto edits = vector<TextEdit>();
+	for (auto rest = data.substr(headerSize); rest.size() >= recordHeaderSize;) {
+		auto payloadSize = GetFixed(rest, 4);
+		auto checksum = static_cast<uint32_t>(GetFixed(rest.substr(4), 4));
+		if (payloadSize > rest.size() - recordHeaderSize)
+			break;
+		auto payload = rest.substr(recordHeaderSize, payloadSize);
+		if (Checksum(payload) != checksum || !DecodeEdits(payload, edits) || !FitsLines(edits, lines))
+			break;
+		ApplyEdits(lines, edits);
+		recovered++;
+		rest.remove_prefix(recordHeaderSize + payloadSize);
+		validSize += recordHeaderSize + payloadSize;
+	}
+	return validSize;
+}
+
+static bool SyncFile(FILE *file) {
+	if (fflush(file) != 0)
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+// EditJournal
+
+EditJournal::~EditJournal() {
+	Stop();
+}
+
+string EditJournal::JournalPathOf(const string& documentPath) {
+	auto path = filesystem::path(documentPath);
+	return (path.parent_path() / ("." + path.filename().string() + ".texted-journal")).string();
+}
+
+int EditJournal::Open(const string& newDocumentPath, vector<string>& lines) {
+	Close();
+	documentPath = newDocumentPath;
+	journalPath = JournalPathOf(documentPath);
+	auto stamp = StampOf(documentPath);
+	auto recovered = 0;
+	auto validSize = stamp ? Replay(journalPath, *stamp, lines, recovered) : 0;
+	return Begin(validSize) ? recovered : -1;
+}
+
+bool EditJournal::Compact(const string& newDocumentPath, uint64_t keepFrom) {
+	PROFILE_SCOPE("EditJournal::Compact");
+	auto kept = string();
+	if (file && keepFrom < total) {
+		Flush();
+		auto stream = ifstream(journalPath, ios::binary);
+		stream.seekg(static_cast<streamoff>(recordsOffset + max(keepFrom, totalAtBegin) - totalAtBegin));
+		auto buffer = stringstream();
+		buffer << stream.rdbuf();
+		kept = buffer.str();
+	}
+	Close();
+	documentPath = newDocumentPath;
+	journalPath = JournalPathOf(documentPath);
+	if (!Begin(0))
+		return false;
+	if (!kept.empty()) {
+		{
+			lock_guard lock(mutex);
+			pending.append(kept);
+			appended += kept.size();
+			total += kept.size();
+		}
+		changed.notify_all();
+	}
+	return true;
+}
+
+bool EditJournal::Begin(size_t validSize) {
+	failed = false;
+	appended = synced = 0;
+	totalAtBegin = total;
+	recordsOffset = validSize > 0 ? validSize : headerSize;
+	pending.clear();
+	if (validSize > 0) {
+		// Appending goes on right after the last intact record.
+		auto error = error_code();
+		filesystem::resize_file(journalPath, validSize, error);
+		file = error ? nullptr : fopen(journalPath.c_str(), "ab");
+	}
+	else if (auto stamp = StampOf(documentPath)) {
+		file = fopen(journalPath.c_str(), "wb");
+		auto header = EncodeHeader(*stamp);
+		if (file && (fwrite(header.data(), 1, header.size(), file) != header.size() || !SyncFile(file))) {
+			fclose(file);
+			file = nullptr;
+		}
+	}
+	if (!file)
+		return false;
+	stopping = false;
+	writer = thread([this]() { Write(); });
+	return true;
+}
+
+void EditJournal::Stop() {
+	if (!file)
+		return;
+	{
+		lock_guard lock(mutex);
+		stopping = true;
+	}
+	changed.notify_all();
+	writer.join();
+	fclose(file);
+	file = nullptr;
+}
+
+void EditJournal::Close() {
+	if (!file)
+		return;
+	Stop();
+	auto error = error_code();
+	filesystem::remove(journalPath, error);
+}
+
+void EditJournal::Append(const vector<TextEdit>& edits) {
+	if (!file || edits.empty())
+		return;
+	PROFILE_SCOPE("EditJournal::Append");
+	record.assign(recordHeaderSize, '\0');
+	PutVarint(record, edits.size());
+	for (const auto& edit: edits) {
+		PutVarint(record, edit.from.line);
+		PutVarint(record, edit.from.column);
+		PutVarint(record, edit.to.line);
+		PutVarint(record, edit.to.column);
+		PutVarint(record, edit.text.size());
+		record.append(edit.text);
+	}
+	auto payload = string_view(record).substr(recordHeaderSize);
+	auto header = string();
+	PutFixed(header, payload.size(), 4);
+	PutFixed(header, Checksum(payload), 4);
+	record.replace(0, recordHeaderSize, header);
+	{
+		lock_guard lock(mutex);
+		pending.append(record);
+		appended += record.size();
+		total += record.size();
+	}
+	changed.notify_all();
+}
+
+void EditJournal::Flush() {
+	if (!file)
+		return;
+	unique_lock lock(mutex);
+	flushRequested = true;
+	changed.notify_all();
+	changed.wait(lock, [&]() { return synced == appended; });
+}
+
+void EditJournal::Write() {
+	auto writing = string();
+	auto unsynced = false;
+	auto lastSync = chrono::steady_clock::now();
+	unique_lock lock(mutex);
+	for (;;) {
+		auto wakeUp = [&]() { return !pending.empty() || stopping || flushRequested; };
+		// Records reach the file as soon as they come, so they survive the editor crashing; syncing, which only
+		// matters if the whole system goes down, waits until `syncInterval` has passed to cover a burst of edits.
+		if (unsynced)
+			changed.wait_until(lock, lastSync + syncInterval, wakeUp);
+		else
+			changed.wait(lock, wakeUp);
+		auto target = appended;
+		auto stop = stopping, flush = flushRequested;
+		writing.swap(pending);
+		lock.unlock();
+
+		if (!writing.empty()) {
+			PROFILE_SCOPE("EditJournal::Write");
+			if (fwrite(writing.data(), 1, writing.size(), file) != writing.size() || fflush(file) != 0)
+				failed = true;
+			writing.clear();
+			unsynced = true;
+		}
+		if (unsynced && (stop || flush || chrono::steady_clock::now() >= lastSync + syncInterval)) {
+			PROFILE_SCOPE("EditJournal::Sync");
+			if (!SyncFile(file))
+				failed = true;
+			lastSync = chrono::steady_clock::now();
+			unsynced = false;
+		}
+
+		lock.lock();
+		if (!unsynced) {
+			synced = target;
+			flushRequested = flushRequested && !flush;
+			changed.notify_all();
+		}
+		if (stop && pending.empty())
+			return;
+	}
+}
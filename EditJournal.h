@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TextEdit.h"
+
+// Append-only log of the edits made to a document since it was last loaded or saved, so unsaved work survives a
+// crash without ever rewriting the document. Each batch of edits becomes one checksummed binary record; a
+// background thread writes records as they come and syncs them to disk at most every `syncInterval`, so a
+// keystroke costs an encode and a queue append. The journal lives next to the document as
+// ".<name>.texted-journal" and starts with the size and modification time of the file it applies to, so edits
+// are only ever replayed onto the exact file they were made against.
+struct EditJournal {
+
+	~EditJournal(); // stops writing but leaves the journal on disk, as a crash would
+
+	// Starts journaling the document at `documentPath`, whose contents were just loaded into `lines`. Edits left by
+	// an earlier session against the file as it is now are replayed into `lines` first and kept in the journal.
+	// Returns how many edit batches were recovered, or -1 when the journal could not be written.
+	int Open(const std::string& documentPath, std::vector<std::string>& lines);
+	// Records one batch, as given to ApplyEdits.
+	void Append(const std::vector<TextEdit>& edits);
+	// How much has been journaled so far, for Compact() to keep what is journaled after.
+	uint64_t Mark() const { return total; }
+	// After the document was saved to `documentPath`: the journal starts over against the saved file. Records appended
+	// after `keepFrom`, a Mark() taken along with the lines that were saved, are kept, since those edits are not in it.
+	bool Compact(const std::string& documentPath, uint64_t keepFrom = UINT64_MAX);
+	// Stops journaling and deletes the journal, e.g. when the document is closed without saving.
+	void Close();
+	// Blocks until every appended record is synced to disk.
+	void Flush();
+
+	bool IsOpen() const { return file != nullptr; }
+	bool Failed() const { return failed; } // a write or sync failed; later edits may not be recoverable
+	const std::string& JournalPath() const { return journalPath; }
+	static std::string JournalPathOf(const std::string& documentPath);
+
+private:
+	std::string documentPath;
+	std::string journalPath;
+	FILE *file = nullptr;
+	std::string record; // encoding buffer, reused across appends
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::string pending; // records waiting for the writer
+	uint64_t appended = 0, synced = 0; // bytes ever queued, and of those, bytes on disk
+	uint64_t total = 0, totalAtBegin = 0; // bytes queued over every Begin(), and before the last one
+	uint64_t recordsOffset = 0; // where the records queued since the last Begin() start in the file
+	bool stopping = false;
+	bool flushRequested = false;
+	std::atomic<bool> failed = false;
+
+	bool Begin(size_t validSize);
+	void Stop();
+	void Write();
+};
@@ -0,0 +1,435 @@
+// Micro-benchmarks for UI::Input edit operations over synthetic documents. Runs without a window:
+// UI::fontMetrics is filled in by hand instead of from a loaded font.
+//
+//   editor_bench                      run the default sweep (1k..10M lines, 10 B..10 MB lines)
+//   editor_bench <lines> <length>     run a single document shape
+//   editor_bench ... --iterations N   samples per operation (default 200)
+//   editor_bench ... --font F.ttf     also time building the glyph quads of a screen of highlighted text
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "EditJournal.h"
+#include "HibernatedLines.h"
+#include "Jobs.h"
+#include "LineDiff.h"
+#include "Profiler.h"
+#include "Widgets.h"
+
+using namespace std;
+
+// Documents
+
+struct DocumentShape {
+	int lines = 1000;
+	int lineLength = 40;
+};
+
+static vector<string> GenerateDocument(const DocumentShape& shape, mt19937& random) {
+	static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz_(){};=+ ";
+	auto pick = uniform_int_distribution<int>(0, sizeof(alphabet) - 2);
+	// Lines share one random pattern so that generating 10M lines stays cheap.
+	auto pattern = string(static_cast<size_t>(shape.lineLength) + 64, ' ');
+	for (auto& c: pattern)
+		c = alphabet[pick(random)];
+	auto lines = vector<string>();
+	lines.reserve(shape.lines);
+	for (auto i = 0; i < shape.lines; i++)
+		lines.emplace_back(pattern, i % 64, shape.lineLength);
+	return lines;
+}
+
+static string FormatSize(long long bytes) {
+	if (bytes >= 1 << 20) return to_string(bytes >> 20) + " MB";
+	if (bytes >= 1 << 10) return to_string(bytes >> 10) + " KB";
+	return to_string(bytes) + " B";
+}
+
+// Measurement
+
+struct Samples {
+	vector<double> microseconds;
+	uint64_t allocations = 0;
+	uint64_t bytes = 0;
+};
+
+// Runs `prepare` untimed, then times `operation` and counts its allocations.
+static void Measure(Samples& samples, const function<void()>& prepare, const function<void()>& operation) {
+	if (prepare) prepare();
+	auto before = Profiler::TotalAllocations(); // counted by AllocationHooks.cpp
+	auto begin = chrono::steady_clock::now();
+	operation();
+	auto end = chrono::steady_clock::now();
+	auto after = Profiler::TotalAllocations();
+	samples.allocations += after.count - before.count;
+	samples.bytes += after.bytes - before.bytes;
+	samples.microseconds.push_back(chrono::duration<double, micro>(end - begin).count());
+}
+
+static double Percentile(vector<double>& values, double percentile) {
+	auto index = static_cast<size_t>(percentile / 100 * static_cast<double>(values.size() - 1) + .5);
+	nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+static void Report(const char *operation, const DocumentShape& shape, Samples& samples) {
+	if (samples.microseconds.empty())
+		return;
+	auto count = static_cast<double>(samples.microseconds.size());
+	auto document = to_string(shape.lines) + " x " + FormatSize(shape.lineLength);
+	printf("%-22s %-18s %6zu %12.2f %12.2f %12.2f %12.2f %10.1f %12.0f\n", operation, document.c_str(),
+		   samples.microseconds.size(),
+		   Percentile(samples.microseconds, 50), Percentile(samples.microseconds, 90),
+		   Percentile(samples.microseconds, 99), *max_element(samples.microseconds.begin(), samples.microseconds.end()),
+		   static_cast<double>(samples.allocations) / count, static_cast<double>(samples.bytes) / count);
+}
+
+// Glyph quads of a full screen of lexed text: built from scratch, reused as they are, and after scrolling by a line.
+static void RunTextQuads(const DocumentShape& shape, vector<string>& lines, int iterations, mt19937& random) {
+	auto input = UI::Input(lines);
+	input.layout = Rectangle {0, 0, 1200, 900};
+	input.lexer = make_unique<CppLexer>();
+	input.OnLinesReplaced();
+	auto contentHeight = static_cast<float>(lines.size()) * UI::fontMetrics.lineHeight;
+	auto scrollSomewhere = [&]() {
+		input.SetTopOffset(uniform_real_distribution<float>(0, contentHeight)(random));
+		// Lex up to the new position first, so that catching up is not timed.
+		for (auto i = 0; i < 1000; i++) {
+			input.UpdateTextQuads();
+			if (!UI::Tick(nullptr))
+				break;
+		}
+	};
+
+	auto cold = Samples(), warm = Samples(), scrolled = Samples();
+	auto quadsNum = 0;
+	for (auto i = 0; i < iterations; i++) {
+		Measure(cold, [&]() { scrollSomewhere(); input.InvalidateLineQuads(0); }, [&]() { input.UpdateTextQuads(); });
+		Measure(warm, nullptr, [&]() { input.UpdateTextQuads(); });
+		quadsNum = 0;
+		for (const auto& [line, quads]: input.lineQuads)
+			quadsNum += quads.batch.QuadsNum();
+		Measure(scrolled, nullptr, [&]() {
+			input.SetTopOffset(input.TopOffset() + UI::fontMetrics.lineHeight);
+			input.UpdateTextQuads();
+		});
+	}
+	Report("text: build quads", shape, cold);
+	Report("text: reuse quads", shape, warm);
+	Report("text: scroll 1 line", shape, scrolled);
+	printf("%-22s %-18s %6d quads on screen\n", "", "", quadsNum);
+
+	// The minimap of the same document: summarized from scratch, then its pixels after an edit.
+	auto minimap = UI::Minimap(input);
+	minimap.layout = Rectangle {1200, 0, minimap.width, 900};
+	auto summarize = Samples(), minimapEdit = Samples();
+	Measure(summarize, nullptr, [&]() {
+		input.minimap->Reset(static_cast<int>(lines.size()));
+		do
+			minimap.UpdatePixels();
+		while (input.minimap->IsSweeping());
+	});
+	auto randomLine = uniform_int_distribution<int>(0, static_cast<int>(lines.size()) - 1);
+	for (auto i = 0; i < iterations; i++)
+		Measure(minimapEdit, [&]() { input.SetCursorLine(randomLine(random)); }, [&]() {
+			input.HandleChar('x');
+			minimap.UpdatePixels();
+		});
+	Report("minimap: summarize", shape, summarize);
+	Report("minimap: HandleChar", shape, minimapEdit);
+}
+
+static void RunDocument(const DocumentShape& shape, int iterations, bool withText) {
+	auto random = mt19937(42);
+	auto lines = GenerateDocument(shape, random);
+	auto input = UI::Input(lines);
+	input.layout = Rectangle {0, 0, 800, 600};
+
+	auto randomLine = [&]() { return uniform_int_distribution<int>(0, static_cast<int>(lines.size()) - 1)(random); };
+	auto randomColumn = [&](int line) {
+		return uniform_int_distribution<int>(0, static_cast<int>(lines[line].size()))(random);
+	};
+	auto placeCursor = [&]() {
+		auto line = randomLine();
+		input.SetCursorLine(line);
+		input.SetCursorColumn(randomColumn(line));
+	};
+
+	// Enter and Backspace at line start are inverses, so pairing them keeps the document shape stable.
+	auto enter = Samples(), joinLines = Samples();
+	for (auto i = 0; i < iterations; i++) {
+		Measure(enter, placeCursor, [&]() { input.HandleKey(KEY_ENTER); });
+		Measure(joinLines, nullptr, [&]() { input.HandleKey(KEY_BACKSPACE); });
+	}
+	Report("HandleKey(Enter)", shape, enter);
+	Report("HandleKey(Backspace@0)", shape, joinLines);
+
+	auto tab = Samples();
+	for (auto i = 0; i < iterations; i++)
+		Measure(tab, placeCursor, [&]() { input.HandleKey(KEY_TAB); });
+	Report("HandleKey(Tab)", shape, tab);
+
+	auto character = Samples();
+	for (auto i = 0; i < iterations; i++)
+		Measure(character, placeCursor, [&]() { input.HandleChar('x'); });
+	Report("HandleChar", shape, character);
+
+	// The same with every edit journaled; then the edits are undone by hand and recovered from the journal.
+	auto documentPath = (filesystem::temp_directory_path() / "editor_bench_document.txt").string();
+	ofstream(documentPath) << "";
+	auto journaledCharacter = Samples(), replay = Samples();
+	auto positions = vector<TextPosition>();
+	{
+		auto journal = EditJournal();
+		journal.Open(documentPath, lines);
+		input.onEdit = [&](const vector<TextEdit>& edits) { journal.Append(edits); };
+		for (auto i = 0; i < iterations; i++)
+			Measure(journaledCharacter, [&]() {
+				placeCursor();
+				positions.push_back({input.CursorLine(), input.CursorColumn()});
+			}, [&]() { input.HandleChar('x'); });
+		input.onEdit = nullptr;
+	}
+	for (auto position = positions.rbegin(); position != positions.rend(); ++position)
+		lines[position->line].erase(position->column, 1);
+	auto recovery = EditJournal();
+	Measure(replay, nullptr, [&]() { recovery.Open(documentPath, lines); });
+	recovery.Close();
+	filesystem::remove(documentPath);
+	Report("journal: HandleChar", shape, journaledCharacter);
+	Report(("journal: replay " + to_string(iterations)).c_str(), shape, replay);
+
+	// The same with the change gutter's diff brought up to date after every edit; then the whole document is rediffed.
+	auto diffedCharacter = Samples(), wholeDiff = Samples();
+	input.diff = make_unique<LineDiff>();
+	auto baseline = lines; // the diff reads the saved lines again, so they cannot be the ones edited
+	input.diff->Reset(LineDiff::Baseline, baseline);
+	input.diff->Reset(LineDiff::Buffer, lines);
+	input.diff->Update();
+	for (auto i = 0; i < iterations; i++)
+		Measure(diffedCharacter, placeCursor, [&]() {
+			input.HandleChar('x');
+			input.diff->Update();
+		});
+	Measure(wholeDiff, nullptr, [&]() {
+		input.diff->Reset(LineDiff::Buffer, lines);
+		while (input.diff->IsBusy()) {
+			input.diff->Update();
+			this_thread::yield();
+		}
+	});
+	Report("diff: HandleChar", shape, diffedCharacter);
+	Report("diff: whole document", shape, wholeDiff);
+	printf("%-22s %-18s %6zu hunks\n", "", "", input.diff->Hunks().size());
+	input.diff = nullptr;
+
+	// The same edits at up to 10k cursors spread over the document, applied as one batch each.
+	auto cursorsNum = min(10'000, static_cast<int>(lines.size()));
+	auto spreadCursors = [&]() {
+		auto cursors = vector<UI::Cursor>();
+		for (auto i = 0; i < cursorsNum; i++) {
+			auto line = static_cast<int>(static_cast<long long>(i) * static_cast<int>(lines.size()) / cursorsNum);
+			auto position = TextPosition {line, static_cast<int>(lines[line].size()) / 2};
+			cursors.push_back(UI::Cursor {position, position});
+		}
+		input.SetCursors(cursors, 0);
+	};
+	auto multiCharacter = Samples(), multiEnter = Samples(), multiJoin = Samples();
+	for (auto i = 0; i < iterations; i++) {
+		Measure(multiCharacter, spreadCursors, [&]() { input.HandleChar('x'); });
+		Measure(multiEnter, spreadCursors, [&]() { input.HandleKey(KEY_ENTER); });
+		Measure(multiJoin, nullptr, [&]() { input.HandleKey(KEY_BACKSPACE); });
+	}
+	auto multiName = [&](const char *operation) { return string(operation) + " x" + to_string(cursorsNum); };
+	Report(multiName("HandleChar").c_str(), shape, multiCharacter);
+	Report(multiName("Enter").c_str(), shape, multiEnter);
+	Report(multiName("Backspace@0").c_str(), shape, multiJoin);
+	input.ClearExtraCursors();
+
+	auto contentHeight = static_cast<float>(lines.size()) * UI::fontMetrics.lineHeight;
+	auto randomOffset = [&]() { return uniform_real_distribution<float>(0, contentHeight)(random); };
+
+	auto scroll = Samples();
+	for (auto i = 0; i < iterations; i++) {
+		auto offset = randomOffset();
+		Measure(scroll, nullptr, [&]() { input.SetTopOffset(offset); });
+	}
+	Report("SetTopOffset", shape, scroll);
+
+	auto click = Samples();
+	for (auto i = 0; i < iterations; i++) {
+		auto position = Vector2 {
+			uniform_real_distribution<float>(0, input.layout.width)(random),
+			uniform_real_distribution<float>(0, input.layout.height)(random)
+		};
+		Measure(click, [&]() { input.SetTopOffset(randomOffset()); },
+				[&]() { input.SetCursorFromPosition(position); });
+	}
+	Report("SetCursorFromPosition", shape, click);
+
+	// Soft-wrapped: the visual line index is built once, then every lookup is O(log n).
+	input.softWrap = true;
+	auto wrapIndex = Samples();
+	Measure(wrapIndex, nullptr, [&]() { input.UpdateVisualLines(); });
+	Report("wrap: build index", shape, wrapIndex);
+	contentHeight = static_cast<float>(input.visualLines.TotalRows()) * UI::fontMetrics.lineHeight;
+
+	auto wrappedScroll = Samples(), wrappedClick = Samples(), wrappedCharacter = Samples();
+	for (auto i = 0; i < iterations; i++) {
+		auto offset = randomOffset();
+		Measure(wrappedScroll, nullptr, [&]() { input.SetTopOffset(offset); });
+		auto position = Vector2 {
+			uniform_real_distribution<float>(0, input.layout.width)(random),
+			uniform_real_distribution<float>(0, input.layout.height)(random)
+		};
+		Measure(wrappedClick, nullptr, [&]() { input.SetCursorFromPosition(position); });
+		Measure(wrappedCharacter, nullptr, [&]() { input.HandleChar('x'); });
+	}
+	Report("wrap: SetTopOffset", shape, wrappedScroll);
+	Report("wrap: SetCursorFromPos", shape, wrappedClick);
+	Report("wrap: HandleChar", shape, wrappedCharacter);
+	input.softWrap = false;
+
+	// Folded: the regions are swept in a frame slice at a time, then all are folded and the same lookups skip the
+	// hidden lines in O(log n).
+	input.UpdateVisualLines();
+	input.lexer = make_unique<CppLexer>();
+	input.folds = make_unique<FoldIndex>();
+	auto foldSweep = Samples(), foldAll = Samples(), foldedScroll = Samples(), foldedCharacter = Samples();
+	Measure(foldSweep, nullptr, [&]() {
+		while (input.folds->IsSweeping())
+			input.UpdateFolds();
+	});
+	Measure(foldAll, nullptr, [&]() { input.FoldAll(true); });
+	auto foldedRows = input.visualLines.TotalRows();
+	contentHeight = static_cast<float>(foldedRows) * UI::fontMetrics.lineHeight;
+	for (auto i = 0; i < iterations; i++) {
+		auto offset = randomOffset();
+		Measure(foldedScroll, nullptr, [&]() { input.SetTopOffset(offset); });
+		Measure(foldedCharacter, placeCursor, [&]() { input.HandleChar('x'); });
+	}
+	Report("fold: sweep", shape, foldSweep);
+	Report("fold: FoldAll", shape, foldAll);
+	Report("fold: SetTopOffset", shape, foldedScroll);
+	Report("fold: HandleChar", shape, foldedCharacter);
+	printf("%-22s %-18s %6zu regions, %d rows shown\n", "", "", input.folds->RegionsNum(), foldedRows);
+	input.folds = nullptr;
+	input.lexer = nullptr;
+	input.OnLinesReplaced();
+
+	// Hidden in another tab: set aside, compressed in the background, then woken and the input rebuilt around the lines.
+	auto hibernate = Samples(), compress = Samples(), wake = Samples();
+	auto& pool = JobPool();
+	auto textBytes = size_t(0), packedBytes = size_t(0);
+	for (auto i = 0; i < min(iterations, 10); i++) {
+		auto hibernated = HibernatedLines();
+		Measure(hibernate, nullptr, [&]() { hibernated.Hibernate(std::move(lines)); });
+		textBytes = hibernated.Bytes();
+		Measure(compress, nullptr, [&]() {
+			hibernated.Compress(pool);
+			while (!hibernated.IsCompressed())
+				this_thread::yield();
+		});
+		packedBytes = hibernated.Bytes();
+		Measure(wake, nullptr, [&]() {
+			hibernated.Wake(pool, lines);
+			input.OnLinesReplaced();
+		});
+	}
+	Report("hibernate: Hibernate", shape, hibernate);
+	Report("hibernate: compress", shape, compress);
+	Report("hibernate: Wake", shape, wake);
+	printf("%-22s %-18s %6s %s -> %s\n", "", "", "", FormatSize(static_cast<long long>(textBytes)).c_str(),
+		   FormatSize(static_cast<long long>(packedBytes)).c_str());
+
+	// A job queued while background work, e.g. indexing a directory tree, keeps queueing more tasks, until its
+	// completion ran on the UI thread: a Visible one waits for the tasks already running, not for the whole tree.
+	auto visibleJob = Samples(), backgroundJob = Samples();
+	auto backgroundLeft = atomic<int>(0);
+	auto scan = function<void(int)>();
+	scan = [&](int depth) {
+		backgroundLeft++;
+		pool.Submit([&, depth]() {
+			this_thread::sleep_for(chrono::microseconds(250));
+			if (depth > 0) {
+				scan(depth - 1);
+				scan(depth - 1);
+			}
+			backgroundLeft--;
+		});
+	};
+	auto queueBackground = [&]() {
+		while (backgroundLeft > 0)
+			this_thread::yield();
+		for (auto i = 0; i < pool.ThreadsNum(); i++)
+			pool.Submit(TaskPriority::Background, [&]() { scan(5); });
+		this_thread::sleep_for(chrono::microseconds(100));
+	};
+	for (auto i = 0; i < min(iterations, 20); i++)
+		for (auto priority: {TaskPriority::Visible, TaskPriority::Background})
+			Measure(priority == TaskPriority::Visible ? visibleJob : backgroundJob, queueBackground, [&]() {
+				auto done = false;
+				RunJob(priority, CancellationToken(), [&]() { return lines.size(); }, [&](size_t) {
+					done = true;
+				});
+				while (!done)
+					RunCompletions(1);
+			});
+	while (backgroundLeft > 0)
+		this_thread::yield();
+	Report("jobs: Visible", shape, visibleJob);
+	Report("jobs: Background", shape, backgroundJob);
+
+	if (withText)
+		RunTextQuads(shape, lines, iterations, random);
+}
+
+int main(int argc, char **argv) {
+	auto iterations = 200;
+	auto fontPath = string();
+	auto shapes = vector<DocumentShape>();
+	for (auto i = 1; i < argc; i++) {
+		auto argument = string(argv[i]);
+		if (argument == "--iterations" && i + 1 < argc)
+			iterations = max(1, atoi(argv[++i]));
+		else if (argument == "--font" && i + 1 < argc)
+			fontPath = argv[++i];
+		else if (i + 1 < argc) {
+			shapes.push_back(DocumentShape {max(1, atoi(argv[i])), max(0, atoi(argv[i + 1]))});
+			i++;
+		}
+		else {
+			fprintf(stderr, "usage: %s [<lines> <line length>] [--iterations N] [--font F.ttf]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (shapes.empty())
+		shapes = {
+			{1'000, 40}, {100'000, 40}, {1'000'000, 40}, {10'000'000, 10},
+			{1'000, 10}, {100, 10'000}, {10, 1'000'000}, {1, 10'000'000},
+		};
+
+	UI::fontMetrics = UI::FontMetrics {16, 16, 8};
+	// Glyphs are rasterized and packed on the CPU only; there is no window to upload them to.
+	UI::glyphAtlas.cpuOnly = true;
+	if (!fontPath.empty() && !UI::glyphAtlas.Load(fontPath, 16)) {
+		fprintf(stderr, "Failed to load font: %s\n", fontPath.c_str());
+		return 1;
+	}
+	UI::glyphAtlas.Upload();
+
+	printf("%-22s %-18s %6s %12s %12s %12s %12s %10s %12s\n", "operation", "document", "n",
+		   "p50 us", "p90 us", "p99 us", "max us", "allocs/op", "bytes/op");
+	for (const auto& shape: shapes)
+		RunDocument(shape, iterations, UI::glyphAtlas.IsLoaded());
+	return 0;
+}
@@ -0,0 +1,506 @@
+#include "FileIndex.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <iterator>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+static const size_t crawlBatch = 4096; // paths published at a time during the first crawl
+static const auto pollInterval = chrono::seconds(5);
+static const size_t pathsPerPart = 32 * 1024; // scored by one worker of the JobPool
+
+// The paths in `paths` under `directory`, which itself is not one of them. A plain prefix range would also take
+// in siblings like "dir-2", which sort between "dir" and "dir/".
+template<typename Container>
+static auto UnderDirectory(Container& paths, const string& directory) {
+	return pair(paths.lower_bound(directory + '/'), paths.lower_bound(directory + static_cast<char>('/' + 1)));
+}
+
+// FileIndex
+
+FileIndex::~FileIndex() {
+	Stop();
+}
+
+void FileIndex::Start(const string& newRoot) {
+	Stop();
+	root = newRoot;
+	{
+		lock_guard lock(changesMutex);
+		changes.clear();
+	}
+	files.clear();
+	stopping = false;
+	crawling = true;
+#ifdef __linux__
+	if (pipe(wakePipe) != 0)
+		wakePipe[0] = wakePipe[1] = -1;
+#endif
+	worker = thread([this]() { Run(); });
+}
+
+void FileIndex::Stop() {
+	if (!worker.joinable())
+		return;
+	stopping = true;
+#ifdef __linux__
+	if (wakePipe[1] >= 0) {
+		auto written = write(wakePipe[1], "x", 1);
+		(void)written; // a full pipe is already a wake-up
+	}
+	worker.join();
+	for (auto& end: wakePipe) {
+		if (end >= 0)
+			close(end);
+		end = -1;
+	}
+#else
+	{
+		lock_guard lock(wakeMutex);
+	}
+	wake.notify_all();
+	worker.join();
+#endif
+	crawling = false;
+}
+
+bool FileIndex::TakeChanges(vector<IndexedFileChange>& taken) {
+	lock_guard lock(changesMutex);
+	if (changes.empty())
+		return false;
+	taken.insert(taken.end(), make_move_iterator(changes.begin()), make_move_iterator(changes.end()));
+	changes.clear();
+	return true;
+}
+
+void FileIndex::Publish(vector<IndexedFileChange>& newChanges) {
+	if (newChanges.empty())
+		return;
+	lock_guard lock(changesMutex);
+	changes.insert(changes.end(), make_move_iterator(newChanges.begin()), make_move_iterator(newChanges.end()));
+	newChanges.clear();
+}
+
+void FileIndex::Run() {
+	PROFILE_SCOPE("FileIndex::Crawl");
+#ifdef __linux__
+	notify = inotify_init1(IN_CLOEXEC);
+	polling = notify < 0;
+#else
+	polling = true;
+#endif
+	auto found = vector<string>();
+	Crawl("", found, true);
+	files = set<string>(make_move_iterator(found.begin()), make_move_iterator(found.end()));
+	crawling = false;
+
+#ifdef __linux__
+	pollfd descriptors[2] = {{wakePipe[0], POLLIN, 0}, {notify, POLLIN, 0}};
+	alignas(inotify_event) char events[64 * 1024];
+	while (!stopping) {
+		// Without a wake-up pipe this polls too, to notice Stop().
+		auto timeout = polling || wakePipe[0] < 0 ? static_cast<int>(chrono::milliseconds(pollInterval).count()) : -1;
+		auto ready = poll(descriptors, notify >= 0 ? 2 : 1, timeout);
+		if (ready < 0 && errno != EINTR)
+			break;
+		if (stopping)
+			break;
+		if (ready == 0 && polling)
+			Recrawl();
+		if (ready > 0 && notify >= 0 && (descriptors[1].revents & POLLIN)) {
+			auto length = read(notify, events, sizeof(events));
+			if (length > 0)
+				HandleEvents(events, static_cast<size_t>(length));
+		}
+	}
+	if (notify >= 0)
+		close(notify);
+	notify = -1;
+	watchedDirectories.clear();
+	watches.clear();
+#else
+	auto lock = unique_lock(wakeMutex);
+	while (!stopping) {
+		wake.wait_for(lock, pollInterval, [&]() { return stopping.load(); });
+		if (stopping)
+			break;
+		lock.unlock();
+		Recrawl();
+		lock.lock();
+	}
+#endif
+}
+
+void FileIndex::Crawl(const string& directory, vector<string>& found, bool publish) {
+	auto pending = vector<string> {directory};
+	auto batch = vector<IndexedFileChange>();
+	while (!pending.empty() && !stopping) {
+		auto current = move(pending.back());
+		pending.pop_back();
+#ifdef __linux__
+		Watch(current);
+#endif
+		auto error = error_code();
+		auto entries = filesystem::directory_iterator(current.empty() ? filesystem::path(root) : filesystem::path(root) / current, error);
+		for (; !error && entries != filesystem::directory_iterator(); entries.increment(error)) {
+			auto name = entries->path().filename().string();
+			if (name.empty() || name.front() == '.')
+				continue;
+			auto statusError = error_code();
+			auto status = entries->symlink_status(statusError);
+			if (statusError)
+				continue;
+			auto relative = current.empty() ? name : current + '/' + name;
+			if (filesystem::is_directory(status))
+				pending.push_back(move(relative));
+			else if (filesystem::is_regular_file(status)) {
+				if (publish)
+					batch.push_back(IndexedFileChange {relative});
+				found.push_back(move(relative));
+				if (batch.size() >= crawlBatch)
+					Publish(batch);
+			}
+		}
+	}
+	Publish(batch);
+}
+
+void FileIndex::Recrawl() {
+	PROFILE_SCOPE("FileIndex::Recrawl");
+	auto found = vector<string>();
+	Crawl("", found, false);
+	if (stopping)
+		return;
+	auto newFiles = set<string>(make_move_iterator(found.begin()), make_move_iterator(found.end()));
+	auto newChanges = vector<IndexedFileChange>();
+	for (auto old = files.begin(), current = newFiles.begin(); old != files.end() || current != newFiles.end();) {
+		if (current == newFiles.end() || (old != files.end() && *old < *current))
+			newChanges.push_back(IndexedFileChange {*old++, true});
+		else if (old == files.end() || *current < *old)
+			newChanges.push_back(IndexedFileChange {*current++});
+		else
+			++old, ++current;
+	}
+	files = move(newFiles);
+	Publish(newChanges);
+}
+
+#ifdef __linux__
+void FileIndex::Watch(const string& directory) {
+	if (notify < 0)
+		return;
+	auto path = directory.empty() ? root : (filesystem::path(root) / directory).string();
+	auto watch = inotify_add_watch(notify, path.c_str(),
+								   IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW);
+	if (watch < 0) {
+		// Typically out of watches (fs.inotify.max_user_watches); recrawling keeps the index right, if late.
+		polling = polling || errno == ENOSPC;
+		return;
+	}
+	watchedDirectories[watch] = directory;
+	watches[directory] = watch;
+}
+
+void FileIndex::Unwatch(const string& directory) {
+	auto unwatch = [&](map<string, int>::iterator watch) {
+		inotify_rm_watch(notify, watch->second);
+		watchedDirectories.erase(watch->second);
+		return watches.erase(watch);
+	};
+	if (auto watch = watches.find(directory); watch != watches.end())
+		unwatch(watch);
+	for (auto [watch, end] = UnderDirectory(watches, directory); watch != end;)
+		watch = unwatch(watch);
+}
+
+void FileIndex::HandleEvents(const char *events, size_t length) {
+	PROFILE_SCOPE("FileIndex::HandleEvents");
+	auto newChanges = vector<IndexedFileChange>();
+	auto found = vector<string>();
+	for (size_t offset = 0; offset < length;) {
+		auto event = reinterpret_cast<const inotify_event *>(events + offset);
+		offset += sizeof(inotify_event) + event->len;
+		if (event->mask & IN_Q_OVERFLOW) {
+			// Events were lost; only a full comparison can tell what changed.
+			Publish(newChanges);
+			Recrawl();
+			return;
+		}
+		auto directory = watchedDirectories.find(event->wd);
+		if (directory == watchedDirectories.end())
+			continue;
+		if (event->mask & IN_IGNORED) {
+			if (auto watch = watches.find(directory->second); watch != watches.end() && watch->second == event->wd)
+				watches.erase(watch);
+			watchedDirectories.erase(directory);
+			continue;
+		}
+		if (event->len == 0 || event->name[0] == '.' || event->name[0] == '\0')
+			continue;
+		auto relative = directory->second.empty() ? string(event->name) : directory->second + '/' + event->name;
+
+		if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			if (event->mask & IN_ISDIR) {
+				Unwatch(relative);
+				auto [file, end] = UnderDirectory(files, relative);
+				for (; file != end; file = files.erase(file))
+					newChanges.push_back(IndexedFileChange {*file, true});
+			}
+			else if (files.erase(relative) > 0)
+				newChanges.push_back(IndexedFileChange {relative, true});
+		}
+		if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+			if (event->mask & IN_ISDIR) {
+				found.clear();
+				Crawl(relative, found, false);
+				for (auto& path: found)
+					if (files.insert(path).second)
+						newChanges.push_back(IndexedFileChange {move(path)});
+			}
+			else {
+				auto error = error_code();
+				auto status = filesystem::symlink_status(filesystem::path(root) / relative, error);
+				if (!error && filesystem::is_regular_file(status) && files.insert(relative).second)
+					newChanges.push_back(IndexedFileChange {relative});
+			}
+		}
+	}
+	Publish(newChanges);
+}
+#endif
+
+// FuzzyMatcher
+
+static char ToLower(char c) {
+	return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+static uint32_t CharacterBit(char c) {
+	c = ToLower(c);
+	if (c >= 'a' && c <= 'z')
+		return 1u << (c - 'a');
+	if (c >= '0' && c <= '9')
+		return 1u << 26;
+	switch (c) {
+		case '.': return 1u << 27;
+		case '_': return 1u << 28;
+		case '-': return 1u << 29;
+		case '/': return 1u << 30;
+		default: return 1u << 31;
+	}
+}
+
+static uint32_t CharacterMask(string_view text) {
+	auto mask = 0u;
+	for (auto c: text)
+		mask |= CharacterBit(c);
+	return mask;
+}
+
+static bool IsWordSeparator(char c) {
+	return c == '/' || c == '_' || c == '-' || c == '.' || c == ' ';
+}
+
+// Scores the shortest window of `path` that holds `query` (lowercase) as a subsequence: found by matching forward
+// to the earliest end, then backward from there to the latest start. Returns false when there is none.
+static bool Score(string_view path, string_view query, int& score) {
+	size_t matched = 0, end = 0;
+	for (size_t i = 0; i < path.size(); i++)
+		if (ToLower(path[i]) == query[matched] && ++matched == query.size()) {
+			end = i + 1;
+			break;
+		}
+	if (matched < query.size())
+		return false;
+	auto start = end;
+	for (auto i = end; i-- > 0;)
+		if (ToLower(path[i]) == query[matched - 1] && --matched == 0) {
+			start = i;
+			break;
+		}
+
+	auto nameStart = path.rfind('/') + 1; // 0 without a directory
+	auto consecutive = 0;
+	score = 0;
+	for (auto i = start; i < end && matched < query.size(); i++) {
+		if (ToLower(path[i]) != query[matched]) {
+			score -= 1;
+			consecutive = 0;
+			continue;
+		}
+		auto points = 16;
+		if (i == nameStart)
+			points += 24;
+		else if (i == 0 || IsWordSeparator(path[i - 1]))
+			points += 12;
+		else if (path[i] >= 'A' && path[i] <= 'Z' && path[i - 1] >= 'a' && path[i - 1] <= 'z')
+			points += 12;
+		if (i >= nameStart)
+			points += 8;
+		points += 8 * consecutive++;
+		score += points;
+		matched++;
+	}
+	score -= static_cast<int>(path.size() / 8);
+	return true;
+}
+
+// A match by index into the paths, so that ranking does not copy them.
+struct ScoredPath {
+	int index = 0;
+	int score = 0;
+};
+
+// Keeps the `maxResults` best of `matches`, sorted.
+static void KeepBest(const vector<string>& paths, vector<ScoredPath>& matches, size_t maxResults) {
+	auto isBetter = [&](const ScoredPath& a, const ScoredPath& b) {
+		if (a.score != b.score)
+			return a.score > b.score;
+		const auto& first = paths[static_cast<size_t>(a.index)];
+		const auto& second = paths[static_cast<size_t>(b.index)];
+		if (first.size() != second.size())
+			return first.size() < second.size();
+		return first < second;
+	};
+	if (matches.size() > maxResults) {
+		nth_element(matches.begin(), matches.begin() + static_cast<ptrdiff_t>(maxResults), matches.end(), isBetter);
+		matches.resize(maxResults);
+	}
+	sort(matches.begin(), matches.end(), isBetter);
+}
+
+void FuzzyMatcher::Add(string path) {
+	if (indices.count(path))
+		return;
+	version++;
+	indices.emplace(path, static_cast<int>(paths.size()));
+	masks.push_back(CharacterMask(path));
+	paths.push_back(move(path));
+}
+
+void FuzzyMatcher::Remove(const string& path) {
+	auto found = indices.find(path);
+	if (found == indices.end())
+		return;
+	version++;
+	auto index = static_cast<size_t>(found->second);
+	indices.erase(found);
+	if (index + 1 < paths.size()) {
+		paths[index] = move(paths.back());
+		masks[index] = masks.back();
+		indices[paths[index]] = static_cast<int>(index);
+	}
+	paths.pop_back();
+	masks.pop_back();
+}
+
+void FuzzyMatcher::Clear() {
+	version++;
+	paths.clear();
+	masks.clear();
+	indices.clear();
+}
+
+void FuzzyMatcher::Find(string_view query, int maxResults, vector<FuzzyMatch>& results, const CancellationToken& token,
+						const FuzzyCandidates *previous, FuzzyCandidates *candidates) const {
+	PROFILE_SCOPE("FuzzyMatcher::Find");
+	results.clear();
+	auto lowerQuery = string();
+	for (auto c: query)
+		if (c != ' ')
+			lowerQuery.push_back(ToLower(c));
+	if (maxResults <= 0)
+		return;
+	auto queryMask = CharacterMask(lowerQuery);
+	auto limit = static_cast<size_t>(maxResults);
+	// A path that holds the query as a subsequence holds every prefix of it too.
+	const auto *narrowed = previous && !previous->query.empty() && previous->version == version &&
+						   lowerQuery.starts_with(previous->query) ? &previous->indices : nullptr;
+	auto count = narrowed ? narrowed->size() : paths.size();
+
+	auto partsNum = clamp<size_t>(count / pathsPerPart, 1, static_cast<size_t>(JobPool().ThreadsNum()) + 1);
+	auto partial = vector<vector<ScoredPath>>(partsNum);
+	auto matched = vector<vector<int>>(candidates && !lowerQuery.empty() ? partsNum : 0);
+	JobPool().ForEach(partsNum, [&](size_t part) {
+		if (token.IsCancelled())
+			return;
+		auto from = count * part / partsNum, to = count * (part + 1) / partsNum;
+		auto& matches = partial[part];
+		auto consider = [&](size_t i) {
+			auto score = 0;
+			if (lowerQuery.empty() || Score(paths[i], lowerQuery, score)) {
+				matches.push_back(ScoredPath {static_cast<int>(i), score});
+				if (!matched.empty())
+					matched[part].push_back(static_cast<int>(i));
+				// Bounded, so that a one-letter query over half a million paths does not keep them all.
+				if (matches.size() >= 4 * limit)
+					KeepBest(paths, matches, limit);
+			}
+		};
+		auto i = from;
+		if (narrowed) {
+			for (; i < to; i++) {
+				auto index = static_cast<size_t>((*narrowed)[i]);
+				if ((masks[index] & queryMask) == queryMask)
+					consider(index);
+			}
+			KeepBest(paths, matches, limit);
+			return;
+		}
+#if defined(__SSE2__)
+		auto queryMasks = _mm_set1_epi32(static_cast<int>(queryMask));
+		for (; i + 4 <= to; i += 4) {
+			auto pathMasks = _mm_loadu_si128(reinterpret_cast<const __m128i *>(masks.data() + i));
+			auto hits = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(
+				_mm_cmpeq_epi32(_mm_and_si128(pathMasks, queryMasks), queryMasks))));
+			for (; hits; hits &= hits - 1)
+				consider(i + static_cast<size_t>(countr_zero(hits)));
+		}
+#elif defined(__ARM_NEON)
+		auto queryMasks = vdupq_n_u32(queryMask);
+		for (; i + 4 <= to; i += 4) {
+			auto equal = vceqq_u32(vandq_u32(vld1q_u32(masks.data() + i), queryMasks), queryMasks);
+			// Narrowed to 16 bits per path; keep one bit of each.
+			auto hits = vget_lane_u64(vreinterpret_u64_u16(vmovn_u32(equal)), 0) & 0x0001000100010001ull;
+			for (; hits; hits &= hits - 1)
+				consider(i + static_cast<size_t>(countr_zero(hits) / 16));
+		}
+#endif
+		for (; i < to; i++)
+			if ((masks[i] & queryMask) == queryMask)
+				consider(i);
+		KeepBest(paths, matches, limit);
+	});
+	if (token.IsCancelled())
+		return;
+
+	if (candidates) {
+		candidates->query = lowerQuery;
+		candidates->version = version;
+		candidates->indices.clear();
+		for (const auto& indices: matched)
+			candidates->indices.insert(candidates->indices.end(), indices.begin(), indices.end());
+	}
+	auto best = vector<ScoredPath>();
+	for (const auto& matches: partial)
+		best.insert(best.end(), matches.begin(), matches.end());
+	KeepBest(paths, best, limit);
+	for (const auto& match: best)
+		results.push_back(FuzzyMatch {paths[static_cast<size_t>(match.index)], match.score});
+}
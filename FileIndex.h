@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Jobs.h"
+
+struct IndexedFileChange {
+	std::string path;
+	bool removed = false; // otherwise added
+};
+
+// The files under a directory, found by crawling it on a background thread and then kept up to date: by inotify
+// watches on every directory on Linux, by recrawling every few seconds elsewhere or when watches run out. Paths are
+// relative to the root and use '/'; hidden entries and symbolic links are skipped.
+struct FileIndex {
+
+	~FileIndex();
+
+	void Start(const std::string& root);
+	void Stop();
+	bool IsRunning() const { return worker.joinable(); }
+	bool IsCrawling() const { return crawling; }
+	const std::string& Root() const { return root; }
+	// Moves the files that appeared and disappeared since the last call into `changes`, oldest first; files found by
+	// the first crawl arrive in batches while it runs. Returns whether there were any.
+	bool TakeChanges(std::vector<IndexedFileChange>& changes);
+
+private:
+	std::string root;
+	std::thread worker;
+	std::atomic<bool> stopping = false;
+	std::atomic<bool> crawling = false;
+	std::mutex changesMutex;
+	std::vector<IndexedFileChange> changes;
+	// Used by the worker only.
+	std::set<std::string> files;
+	bool polling = false;
+#ifdef __linux__
+	int notify = -1;
+	int wakePipe[2] = {-1, -1};
+	std::unordered_map<int, std::string> watchedDirectories;
+	std::map<std::string, int> watches;
+#else
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+#endif
+
+	void Run();
+	// Lists the files under `directory`, relative to the root, watching every directory on the way. With
+	// `publish` set they are published as added in batches as they are found.
+	void Crawl(const std::string& directory, std::vector<std::string>& found, bool publish);
+	// Crawls everything again and publishes the difference.
+	void Recrawl();
+	void Publish(std::vector<IndexedFileChange>& newChanges);
+#ifdef __linux__
+	void Watch(const std::string& directory);
+	void Unwatch(const std::string& directory);
+	void HandleEvents(const char *events, size_t length);
+#endif
+};
+
+struct FuzzyMatch {
+	std::string path;
+	int score = 0;
+};
+
+// Every path that matched a query, by index, while the matcher is unchanged.
+struct FuzzyCandidates {
+	std::string query; // lowercase, spaces removed
+	std::vector<int> indices;
+	uint64_t version = 0; // of the matcher
+};
+
+// Ranks paths against a query typed as a subsequence of one of them, fzf style: every query character has to occur
+// in the path in order, ignoring case, and runs of consecutive characters, matches at the start of a word or of the
+// file name, and short paths score higher.
+//
+// A 32-bit mask of the characters in each path is kept alongside it; paths whose mask lacks a character of the
+// query are skipped four at a time with SSE2 or NEON before any is scored, and the rest is split over the JobPool. A
+// query typed on from the last one only scores the paths that matched that one.
+struct FuzzyMatcher {
+
+	int Size() const { return static_cast<int>(paths.size()); }
+	void Add(std::string path);
+	void Remove(const std::string& path);
+	void Clear();
+	// The `maxResults` best matches of `query`, best first. Spaces in the query are ignored. When `query` extends the
+	// query of `previous`, only its paths are scored; `candidates` gets every path that matched. Stops early, with no
+	// results, once `token` is cancelled.
+	void Find(std::string_view query, int maxResults, std::vector<FuzzyMatch>& results,
+			  const CancellationToken& token = CancellationToken(), const FuzzyCandidates *previous = nullptr,
+			  FuzzyCandidates *candidates = nullptr) const;
+
+private:
+	uint64_t version = 0; // moved on by every change of the paths' indices
+	std::vector<std::string> paths;
+	std::vector<uint32_t> masks;
+	std::unordered_map<std::string, int> indices;
+};
@@ -0,0 +1,329 @@
+#include "FileWatch.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const uint64_t hashBasis = 14695981039346656037ull; // FNV-1a
+static const uint64_t hashPrime = 1099511628211ull;
+static const size_t blockSize = 1 << 20;
+static const uint64_t minChunkBytes = 16 << 10;
+static const uint64_t maxChunkBytes = 256 << 10;
+static const uint64_t boundaryMask = 7; // past the minimum, about one line in eight ends a chunk
+static const size_t tailBytes = 4096;
+static const auto pollInterval = chrono::milliseconds(500);
+
+static uint64_t Hash(uint64_t hash, string_view data) {
+	for (auto c: data)
+		hash = (hash ^ static_cast<unsigned char>(c)) * hashPrime;
+	return hash;
+}
+
+// Splits like std::getline: a final newline does not start another line.
+static void SplitLines(string_view data, vector<string>& lines) {
+	size_t start = 0;
+	for (auto newline = data.find('\n'); newline != string_view::npos; newline = data.find('\n', start)) {
+		lines.emplace_back(data.substr(start, newline - start));
+		start = newline + 1;
+	}
+	if (start < data.size())
+		lines.emplace_back(data.substr(start));
+}
+
+static void KeepTail(string& tail, string_view data) {
+	if (data.size() >= tailBytes)
+		tail.assign(data.substr(data.size() - tailBytes));
+	else {
+		tail.append(data);
+		if (tail.size() > tailBytes)
+			tail.erase(0, tail.size() - tailBytes);
+	}
+}
+
+// Scan
+
+void FileWatch::Scan::Feed(string_view data) {
+	size_t start = 0;
+	for (auto newline = data.find('\n'); newline != string_view::npos; newline = data.find('\n', start)) {
+		auto lineHash = Hash(partialBytes > 0 ? partialHash : hashBasis, data.substr(start, newline - start));
+		AddLine(lineHash, partialBytes + newline - start + 1);
+		partialBytes = 0;
+		start = newline + 1;
+	}
+	if (start < data.size()) {
+		partialHash = Hash(partialBytes > 0 ? partialHash : hashBasis, data.substr(start));
+		partialBytes += data.size() - start;
+	}
+}
+
+void FileWatch::Scan::AddLine(uint64_t lineHash, uint64_t bytes) {
+	if (!lastChunkOpen) {
+		chunks.push_back(Chunk {hashBasis, 0, 0});
+		lastChunkOpen = true;
+	}
+	auto& chunk = chunks.back();
+	chunk.hash = (chunk.hash ^ lineHash) * hashPrime;
+	chunk.bytes += bytes;
+	chunk.lines++;
+	completeBytes += bytes;
+	completeLines++;
+	// Boundaries depend on the lines themselves, so after an insertion the chunks fall back into step.
+	if ((chunk.bytes >= minChunkBytes && (lineHash & boundaryMask) == 0) || chunk.bytes >= maxChunkBytes)
+		lastChunkOpen = false;
+}
+
+vector<FileWatch::Chunk> FileWatch::Scan::AllChunks() const {
+	auto all = chunks;
+	if (partialBytes > 0)
+		all.push_back(Chunk {partialHash, partialBytes, 1});
+	return all;
+}
+
+// FileWatch
+
+FileWatch::~FileWatch() {
+	Stop();
+}
+
+void FileWatch::Start(const string& newPath) {
+	Stop();
+	path = newPath;
+	{
+		lock_guard lock(changesMutex);
+		changes.clear();
+	}
+	bytesRead = 0;
+	stopping = false;
+#ifdef __linux__
+	if (pipe(wakePipe) != 0)
+		wakePipe[0] = wakePipe[1] = -1;
+#endif
+	worker = thread([this]() { Watch(); });
+}
+
+void FileWatch::Stop() {
+	if (!worker.joinable())
+		return;
+	stopping = true;
+#ifdef __linux__
+	if (wakePipe[1] >= 0) {
+		auto written = write(wakePipe[1], "x", 1);
+		(void)written; // a full pipe is already a wake-up
+	}
+	worker.join();
+	for (auto& end: wakePipe) {
+		if (end >= 0)
+			close(end);
+		end = -1;
+	}
+#else
+	{
+		lock_guard lock(wakeMutex);
+	}
+	wake.notify_all();
+	worker.join();
+#endif
+}
+
+bool FileWatch::TakeChanges(vector<FileChange>& taken) {
+	lock_guard lock(changesMutex);
+	if (changes.empty())
+		return false;
+	taken.insert(taken.end(), make_move_iterator(changes.begin()), make_move_iterator(changes.end()));
+	changes.clear();
+	return true;
+}
+
+void FileWatch::Publish(FileChange change) {
+	lock_guard lock(changesMutex);
+	changes.push_back(move(change));
+}
+
+void FileWatch::Watch() {
+#ifdef __linux__
+	// The directory is watched rather than the file, so replacing the file by renaming over it is seen too.
+	auto directory = filesystem::path(path).parent_path();
+	auto name = filesystem::path(path).filename().string();
+	auto notify = inotify_init1(IN_CLOEXEC);
+	if (notify >= 0 && inotify_add_watch(notify, (directory.empty() ? "." : directory.string()).c_str(),
+										 IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+		close(notify);
+		notify = -1;
+	}
+	// Watching starts before the first scan, so nothing written meanwhile goes unnoticed.
+	scan = Scan();
+	ScanFile(scan);
+	Check();
+	pollfd descriptors[2] = {{wakePipe[0], POLLIN, 0}, {notify, POLLIN, 0}};
+	alignas(inotify_event) char events[16 * 1024];
+	while (!stopping) {
+		// Without inotify, or without a wake-up pipe, this polls.
+		auto timeout = notify >= 0 && wakePipe[0] >= 0 ? -1 : static_cast<int>(pollInterval.count());
+		if (poll(descriptors, notify >= 0 ? 2 : 1, timeout) < 0 && errno != EINTR)
+			break;
+		if (stopping)
+			break;
+		auto relevant = notify < 0 || timeout >= 0;
+		if (notify >= 0 && (descriptors[1].revents & POLLIN)) {
+			auto length = read(notify, events, sizeof(events));
+			for (auto offset = ssize_t(0); offset < length;) {
+				auto event = reinterpret_cast<const inotify_event *>(events + offset);
+				relevant = relevant || (event->len > 0 && name == event->name);
+				offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+			}
+		}
+		if (relevant)
+			Check();
+	}
+	if (notify >= 0)
+		close(notify);
+#else
+	scan = Scan();
+	ScanFile(scan);
+	auto lock = unique_lock(wakeMutex);
+	while (!stopping) {
+		wake.wait_for(lock, pollInterval, [&]() { return stopping.load(); });
+		if (stopping)
+			break;
+		lock.unlock();
+		Check();
+		lock.lock();
+	}
+#endif
+}
+
+void FileWatch::Check() {
+	auto error = error_code();
+	auto size = filesystem::file_size(path, error);
+	if (error)
+		return; // e.g. between removing and recreating it
+	auto time = filesystem::last_write_time(path, error);
+	if (error)
+		return;
+	auto stamp = static_cast<int64_t>(time.time_since_epoch().count());
+	if (size == scan.size && stamp == scan.time)
+		return;
+	PROFILE_SCOPE("FileWatch::Check");
+	if (size > scan.size && TryAppend(size, stamp))
+		return;
+	Rescan();
+}
+
+bool FileWatch::ReadRange(uint64_t from, uint64_t to, string& data) {
+	data.clear();
+	auto file = ifstream(path, ios::binary);
+	if (!file || !file.seekg(static_cast<streamoff>(from)))
+		return false;
+	data.resize(to - from);
+	file.read(data.data(), static_cast<streamsize>(data.size()));
+	bytesRead += static_cast<uint64_t>(file.gcount());
+	return static_cast<uint64_t>(file.gcount()) == to - from;
+}
+
+bool FileWatch::ScanFile(Scan& newScan) {
+	PROFILE_SCOPE("FileWatch::ScanFile");
+	auto error = error_code();
+	newScan.size = filesystem::file_size(path, error);
+	if (error)
+		return false;
+	newScan.time = static_cast<int64_t>(filesystem::last_write_time(path, error).time_since_epoch().count());
+	auto file = ifstream(path, ios::binary);
+	if (error || !file)
+		return false;
+	auto block = string(blockSize, '\0');
+	for (auto remaining = newScan.size; remaining > 0 && !stopping;) {
+		file.read(block.data(), static_cast<streamsize>(min<uint64_t>(remaining, blockSize)));
+		auto read = static_cast<size_t>(file.gcount());
+		if (read == 0)
+			return false;
+		bytesRead += read;
+		remaining -= read;
+		auto data = string_view(block.data(), read);
+		newScan.Feed(data);
+		KeepTail(newScan.tail, data);
+	}
+	return !stopping;
+}
+
+bool FileWatch::TryAppend(uint64_t newSize, int64_t newTime) {
+	// From the start of the incomplete last line, which the new bytes may continue, or from the start of the tail.
+	auto from = min(scan.completeBytes, scan.size - scan.tail.size());
+	auto data = string();
+	if (!ReadRange(from, newSize, data))
+		return false;
+	if (data.compare(scan.size - scan.tail.size() - from, scan.tail.size(), scan.tail) != 0)
+		return false;
+
+	auto change = FileChange();
+	change.firstLine = scan.completeLines;
+	change.removedLines = scan.partialBytes > 0 ? 1 : 0;
+	change.whole = scan.LinesNum() == 0;
+	auto lines = string_view(data).substr(scan.completeBytes - from);
+	SplitLines(lines, change.addedLines);
+	scan.partialBytes = 0;
+	scan.Feed(lines);
+	scan.size = newSize;
+	scan.time = newTime;
+	// `data` reaches back over the old tail, so it holds the new one.
+	scan.tail.clear();
+	KeepTail(scan.tail, data);
+	Publish(move(change));
+	return true;
+}
+
+void FileWatch::Rescan() {
+	for (;;) {
+		auto newScan = Scan();
+		if (!ScanFile(newScan))
+			return;
+		auto oldChunks = scan.AllChunks(), newChunks = newScan.AllChunks();
+		auto common = min(oldChunks.size(), newChunks.size());
+		size_t prefix = 0, suffix = 0;
+		while (prefix < common && oldChunks[prefix] == newChunks[prefix])
+			prefix++;
+		while (suffix < common - prefix && oldChunks[oldChunks.size() - 1 - suffix] == newChunks[newChunks.size() - 1 - suffix])
+			suffix++;
+		if (prefix == oldChunks.size() && prefix == newChunks.size()) {
+			scan = move(newScan); // touched, not changed
+			return;
+		}
+
+		auto change = FileChange();
+		auto newFrom = uint64_t(0), newTo = newScan.size;
+		for (size_t i = 0; i < prefix; i++) {
+			change.firstLine += oldChunks[i].lines;
+			newFrom += newChunks[i].bytes;
+		}
+		auto oldEnd = scan.LinesNum();
+		for (size_t i = 0; i < suffix; i++) {
+			oldEnd -= oldChunks[oldChunks.size() - 1 - i].lines;
+			newTo -= newChunks[newChunks.size() - 1 - i].bytes;
+		}
+		change.removedLines = oldEnd - change.firstLine;
+		change.whole = change.firstLine == 0 && oldEnd == scan.LinesNum();
+		auto data = string();
+		if (!ReadRange(newFrom, newTo, data))
+			return;
+		// The file changed again while being read; the lines read may not match the hashes.
+		auto error = error_code();
+		auto size = filesystem::file_size(path, error);
+		auto time = filesystem::last_write_time(path, error);
+		if (!error && (size != newScan.size || static_cast<int64_t>(time.time_since_epoch().count()) != newScan.time))
+			continue;
+		SplitLines(data, change.addedLines);
+		scan = move(newScan);
+		Publish(move(change));
+		return;
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Lines [firstLine, firstLine + removedLines) of the file as last seen were replaced by `addedLines`. Lines are
+// split the way std::getline splits them: a final newline does not start another line.
+struct FileChange {
+	int firstLine = 0;
+	int removedLines = 0;
+	std::vector<std::string> addedLines;
+	bool whole = false; // every line was replaced, e.g. after the file was truncated
+};
+
+// Follows changes made to a file on disk from a background thread, woken by inotify on Linux and polling
+// elsewhere, and reads only what changed. When the file grew and its last bytes are as they were, it was appended
+// to, and just the new bytes are read, so tailing a multi-gigabyte log costs reads the size of the new lines.
+// Anything else is found by rescanning the file into chunk hashes and comparing them with the previous scan; only
+// the lines between the first and the last differing chunk are read back. Chunks end at lines whose hash meets a
+// condition, so inserting or removing lines only changes the chunks around them.
+struct FileWatch {
+
+	~FileWatch();
+
+	// Starts following the file at `path`, whose current contents the caller has loaded. The file is scanned once
+	// in the background first.
+	void Start(const std::string& path);
+	void Stop();
+	bool IsWatching() const { return worker.joinable(); }
+	// Moves the changes found since the last call into `changes`, oldest first; each applies to the lines as left
+	// by the ones before. Returns whether there were any.
+	bool TakeChanges(std::vector<FileChange>& changes);
+	// Bytes read from the file since Start, the first scan included.
+	uint64_t BytesRead() const { return bytesRead; }
+
+private:
+	struct Chunk {
+		uint64_t hash = 0;
+		uint64_t bytes = 0;
+		int lines = 0;
+		bool operator==(const Chunk&) const = default;
+	};
+	// What is known of the file contents: hashes of chunks of whole lines, and the incomplete line at the end.
+	struct Scan {
+		std::vector<Chunk> chunks;
+		bool lastChunkOpen = false; // the last chunk ended at the end of the file rather than at a boundary
+		uint64_t completeBytes = 0; // where the incomplete last line starts
+		int completeLines = 0;
+		uint64_t partialHash = 0, partialBytes = 0; // of the incomplete last line, while scanning
+		uint64_t size = 0;
+		int64_t time = 0;
+		std::string tail; // the last bytes of the file, to tell appends from rewrites
+
+		void Feed(std::string_view data);
+		void AddLine(uint64_t lineHash, uint64_t bytes);
+		int LinesNum() const { return completeLines + (partialBytes > 0); }
+		// The chunks, plus the incomplete last line as a chunk of its own.
+		std::vector<Chunk> AllChunks() const;
+	};
+
+	std::string path;
+	std::thread worker;
+	std::atomic<bool> stopping = false;
+	std::atomic<uint64_t> bytesRead = 0;
+	std::mutex changesMutex;
+	std::vector<FileChange> changes;
+	Scan scan; // used by the worker only
+#ifdef __linux__
+	int wakePipe[2] = {-1, -1};
+#else
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+#endif
+
+	void Watch();
+	void Check();
+	bool ScanFile(Scan& newScan);
+	bool TryAppend(uint64_t newSize, int64_t newTime);
+	void Rescan();
+	bool ReadRange(uint64_t from, uint64_t to, std::string& data);
+	void Publish(FileChange change);
+};
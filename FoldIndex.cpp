@@ -0,0 +1,629 @@
+#include "FoldIndex.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <climits>
+#include <iterator>
+
+using namespace std;
+
+// Regions a block is made with. It is split once it holds twice as many, and merged with its neighbours once it holds
+// less than a quarter.
+static const size_t blockRegions = 256;
+// Snapshots moved along with the pending edits per sweep, edited or not, while some were not.
+static const size_t snapshotsMovedPerSweep = 256;
+
+// Moves `position` with the last of the edits that starts at or before it; false when an edit replaced it, which
+// leaves it at the end of that edit.
+static bool Move(TextPosition& position, const vector<TextEdit>& edits, const vector<TextPosition>& ends) {
+	if (position < edits.front().from)
+		return true;
+	// Past the line the last edit ends on, positions only shift by whole lines.
+	if (position.line > edits.back().to.line) {
+		position.line += ends.back().line - edits.back().to.line;
+		return true;
+	}
+	auto next = upper_bound(edits.begin(), edits.end(), position,
+							[](const TextPosition& position, const TextEdit& edit) { return position < edit.from; });
+	if (next == edits.begin())
+		return true;
+	auto edit = prev(next) - edits.begin();
+	auto moved = MovePosition(position, edits[edit], ends[edit]);
+	position = moved.value_or(ends[edit]);
+	return moved.has_value();
+}
+
+static bool MoveAll(vector<TextPosition>& positions, const vector<TextEdit>& edits, const vector<TextPosition>& ends) {
+	return all_of(positions.begin(), positions.end(), [&](TextPosition& position) { return Move(position, edits, ends); });
+}
+
+static void ShiftLines(FoldIndex::Region& region, int delta) {
+	region.open.line += delta;
+	region.lastLine += delta;
+	region.resume.line += delta;
+	region.close.line += delta;
+}
+
+// A comment's resume is past its close, a block's close past the lines it hides.
+static int LastLineOf(const FoldIndex::Region& region) {
+	return max({region.lastLine, region.resume.line, region.close.line});
+}
+
+static pair<int, int> Union(pair<int, int> a, pair<int, int> b) {
+	return {min(a.first, b.first), max(a.second, b.second)};
+}
+
+void FoldIndex::Reset() {
+	blocks.clear();
+	regionsNum = spansNum = 0;
+	sweeping = true;
+	foldFound = false;
+	state = Snapshot();
+	snapshots.clear();
+	sweptFrom = nextPreviousSnapshot = 0;
+	taken.clear();
+	sweepFrom = resyncFrom = TextPosition();
+	found.clear();
+	bytesSinceSnapshot = 0;
+	pendingEdits.clear();
+	firstPendingEdit = nextMovedSnapshot = passEdits = 0;
+}
+
+FoldIndex::Snapshot& FoldIndex::Moved(Snapshot& snapshot) {
+	for (; snapshot.moved < firstPendingEdit + pendingEdits.size(); snapshot.moved++) {
+		const auto& [edits, ends] = pendingEdits[snapshot.moved - firstPendingEdit];
+		// One replaced is still moved, to keep its place.
+		auto kept = Move(snapshot.position, edits, ends);
+		kept = Move(snapshot.lineResume, edits, ends) && kept;
+		kept = MoveAll(snapshot.braces, edits, ends) && kept;
+		kept = MoveAll(snapshot.conditionals, edits, ends) && kept;
+		snapshot.replaced = snapshot.replaced || !kept;
+	}
+	return snapshot;
+}
+
+void FoldIndex::MoveSnapshots(size_t count) {
+	if (pendingEdits.empty())
+		return;
+	for (; count > 0 && nextMovedSnapshot < snapshots.size(); count--)
+		Moved(snapshots[nextMovedSnapshot++]);
+	if (nextMovedSnapshot < snapshots.size())
+		return;
+	pendingEdits.erase(pendingEdits.begin(), pendingEdits.begin() + static_cast<ptrdiff_t>(passEdits - firstPendingEdit));
+	firstPendingEdit = passEdits;
+	nextMovedSnapshot = 0;
+	passEdits = firstPendingEdit + pendingEdits.size();
+}
+
+void FoldIndex::KeepTaken() {
+	for (auto& snapshot: taken)
+		snapshot.moved = firstPendingEdit + pendingEdits.size();
+	auto first = snapshots.begin() + static_cast<ptrdiff_t>(sweptFrom);
+	auto passed = nextPreviousSnapshot - sweptFrom;
+	if (taken.size() == passed)
+		move(taken.begin(), taken.end(), first);
+	else {
+		first = snapshots.erase(first, first + static_cast<ptrdiff_t>(passed));
+		snapshots.insert(first, make_move_iterator(taken.begin()), make_move_iterator(taken.end()));
+	}
+	// The ones taken are moved already; the pass goes on with those after.
+	if (nextMovedSnapshot > sweptFrom)
+		nextMovedSnapshot = max(nextMovedSnapshot, nextPreviousSnapshot) - nextPreviousSnapshot + sweptFrom + taken.size();
+	sweptFrom = nextPreviousSnapshot = sweptFrom + taken.size();
+	taken.clear();
+}
+
+bool FoldIndex::Lex(const Lexer& lexer, const Token& token, TextPosition& position) {
+	state.position = position;
+	while (nextPreviousSnapshot < snapshots.size() && Moved(snapshots[nextPreviousSnapshot]).position < position)
+		nextPreviousSnapshot++;
+	if (nextPreviousSnapshot < snapshots.size() && position >= resyncFrom && !snapshots[nextPreviousSnapshot].replaced &&
+		snapshots[nextPreviousSnapshot] == state)
+		return true;
+	if (bytesSinceSnapshot >= snapshotSpacing) {
+		taken.push_back(state);
+		bytesSinceSnapshot = 0;
+	}
+	bytesSinceSnapshot += static_cast<int>(token.text.size());
+
+	auto start = position;
+	for (size_t offset = 0;;) {
+		auto newline = token.text.find('\n', offset);
+		if (newline == string_view::npos) {
+			position.column += static_cast<int>(token.text.size() - offset);
+			break;
+		}
+		position = TextPosition {position.line + 1, 0};
+		offset = newline + 1;
+	}
+
+	// Braces and conditionals close the last one opened; a stray closing one is ignored.
+	auto close = [&](vector<TextPosition>& opened) {
+		if (opened.empty())
+			return;
+		if (start.line - 1 > opened.back().line)
+			found.push_back(Region {opened.back(), start.line - 1, state.lineResume, start});
+		opened.pop_back();
+	};
+	switch (lexer.FoldMarkOf(token)) {
+		case FoldMark::Open: state.braces.push_back(start); break;
+		case FoldMark::Close: close(state.braces); break;
+		case FoldMark::ConditionalOpen: state.conditionals.push_back(start); break;
+		case FoldMark::ConditionalClose: close(state.conditionals); break;
+		case FoldMark::Comment:
+			if (position.line > start.line)
+				found.push_back(Region {start, position.line, position, start});
+			break;
+		case FoldMark::None: break;
+	}
+	// Lexing the rest of a line can start inside whitespace, but not inside a comment or a string.
+	if (position.line > start.line)
+		state.lineResume = position.column == 0 || lexer.IsWhitespace(token.type) ? TextPosition {position.line, 0} : start;
+	return false;
+}
+
+pair<int, int> FoldIndex::Sweep(const vector<string>& lines, Lexer& lexer, int budget) {
+	MoveSnapshots(snapshotsMovedPerSweep);
+	if (!sweeping)
+		return {1, 0};
+	PROFILE_SCOPE("FoldIndex::Sweep");
+	if (lines.empty())
+		return {1, 0};
+	auto lastLine = static_cast<int>(lines.size()) - 1;
+	auto end = TextPosition {lastLine, static_cast<int>(lines[lastLine].size())};
+	if (end < state.position) {
+		Reset();
+		return {0, INT_MAX};
+	}
+	lexer.lines = const_cast<vector<string> *>(&lines);
+
+	auto converged = false, atEnd = false;
+	for (auto sliceBudget = budget; budget > 0 && !converged && !atEnd;) {
+		// Whole lines, so that only the last token can have been cut off by the end of the slice; it is lexed again
+		// with the next one.
+		auto from = state.position, to = from;
+		for (auto size = 0; to.line < lastLine && size < sliceBudget;) {
+			size += static_cast<int>(lines[to.line].size()) - to.column + 1;
+			to = TextPosition {to.line + 1, 0};
+		}
+		if (to.line == lastLine)
+			to = end;
+		atEnd = to == end;
+		lexer.Reset(from, to);
+
+		auto position = from;
+		lexer.NextToken();
+		while (lexer.currentToken.type != EOF) {
+			auto token = lexer.currentToken;
+			lexer.NextToken();
+			if (lexer.currentToken.type == EOF && !atEnd)
+				break;
+			if ((converged = Lex(lexer, token, position)))
+				break;
+		}
+		if (converged)
+			break;
+		state.position = position;
+		// A token longer than the slice, like a huge comment, takes a longer one.
+		if (position == from && !atEnd)
+			sliceBudget *= 2;
+		else
+			budget -= static_cast<int>(lexer.sourceCode.size());
+	}
+	// What the slice found can be folded at once, rather than once the whole document was swept.
+	if (!converged && !atEnd) {
+		auto changed = Settle(state.position);
+		sweepFrom = state.position;
+		return changed;
+	}
+
+	// At the end every one from before the edits was passed.
+	if (!converged)
+		nextPreviousSnapshot = snapshots.size();
+	KeepTaken();
+	auto changed = Settle(converged ? state.position : TextPosition {INT_MAX, INT_MAX});
+	sweeping = false;
+	foldFound = false;
+	return changed;
+}
+
+pair<int, int> FoldIndex::Settle(const TextPosition& upTo) {
+	found.erase(remove_if(found.begin(), found.end(), [&](const Region& region) { return region.close >= upTo; }),
+				found.end());
+	sort(found.begin(), found.end(), [](const Region& a, const Region& b) { return a.open < b.open; });
+
+	// Those completed in range open before `upTo` and reach `sweepFrom`, which rules out most blocks by their lines.
+	// A region found again where one was folded stays folded.
+	auto replaced = vector<Cursor>();
+	auto folded = vector<TextPosition>();
+	auto firstLine = INT_MAX, lastLine = -1;
+	for (size_t b = 0; b < blocks.size() && blocks[b].firstLine <= upTo.line; b++) {
+		auto& block = blocks[b];
+		if (block.lastLine < sweepFrom.line)
+			continue;
+		for (size_t index = 0; index < block.regions.size(); index++) {
+			auto region = RegionOf({b, index});
+			if (region.close < sweepFrom || region.close >= upTo)
+				continue;
+			replaced.push_back({b, index});
+			if (region.folded)
+				folded.push_back(region.open);
+			block.regions[index].folded = false;
+			firstLine = min(firstLine, region.Line());
+			lastLine = max(lastLine, region.lastLine);
+		}
+	}
+	auto changed = replaced.empty() ? pair {INT_MAX, -1} : UpdateSpans(firstLine, lastLine);
+	Erase(replaced);
+	if (!replaced.empty())
+		Rebalance(replaced.front().block, replaced.back().block);
+
+	firstLine = INT_MAX, lastLine = -1;
+	for (auto& region: found) {
+		region.folded = foldFound || binary_search(folded.begin(), folded.end(), region.open);
+		if (region.folded) {
+			firstLine = min(firstLine, region.Line());
+			lastLine = max(lastLine, region.lastLine);
+		}
+		Insert(region);
+	}
+	found.clear();
+	return firstLine > lastLine ? changed : Union(changed, UpdateSpans(firstLine, lastLine));
+}
+
+pair<int, int> FoldIndex::ApplyEdits(const vector<TextEdit>& edits, const vector<TextPosition>& ends) {
+	if (edits.empty())
+		return {1, 0};
+	PROFILE_SCOPE("FoldIndex::ApplyEdits");
+	const auto& firstEdit = edits.front().from;
+	auto changed = pair {INT_MAX, -1};
+	auto movedResyncFrom = resyncFrom;
+	auto keepsResync = sweeping && Move(movedResyncFrom, edits, ends);
+	resyncFrom = keepsResync ? max(movedResyncFrom, ends.back()) : ends.back();
+	// A sweep that has not reached the edits yet goes on as it is.
+	if (!sweeping || firstEdit <= state.position) {
+		// Past where it was, the regions are the ones from before the earlier edits, so it cannot stop short of there;
+		// the snapshots it took are still resumed from.
+		if (sweeping) {
+			auto swept = state.position;
+			Move(swept, edits, ends);
+			resyncFrom = max(resyncFrom, swept);
+			KeepTaken();
+		}
+		auto next = static_cast<size_t>(partition_point(snapshots.begin(), snapshots.end(), [&](Snapshot& snapshot) {
+			return Moved(snapshot).position < firstEdit;
+		}) - snapshots.begin());
+		while (next > 0 && Moved(snapshots[next - 1]).replaced)
+			next--;
+		auto restart = next == 0 ? Snapshot() : snapshots[next - 1];
+		if (sweeping)
+			changed = Settle(restart.position);
+		sweptFrom = nextPreviousSnapshot = next;
+		state = move(restart);
+		sweepFrom = state.position;
+		bytesSinceSnapshot = 0;
+		sweeping = true;
+	}
+	// The snapshots are moved along with the edits later.
+	if (pendingEdits.empty()) {
+		nextMovedSnapshot = 0;
+		passEdits = firstPendingEdit + 1;
+	}
+	auto& [movedEdits, movedEnds] = pendingEdits.emplace_back();
+	movedEdits.reserve(edits.size());
+	for (const auto& edit: edits)
+		movedEdits.push_back(TextEdit {edit.from, edit.to});
+	movedEnds = ends;
+
+	// Edits sorted by position also end in order, so the first one that reaches a region's lines is found by bisection.
+	auto touches = [&](int firstLine, int lastLine) {
+		auto edit = lower_bound(edits.begin(), edits.end(), firstLine,
+								[](const TextEdit& edit, int line) { return edit.to.line < line; });
+		return edit != edits.end() && edit->from.line <= lastLine;
+	};
+	// Regions an edit replaced part of stay where it left them, unfolded, until the spans are marked again without
+	// them. The spans change only about the edited lines and the regions unfolded.
+	auto dropped = vector<Cursor>();
+	auto firstLine = firstEdit.line, lastLine = ends.back().line;
+	auto firstMoved = blocks.size(), lastMoved = size_t(0);
+	for (size_t b = 0; b < blocks.size(); b++) {
+		auto& block = blocks[b];
+		if (block.lastLine < firstEdit.line)
+			continue;
+		// Past the edits that end before its first line and short of the next one, a block only shifts.
+		auto next = partition_point(edits.begin(), edits.end(), [&](const TextEdit& edit) { return edit.to.line < block.firstLine; });
+		if (next != edits.begin() && (next == edits.end() || next->from.line > block.lastLine)) {
+			auto edit = prev(next) - edits.begin();
+			auto delta = ends[edit].line - edits[edit].to.line;
+			block.lineShift += delta;
+			block.firstLine += delta;
+			block.lastLine += delta;
+			continue;
+		}
+		Unshift(block);
+		for (size_t index = 0; index < block.regions.size(); index++) {
+			auto& region = block.regions[index];
+			// Editing the lines a region hides opens it.
+			auto unfolded = region.folded && region.lastLine >= firstEdit.line && touches(region.Line() + 1, region.lastLine);
+			auto kept = Move(region.open, edits, ends);
+			kept = Move(region.resume, edits, ends) && kept;
+			kept = Move(region.close, edits, ends) && kept;
+			// A line break put into the last line it hides adds one; a comment hides up to its end.
+			region.lastLine = region.close == region.open ? region.resume.line : region.close.line - 1;
+			if (!kept || region.lastLine <= region.Line()) {
+				dropped.push_back({b, index});
+				unfolded = region.folded;
+			}
+			if (unfolded) {
+				region.folded = false;
+				firstLine = min(firstLine, region.Line());
+				lastLine = max(lastLine, region.lastLine);
+			}
+		}
+		Summarize(block);
+		firstMoved = min(firstMoved, b);
+		lastMoved = b;
+	}
+	changed = Union(changed, UpdateSpans(firstLine, lastLine));
+	Erase(dropped);
+	if (firstMoved < blocks.size())
+		Rebalance(firstMoved, lastMoved);
+	return changed;
+}
+
+FoldIndex::Cursor FoldIndex::RegionAt(int line) const {
+	auto cursor = LowerBound({line + 1, 0});
+	if (!Previous(cursor))
+		return {blocks.size(), 0};
+	if (RegionOf(cursor).Line() == line)
+		return cursor;
+	// The innermost one spanning it opens last; blocks that do not reach it are passed by their lines.
+	do {
+		const auto& block = blocks[cursor.block];
+		if (block.lastLine < line)
+			cursor.index = 0;
+		else if (block.regions[cursor.index].lastLine + block.lineShift >= line)
+			return cursor;
+	} while (Previous(cursor));
+	return {blocks.size(), 0};
+}
+
+pair<int, int> FoldIndex::SetFolded(int line, bool folded) {
+	auto firstLine = INT_MAX, lastLine = -1;
+	if (folded) {
+		if (auto cursor = RegionAt(line); cursor.block < blocks.size()) {
+			blocks[cursor.block].regions[cursor.index].folded = true;
+			auto region = RegionOf(cursor);
+			firstLine = region.Line();
+			lastLine = region.lastLine;
+		}
+	}
+	else
+		for (auto cursor = LowerBound({line, 0}); cursor.block < blocks.size() && RegionOf(cursor).Line() == line; Next(cursor)) {
+			blocks[cursor.block].regions[cursor.index].folded = false;
+			firstLine = line;
+			lastLine = max(lastLine, RegionOf(cursor).lastLine);
+		}
+	return firstLine > lastLine ? pair {1, 0} : UpdateSpans(firstLine, lastLine);
+}
+
+pair<int, int> FoldIndex::SetAllFolded(bool folded) {
+	for (auto& block: blocks)
+		for (auto& region: block.regions)
+			region.folded = folded;
+	foldFound = folded && sweeping;
+	return UpdateSpans(0, INT_MAX);
+}
+
+pair<int, int> FoldIndex::Reveal(int line) {
+	auto firstLine = INT_MAX, lastLine = -1;
+	for (auto cursor = LowerBound({line, 0}); Previous(cursor);) {
+		auto& block = blocks[cursor.block];
+		if (block.lastLine < line) {
+			cursor.index = 0;
+			continue;
+		}
+		auto& region = block.regions[cursor.index];
+		if (region.folded && region.lastLine + block.lineShift >= line) {
+			region.folded = false;
+			firstLine = min(firstLine, region.Line() + block.lineShift);
+			lastLine = max(lastLine, region.lastLine + block.lineShift);
+		}
+	}
+	return firstLine > lastLine ? pair {1, 0} : UpdateSpans(firstLine, lastLine);
+}
+
+pair<int, int> FoldIndex::UpdateSpans(int firstLine, int lastLine) {
+	auto cursor = LowerBound({firstLine, 0});
+	// The last line of the span before, by the old marks and by the new ones; they differ only after a mark changed.
+	auto spanLast = -1;
+	if (auto previous = cursor; PreviousSpan(previous))
+		spanLast = RegionOf(previous).lastLine;
+	auto previousSpanLast = spanLast;
+	auto changed = pair {INT_MAX, -1};
+	for (; cursor.block < blocks.size(); Next(cursor)) {
+		auto& block = blocks[cursor.block];
+		auto& region = block.regions[cursor.index];
+		auto line = region.Line() + block.lineShift, regionLast = region.lastLine + block.lineShift;
+		// Both mark the regions after alike once they agree, or once neither span reaches here.
+		if (line > lastLine && (previousSpanLast == spanLast || max(previousSpanLast, spanLast) < line))
+			break;
+		auto span = region.folded && line > spanLast;
+		if (region.span)
+			previousSpanLast = regionLast;
+		if (span)
+			spanLast = regionLast;
+		if (span != region.span) {
+			region.span = span;
+			block.spansNum += span ? 1 : -1;
+			spansNum += span ? 1 : -1;
+			changed = Union(changed, {line + 1, regionLast});
+		}
+	}
+	return changed;
+}
+
+vector<pair<int, int>> FoldIndex::HiddenSpans(int firstLine, int lastLine) const {
+	auto hidden = vector<pair<int, int>>();
+	if (spansNum == 0)
+		return hidden;
+	auto cursor = LowerBound({firstLine, 0});
+	// The span of a region opening before firstLine may reach into it.
+	if (auto previous = cursor; PreviousSpan(previous))
+		if (auto region = RegionOf(previous); region.lastLine >= firstLine)
+			hidden.emplace_back(firstLine, min(region.lastLine, lastLine));
+	while (cursor.block < blocks.size() && blocks[cursor.block].firstLine < lastLine) {
+		const auto& block = blocks[cursor.block];
+		if (block.spansNum == 0) {
+			cursor = {cursor.block + 1, 0};
+			continue;
+		}
+		const auto& region = block.regions[cursor.index];
+		auto line = region.Line() + block.lineShift;
+		if (line >= lastLine)
+			break;
+		if (region.span)
+			hidden.emplace_back(line + 1, min(region.lastLine + block.lineShift, lastLine));
+		Next(cursor);
+	}
+	return hidden;
+}
+
+TextPosition FoldIndex::ResumeBefore(const TextPosition& from) const {
+	// The last span that ends before from.line: the one before the first region opening on it or after, unless that
+	// span takes in from.line.
+	auto cursor = LowerBound({from.line, 0});
+	if (!PreviousSpan(cursor) || (RegionOf(cursor).lastLine >= from.line && !PreviousSpan(cursor)))
+		return TextPosition();
+	auto resume = RegionOf(cursor).resume;
+	// Text the sweep has yet to reach again may have changed, so only positions before it are known token starts.
+	return sweeping && resume >= sweepFrom ? TextPosition() : resume;
+}
+
+FoldIndex::Region FoldIndex::RegionOf(const Cursor& cursor) const {
+	const auto& block = blocks[cursor.block];
+	auto region = block.regions[cursor.index];
+	ShiftLines(region, block.lineShift);
+	return region;
+}
+
+FoldIndex::Cursor FoldIndex::LowerBound(const TextPosition& position) const {
+	// In the last block opening before `position`, unless that block holds none at or after it.
+	auto next = partition_point(blocks.begin(), blocks.end(), [&](const Block& block) {
+		return TextPosition {block.firstLine, block.regions.front().open.column} < position;
+	});
+	if (next == blocks.begin())
+		return {0, 0};
+	auto block = static_cast<size_t>(next - blocks.begin()) - 1;
+	const auto& regions = blocks[block].regions;
+	auto shift = blocks[block].lineShift;
+	auto index = partition_point(regions.begin(), regions.end(), [&](const Region& region) {
+		return TextPosition {region.open.line + shift, region.open.column} < position;
+	}) - regions.begin();
+	return static_cast<size_t>(index) < regions.size() ? Cursor {block, static_cast<size_t>(index)} : Cursor {block + 1, 0};
+}
+
+void FoldIndex::Next(Cursor& cursor) const {
+	if (++cursor.index == blocks[cursor.block].regions.size())
+		cursor = {cursor.block + 1, 0};
+}
+
+bool FoldIndex::Previous(Cursor& cursor) const {
+	if (cursor.index == 0) {
+		if (cursor.block == 0)
+			return false;
+		cursor.block--;
+		cursor.index = blocks[cursor.block].regions.size();
+	}
+	cursor.index--;
+	return true;
+}
+
+bool FoldIndex::PreviousSpan(Cursor& cursor) const {
+	if (spansNum == 0)
+		return false;
+	while (Previous(cursor))
+		if (blocks[cursor.block].spansNum == 0)
+			cursor.index = 0;
+		else if (blocks[cursor.block].regions[cursor.index].span)
+			return true;
+	return false;
+}
+
+void FoldIndex::Insert(const Region& region) {
+	auto cursor = LowerBound(region.open);
+	// At the end of the block before rather than the start of the next, whose first line stays.
+	if (blocks.empty())
+		blocks.emplace_back();
+	else if (cursor.index == 0 && cursor.block > 0)
+		cursor = {cursor.block - 1, blocks[cursor.block - 1].regions.size()};
+	auto& block = blocks[cursor.block];
+	Unshift(block);
+	block.regions.insert(block.regions.begin() + static_cast<ptrdiff_t>(cursor.index), region);
+	block.firstLine = block.regions.front().Line();
+	block.lastLine = max(block.lastLine, LastLineOf(region));
+	block.spansNum += region.span;
+	spansNum += region.span;
+	regionsNum++;
+	Rebalance(cursor.block, cursor.block);
+}
+
+void FoldIndex::Erase(const vector<Cursor>& cursors) {
+	for (size_t i = 0; i < cursors.size();) {
+		auto block = cursors[i].block;
+		auto& regions = blocks[block].regions;
+		// Each block is compacted once, from the first region it loses.
+		auto kept = cursors[i].index;
+		for (auto index = kept; index < regions.size(); index++)
+			if (i < cursors.size() && cursors[i].block == block && cursors[i].index == index)
+				i++;
+			else
+				regions[kept++] = regions[index];
+		regionsNum -= regions.size() - kept;
+		regions.resize(kept);
+		Summarize(blocks[block]);
+	}
+}
+
+void FoldIndex::Rebalance(size_t firstBlock, size_t lastBlock) {
+	auto fits = [&](const Block& block) {
+		auto size = block.regions.size();
+		return size > 0 && size <= 2 * blockRegions && (size >= blockRegions / 4 || blocks.size() == 1);
+	};
+	if (all_of(blocks.begin() + static_cast<ptrdiff_t>(firstBlock), blocks.begin() + static_cast<ptrdiff_t>(lastBlock) + 1, fits))
+		return;
+	// The neighbours are dealt out again too, so a small block always has regions to merge with.
+	auto from = firstBlock > 0 ? firstBlock - 1 : 0, to = min(lastBlock + 1, blocks.size() - 1);
+	auto regions = vector<Region>();
+	for (auto i = from; i <= to; i++) {
+		Unshift(blocks[i]);
+		regions.insert(regions.end(), blocks[i].regions.begin(), blocks[i].regions.end());
+	}
+	auto size = regions.size();
+	auto blocksNum = size == 0 ? 0 : max<size_t>(1, (size + blockRegions / 2) / blockRegions);
+	auto dealt = vector<Block>(blocksNum);
+	for (size_t i = 0; i < blocksNum; i++) {
+		auto first = static_cast<ptrdiff_t>(size * i / blocksNum), last = static_cast<ptrdiff_t>(size * (i + 1) / blocksNum);
+		dealt[i].regions.assign(regions.begin() + first, regions.begin() + last);
+		Summarize(dealt[i]);
+	}
+	blocks.erase(blocks.begin() + static_cast<ptrdiff_t>(from), blocks.begin() + static_cast<ptrdiff_t>(to) + 1);
+	blocks.insert(blocks.begin() + static_cast<ptrdiff_t>(from), make_move_iterator(dealt.begin()), make_move_iterator(dealt.end()));
+}
+
+void FoldIndex::Unshift(Block& block) {
+	if (block.lineShift == 0)
+		return;
+	for (auto& region: block.regions)
+		ShiftLines(region, block.lineShift);
+	block.lineShift = 0;
+}
+
+void FoldIndex::Summarize(Block& block) {
+	block.firstLine = block.regions.empty() ? 0 : block.regions.front().Line() + block.lineShift;
+	block.lastLine = 0;
+	block.spansNum = 0;
+	for (const auto& region: block.regions) {
+		block.lastLine = max(block.lastLine, LastLineOf(region) + block.lineShift);
+		block.spansNum += region.span;
+	}
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "Lexer.h"
+#include "TextEdit.h"
+
+// The regions of a document that can be folded, found from the lexer's tokens a slice per frame: brace blocks, block
+// comments and #if...#endif, each spanning lines. A folded region keeps its first line shown and hides the rest; the
+// hidden lines go to VisualLineIndex::SetHidden(), where they take no rows.
+//
+// Every few kilobytes the sweep keeps a snapshot of its state, the braces and conditionals still open. An edit moves
+// the regions and snapshots along with the text and restarts the sweep at the last snapshot before it. The sweep
+// stops at the first later snapshot, past the edits, that it reaches in the same state, since from there on it would
+// only find the regions it found before.
+struct FoldIndex {
+	static const int snapshotSpacing = 16 * 1024; // bytes lexed between two snapshots
+
+	struct Region {
+		TextPosition open; // of the token it starts with; its line stays shown
+		int lastLine = 0; // the last line it hides
+		// A token start at or before the start of the line after lastLine and as late as lexing allows, so the text
+		// after the region can be lexed from there rather than from before it.
+		TextPosition resume;
+		TextPosition close; // of the token that completed it
+		bool folded = false;
+		bool span = false; // folded with its first line shown, so the lines it hides are a span of their own
+
+		int Line() const { return open.line; }
+	};
+
+	size_t RegionsNum() const { return regionsNum; }
+	bool IsSweeping() const { return sweeping; }
+
+	// Forgets every region and sweeps the document anew, e.g. after a file was loaded.
+	void Reset();
+	// Lexes about `budget` bytes more of the sweep; the regions found so far can be folded right away. This and the
+	// calls below return the lines, [first, last], whose hidden state may have changed; first > last when none.
+	std::pair<int, int> Sweep(const std::vector<std::string>& lines, Lexer& lexer, int budget);
+	// Moves everything along with edits and restarts the sweep before the first one. Folded regions whose hidden lines
+	// were edited are unfolded. `ends` is what ApplyEdits() returned for `edits`.
+	std::pair<int, int> ApplyEdits(const std::vector<TextEdit>& edits, const std::vector<TextPosition>& ends);
+
+	// Folds the region at `line`, or unfolds every region starting on it.
+	std::pair<int, int> SetFolded(int line, bool folded);
+	// Folding all while a sweep is under way also folds what it finds.
+	std::pair<int, int> SetAllFolded(bool folded);
+	// Unfolds the regions that hide `line`.
+	std::pair<int, int> Reveal(int line);
+
+	// The lines hidden by folded regions, as sorted [first, last] spans, clipped to [firstLine, lastLine].
+	std::vector<std::pair<int, int>> HiddenSpans(int firstLine, int lastLine) const;
+	// Where lexing for `from` may start without lexing the hidden text before it: the resume position of the last
+	// fold above it. The start of the document when there is none, or when the sweep has yet to confirm it.
+	TextPosition ResumeBefore(const TextPosition& from) const;
+
+private:
+	struct Snapshot {
+		TextPosition position; // a token start
+		TextPosition lineResume; // resume position for the start of position.line
+		std::vector<TextPosition> braces; // opened and not closed yet
+		std::vector<TextPosition> conditionals;
+		size_t moved = 0; // pending edits it was moved along with, counted from the first ever made
+		bool replaced = false; // by an edit; it keeps its place in order but is neither resumed from nor matched
+
+		// The same lexer state, however it was moved.
+		bool operator==(const Snapshot& other) const {
+			return position == other.position && lineResume == other.lineResume && braces == other.braces &&
+				   conditionals == other.conditionals;
+		}
+	};
+
+	// Regions sorted by where they open, a few hundred to a block. While a sweep is under way the ones it has not
+	// reached yet were found before the last edits and moved along with them. A block wholly past an edit moves by
+	// its shift alone, so an edit goes through the regions of the blocks it reaches into and the headers of the rest.
+	struct Block {
+		std::vector<Region> regions; // their lines are lineShift short
+		int lineShift = 0;
+		int firstLine = 0; // of the first region
+		int lastLine = 0; // the last line one of them reaches, its resume and close included
+		int spansNum = 0;
+	};
+	// A region's place in `blocks`; {blocks.size(), 0} past the last one.
+	struct Cursor {
+		size_t block = 0;
+		size_t index = 0;
+	};
+
+	std::vector<Block> blocks;
+	size_t regionsNum = 0;
+	size_t spansNum = 0;
+
+	bool sweeping = true;
+	bool foldFound = false;
+	Snapshot state; // where the sweep is
+	// Sorted. Those past where the sweep restarted are from before the edits since; it stops at one it matches, and
+	// the ones it passed, from `sweptFrom` on, are replaced by those it took. A snapshot is moved along with the
+	// pending edits when it is looked at, or else by a pass that moves a slice of them every sweep, so an edit only
+	// moves the few it is bisected through.
+	std::vector<Snapshot> snapshots;
+	size_t sweptFrom = 0;
+	size_t nextPreviousSnapshot = 0; // the first one the sweep has not passed
+	std::vector<Snapshot> taken; // by the sweep since it restarted
+	// Where it restarted or its last slice ended; regions completed after are replaced by what it finds.
+	TextPosition sweepFrom;
+	TextPosition resyncFrom; // end of the furthest edit since it restarted; it can only stop after
+	std::vector<Region> found; // completed by the sweep since it restarted
+	int bytesSinceSnapshot = 0;
+	// Edits, with their ends, that not every snapshot was moved along with yet; the first is the
+	// `firstPendingEdit`-th made. They are dropped once a pass moved every snapshot along with them.
+	std::vector<std::pair<std::vector<TextEdit>, std::vector<TextPosition>>> pendingEdits;
+	size_t firstPendingEdit = 0;
+	size_t nextMovedSnapshot = 0; // where the pass is
+	size_t passEdits = 0; // edits made when the pass started
+
+	// Takes in the token starting at `position` and moves it past; returns true when the sweep can stop there.
+	bool Lex(const Lexer& lexer, const Token& token, TextPosition& position);
+	// Moves the snapshot along with the pending edits it was not yet.
+	Snapshot& Moved(Snapshot& snapshot);
+	// Moves `count` more snapshots in the pass; the edits made before it started are dropped when it is through.
+	void MoveSnapshots(size_t count);
+	// Puts the snapshots taken by the sweep in place of the ones it passed.
+	void KeepTaken();
+	// Replaces the regions completed between `sweepFrom` and `upTo` with the ones found there.
+	std::pair<int, int> Settle(const TextPosition& upTo);
+	// Marks the spans again from the regions opening on `firstLine` on; past `lastLine` it stops once the marks agree
+	// with the ones before, which every change of a region's fold or place must lie within. Returns the lines of the
+	// spans marked or unmarked.
+	std::pair<int, int> UpdateSpans(int firstLine, int lastLine);
+
+	// The region with its lines where they are.
+	Region RegionOf(const Cursor& cursor) const;
+	// The first region opening at or after `position`.
+	Cursor LowerBound(const TextPosition& position) const;
+	void Next(Cursor& cursor) const;
+	bool Previous(Cursor& cursor) const;
+	bool PreviousSpan(Cursor& cursor) const;
+	// The innermost region that starts on `line`, or else the innermost one that spans it.
+	Cursor RegionAt(int line) const;
+	void Insert(const Region& region);
+	// Removes the regions at `cursors`, which are sorted and mark no spans.
+	void Erase(const std::vector<Cursor>& cursors);
+	// Splits the blocks of [firstBlock, lastBlock] grown too large and merges those shrunk too small or emptied.
+	void Rebalance(size_t firstBlock, size_t lastBlock);
+	// Moves the regions of the block by its shift, so they can be changed in place.
+	static void Unshift(Block& block);
+	static void Summarize(Block& block);
+};
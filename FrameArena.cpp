@@ -0,0 +1,31 @@
+#include "FrameArena.h"
+#include <algorithm>
+
+using namespace std;
+
+FrameArena frameArena;
+
+void *FrameArena::Allocate(size_t size, size_t alignment) {
+	auto start = (used + alignment - 1) & ~(alignment - 1);
+	if (block && start + size <= blockSize) {
+		used = start + size;
+		return block.get() + start;
+	}
+	// new[] aligns for any fundamental type, which is all the allocators ask for.
+	overflow.push_back(make_unique_for_overwrite<byte[]>(size));
+	overflowSize += size;
+	return overflow.back().get();
+}
+
+void FrameArena::Reset() {
+	if (!overflow.empty() || !block) {
+		auto size = max(minBlockSize, used + overflowSize);
+		size += size / 2; // room for a frame a little busier than this one
+		overflow.clear();
+		overflowSize = 0;
+		block = nullptr; // freed before the new one is taken, so the two are never held at once
+		block = make_unique_for_overwrite<byte[]>(size);
+		blockSize = size;
+	}
+	used = 0;
+}
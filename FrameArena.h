@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Memory for what the UI thread builds and drops within a frame, like the text of labels. Allocating bumps an offset
+// into a block and freeing does nothing; Reset() at the end of the frame takes it all back. A frame that outgrew the
+// block takes more from the heap, and the next Reset() replaces the block with one as big as the whole frame used, so
+// a frame like one before does not touch the heap at all.
+struct FrameArena {
+	FrameArena() = default;
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	void *Allocate(size_t size, size_t alignment);
+	void Reset();
+	size_t Capacity() const { return blockSize; }
+
+private:
+	static constexpr size_t minBlockSize = 64 << 10;
+
+	std::unique_ptr<std::byte[]> block;
+	size_t blockSize = 0;
+	size_t used = 0;
+	std::vector<std::unique_ptr<std::byte[]>> overflow; // taken from the heap after the block was full
+	size_t overflowSize = 0;
+};
+
+// The arena of the UI thread; nothing allocated from it lives past the frame.
+extern FrameArena frameArena;
+
+template<typename T>
+struct FrameAllocator {
+	using value_type = T;
+
+	FrameAllocator() = default;
+	template<typename U>
+	FrameAllocator(const FrameAllocator<U>&) {}
+
+	T *allocate(size_t n) { return static_cast<T *>(frameArena.Allocate(n * sizeof(T), alignof(T))); }
+	void deallocate(T *, size_t) {}
+
+	template<typename U>
+	bool operator==(const FrameAllocator<U>&) const { return true; }
+};
+
+using FrameString = std::basic_string<char, std::char_traits<char>, FrameAllocator<char>>;
+template<typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+template<typename... Args>
+FrameString FrameFormat(std::format_string<Args...> format, Args&&... args) {
+	auto text = FrameString();
+	std::format_to(std::back_inserter(text), format, std::forward<Args>(args)...);
+	return text;
+}
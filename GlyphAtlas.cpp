@@ -0,0 +1,231 @@
+#include "GlyphAtlas.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <bit>
+
+using namespace std;
+
+bool GlyphAtlas::Load(const string& path, int newSize) {
+	Unload();
+	auto dataSize = 0;
+	auto data = LoadFileData(path.c_str(), &dataSize);
+	if (!data)
+		return false;
+	fileData.assign(data, data + dataSize);
+	UnloadFileData(data);
+	size = newSize;
+	// Room for about a thousand glyphs a page.
+	pageSize = clamp(static_cast<int>(bit_ceil(static_cast<unsigned>(max(size, 1)) * 32)), 256, 2048);
+	// Printable ASCII is rasterized right away, so the first frame does not miss most of its glyphs.
+	for (auto codepoint = 32; codepoint < 127; codepoint++)
+		Find(codepoint);
+	return true;
+}
+
+void GlyphAtlas::Unload() {
+	for (const auto& page: pages)
+		if (page.texture.id != 0)
+			UnloadTexture(page.texture);
+	fileData.clear();
+	pages.clear();
+	glyphs.clear();
+	lru.clear();
+	freeSlots.clear();
+	pendingCodepoints.clear();
+	evictionsNum = 0;
+	generation++;
+}
+
+const GlyphAtlas::Glyph *GlyphAtlas::Find(int codepoint) {
+	if (!IsLoaded())
+		return nullptr;
+	if (auto found = glyphs.find(codepoint); found != glyphs.end()) {
+		auto& entry = found->second;
+		if (entry.lastUsedFrame != frame) {
+			entry.lastUsedFrame = frame;
+			lru.splice(lru.begin(), lru, entry.lru);
+		}
+		return &entry.glyph;
+	}
+
+	PROFILE_SCOPE("GlyphAtlas::Rasterize");
+	auto info = LoadFontData(fileData.data(), static_cast<int>(fileData.size()), size, &codepoint, 1, FONT_DEFAULT);
+	if (!info)
+		return nullptr;
+	auto entry = Entry();
+	const auto& image = info[0].image;
+	if (image.width > 0 && image.height > 0) {
+		if (!Allocate(image.width + 2 * padding, image.height + 2 * padding, entry.slot)) {
+			UnloadFontData(info, 1);
+			return nullptr;
+		}
+		Blit(entry.slot, image);
+		entry.glyph.page = entry.slot.page;
+		entry.glyph.source = Rectangle {
+			static_cast<float>(entry.slot.x), static_cast<float>(entry.slot.y),
+			static_cast<float>(image.width + 2 * padding), static_cast<float>(image.height + 2 * padding)
+		};
+	}
+	entry.glyph.offset = Vector2 {static_cast<float>(info[0].offsetX - padding), static_cast<float>(info[0].offsetY - padding)};
+	entry.glyph.advance = static_cast<float>(info[0].advanceX > 0 ? info[0].advanceX : image.width);
+	entry.glyph.ready = entry.glyph.page < 0;
+	if (!entry.glyph.ready)
+		pendingCodepoints.push_back(codepoint);
+	UnloadFontData(info, 1);
+
+	entry.lastUsedFrame = frame;
+	lru.push_front(codepoint);
+	entry.lru = lru.begin();
+	return &glyphs.emplace(codepoint, entry).first->second.glyph;
+}
+
+bool GlyphAtlas::Upload() {
+	auto uploaded = false;
+	for (auto& page: pages) {
+		if (page.dirtyTop >= page.dirtyBottom)
+			continue;
+		PROFILE_SCOPE("GlyphAtlas::Upload");
+		if (cpuOnly)
+			page.texture = Texture2D {0, pageSize, pageSize, 1, PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA};
+		else if (page.texture.id == 0) {
+			auto image = Image {page.pixels.data(), pageSize, pageSize, 1, PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA};
+			page.texture = LoadTextureFromImage(image);
+		}
+		else {
+			// The changed rows are contiguous in memory, so they go up as they are.
+			auto rows = Rectangle {
+				0, static_cast<float>(page.dirtyTop), static_cast<float>(pageSize), static_cast<float>(page.dirtyBottom - page.dirtyTop)
+			};
+			UpdateTextureRec(page.texture, rows, page.pixels.data() + static_cast<size_t>(page.dirtyTop) * pageSize * 2);
+		}
+		page.dirtyTop = page.dirtyBottom = 0;
+		uploaded = true;
+	}
+	for (auto codepoint: pendingCodepoints)
+		if (auto found = glyphs.find(codepoint); found != glyphs.end())
+			found->second.glyph.ready = true;
+	pendingCodepoints.clear();
+	frame++;
+	return uploaded;
+}
+
+bool GlyphAtlas::Allocate(int width, int height, Slot& slot) {
+	if (width > pageSize || ShelfHeight(height) > pageSize)
+		return false;
+	for (;;) {
+		// The narrowest slot an evicted glyph left behind on a shelf of the right height comes first.
+		auto shelfHeight = ShelfHeight(height);
+		auto best = freeSlots.end();
+		for (auto free = freeSlots.begin(); free != freeSlots.end(); ++free)
+			if (free->height == shelfHeight && free->width >= width && (best == freeSlots.end() || free->width < best->width))
+				best = free;
+		if (best != freeSlots.end()) {
+			slot = *best;
+			slot.width = width;
+			if (best->width > width) {
+				best->x += width;
+				best->width -= width;
+			}
+			else {
+				*best = freeSlots.back();
+				freeSlots.pop_back();
+			}
+			return true;
+		}
+		if (AllocateFresh(width, height, slot))
+			return true;
+		if (!EvictLeastRecentlyUsed())
+			return false;
+	}
+}
+
+bool GlyphAtlas::AllocateFresh(int width, int height, Slot& slot) {
+	auto shelfHeight = ShelfHeight(height);
+	for (auto pageIndex = 0; pageIndex < PagesNum(); pageIndex++)
+		for (auto& shelf: pages[pageIndex].shelves)
+			// An emptied shelf takes any glyph that is not taller.
+			if ((shelf.height == shelfHeight || (shelf.filled == 0 && shelf.height > shelfHeight))
+				&& shelf.filled + width <= pageSize) {
+				slot = Slot {pageIndex, shelf.filled, shelf.y, width, shelf.height};
+				shelf.filled += width;
+				return true;
+			}
+	for (auto pageIndex = 0; pageIndex <= PagesNum(); pageIndex++) {
+		if (pageIndex == PagesNum()) {
+			if (PagesNum() >= maxPages)
+				return false;
+			auto& page = pages.emplace_back();
+			// Transparent white, so filtering at glyph edges blends towards the text color.
+			page.pixels.resize(static_cast<size_t>(pageSize) * pageSize * 2);
+			for (size_t i = 0; i < page.pixels.size(); i += 2)
+				page.pixels[i] = 255;
+			page.dirtyBottom = pageSize;
+		}
+		auto& shelves = pages[pageIndex].shelves;
+		auto bottom = shelves.empty() ? 0 : shelves.back().y + shelves.back().height;
+		if (bottom + shelfHeight <= pageSize) {
+			shelves.push_back(Shelf {bottom, shelfHeight, width});
+			slot = Slot {pageIndex, 0, bottom, width, shelfHeight};
+			return true;
+		}
+	}
+	return false;
+}
+
+bool GlyphAtlas::EvictLeastRecentlyUsed() {
+	if (lru.empty())
+		return false;
+	auto codepoint = lru.back();
+	auto found = glyphs.find(codepoint);
+	if (found->second.lastUsedFrame == frame)
+		return false;
+	auto slot = found->second.slot;
+	lru.pop_back();
+	glyphs.erase(found);
+	evictionsNum++;
+	generation++;
+	if (slot.width == 0)
+		return true;
+
+	// Neighbouring free slots merge, and free space at the end of a shelf goes back to the shelf.
+	for (auto free = freeSlots.begin(); free != freeSlots.end();)
+		if (free->page == slot.page && free->y == slot.y && (free->x + free->width == slot.x || slot.x + slot.width == free->x)) {
+			slot.x = min(slot.x, free->x);
+			slot.width += free->width;
+			*free = freeSlots.back();
+			freeSlots.pop_back();
+			free = freeSlots.begin();
+		}
+		else
+			++free;
+	auto& shelves = pages[slot.page].shelves;
+	auto shelf = find_if(shelves.begin(), shelves.end(), [&](const Shelf& shelf) { return shelf.y == slot.y; });
+	if (slot.x + slot.width == shelf->filled)
+		shelf->filled = slot.x;
+	else
+		freeSlots.push_back(slot);
+	return true;
+}
+
+void GlyphAtlas::Blit(const Slot& slot, const Image& image) {
+	auto& page = pages[slot.page];
+	auto source = static_cast<const unsigned char *>(image.data);
+	// The whole slot is written, so nothing of a glyph evicted from it is left.
+	for (auto y = 0; y < slot.height; y++) {
+		auto row = page.pixels.data() + (static_cast<size_t>(slot.y + y) * pageSize + slot.x) * 2;
+		for (auto x = 0; x < slot.width; x++) {
+			auto imageX = x - padding, imageY = y - padding;
+			auto inside = imageX >= 0 && imageX < image.width && imageY >= 0 && imageY < image.height;
+			row[x * 2] = 255;
+			row[x * 2 + 1] = inside ? source[imageY * image.width + imageX] : 0;
+		}
+	}
+	if (page.dirtyTop >= page.dirtyBottom) {
+		page.dirtyTop = slot.y;
+		page.dirtyBottom = slot.y + slot.height;
+	}
+	else {
+		page.dirtyTop = min(page.dirtyTop, slot.y);
+		page.dirtyBottom = max(page.dirtyBottom, slot.y + slot.height);
+	}
+}
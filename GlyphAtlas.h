@@ -0,0 +1,90 @@
+#pragma once
+
+#include <raylib.h>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Glyphs of one TTF font at one pixel size, rasterized the first time they are asked for into pages of a texture
+// atlas, so startup costs one file read and memory grows with the glyphs actually shown rather than with the font.
+//
+// Pages are packed in shelves: rows as tall as the glyphs put in them, filled left to right. Once `maxPages` pages
+// are full, the least recently used glyphs give up their slots, except those used in the current frame, whose quads
+// may still be waiting in the render batch. Pixels go into a CPU-side copy of each page first and reach the
+// textures in one upload per page per frame.
+struct GlyphAtlas {
+
+	struct Glyph {
+		int page = -1;
+		Rectangle source = {0, 0, 0, 0}; // in the page texture, padding included
+		Vector2 offset = {0, 0}; // from the pen position to the top left of `source`
+		float advance = 0;
+		bool ready = false; // uploaded; until then its slot may still show the glyph evicted from it
+	};
+
+	static const int padding = 1; // empty pixels around each glyph, so filtering does not bleed into neighbours
+	int maxPages = 4;
+	bool cpuOnly = false; // rasterize and pack without creating textures, e.g. in benchmarks that have no window
+
+	bool Load(const std::string& path, int newSize);
+	void Unload();
+	bool IsLoaded() const { return !fileData.empty(); }
+	int Size() const { return size; }
+	int PageSize() const { return pageSize; }
+
+	// Rasterizes the glyph on first use and marks it used in this frame; nullptr when no font is loaded or every slot
+	// it could take is in use this frame.
+	const Glyph *Find(int codepoint);
+	const Texture2D& PageTexture(int page) const { return pages[page].texture; }
+
+	// Sends the pixels rasterized since the last call to the textures and starts a new frame. True when anything was
+	// uploaded, since glyphs rasterized while drawing the last frame only show from the next one.
+	bool Upload();
+
+	int GlyphsNum() const { return static_cast<int>(glyphs.size()); }
+	int PagesNum() const { return static_cast<int>(pages.size()); }
+	int EvictionsNum() const { return evictionsNum; }
+	// Changes whenever a glyph found earlier may have lost its slot, so quads built before are stale.
+	uint64_t Generation() const { return generation; }
+
+private:
+	struct Slot {
+		int page = 0;
+		int x = 0, y = 0, width = 0, height = 0;
+	};
+	struct Shelf {
+		int y = 0, height = 0, filled = 0;
+	};
+	struct Page {
+		std::vector<unsigned char> pixels; // gray-alpha, `pageSize` squared
+		Texture2D texture = {0, 0, 0, 0, 0};
+		std::vector<Shelf> shelves;
+		int dirtyTop = 0, dirtyBottom = 0; // rows changed since the last upload
+	};
+	struct Entry {
+		Glyph glyph;
+		Slot slot;
+		uint64_t lastUsedFrame = 0;
+		std::list<int>::iterator lru;
+	};
+
+	std::vector<unsigned char> fileData;
+	int size = 0;
+	int pageSize = 512;
+	uint64_t frame = 1;
+	std::vector<Page> pages;
+	std::unordered_map<int, Entry> glyphs;
+	std::list<int> lru; // codepoints, most recently used first
+	std::vector<Slot> freeSlots; // left behind by evicted glyphs
+	std::vector<int> pendingCodepoints; // rasterized since the last upload
+	int evictionsNum = 0;
+	uint64_t generation = 0;
+
+	static int ShelfHeight(int height) { return (height + 3) & ~3; }
+	bool Allocate(int width, int height, Slot& slot);
+	bool AllocateFresh(int width, int height, Slot& slot);
+	bool EvictLeastRecentlyUsed();
+	void Blit(const Slot& slot, const Image& image);
+};
@@ -0,0 +1,195 @@
+#include "HibernatedLines.h"
+#include "Compression.h"
+#include "Profiler.h"
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <utility>
+
+using namespace std;
+
+struct HibernatedLines::State {
+	struct Block {
+		size_t size = 0; // of the text, a newline after every line
+		size_t packedSize = 0;
+		size_t linesNum = 0;
+	};
+
+	struct Packed {
+		vector<Block> blocks;
+		string text;
+	};
+
+	// Held by the task while it compresses, so Wake() finds the lines either untouched or all compressed.
+	mutex compressing;
+	atomic<bool> woken = false;
+	atomic<bool> compressed = false;
+	atomic<size_t> bytes = 0;
+	vector<string> lines;
+	// Once compressed. Taken under the lock, so a wake ahead decompresses what it took while the lines change.
+	shared_ptr<const Packed> packed;
+	// Counted by every wake ahead and Compress(), so a wake ahead asked to compress again before it ran keeps them so.
+	atomic<uint64_t> wakesAhead = 0;
+};
+
+static size_t TextBytes(const vector<string>& lines) {
+	auto bytes = size_t(0);
+	for (const auto& line: lines)
+		bytes += line.size() + 1;
+	return bytes;
+}
+
+static void CompressLines(HibernatedLines::State& state) {
+	lock_guard lock(state.compressing);
+	if (state.woken || state.compressed)
+		return;
+	PROFILE_SCOPE("HibernatedLines::Compress");
+	using Block = HibernatedLines::State::Block;
+	auto blocks = vector<Block>();
+	auto packed = string();
+	auto text = string();
+	const auto& lines = state.lines;
+	for (size_t line = 0; line < lines.size();) {
+		if (state.woken)
+			return;
+		auto first = line;
+		text.clear();
+		for (; line < lines.size() && (text.empty() || text.size() + lines[line].size() < HibernatedLines::blockSize); line++) {
+			text += lines[line];
+			text.push_back('\n');
+		}
+		auto packedStart = packed.size();
+		Compress(text, packed);
+		blocks.push_back(Block {text.size(), packed.size() - packedStart, line - first});
+	}
+	packed.shrink_to_fit();
+	state.bytes = packed.size();
+	state.packed = make_shared<const HibernatedLines::State::Packed>(HibernatedLines::State::Packed {move(blocks), move(packed)});
+	state.lines = {}; // freed here rather than on the UI thread
+	state.compressed = true;
+}
+
+// Splitting a block into lines costs about as much as decompressing it, so both run side by side.
+static bool DecompressLines(const HibernatedLines::State::Packed& packed, ThreadPool& pool, vector<string>& lines) {
+	const auto& blocks = packed.blocks;
+	auto packedStarts = vector<size_t>();
+	auto linesNum = size_t(0), packedStart = size_t(0);
+	for (const auto& block: blocks) {
+		packedStarts.push_back(packedStart);
+		packedStart += block.packedSize;
+		linesNum += block.linesNum;
+	}
+	auto blockLines = vector<vector<string>>(blocks.size());
+	auto failed = atomic<bool>(false);
+	pool.ForEach(blocks.size(), [&](size_t block) {
+		thread_local auto text = string();
+		text.clear();
+		auto blockText = string_view(packed.text).substr(packedStarts[block], blocks[block].packedSize);
+		if (!Decompress(blockText, blocks[block].size, text))
+			failed = true;
+		auto& split = blockLines[block];
+		split.reserve(blocks[block].linesNum);
+		for (size_t start = 0; start < text.size();) {
+			auto end = static_cast<const char *>(memchr(text.data() + start, '\n', text.size() - start));
+			auto length = static_cast<size_t>(end - text.data()) - start;
+			split.emplace_back(text.data() + start, length);
+			start += length + 1;
+		}
+	});
+	lines.clear();
+	lines.reserve(linesNum);
+	for (auto& block: blockLines)
+		move(block.begin(), block.end(), back_inserter(lines));
+	return !failed;
+}
+
+HibernatedLines::~HibernatedLines() {
+	Drop();
+}
+
+void HibernatedLines::Hibernate(vector<string>&& lines) {
+	Drop();
+	state = make_shared<State>();
+	state->bytes = TextBytes(lines);
+	state->lines = move(lines);
+}
+
+void HibernatedLines::Compress(ThreadPool& pool) {
+	if (!state || compressing)
+		return;
+	compressing = true;
+	wakingAhead = false;
+	state->wakesAhead++;
+	pool.Submit(TaskPriority::Background, [state = state]() { CompressLines(*state); });
+}
+
+void HibernatedLines::Drop() {
+	if (state)
+		state->woken = true;
+	state = nullptr;
+	compressing = wakingAhead = false;
+}
+
+void HibernatedLines::Drop(ThreadPool& pool) {
+	if (!state)
+		return;
+	auto dropped = exchange(state, nullptr);
+	compressing = wakingAhead = false;
+	dropped->woken = true;
+	pool.Submit(TaskPriority::Background, [dropped]() {
+		lock_guard lock(dropped->compressing);
+		dropped->lines = {};
+	});
+}
+
+bool HibernatedLines::Wake(ThreadPool& pool, vector<string>& lines) {
+	if (!state)
+		return true;
+	PROFILE_SCOPE("HibernatedLines::Wake");
+	auto woken = exchange(state, nullptr);
+	compressing = wakingAhead = false;
+	woken->woken = true;
+	lock_guard lock(woken->compressing); // waits for the block being compressed, if any
+	if (!woken->compressed) {
+		lines = move(woken->lines);
+		return true;
+	}
+	return DecompressLines(*woken->packed, pool, lines);
+}
+
+function<void()> HibernatedLines::WakeAhead(ThreadPool& pool, function<void(const vector<string>&)> woken) {
+	if (!IsCompressed() || wakingAhead)
+		return nullptr;
+	wakingAhead = true;
+	// Compressing them again is up to the owner once they are woken.
+	compressing = false;
+	return [state = state, &pool, woken = move(woken), wakeAhead = ++state->wakesAhead]() {
+		PROFILE_SCOPE("HibernatedLines::WakeAhead");
+		auto packed = shared_ptr<const State::Packed>();
+		{
+			lock_guard lock(state->compressing);
+			packed = state->packed;
+		}
+		auto lines = vector<string>();
+		if (!packed || state->wakesAhead != wakeAhead || !DecompressLines(*packed, pool, lines))
+			return;
+		auto bytes = TextBytes(lines);
+		if (woken)
+			woken(lines);
+		lock_guard lock(state->compressing);
+		if (state->woken || state->packed != packed || state->wakesAhead != wakeAhead)
+			return;
+		state->lines = move(lines);
+		state->bytes = bytes;
+		state->packed = nullptr;
+		state->compressed = false;
+	};
+}
+
+bool HibernatedLines::IsCompressed() const {
+	return state && state->compressed;
+}
+
+size_t HibernatedLines::Bytes() const {
+	return state ? state->bytes.load() : 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+
+// The lines of a document that is not shown, set aside as they are and, once asked to, compressed in memory (see
+// Compression.h). Compression runs on a ThreadPool a block of about a megabyte of text at a time and looks between
+// blocks whether the lines are wanted back; until it finishes the lines stay as they were, so waking them never waits
+// for more than one block. Blocks hold whole lines, so waking decompresses them side by side on the pool.
+struct HibernatedLines {
+	static constexpr size_t blockSize = 1 << 20;
+
+	~HibernatedLines();
+
+	// Takes `lines`; lines still hibernated are dropped.
+	void Hibernate(std::vector<std::string>&& lines);
+	// Starts compressing the hibernated lines on `pool` as a Background task, unless already started.
+	void Compress(ThreadPool& pool);
+	void Drop();
+	// Drops the lines, freeing them on `pool` as a Background task rather than on this thread.
+	void Drop(ThreadPool& pool);
+	// Moves the lines given to Hibernate() into `lines`, decompressed with the help of `pool`, or as they are when
+	// compression had not finished; leaves `lines` alone when nothing hibernates. Returns false when the compressed
+	// text did not decompress, which leaves the lines of those blocks out.
+	bool Wake(ThreadPool& pool, std::vector<std::string>& lines);
+	// The decompression of compressed lines ahead of Wake(), to run on any thread, e.g. as a job, while the owner goes
+	// on; once it ran, the lines are kept as they are until Compress() is called again, and Wake() only moves them.
+	// Empty when they are not compressed, or are being woken ahead already. `woken` is given the lines once they are,
+	// on the same thread, e.g. to work out what derives from them.
+	std::function<void()> WakeAhead(ThreadPool& pool,
+									std::function<void(const std::vector<std::string>&)> woken = nullptr);
+	bool IsCompressed() const;
+	bool IsCompressing() const { return compressing; } // or compressed
+	// Memory the lines take now: the compressed size once compressed, else the size of the text.
+	size_t Bytes() const;
+
+	// What the compression task shares with the owner; the task keeps it alive past Wake().
+	struct State;
+
+private:
+	std::shared_ptr<State> state;
+	bool compressing = false;
+	bool wakingAhead = false;
+};
@@ -0,0 +1,62 @@
+#include "Jobs.h"
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include "Profiler.h"
+
+using namespace std;
+
+// CancellationSource
+
+CancellationToken CancellationSource::Token() const {
+	auto token = CancellationToken();
+	token.version = version;
+	token.taken = version->load(memory_order_acquire);
+	return token;
+}
+
+void CancellationSource::Cancel() {
+	version->fetch_add(1, memory_order_release);
+}
+
+// Jobs
+
+static mutex completionsMutex;
+static deque<function<void()>> completions;
+// Counted apart from the queue, so a tick with nothing to run does not take the lock.
+static atomic<int> completionsNum = 0;
+
+ThreadPool& JobPool() {
+	// Made after the globals that submit to it, so destroyed before them: their tasks never outlive what they use.
+	static auto pool = ThreadPool();
+	return pool;
+}
+
+void PostCompletion(function<void()> completion) {
+	lock_guard lock(completionsMutex);
+	completions.push_back(move(completion));
+	completionsNum++;
+}
+
+bool RunCompletions(double budget) {
+	if (completionsNum == 0)
+		return false;
+	PROFILE_SCOPE("Jobs::RunCompletions");
+	auto start = chrono::steady_clock::now();
+	auto ran = false;
+	// At least one runs per call, however long it takes, so a slow completion cannot hold up those behind it.
+	while (!ran || chrono::duration<double>(chrono::steady_clock::now() - start).count() < budget) {
+		auto completion = function<void()>();
+		{
+			lock_guard lock(completionsMutex);
+			if (completions.empty())
+				break;
+			completion = move(completions.front());
+			completions.pop_front();
+			completionsNum--;
+		}
+		completion();
+		ran = true;
+	}
+	return ran;
+}
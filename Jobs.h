@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include "ThreadPool.h"
+
+// Background work of the editor. Every feature queues its tasks on one shared ThreadPool with a priority, and a task
+// that has a result for the UI hands it back as a completion; UI::Tick() runs those on the UI thread, so widgets and
+// documents are only ever changed there.
+
+struct CancellationToken;
+
+// A version, e.g. of a document's text: Cancel() moves it on, which cancels every token taken before.
+struct CancellationSource {
+	CancellationToken Token() const;
+	void Cancel();
+
+private:
+	std::shared_ptr<std::atomic<uint64_t>> version = std::make_shared<std::atomic<uint64_t>>(0);
+};
+
+// Cheap to copy and to check from any thread. One made by default is never cancelled.
+struct CancellationToken {
+	bool IsCancelled() const { return version && version->load(std::memory_order_acquire) != taken; }
+
+private:
+	friend struct CancellationSource;
+	std::shared_ptr<const std::atomic<uint64_t>> version;
+	uint64_t taken = 0;
+};
+
+// The pool the editor's features share, a worker per core; started on first use.
+ThreadPool& JobPool();
+
+// Queues `completion` to run on the UI thread. Callable from any thread.
+void PostCompletion(std::function<void()> completion);
+// Runs the completions queued so far for up to about `budget` seconds, leaving the rest for the next call. Returns
+// whether any ran.
+bool RunCompletions(double budget);
+
+// Runs `work` on the JobPool, then `complete` with what it returned on the UI thread. Each is skipped when `token`
+// was cancelled by the time it would run, so a result worked out for a text edited since is dropped, not applied.
+template<typename Work, typename Complete>
+void RunJob(TaskPriority priority, CancellationToken token, Work work, Complete complete) {
+	JobPool().Submit(priority, [token, work = std::move(work), complete = std::move(complete)]() mutable {
+		if (token.IsCancelled())
+			return;
+		auto result = std::make_shared<decltype(work())>(work());
+		PostCompletion([token, result, complete = std::move(complete)]() mutable {
+			if (!token.IsCancelled())
+				complete(std::move(*result));
+		});
+	});
+}
@@ -2,7 +2,9 @@
 #include <fstream>
 #include <sstream>
 #include <cassert>
+#include <algorithm>
 #include "Lexer.h"
+#include "Profiler.h"
 
 using namespace std;
 
@@ -40,7 +42,34 @@ const char *CppLexer::TokenTypeName(int type) const {
 	}
 }
 
+bool CppLexer::IsIdentifier(int type) const {
+	return type == Identifier;
+}
+
+bool CppLexer::IsWhitespace(int type) const {
+	return type == Whitespace;
+}
+
+FoldMark CppLexer::FoldMarkOf(const Token& token) const {
+	switch (token.type) {
+		case Invalid: // braces are not lexed as anything else
+			return token.text == "{" ? FoldMark::Open : token.text == "}" ? FoldMark::Close : FoldMark::None;
+		case BlockComment:
+			return FoldMark::Comment;
+		case Directive: {
+			auto name = token.text.substr(1);
+			name.remove_prefix(min(name.find_first_not_of(" \t"), name.size()));
+			if (name == "if" || name == "ifdef" || name == "ifndef")
+				return FoldMark::ConditionalOpen;
+			return name == "endif" ? FoldMark::ConditionalClose : FoldMark::None;
+		}
+		default:
+			return FoldMark::None;
+	}
+}
+
 void Lexer::Reset() {
+	PROFILE_SCOPE("Lexer::Reset");
 	position = 0;
 	sourceCode.clear();
 	if (lines) {
@@ -56,6 +85,100 @@ void Lexer::Reset() {
 	currentToken = Token();
 }
 
+void Lexer::Reset(const TextPosition& from, const TextPosition& to) {
+	PROFILE_SCOPE("Lexer::Reset(range)");
+	position = 0;
+	sourceCode.clear();
+	if (lines && !lines->empty()) {
+		auto lastLine = min(to.line, static_cast<int>(lines->size()) - 1);
+		for (auto line = from.line; line <= lastLine; line++) {
+			const auto& text = (*lines)[line];
+			auto begin = line == from.line ? min(static_cast<size_t>(from.column), text.size()) : 0;
+			auto end = line == to.line ? min(static_cast<size_t>(to.column), text.size()) : text.size();
+			sourceCode.append(text, begin, end - begin);
+			if (line != to.line)
+				sourceCode.push_back('\n');
+		}
+	}
+	currentToken = Token();
+}
+
+void Lexer::ResetSource(string source) {
+	position = 0;
+	sourceCode = move(source);
+	currentToken = Token();
+}
+
+TextPosition LexerCheckpoints::Before(const TextPosition& position) const {
+	auto verifiedEnd = positions.begin() + static_cast<ptrdiff_t>(verifiedNum);
+	auto next = upper_bound(positions.begin(), verifiedEnd, position);
+	return next == positions.begin() ? TextPosition() : *prev(next);
+}
+
+void LexerCheckpoints::Record(const TextPosition& previous, const TextPosition& position) {
+	auto next = upper_bound(positions.begin(), positions.end(), previous);
+	if (next != positions.end() && *next <= position)
+		return;
+	// Lexing resolved every unverified checkpoint before `position` on the way here.
+	assert(static_cast<size_t>(next - positions.begin()) <= verifiedNum);
+	positions.insert(next, position);
+	verifiedNum++;
+}
+
+bool LexerCheckpoints::Verify(const TextPosition& position) {
+	if (verifiedNum == positions.size())
+		return false;
+	auto passed = positions.begin() + static_cast<ptrdiff_t>(verifiedNum);
+	auto end = passed;
+	while (end != positions.end() && *end < position)
+		++end;
+	positions.erase(passed, end);
+	if (verifiedNum == positions.size() || positions[verifiedNum] != position)
+		return false;
+	if (position < resyncFrom) {
+		verifiedNum++;
+		return false;
+	}
+	verifiedNum = positions.size();
+	return true;
+}
+
+vector<TextPosition> LexerCheckpoints::Verified() const {
+	return vector<TextPosition>(positions.begin(), positions.begin() + static_cast<ptrdiff_t>(verifiedNum));
+}
+
+void LexerCheckpoints::Restore(vector<TextPosition> verified) {
+	positions = move(verified);
+	verifiedNum = positions.size();
+}
+
+void LexerCheckpoints::ApplyEdits(const vector<TextEdit>& edits, const vector<TextPosition>& ends) {
+	if (edits.empty())
+		return;
+	auto hadUnverified = verifiedNum < positions.size();
+	auto first = lower_bound(positions.begin(), positions.end(), edits.front().from);
+	auto unverified = positions.begin() + static_cast<ptrdiff_t>(verifiedNum);
+	// Verified checkpoints in front of still unverified ones were lexed from a different text than those, so
+	// landing on one of them later could not vouch for the rest; only the older ones are kept.
+	if (hadUnverified && first < unverified)
+		first = positions.erase(first, unverified);
+	verifiedNum = min(verifiedNum, static_cast<size_t>(first - positions.begin()));
+
+	// Each checkpoint moves with the last edit before it; ones inside a replaced range are dropped.
+	auto kept = first;
+	size_t edit = 0;
+	for (auto checkpoint = first; checkpoint != positions.end(); ++checkpoint) {
+		while (edit + 1 < edits.size() && edits[edit + 1].from <= *checkpoint)
+			edit++;
+		if (auto moved = MovePosition(*checkpoint, edits[edit], ends[edit]))
+			*kept++ = *moved;
+	}
+	positions.erase(kept, positions.end());
+
+	auto movedResyncFrom = MovePosition(resyncFrom, edits.back(), ends.back());
+	resyncFrom = hadUnverified && movedResyncFrom && *movedResyncFrom > ends.back() ? *movedResyncFrom : ends.back();
+}
+
 void CppLexer::NextToken() {
 	if (position >= sourceCode.size()) {
 		currentToken.type = EOF;
@@ -79,7 +202,7 @@ void CppLexer::NextToken() {
 
 bool CppLexer::TryConsumeWhitespace() {
 	auto startPosition = position;
-	while (position < sourceCode.size() && isspace(sourceCode[position]))
+	while (position < sourceCode.size() && isspace(static_cast<unsigned char>(sourceCode[position])))
 		position++;
 	if (startPosition < position) {
 		currentToken.type = Whitespace;
@@ -96,11 +219,18 @@ static const std::set<std::string_view> keywords = {
 	"true","false","nullptr","nullopt"
 };
 
+// Bytes of multibyte UTF-8 sequences count as letters, so non-ASCII identifiers lex as one token.
+static bool IsIdentifierStart(char c) {
+	auto byte = static_cast<unsigned char>(c);
+	return isalpha(byte) || c == '_' || byte >= 0x80;
+}
+
 bool CppLexer::TryConsumeIdentifierOrKeyword() {
 	auto startPosition = position;
-	if (isalpha(sourceCode[position]) || sourceCode[position] == '_') {
+	if (IsIdentifierStart(sourceCode[position])) {
 		position++;
-		while (position < sourceCode.size() && (isalnum(sourceCode[position]) || sourceCode[position] == '_'))
+		while (position < sourceCode.size() &&
+			   (IsIdentifierStart(sourceCode[position]) || isdigit(static_cast<unsigned char>(sourceCode[position]))))
 			position++;
 		currentToken.text = std::string_view(&sourceCode[startPosition], position - startPosition);
 		currentToken.type = keywords.find(currentToken.text) != keywords.end() ? Keyword : Identifier;
@@ -137,13 +267,12 @@ bool CppLexer::TryConsumeBlockComment() {
 				currentToken.text = std::string_view(&sourceCode[startPosition], position - startPosition);
 				return true;
 			}
-			if (position + 1 >= sourceCode.size()) {
-				currentToken.type = BlockComment;
-				currentToken.text = std::string_view(&sourceCode[startPosition], position + 1 - startPosition);
-				return true;
-			}
 			position++;
 		}
+		// An unterminated comment runs to the end, even when the source ends right after "/*".
+		currentToken.type = BlockComment;
+		currentToken.text = std::string_view(&sourceCode[startPosition], position - startPosition);
+		return true;
 	}
 	return false;
 }
@@ -152,9 +281,9 @@ bool CppLexer::TryConsumeDirective() {
 	if (position < sourceCode.size() && sourceCode[position] == '#') {
 		auto startPosition = position;
 		position++; // skip '#'
-		while (position < sourceCode.size() && isspace(sourceCode[position]))
+		while (position < sourceCode.size() && isspace(static_cast<unsigned char>(sourceCode[position])))
 			position++;
-		while (position < sourceCode.size() && !isspace(sourceCode[position]) && sourceCode[position] != '\n')
+		while (position < sourceCode.size() && !isspace(static_cast<unsigned char>(sourceCode[position])) && sourceCode[position] != '\n')
 			position++;
 		currentToken.type = Directive;
 		currentToken.text = std::string_view(&sourceCode[startPosition], position - startPosition);
@@ -174,7 +303,7 @@ bool CppLexer::TryConsumeString() {
 				currentToken.text = std::string_view(&sourceCode[startPosition], position - startPosition);
 				return true;
 			}
-			if (sourceCode[position] == '\\') {
+			if (sourceCode[position] == '\\' && position + 1 < sourceCode.size()) {
 				position++; // skip escape character
 			}
 			position++;
@@ -1,9 +1,20 @@
 #pragma once
 
+#include <cstdio>
 #include <string>
 #include <string_view>
 #include <memory>
 #include <optional>
+#include <vector>
+#include "TextEdit.h"
+
+// What a token means to code folding (see FoldIndex).
+enum class FoldMark {
+	None,
+	Open, Close, // a brace
+	Comment, // a block comment, folded when it spans lines
+	ConditionalOpen, ConditionalClose, // #if, #ifdef, #ifndef and #endif
+};
 
 struct Token {
 	int type = EOF;
@@ -17,14 +28,26 @@ struct Lexer {
 
 	virtual ~Lexer() = default;
 	virtual void Reset();
+	// Lexes only the text in [from, to); `from` has to be where a token starts (see LexerCheckpoints).
+	virtual void Reset(const TextPosition& from, const TextPosition& to);
+	// Lexes `source` instead of the lines, e.g. a whole file read from disk.
+	void ResetSource(std::string source);
 	virtual void NextToken() {}
 	virtual const char *TokenTypeName(int type) const { return "Unknown"; }
+	// Whether tokens of `type` are names worth indexing (see SymbolIndex).
+	virtual bool IsIdentifier(int type) const { return false; }
+	// Whether tokens of `type` are only whitespace, so that lexing may as well start inside one.
+	virtual bool IsWhitespace(int type) const { return false; }
+	virtual FoldMark FoldMarkOf(const Token& token) const { return FoldMark::None; }
 };
 
 struct CppLexer : public Lexer {
 
 	void NextToken() override;
 	const char *TokenTypeName(int type) const override;
+	bool IsIdentifier(int type) const override;
+	bool IsWhitespace(int type) const override;
+	FoldMark FoldMarkOf(const Token& token) const override;
 
 	bool TryConsumeWhitespace();
 	bool TryConsumeIdentifierOrKeyword();
@@ -34,3 +57,31 @@ struct CppLexer : public Lexer {
 	bool TryConsumeString();
 	bool TryConsumeCharLiteral();
 };
+
+// Positions where a token is known to start, recorded while lexing. The lexers keep no state between tokens,
+// so lexing can resume at any of them instead of at the top of the document.
+//
+// Edits shift the checkpoints behind them instead of dropping them. Those are unverified until lexing from a
+// verified one reaches them: the one it lands on is a token start again and the ones it skips are dropped. Once it
+// lands on one behind every edit made since, the tokens from there on are the same as before the edits, so all the
+// remaining ones are verified at once.
+struct LexerCheckpoints {
+	static const int spacing = 16 * 1024; // bytes lexed between two recorded checkpoints
+
+	std::vector<TextPosition> positions; // sorted
+	size_t verifiedNum = 0; // positions[0, verifiedNum) are verified
+	TextPosition resyncFrom; // end of the furthest edit made while some checkpoints were unverified
+
+	// The last verified checkpoint at or before `position`, or the start of the document.
+	TextPosition Before(const TextPosition& position) const;
+	// Adds `position`, reached by lexing, unless a checkpoint already exists after `previous` and at or before it.
+	void Record(const TextPosition& previous, const TextPosition& position);
+	// Called at every token start while lexing; returns true when that verified all the remaining checkpoints.
+	bool Verify(const TextPosition& position);
+	// Moves the checkpoints along with an edit; `ends` is what ApplyEdits() returned for `edits`.
+	void ApplyEdits(const std::vector<TextEdit>& edits, const std::vector<TextPosition>& ends);
+	void Clear() { positions.clear(); verifiedNum = 0; }
+	// The verified checkpoints, to be given back to Restore() for the same text, e.g. in a later session.
+	std::vector<TextPosition> Verified() const;
+	void Restore(std::vector<TextPosition> verified);
+};
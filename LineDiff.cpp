@@ -0,0 +1,394 @@
+#include "LineDiff.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+using namespace std;
+
+static const int foregroundLines = 20'000; // baseline and document lines of a dirty hunk that are diffed right away
+static const int myersLines = 1'000; // gaps this small go to Myers directly
+static const int myersMaxCost = 1'000; // larger gaps without anchors count as replaced past this many differing lines
+static const int maxAnchorOccurrences = 64;
+
+using Match = pair<int, int>; // baseline line, document line
+
+static uint64_t HashLine(const string& line) {
+	return hash<string_view>()(line);
+}
+
+// Myers' greedy O(ND) algorithm; appends the matching lines of the shortest edit, or returns false when more than
+// `maxCost` lines differ.
+static bool Myers(const uint64_t *a, int n, const uint64_t *b, int m, Match offset, int maxCost, vector<Match>& matches) {
+	auto limit = min(n + m, maxCost);
+	auto v = vector<int>(2 * static_cast<size_t>(limit) + 3, 0);
+	auto at = [&](int k) { return static_cast<size_t>(k + limit + 1); };
+	// The furthest points of every step, from diagonal -d - 1 to d + 1, to walk the path back.
+	auto trace = vector<int>();
+	auto traceStarts = vector<size_t>();
+	for (auto d = 0; d <= limit; d++) {
+		traceStarts.push_back(trace.size());
+		trace.insert(trace.end(), v.begin() + static_cast<ptrdiff_t>(at(-d - 1)), v.begin() + static_cast<ptrdiff_t>(at(d + 1) + 1));
+		for (auto k = -d; k <= d; k += 2) {
+			auto x = k == -d || (k != d && v[at(k - 1)] < v[at(k + 1)]) ? v[at(k + 1)] : v[at(k - 1)] + 1;
+			auto y = x - k;
+			while (x < n && y < m && a[x] == b[y])
+				x++, y++;
+			v[at(k)] = x;
+			if (x < n || y < m)
+				continue;
+
+			auto first = matches.size();
+			for (auto step = d; step > 0; step--) {
+				auto previous = [&](int k) { return trace[traceStarts[step] + static_cast<size_t>(k + step + 1)]; };
+				auto stepK = x - y;
+				auto previousK = stepK == -step || (stepK != step && previous(stepK - 1) < previous(stepK + 1)) ? stepK + 1 : stepK - 1;
+				auto previousX = previous(previousK), previousY = previousX - previousK;
+				for (; x > previousX && y > previousY; x--, y--)
+					matches.push_back({offset.first + x - 1, offset.second + y - 1});
+				x = previousX;
+				y = previousY;
+			}
+			for (; x > 0 && y > 0; x--, y--)
+				matches.push_back({offset.first + x - 1, offset.second + y - 1});
+			reverse(matches.begin() + static_cast<ptrdiff_t>(first), matches.end());
+			return true;
+		}
+	}
+	return false;
+}
+
+// Lines that occur as often in both ranges, at most `maxOccurrences` times, the k-th occurrence in `a` paired with
+// the k-th in `b`; then the longest run of them that is in the same order on both sides. Returns how many lines of
+// `b` occur in `a` at all.
+static int FindAnchors(const uint64_t *a, int a0, int a1, const uint64_t *b, int b0, int b1, int maxOccurrences,
+						vector<Match>& anchors) {
+	struct Occurrences {
+		int inA = 0, inB = 0;
+		int nextInB = -1; // the next occurrence in `b` to pair
+	};
+	auto occurrences = unordered_map<uint64_t, Occurrences>();
+	occurrences.reserve(static_cast<size_t>(a1 - a0));
+	for (auto i = a0; i < a1; i++)
+		occurrences[a[i]].inA++;
+	// The occurrences of a line in `b` are chained in order through `laterInB`.
+	auto laterInB = vector<int>(static_cast<size_t>(b1 - b0), -1);
+	auto shared = 0;
+	for (auto i = b1 - 1; i >= b0; i--)
+		if (auto found = occurrences.find(b[i]); found != occurrences.end()) {
+			shared++;
+			found->second.inB++;
+			laterInB[i - b0] = found->second.nextInB;
+			found->second.nextInB = i;
+		}
+	auto candidates = vector<Match>();
+	for (auto i = a0; i < a1; i++)
+		if (auto& found = occurrences[a[i]]; found.inA == found.inB && found.inA <= maxOccurrences) {
+			candidates.push_back({i, found.nextInB});
+			found.nextInB = laterInB[found.nextInB - b0];
+		}
+
+	// Patience sorting: `tails[k]` ends the best run of length k + 1 found so far.
+	auto tails = vector<int>(), previous = vector<int>(candidates.size(), -1);
+	for (auto i = 0; i < static_cast<int>(candidates.size()); i++) {
+		auto tail = lower_bound(tails.begin(), tails.end(), candidates[i].second,
+								[&](int candidate, int line) { return candidates[candidate].second < line; });
+		if (tail != tails.begin())
+			previous[i] = *prev(tail);
+		if (tail == tails.end())
+			tails.push_back(i);
+		else
+			*tail = i;
+	}
+	anchors.clear();
+	for (auto i = tails.empty() ? -1 : tails.back(); i >= 0; i = previous[i])
+		anchors.push_back(candidates[i]);
+	reverse(anchors.begin(), anchors.end());
+	return shared;
+}
+
+// Matching lines of `a` and `b`, sorted.
+static void DiffLines(const uint64_t *a, int n, const uint64_t *b, int m, vector<Match>& matches,
+					  const atomic<bool> *cancelled = nullptr) {
+	struct Range {
+		int a0, a1, b0, b1;
+	};
+	auto ranges = vector<Range> {{0, n, 0, m}};
+	auto anchors = vector<Match>();
+	while (!ranges.empty() && !(cancelled && *cancelled)) {
+		auto range = ranges.back();
+		ranges.pop_back();
+		for (; range.a0 < range.a1 && range.b0 < range.b1 && a[range.a0] == b[range.b0]; range.a0++, range.b0++)
+			matches.push_back({range.a0, range.b0});
+		for (; range.a0 < range.a1 && range.b0 < range.b1 && a[range.a1 - 1] == b[range.b1 - 1]; range.a1--, range.b1--)
+			matches.push_back({range.a1 - 1, range.b1 - 1});
+		auto sizeA = range.a1 - range.a0, sizeB = range.b1 - range.b0;
+		if (sizeA == 0 || sizeB == 0)
+			continue;
+		if (sizeA + sizeB <= myersLines) {
+			Myers(a + range.a0, sizeA, b + range.b0, sizeB, {range.a0, range.b0}, sizeA + sizeB, matches);
+			continue;
+		}
+		// Lines unique on both sides make the best anchors; repeated ones do for files without such lines.
+		if (FindAnchors(a, range.a0, range.a1, b, range.b0, range.b1, 1, anchors) == 0)
+			continue; // nothing in common
+		if (anchors.empty())
+			FindAnchors(a, range.a0, range.a1, b, range.b0, range.b1, maxAnchorOccurrences, anchors);
+		if (anchors.empty()) {
+			Myers(a + range.a0, sizeA, b + range.b0, sizeB, {range.a0, range.b0}, myersMaxCost, matches);
+			continue;
+		}
+		auto previous = Match {range.a0 - 1, range.b0 - 1};
+		for (const auto& anchor: anchors) {
+			ranges.push_back({previous.first + 1, anchor.first, previous.second + 1, anchor.second});
+			matches.push_back(anchor);
+			previous = anchor;
+		}
+		ranges.push_back({previous.first + 1, range.a1, previous.second + 1, range.b1});
+	}
+	sort(matches.begin(), matches.end());
+}
+
+// The runs between matches of an `n` by `m` diff as hunks, moved by `offset`.
+static void AppendHunks(const vector<Match>& matches, int n, int m, Match offset, vector<LineDiff::Hunk>& hunks) {
+	auto previous = Match {-1, -1};
+	auto addUpTo = [&](const Match& next) {
+		if (next.first - previous.first > 1 || next.second - previous.second > 1) {
+			auto hunk = LineDiff::Hunk();
+			hunk.from[LineDiff::Baseline] = offset.first + previous.first + 1;
+			hunk.from[LineDiff::Buffer] = offset.second + previous.second + 1;
+			hunk.count[LineDiff::Baseline] = next.first - previous.first - 1;
+			hunk.count[LineDiff::Buffer] = next.second - previous.second - 1;
+			hunks.push_back(hunk);
+		}
+		previous = next;
+	};
+	for (const auto& match: matches)
+		addUpTo(match);
+	addUpTo({n, m});
+}
+
+// LineDiff
+
+LineDiff::~LineDiff() {
+	CancelJob();
+}
+
+vector<uint64_t> LineDiff::HashLines(const vector<string>& lines) {
+	PROFILE_SCOPE("LineDiff::HashLines");
+	auto hashes = vector<uint64_t>(lines.size());
+	for (size_t i = 0; i < lines.size(); i++)
+		hashes[i] = HashLine(lines[i]);
+	return hashes;
+}
+
+void LineDiff::Reset(Side side, const vector<string>& lines, vector<uint64_t> hashes) {
+	PROFILE_SCOPE("LineDiff::Reset");
+	CancelJob();
+	this->lines[side] = &lines;
+	this->hashes[side] = hashes.size() == lines.size() ? move(hashes) : HashLines(lines);
+	MarkAllDirty();
+}
+
+void LineDiff::MarkSaved() {
+	CancelJob();
+	hashes[Baseline] = hashes[Buffer];
+	hunks.clear();
+	dirtyNum = 0;
+}
+
+void LineDiff::MarkAllDirty() {
+	hunks = {DirtyHunk(0, LinesNum(Baseline), 0, LinesNum(Buffer))};
+	dirtyNum = 1;
+}
+
+LineDiff::Hunk LineDiff::DirtyHunk(int baselineFrom, int baselineCount, int bufferFrom, int bufferCount) {
+	auto hunk = Hunk();
+	hunk.from[Baseline] = baselineFrom;
+	hunk.count[Baseline] = baselineCount;
+	hunk.from[Buffer] = bufferFrom;
+	hunk.count[Buffer] = bufferCount;
+	hunk.dirty = true;
+	hunk.id = nextId++;
+	return hunk;
+}
+
+void LineDiff::ApplyLineChanges(Side side, const vector<string>& lines, const vector<LineChange>& changes) {
+	if (changes.empty())
+		return;
+	this->lines[side] = &lines;
+	::ApplyLineChanges(hashes[side], changes, uint64_t(0));
+	for (const auto& change: changes)
+		for (auto line = change.line; line < change.line + change.addedLines; line++)
+			hashes[side][line] = HashLine(lines[line]);
+	Sweep(side, changes);
+}
+
+// Merges the changes into the hunks in one pass: every group of hunks and changes that overlap or touch becomes
+// one dirty hunk, and the hunks in between only move.
+void LineDiff::Sweep(Side side, const vector<LineChange>& changes) {
+	auto other = side == Baseline ? Buffer : Baseline;
+	// The changes in the lines from before all of them; ApplyEdits reports them in document order.
+	struct Span {
+		int from, removed, added;
+	};
+	auto spans = vector<Span>();
+	spans.reserve(changes.size());
+	auto delta = 0;
+	for (const auto& change: changes) {
+		auto from = change.line - delta;
+		if (!spans.empty() && from < spans.back().from + spans.back().removed) {
+			for (const auto& single: changes)
+				Sweep(side, vector<LineChange> {single});
+			return;
+		}
+		spans.push_back({from, change.removedLines, change.addedLines});
+		delta += change.addedLines - change.removedLines;
+	}
+
+	auto end = [&](const Hunk& hunk) { return hunk.from[side] + hunk.count[side]; };
+	auto merged = vector<Hunk>();
+	merged.reserve(hunks.size() + spans.size());
+	size_t h = 0, i = 0;
+	auto offset = 0; // from a line of `side` to the same line of `other`, past the hunks so far
+	auto shift = 0; // lines added by the changes so far
+	auto passHunk = [&]() {
+		auto& hunk = hunks[h++];
+		offset = hunk.from[other] + hunk.count[other] - end(hunk);
+		return hunk;
+	};
+	while (i < spans.size()) {
+		while (h < hunks.size() && end(hunks[h]) < spans[i].from) {
+			merged.push_back(passHunk());
+			merged.back().from[side] += shift;
+		}
+		auto groupFrom = spans[i].from, otherFrom = groupFrom + offset;
+		if (h < hunks.size() && hunks[h].from[side] < groupFrom) {
+			groupFrom = hunks[h].from[side];
+			otherFrom = hunks[h].from[other];
+		}
+		auto groupEnd = groupFrom, groupShift = 0;
+		for (auto grew = true; grew;) {
+			grew = false;
+			for (; i < spans.size() && spans[i].from <= groupEnd; i++, grew = true) {
+				groupEnd = max(groupEnd, spans[i].from + spans[i].removed);
+				groupShift += spans[i].added - spans[i].removed;
+			}
+			for (; h < hunks.size() && hunks[h].from[side] <= groupEnd; grew = true) {
+				groupEnd = max(groupEnd, end(hunks[h]));
+				const auto& hunk = passHunk();
+				dirtyNum -= hunk.dirty;
+				if (hunk.dirty && hunk.id == job.hunkId)
+					cancelled = true; // its result would be dropped
+			}
+		}
+		auto hunk = side == Buffer
+					? DirtyHunk(otherFrom, groupEnd + offset - otherFrom, groupFrom + shift, groupEnd - groupFrom + groupShift)
+					: DirtyHunk(groupFrom + shift, groupEnd - groupFrom + groupShift, otherFrom, groupEnd + offset - otherFrom);
+		merged.push_back(hunk);
+		dirtyNum++;
+		shift += groupShift;
+	}
+	while (h < hunks.size()) {
+		merged.push_back(passHunk());
+		merged.back().from[side] += shift;
+	}
+	hunks = move(merged);
+}
+
+bool LineDiff::Update() {
+	auto changed = TakeJobResult();
+	if (dirtyNum == 0)
+		return changed;
+	PROFILE_SCOPE("LineDiff::Update");
+	auto updated = vector<Hunk>();
+	updated.reserve(hunks.size());
+	auto matches = vector<Match>();
+	for (auto hunk: hunks) {
+		if (!hunk.dirty) {
+			updated.push_back(hunk);
+			continue;
+		}
+		// Lines in common at both ends are skipped right away, even when the hunk spans a whole file.
+		auto a = hashes[Baseline].data() + hunk.from[Baseline], b = hashes[Buffer].data() + hunk.from[Buffer];
+		auto n = hunk.count[Baseline], m = hunk.count[Buffer];
+		auto same = [&](int i, int j) {
+			return a[i] == b[j] && (*lines[Baseline])[hunk.from[Baseline] + i] == (*lines[Buffer])[hunk.from[Buffer] + j];
+		};
+		auto head = 0, tail = 0;
+		while (head < n && head < m && same(head, head))
+			head++;
+		while (tail < n - head && tail < m - head && same(n - 1 - tail, m - 1 - tail))
+			tail++;
+		hunk.from[Baseline] += head;
+		hunk.from[Buffer] += head;
+		hunk.count[Baseline] -= head + tail;
+		hunk.count[Buffer] -= head + tail;
+		changed = changed || head + tail > 0;
+		if (hunk.count[Baseline] + hunk.count[Buffer] > foregroundLines) {
+			updated.push_back(hunk);
+			continue;
+		}
+		matches.clear();
+		DiffLines(a + head, hunk.count[Baseline], b + head, hunk.count[Buffer], matches);
+		AppendConfirmedHunks(matches, hunk, updated);
+		dirtyNum--;
+		changed = true;
+	}
+	hunks = move(updated);
+
+	if (dirtyNum > 0 && !worker.joinable()) {
+		const auto& hunk = *find_if(hunks.begin(), hunks.end(), [](const Hunk& hunk) { return hunk.dirty; });
+		job.hunkId = hunk.id;
+		for (auto side: {Baseline, Buffer}) {
+			auto first = hashes[side].begin() + hunk.from[side];
+			job.lines[side].assign(first, first + hunk.count[side]);
+		}
+		job.matches.clear();
+		jobDone = false;
+		cancelled = false;
+		worker = thread([this]() {
+			PROFILE_SCOPE("LineDiff::Background");
+			auto n = static_cast<int>(job.lines[Baseline].size()), m = static_cast<int>(job.lines[Buffer].size());
+			DiffLines(job.lines[Baseline].data(), n, job.lines[Buffer].data(), m, job.matches, &cancelled);
+			jobDone = true;
+		});
+	}
+	return changed;
+}
+
+bool LineDiff::TakeJobResult() {
+	if (!worker.joinable() || !jobDone)
+		return false;
+	worker.join();
+	// An edit merged the hunk into another one meanwhile; that one is diffed anew.
+	auto hunk = find_if(hunks.begin(), hunks.end(), [&](const Hunk& hunk) { return hunk.dirty && hunk.id == job.hunkId; });
+	if (hunk == hunks.end())
+		return false;
+	// Its lines are as they were when the job began, or an edit would have merged it away.
+	auto result = vector<Hunk>();
+	AppendConfirmedHunks(job.matches, *hunk, result);
+	hunk = hunks.erase(hunk);
+	hunks.insert(hunk, result.begin(), result.end());
+	dirtyNum--;
+	return true;
+}
+
+// The hunks between `matches` of `hunk`, once those paired up by a mere hash collision are dropped.
+void LineDiff::AppendConfirmedHunks(vector<Match>& matches, const Hunk& hunk, vector<Hunk>& to) const {
+	const auto& a = *lines[Baseline];
+	const auto& b = *lines[Buffer];
+	erase_if(matches, [&](const Match& match) {
+		return a[hunk.from[Baseline] + match.first] != b[hunk.from[Buffer] + match.second];
+	});
+	AppendHunks(matches, hunk.count[Baseline], hunk.count[Buffer], {hunk.from[Baseline], hunk.from[Buffer]}, to);
+}
+
+void LineDiff::CancelJob() {
+	if (!worker.joinable())
+		return;
+	cancelled = true;
+	worker.join();
+	jobDone = false;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "TextEdit.h"
+
+// Line-level differences between a document and its saved version, the baseline, kept up to date while the
+// document is edited. Lines are compared by 64-bit hash, so each is hashed once when it changes; the lines a diff
+// pairs up are then compared by text, so two lines that only share a hash still count as changed.
+//
+// An edit only marks the hunks it touches as dirty, and Update rediffs just those. Lines both sides start or end
+// with are skipped first. Lines that occur once on each side then anchor the rest (patience diff: the longest run
+// of anchors in the same order), and the gaps between anchors go to Myers' O(ND) algorithm once they are small.
+// A dirty hunk too large for one frame is diffed on a background thread; edits elsewhere go on meanwhile.
+struct LineDiff {
+
+	enum Side { Baseline = 0, Buffer = 1 };
+
+	// `count[Baseline]` lines from `from[Baseline]` on became `count[Buffer]` lines from `from[Buffer]` on. Hunks are
+	// sorted and separated by at least one unchanged line.
+	struct Hunk {
+		int from[2] = {0, 0};
+		int count[2] = {0, 0};
+		bool dirty = false; // its lines were edited since it was diffed
+		uint64_t id = 0;
+	};
+
+	~LineDiff();
+
+	// The hashes Reset() takes of `lines`, to be worked out ahead on any thread or kept from an earlier diff.
+	static std::vector<uint64_t> HashLines(const std::vector<std::string>& lines);
+	// Takes new contents for one side, e.g. the baseline after a file was loaded; everything is rediffed. `lines`
+	// is read again by Update, so it must stay where it is, and be passed again after every change. `hashes` are
+	// used when they are HashLines(lines) and the lines are hashed here otherwise.
+	void Reset(Side side, const std::vector<std::string>& lines, std::vector<uint64_t> hashes = {});
+	// After a save: the document is the new baseline.
+	void MarkSaved();
+	// Keeps one side in step after its lines were changed by ApplyEdits; only the touched hunks become dirty.
+	void ApplyLineChanges(Side side, const std::vector<std::string>& lines, const std::vector<LineChange>& changes);
+	// Rediffs the dirty hunks. Returns whether the hunks changed, e.g. because a background diff finished.
+	bool Update();
+	// Dirty hunks are left, being diffed in the background.
+	bool IsBusy() const { return dirtyNum > 0; }
+
+	const std::vector<Hunk>& Hunks() const { return hunks; }
+	const std::vector<uint64_t>& Hashes(Side side) const { return hashes[side]; }
+	int LinesNum(Side side) const { return static_cast<int>(hashes[side].size()); }
+
+private:
+	struct Job {
+		uint64_t hunkId = 0;
+		std::vector<uint64_t> lines[2];
+		std::vector<std::pair<int, int>> matches; // relative to the start of the hunk, not yet compared by text
+	};
+
+	std::vector<uint64_t> hashes[2];
+	const std::vector<std::string> *lines[2] = {nullptr, nullptr};
+	std::vector<Hunk> hunks;
+	int dirtyNum = 0;
+	uint64_t nextId = 1;
+	std::thread worker;
+	std::atomic<bool> jobDone = false;
+	std::atomic<bool> cancelled = false;
+	Job job;
+
+	Hunk DirtyHunk(int baselineFrom, int baselineCount, int bufferFrom, int bufferCount);
+	void MarkAllDirty();
+	void Sweep(Side side, const std::vector<LineChange>& changes);
+	void CancelJob();
+	void AppendConfirmedHunks(std::vector<std::pair<int, int>>& matches, const Hunk& hunk, std::vector<Hunk>& to) const;
+	bool TakeJobResult();
+};
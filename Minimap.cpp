@@ -0,0 +1,140 @@
+#include "Minimap.h"
+#include "Profiler.h"
+#include <algorithm>
+
+using namespace std;
+
+static const int typesNum = 16; // token types told apart; CppLexer has 12
+
+static MinimapSummary::Row Merge(const MinimapSummary::Row& first, const MinimapSummary::Row& second) {
+	auto merged = MinimapSummary::Row();
+	for (auto i = 0; i < MinimapSummary::buckets; i++) {
+		merged.density[i] = static_cast<uint8_t>((first.density[i] + second.density[i] + 1) / 2);
+		merged.type[i] = first.density[i] >= second.density[i] ? first.type[i] : second.type[i];
+	}
+	return merged;
+}
+
+MinimapSummary::MinimapSummary() {
+	Reset(0);
+}
+
+void MinimapSummary::Reset(int linesNum) {
+	levels.assign(1, vector<Row>(static_cast<size_t>(linesNum)));
+	while (levels.back().size() > 1)
+		levels.emplace_back((levels.back().size() + 1) / 2);
+	sweepLine = 0;
+	staleFrom = staleTo = 0;
+	generation++;
+}
+
+void MinimapSummary::ApplyLineChanges(const vector<string>& lines, const vector<LineChange>& changes, Lexer *lexer) {
+	if (changes.empty())
+		return;
+	auto countChanged = false;
+	for (const auto& change: changes)
+		countChanged = countChanged || change.removedLines != change.addedLines;
+
+	::ApplyLineChanges(levels.front(), changes, Row());
+	for (const auto& change: changes) {
+		for (auto line = change.line; line < change.line + change.addedLines; line++)
+			Summarize(lines, line, lexer);
+		if (change.line < sweepLine)
+			sweepLine = max(change.line, sweepLine + change.addedLines - change.removedLines);
+		if (!countChanged)
+			MarkStale(change.line, change.line + change.addedLines);
+	}
+	if (countChanged) {
+		// Every row after the first change moved, so each level above is merged anew from there.
+		for (size_t level = 1; level < levels.size() || levels.back().size() > 1; level++) {
+			if (level == levels.size())
+				levels.emplace_back();
+			levels[level].resize((levels[level - 1].size() + 1) / 2);
+		}
+		while (levels.size() > 1 && levels[levels.size() - 2].size() <= 1)
+			levels.pop_back();
+		MarkStale(changes.front().line, LinesNum());
+	}
+	generation++;
+}
+
+bool MinimapSummary::Sweep(const vector<string>& lines, Lexer *lexer, int budget) {
+	auto end = min(LinesNum(), sweepLine + budget);
+	if (sweepLine < end) {
+		PROFILE_SCOPE("MinimapSummary::Sweep");
+		for (auto line = sweepLine; line < end; line++)
+			Summarize(lines, line, lexer);
+		MarkStale(sweepLine, end);
+		sweepLine = end;
+		generation++;
+	}
+	UpdateLevels();
+	return IsSweeping();
+}
+
+void MinimapSummary::Summarize(const vector<string>& lines, int line, Lexer *lexer) {
+	const auto& text = lines[line];
+	auto length = min(static_cast<int>(text.size()), columns);
+	auto& row = levels.front()[line];
+	row = Row();
+	if (length == 0)
+		return;
+
+	uint8_t cells[buckets][typesNum] = {}; // text bytes of each bucket by token type
+	auto count = [&](int from, int to, int type) {
+		for (auto column = from; column < to; column++)
+			if (static_cast<unsigned char>(text[column]) > ' ')
+				cells[column / bucketColumns][type]++;
+	};
+	if (lexer) {
+		lexer->lines = const_cast<vector<string> *>(&lines);
+		lexer->Reset(TextPosition {line, 0}, TextPosition {line, length});
+		auto column = 0;
+		for (lexer->NextToken(); lexer->currentToken.type != EOF && column < length; lexer->NextToken()) {
+			auto size = static_cast<int>(lexer->currentToken.text.size());
+			count(column, min(column + size, length), clamp(lexer->currentToken.type, 0, typesNum - 1));
+			column += size;
+		}
+	}
+	else
+		count(0, length, 0);
+
+	for (auto bucket = 0; bucket < buckets; bucket++) {
+		auto total = 0, best = 0;
+		for (auto type = 0; type < typesNum; type++) {
+			total += cells[bucket][type];
+			if (cells[bucket][type] > cells[bucket][best])
+				best = type;
+		}
+		row.density[bucket] = static_cast<uint8_t>(total * 255 / bucketColumns);
+		row.type[bucket] = static_cast<int8_t>(best);
+	}
+}
+
+void MinimapSummary::MarkStale(int from, int to) {
+	if (staleFrom >= staleTo) {
+		staleFrom = from;
+		staleTo = to;
+	}
+	else {
+		staleFrom = min(staleFrom, from);
+		staleTo = max(staleTo, to);
+	}
+}
+
+void MinimapSummary::UpdateLevels() {
+	if (staleFrom >= staleTo)
+		return;
+	PROFILE_SCOPE("MinimapSummary::UpdateLevels");
+	auto from = static_cast<size_t>(staleFrom), to = min(static_cast<size_t>(staleTo), levels.front().size());
+	for (size_t level = 1; level < levels.size(); level++) {
+		// The parents of rows [from, to) below.
+		from /= 2;
+		to = (to + 1) / 2;
+		const auto& below = levels[level - 1];
+		auto& rows = levels[level];
+		for (auto i = from; i < min(to, rows.size()); i++)
+			rows[i] = 2 * i + 1 < below.size() ? Merge(below[2 * i], below[2 * i + 1]) : below[2 * i];
+	}
+	staleFrom = staleTo = 0;
+}
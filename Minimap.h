@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Lexer.h"
+#include "TextEdit.h"
+
+// What a minimap shows of every line, at every scale. Level 0 has a row per line: for each bucket of columns, how
+// much of it is text and which token type most of that text is. Each level above merges pairs of rows of the one
+// below, so a million lines fit a few hundred pixels with every row summarized once.
+//
+// Lines are lexed on their own, the first `columns` bytes only, so the colors are an approximation: a line inside a
+// block comment shows as code. An edit resummarizes just its lines; the levels above are patched along the edited
+// rows, or from the first edited row on when lines were added or removed.
+struct MinimapSummary {
+	static constexpr int buckets = 16;
+	static constexpr int bucketColumns = 8;
+	static constexpr int columns = buckets * bucketColumns;
+
+	struct Row {
+		uint8_t density[buckets] = {}; // 255 when every byte of the bucket is text
+		int8_t type[buckets] = {}; // token type of most of the bucket's text
+	};
+
+	int LinesNum() const { return static_cast<int>(levels.front().size()); }
+	int LevelsNum() const { return static_cast<int>(levels.size()); }
+	int RowsNum(int level) const { return static_cast<int>(levels[level].size()); }
+	// Summarizes lines [index << level, (index + 1) << level).
+	const Row& At(int level, int index) const { return levels[level][index]; }
+	// Changes whenever any row does.
+	uint64_t Generation() const { return generation; }
+	bool IsSweeping() const { return sweepLine < LinesNum(); }
+
+	MinimapSummary();
+	// Every line is summarized anew, a slice at a time by Sweep().
+	void Reset(int linesNum);
+	// Summarizes the changed lines right away and the levels above them on the next Sweep(); `lexer` may be null.
+	void ApplyLineChanges(const std::vector<std::string>& lines, const std::vector<LineChange>& changes, Lexer *lexer);
+	// Summarizes up to `budget` lines not summarized since Reset() and brings the levels above up to date. Returns
+	// whether lines are left.
+	bool Sweep(const std::vector<std::string>& lines, Lexer *lexer, int budget);
+
+private:
+	std::vector<std::vector<Row>> levels;
+	int sweepLine = 0;
+	// Level 0 rows whose ancestors are out of date.
+	int staleFrom = 0, staleTo = 0;
+	uint64_t generation = 0;
+
+	void Summarize(const std::vector<std::string>& lines, int line, Lexer *lexer);
+	void MarkStale(int from, int to);
+	void UpdateLevels();
+};
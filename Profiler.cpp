@@ -0,0 +1,205 @@
+#include "Profiler.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+namespace Profiler {
+
+	static const size_t eventsPerThread = 1 << 16;
+	static const size_t framesKept = 1024;
+
+	struct ThreadBuffer {
+		int threadId = 0;
+		array<Event, eventsPerThread> events;
+		atomic<uint64_t> head = 0;
+	};
+
+	// Buffers are never freed so that events of finished threads still end up in the trace.
+	static mutex buffersMutex;
+	static vector<unique_ptr<ThreadBuffer>> buffers;
+	static thread_local ThreadBuffer *threadBuffer = nullptr;
+
+	static const auto startTime = chrono::steady_clock::now();
+
+	static array<float, framesKept> frameTimes;
+	static uint64_t framesRecorded = 0;
+	static int64_t frameBegin = 0;
+
+	thread_local const char *currentScope = nullptr;
+
+	// Allocations. Those per frame are only touched by the thread running the frames; a frame's are counted from
+	// its BeginFrame() to the next one, so what happens after it is drawn counts too.
+	static atomic<uint64_t> allocationCount = 0;
+	static atomic<uint64_t> allocatedBytes = 0;
+	static atomic<uint64_t> freeCount = 0;
+	static thread_local bool isFrameThread = false;
+	static bool frameStarted = false, frameDrawn = false;
+	static Allocations frameAllocations, lastFrameAllocations, lastIdleFrameAllocations;
+	static array<ScopeAllocations, allocationScopesNum> frameScopes, lastFrameScopes;
+	static int frameScopesNum = 0, lastFrameScopesNum = 0;
+	static array<uint64_t, framesKept> frameAllocationCounts;
+	static uint64_t frameAllocationsRecorded = 0;
+
+	int64_t Now() {
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - startTime).count();
+	}
+
+	static ThreadBuffer& CurrentThreadBuffer() {
+		if (!threadBuffer) {
+			lock_guard lock(buffersMutex);
+			buffers.emplace_back(make_unique<ThreadBuffer>());
+			buffers.back()->threadId = static_cast<int>(buffers.size());
+			threadBuffer = buffers.back().get();
+		}
+		return *threadBuffer;
+	}
+
+	void Record(const char *name, int64_t begin, int64_t end) {
+		auto& buffer = CurrentThreadBuffer();
+		auto head = buffer.head.load(memory_order_relaxed);
+		buffer.events[head % eventsPerThread] = Event {name, begin, end};
+		buffer.head.store(head + 1, memory_order_release);
+	}
+
+	void BeginFrame() {
+		isFrameThread = true;
+		if (frameDrawn) {
+			lastFrameAllocations = frameAllocations;
+			lastFrameScopes = frameScopes;
+			lastFrameScopesNum = frameScopesNum;
+			frameAllocationCounts[frameAllocationsRecorded++ % framesKept] = frameAllocations.count;
+		}
+		else if (frameStarted)
+			lastIdleFrameAllocations = frameAllocations;
+		frameStarted = true;
+		frameDrawn = false;
+		frameAllocations = Allocations();
+		frameScopesNum = 0;
+		frameBegin = Now();
+	}
+
+	void EndFrame() {
+		auto end = Now();
+		Record("Frame", frameBegin, end);
+		frameTimes[framesRecorded % framesKept] = static_cast<float>(end - frameBegin) / 1e6f;
+		framesRecorded++;
+		frameDrawn = true;
+	}
+
+	int FrameCount() {
+		return static_cast<int>(min<uint64_t>(framesRecorded, framesKept));
+	}
+
+	// Sorted in place of a copy, so that the overlay showing them allocates nothing more.
+	template<typename T>
+	static T Percentile(const array<T, framesKept>& values, uint64_t recorded, float percentile) {
+		static array<T, framesKept> sorted;
+		auto count = static_cast<int>(min<uint64_t>(recorded, framesKept));
+		if (count == 0)
+			return 0;
+		copy(values.begin(), values.begin() + count, sorted.begin());
+		auto index = clamp(static_cast<int>(percentile / 100 * static_cast<float>(count - 1) + .5f), 0, count - 1);
+		nth_element(sorted.begin(), sorted.begin() + index, sorted.begin() + count);
+		return sorted[index];
+	}
+
+	float FrameTimePercentile(float percentile) {
+		return Percentile(frameTimes, framesRecorded, percentile);
+	}
+
+	void RecordAllocation(size_t bytes) {
+		allocationCount.fetch_add(1, memory_order_relaxed);
+		allocatedBytes.fetch_add(bytes, memory_order_relaxed);
+		if (!isFrameThread)
+			return;
+		frameAllocations.count++;
+		frameAllocations.bytes += bytes;
+		auto scope = 0;
+		while (scope < frameScopesNum && frameScopes[scope].scope != currentScope)
+			scope++;
+		if (scope == allocationScopesNum)
+			scope--;
+		else if (scope == frameScopesNum)
+			frameScopes[frameScopesNum++] = ScopeAllocations {currentScope, {}};
+		frameScopes[scope].allocations.count++;
+		frameScopes[scope].allocations.bytes += bytes;
+	}
+
+	void RecordFree() {
+		freeCount.fetch_add(1, memory_order_relaxed);
+	}
+
+	Allocations TotalAllocations() {
+		return Allocations {allocationCount.load(memory_order_relaxed), allocatedBytes.load(memory_order_relaxed)};
+	}
+
+	uint64_t TotalFrees() {
+		return freeCount.load(memory_order_relaxed);
+	}
+
+	Allocations LastFrameAllocations() {
+		return lastFrameAllocations;
+	}
+
+	Allocations LastIdleFrameAllocations() {
+		return lastIdleFrameAllocations;
+	}
+
+	uint64_t FrameAllocationsPercentile(float percentile) {
+		return Percentile(frameAllocationCounts, frameAllocationsRecorded, percentile);
+	}
+
+	int LastFrameAllocationScopes(ScopeAllocations *scopes, int maxScopes) {
+		auto count = min(maxScopes, lastFrameScopesNum);
+		partial_sort_copy(lastFrameScopes.begin(), lastFrameScopes.begin() + lastFrameScopesNum, scopes, scopes + count,
+						  [](const ScopeAllocations& a, const ScopeAllocations& b) {
+							  return a.allocations.count > b.allocations.count;
+						  });
+		return count;
+	}
+
+	static void WriteJsonString(ofstream& file, const char *text) {
+		file << '"';
+		for (auto c = text; *c; c++) {
+			if (*c == '"' || *c == '\\')
+				file << '\\';
+			file << *c;
+		}
+		file << '"';
+	}
+
+	bool WriteChromeTrace(const string& path) {
+		ofstream file(path, ios::out | ios::trunc);
+		if (!file.is_open())
+			return false;
+
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		auto first = true;
+		lock_guard lock(buffersMutex);
+		for (const auto& buffer: buffers) {
+			// A writer may overwrite the oldest slots while we read; those few events are simply lost.
+			auto head = buffer->head.load(memory_order_acquire);
+			auto tail = head > eventsPerThread ? head - eventsPerThread : 0;
+			for (auto i = tail; i < head; i++) {
+				const auto& event = buffer->events[i % eventsPerThread];
+				if (!event.name)
+					continue;
+				file << (first ? "\n" : ",\n") << "{\"name\":";
+				WriteJsonString(file, event.name);
+				file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId
+					 << ",\"ts\":" << static_cast<double>(event.begin) / 1e3
+					 << ",\"dur\":" << static_cast<double>(event.end - event.begin) / 1e3 << "}";
+				first = false;
+			}
+		}
+		file << "\n]}\n";
+		return file.good();
+	}
+}
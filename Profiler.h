@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Scoped hot-path instrumentation. Every thread records into its own fixed-size ring buffer, so recording
+// a scope is two clock reads and a store without locks. Build with -DTEXTED_PROFILE=ON to enable;
+// otherwise the PROFILE_* macros expand to nothing.
+//
+// Where AllocationHooks.cpp is linked in (with TEXTED_PROFILE, and in editor_bench), every operator new is counted
+// too; those on the thread running the frames are also counted per frame, under the innermost scope they were made in.
+
+namespace Profiler {
+
+	struct Event {
+		const char *name = nullptr;
+		int64_t begin = 0; // nanoseconds since profiler start
+		int64_t end = 0;
+	};
+
+	int64_t Now();
+	void Record(const char *name, int64_t begin, int64_t end);
+
+	// The thread calling these is the one whose allocations are counted per frame. A frame begun and not ended, as
+	// when nothing had to be drawn, is an idle one.
+	void BeginFrame();
+	void EndFrame();
+	// Frame time in milliseconds at the given percentile (0..100) over the most recent frames.
+	float FrameTimePercentile(float percentile);
+	int FrameCount();
+
+	struct Allocations {
+		uint64_t count = 0;
+		uint64_t bytes = 0;
+	};
+	struct ScopeAllocations {
+		const char *scope = nullptr; // nullptr outside any scope
+		Allocations allocations;
+	};
+	static constexpr int allocationScopesNum = 32; // per frame; allocations in further scopes go to the last one
+
+	// Called by the hooks for every operator new, so it allocates nothing and takes no lock.
+	void RecordAllocation(size_t bytes);
+	void RecordFree();
+	Allocations TotalAllocations(); // on every thread since start
+	uint64_t TotalFrees();
+	// Allocations of the last frame drawn and of the last idle one, on the thread running the frames.
+	Allocations LastFrameAllocations();
+	Allocations LastIdleFrameAllocations();
+	// Allocations per frame drawn at the given percentile (0..100) over the most recent frames.
+	uint64_t FrameAllocationsPercentile(float percentile);
+	// The scopes the allocations of the last frame drawn were made in, most allocations first; returns how many.
+	int LastFrameAllocationScopes(ScopeAllocations *scopes, int maxScopes);
+
+	// Writes every buffered event as Chrome trace-event JSON (chrome://tracing, Perfetto).
+	bool WriteChromeTrace(const std::string& path);
+
+	// The innermost scope open on this thread, which its allocations are counted under.
+	extern thread_local const char *currentScope;
+
+	struct Scope {
+		const char *name;
+		const char *outerScope;
+		int64_t begin;
+		explicit Scope(const char *name) : name(name), outerScope(currentScope), begin(Now()) { currentScope = name; }
+		~Scope() {
+			Record(name, begin, Now());
+			currentScope = outerScope;
+		}
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	};
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef TEXTED_PROFILE
+#define PROFILE_SCOPE(name) Profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__func__)
+#define PROFILE_FRAME_BEGIN() Profiler::BeginFrame()
+#define PROFILE_FRAME_END() Profiler::EndFrame()
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_FUNCTION() ((void)0)
+#define PROFILE_FRAME_BEGIN() ((void)0)
+#define PROFILE_FRAME_END() ((void)0)
+#endif
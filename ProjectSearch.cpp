@@ -0,0 +1,205 @@
+#include "ProjectSearch.h"
+#include "Jobs.h"
+#include "Profiler.h"
+#include "Search.h"
+#include "TextFile.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <utility>
+
+using namespace std;
+
+// Files are grouped by count: their sizes would take a stat each, which costs more than reading a small file.
+static const size_t filesPerTask = 32;
+static const size_t binaryProbe = 8000; // bytes looked at for a NUL, as git does
+static const size_t matchesPerFile = 1000;
+static const size_t previewContext = 40; // bytes shown before a match
+static const size_t previewLength = 160;
+
+struct ProjectSearch::State {
+	struct Node {
+		ProjectSearchResult result;
+		Node *next = nullptr;
+	};
+
+	string root;
+	string pattern;
+	atomic<bool> cancelled = false;
+	atomic<bool> truncated = false;
+	atomic<int> tasks = 0; // queued or running
+	atomic<int> matches = 0;
+	atomic<uint64_t> files = 0;
+	atomic<uint64_t> bytes = 0;
+	// Newest first; the UI thread takes the whole list at once, so no node is ever popped alone.
+	atomic<Node *> results = nullptr;
+
+	~State() {
+		for (auto node = results.load(); node;)
+			delete exchange(node, node->next);
+	}
+
+	void Push(ProjectSearchResult result) {
+		auto node = new Node {move(result)};
+		node->next = results.load(memory_order_relaxed);
+		while (!results.compare_exchange_weak(node->next, node, memory_order_release, memory_order_relaxed)) {}
+	}
+};
+
+static void SearchFile(ProjectSearch::State& state, const string& relative, string& buffer) {
+	auto contents = FileContents();
+	if (!contents.Load((filesystem::path(state.root) / relative).string(), buffer))
+		return;
+	auto data = contents.data;
+	if (memchr(data.data(), 0, min(data.size(), binaryProbe)))
+		return;
+	state.files++;
+	state.bytes += data.size();
+
+	const auto& pattern = state.pattern;
+	auto result = ProjectSearchResult {relative, {}};
+	auto line = 0;
+	size_t lineStart = 0, counted = 0;
+	for (auto position = FindLiteral(data, pattern); position != string_view::npos && !state.cancelled;
+		 position = FindLiteral(data, pattern, position + pattern.size())) {
+		if (auto newlines = CountNewlines(data.substr(counted, position - counted)); newlines > 0) {
+			line += static_cast<int>(newlines);
+			lineStart = data.rfind('\n', position - 1) + 1; // no further back than `counted`
+		}
+		counted = position;
+
+		// Only as much of the line as the preview shows is looked at, so a huge minified line costs no more.
+		auto from = position - min(position - lineStart, previewContext);
+		if (from == lineStart)
+			while (from < position && (data[from] == ' ' || data[from] == '\t'))
+				from++;
+		while (from < position && (static_cast<unsigned char>(data[from]) & 0xC0) == 0x80)
+			from++;
+		auto to = min(data.size(), from + previewLength);
+		if (auto lineEnd = data.substr(position, to - position).find('\n'); lineEnd != string_view::npos)
+			to = position + lineEnd;
+		if (to > position && data[to - 1] == '\r')
+			to--;
+		while (to > position + pattern.size() && to < data.size() && (static_cast<unsigned char>(data[to]) & 0xC0) == 0x80)
+			to--;
+
+		result.matches.push_back(ProjectMatch {
+			line, static_cast<int>(position - lineStart), static_cast<int>(pattern.size()),
+			string(data.substr(from, to - from)), static_cast<int>(position - from)
+		});
+		if (result.matches.size() >= matchesPerFile)
+			break;
+	}
+	if (result.matches.empty())
+		return;
+	if (state.matches += static_cast<int>(result.matches.size()); state.matches >= ProjectSearch::maxMatches) {
+		state.truncated = true;
+		state.cancelled = true;
+	}
+	state.Push(move(result));
+}
+
+// Counts the task as queued until it has run, so IsRunning() is true while anything is left.
+static void Spawn(ThreadPool& pool, const shared_ptr<ProjectSearch::State>& state, function<void()> task) {
+	state->tasks++;
+	pool.Submit([state, task = move(task)]() {
+		if (!state->cancelled)
+			task();
+		state->tasks--;
+	});
+}
+
+static void SearchFiles(ProjectSearch::State& state, const vector<string>& files) {
+	PROFILE_SCOPE("ProjectSearch::SearchFiles");
+	thread_local auto buffer = string();
+	for (const auto& file: files) {
+		if (state.cancelled)
+			return;
+		SearchFile(state, file, buffer);
+	}
+}
+
+static void SearchDirectory(ThreadPool& pool, const shared_ptr<ProjectSearch::State>& state, const string& directory) {
+	PROFILE_SCOPE("ProjectSearch::SearchDirectory");
+	auto batch = vector<string>();
+
+	auto error = error_code();
+	auto path = directory.empty() ? filesystem::path(state->root) : filesystem::path(state->root) / directory;
+	auto entries = filesystem::directory_iterator(path, error);
+	for (; !error && entries != filesystem::directory_iterator() && !state->cancelled; entries.increment(error)) {
+		auto name = entries->path().filename().string();
+		if (name.empty() || name.front() == '.')
+			continue;
+		auto statusError = error_code();
+		auto status = entries->symlink_status(statusError);
+		if (statusError)
+			continue;
+		auto relative = directory.empty() ? name : directory + '/' + name;
+		if (filesystem::is_directory(status))
+			Spawn(pool, state, [&pool, state, relative]() { SearchDirectory(pool, state, relative); });
+		else if (filesystem::is_regular_file(status)) {
+			batch.push_back(move(relative));
+			if (batch.size() >= filesPerTask) {
+				Spawn(pool, state, [state = state.get(), files = move(batch)]() { SearchFiles(*state, files); });
+				batch.clear();
+			}
+		}
+	}
+	// The last few files are searched right here; the subdirectories queued above are left to be stolen.
+	SearchFiles(*state, batch);
+}
+
+// ProjectSearch
+
+ProjectSearch::~ProjectSearch() {
+	Cancel();
+}
+
+void ProjectSearch::Start(const string& root, string pattern) {
+	Cancel();
+	// Matches never span lines.
+	if (pattern.empty() || pattern.find('\n') != string::npos)
+		return;
+	state = make_shared<State>();
+	state->root = root;
+	state->pattern = move(pattern);
+	Spawn(JobPool(), state, [state = state]() { SearchDirectory(JobPool(), state, ""); });
+}
+
+void ProjectSearch::Cancel() {
+	if (state)
+		state->cancelled = true;
+	state = nullptr;
+}
+
+bool ProjectSearch::IsRunning() const {
+	return state && state->tasks > 0;
+}
+
+bool ProjectSearch::IsTruncated() const {
+	return state && state->truncated;
+}
+
+uint64_t ProjectSearch::FilesSearched() const {
+	return state ? state->files.load() : 0;
+}
+
+uint64_t ProjectSearch::BytesSearched() const {
+	return state ? state->bytes.load() : 0;
+}
+
+bool ProjectSearch::TakeResults(vector<ProjectSearchResult>& results) {
+	if (!state)
+		return false;
+	auto node = state->results.exchange(nullptr, memory_order_acquire);
+	if (!node)
+		return false;
+	// Newest first; reversed, so results arrive in the order they were found.
+	auto first = results.size();
+	while (node) {
+		results.push_back(move(node->result));
+		delete exchange(node, node->next);
+	}
+	reverse(results.begin() + static_cast<ptrdiff_t>(first), results.end());
+	return true;
+}
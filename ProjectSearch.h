@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct ProjectMatch {
+	int line = 0;
+	int column = 0; // in bytes
+	int length = 0;
+	std::string text; // the line, leading blanks dropped and shortened when long
+	int textColumn = 0; // where the match starts in `text`
+};
+
+struct ProjectSearchResult {
+	std::string path; // relative to the searched directory, with '/'
+	std::vector<ProjectMatch> matches; // in file order
+};
+
+// Searches the files under a directory for a literal string on the JobPool. Every directory is listed by a task
+// of its own, which queues a task per subdirectory and per few files, so idle workers steal whole subtrees;
+// large files are mapped rather than read. Files holding a NUL byte near the start are taken for binary and
+// skipped, as are hidden entries and symbolic links. Results are handed to the UI thread a file at a time through a
+// lock-free stack, in no particular order.
+struct ProjectSearch {
+	static constexpr int maxMatches = 100'000; // beyond this the search stops
+
+	~ProjectSearch();
+
+	void Start(const std::string& root, std::string pattern);
+	// Returns right away; tasks of the cancelled search that are still queued return as soon as they run.
+	void Cancel();
+	bool IsRunning() const;
+	bool IsTruncated() const;
+	uint64_t FilesSearched() const;
+	uint64_t BytesSearched() const;
+	// Moves the files with matches found since the last call into `results`. Returns whether there were any.
+	bool TakeResults(std::vector<ProjectSearchResult>& results);
+
+	// What the tasks of one search share; they keep it alive past Cancel().
+	struct State;
+
+private:
+	std::shared_ptr<State> state;
+};
@@ -0,0 +1,261 @@
+#include "Search.h"
+#include "Profiler.h"
+#include <bit>
+#include <cctype>
+#include <cstring>
+#include <memory>
+#include <re2/re2.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+static const size_t matchesPerBatch = 256;
+static const int linesPerBatch = 4096;
+
+size_t FindLiteral(string_view haystack, string_view needle, size_t from) {
+	auto size = needle.size();
+	if (size == 0)
+		return from <= haystack.size() ? from : string_view::npos;
+	if (from > haystack.size() || size > haystack.size() - from)
+		return string_view::npos;
+
+	auto data = haystack.data();
+	auto lastStart = haystack.size() - size;
+	auto i = from;
+
+#if defined(__SSE2__)
+	auto firstBytes = _mm_set1_epi8(needle.front());
+	auto lastBytes = _mm_set1_epi8(needle.back());
+	for (; i + 15 <= lastStart; i += 16) {
+		auto first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+		auto last = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + size - 1));
+		auto candidates = static_cast<unsigned>(_mm_movemask_epi8(
+			_mm_and_si128(_mm_cmpeq_epi8(first, firstBytes), _mm_cmpeq_epi8(last, lastBytes))));
+		for (; candidates; candidates &= candidates - 1) {
+			auto offset = i + countr_zero(candidates);
+			if (memcmp(data + offset, needle.data(), size) == 0)
+				return offset;
+		}
+	}
+#elif defined(__ARM_NEON)
+	auto firstBytes = vdupq_n_u8(static_cast<uint8_t>(needle.front()));
+	auto lastBytes = vdupq_n_u8(static_cast<uint8_t>(needle.back()));
+	for (; i + 15 <= lastStart; i += 16) {
+		auto first = vld1q_u8(reinterpret_cast<const uint8_t *>(data + i));
+		auto last = vld1q_u8(reinterpret_cast<const uint8_t *>(data + i + size - 1));
+		auto equal = vandq_u8(vceqq_u8(first, firstBytes), vceqq_u8(last, lastBytes));
+		// Narrowing shift packs the 16 byte masks into 64 bits, four bits per byte; keep one bit of each.
+		auto candidates = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0)
+						  & 0x8888888888888888ull;
+		for (; candidates; candidates &= candidates - 1) {
+			auto offset = i + countr_zero(candidates) / 4;
+			if (memcmp(data + offset, needle.data(), size) == 0)
+				return offset;
+		}
+	}
+#endif
+
+	while (i <= lastStart) {
+		auto found = static_cast<const char *>(memchr(data + i, needle.front(), lastStart - i + 1));
+		if (!found)
+			return string_view::npos;
+		i = found - data;
+		if (memcmp(data + i, needle.data(), size) == 0)
+			return i;
+		i++;
+	}
+	return string_view::npos;
+}
+
+void FindAllLiteral(const vector<string>& lines, string_view needle, vector<SearchMatch>& matches) {
+	if (needle.empty())
+		return;
+	auto linesNum = static_cast<int>(lines.size());
+	for (auto i = 0; i < linesNum; i++)
+		for (auto position = FindLiteral(lines[i], needle); position != string_view::npos;
+			 position = FindLiteral(lines[i], needle, position + needle.size()))
+			matches.push_back({i, static_cast<int>(position), static_cast<int>(needle.size())});
+}
+
+// Regular expressions
+
+// RE2 matches in time linear in the line, without recursing per character, so a multi-megabyte line can neither
+// overflow the stack nor keep a scan from seeing that it was cancelled for long.
+static unique_ptr<RE2> CompileRegex(const string& pattern, string& error) {
+	auto options = RE2::Options();
+	options.set_log_errors(false);
+	auto expression = make_unique<RE2>(pattern, options);
+	if (!expression->ok()) {
+		error = expression->error();
+		return nullptr;
+	}
+	return expression;
+}
+
+// Calls `found` with the `groups` of every match in `line`, left to right, the whole match first; after an empty
+// match the search goes on a character later. Stops early once `stop` is set.
+template<typename Found>
+static void ForEachRegexMatch(const RE2& expression, const string& line, vector<re2::StringPiece>& groups,
+							  const atomic<bool> *stop, Found found) {
+	auto text = re2::StringPiece(line);
+	auto position = size_t(0);
+	while (position <= line.size() && !(stop && *stop) && expression.Match(text, position, line.size(), RE2::UNANCHORED, groups.data(),
+													   static_cast<int>(groups.size()))) {
+		auto begin = static_cast<size_t>(groups[0].data() - line.data());
+		found(begin, groups);
+		position = begin + groups[0].size();
+		if (groups[0].empty())
+			for (position++; position < line.size() && (line[position] & 0xC0) == 0x80; position++);
+	}
+}
+
+// The replacement of one match, with $& for the match, $1 to $99 for its groups, $` and $' for the line before and
+// after it, and $$ for a dollar sign, as ECMAScript's String.replace takes them.
+static string FormatReplacement(const string& replacement, const string& line, const vector<re2::StringPiece>& groups) {
+	auto result = string();
+	for (size_t i = 0; i < replacement.size(); i++) {
+		auto next = i + 1 < replacement.size() ? replacement[i + 1] : '\0';
+		if (replacement[i] != '$' || !next) {
+			result += replacement[i];
+			continue;
+		}
+		auto match = string_view(groups[0].data(), groups[0].size());
+		if (next == '$')
+			result += '$';
+		else if (next == '&')
+			result += match;
+		else if (next == '`')
+			result.append(line.data(), static_cast<size_t>(match.data() - line.data()));
+		else if (next == '\'')
+			result.append(match.data() + match.size(), line.data() + line.size());
+		else if (isdigit(static_cast<unsigned char>(next))) {
+			// Two digits when they name a group, else one; $0 and groups that do not exist are kept as written.
+			auto group = static_cast<size_t>(next - '0');
+			auto digits = size_t(1);
+			if (i + 2 < replacement.size() && isdigit(static_cast<unsigned char>(replacement[i + 2]))) {
+				auto twoDigits = group * 10 + static_cast<size_t>(replacement[i + 2] - '0');
+				if (twoDigits > 0 && twoDigits < groups.size()) {
+					group = twoDigits;
+					digits = 2;
+				}
+			}
+			if (group == 0 || group >= groups.size()) {
+				result += replacement[i];
+				continue;
+			}
+			result.append(groups[group].data(), groups[group].size());
+			i += digits;
+			continue;
+		}
+		else {
+			result += replacement[i];
+			continue;
+		}
+		i++;
+	}
+	return result;
+}
+
+// Search
+
+Search::~Search() {
+	Cancel();
+}
+
+void Search::Cancel() {
+	cancelled = true;
+	if (worker.joinable())
+		worker.join();
+	running = false;
+	lock_guard lock(pendingMutex);
+	pending.clear();
+}
+
+void Search::Publish(vector<SearchMatch>& batch) {
+	if (batch.empty())
+		return;
+	lock_guard lock(pendingMutex);
+	pending.insert(pending.end(), batch.begin(), batch.end());
+	batch.clear();
+}
+
+bool Search::TakeMatches(vector<SearchMatch>& matches) {
+	lock_guard lock(pendingMutex);
+	if (pending.empty())
+		return false;
+	matches.insert(matches.end(), pending.begin(), pending.end());
+	pending.clear();
+	return true;
+}
+
+void Search::Start(const vector<string>& lines, string pattern, bool isRegex) {
+	Cancel();
+	error.clear();
+	if (pattern.empty())
+		return;
+
+	auto expression = shared_ptr<RE2>();
+	if (isRegex && !(expression = CompileRegex(pattern, error)))
+		return;
+
+	cancelled = false;
+	running = true;
+	worker = thread([this, &lines, pattern = move(pattern), expression = move(expression)]() {
+		PROFILE_SCOPE("Search::Scan");
+		auto batch = vector<SearchMatch>();
+		auto groups = vector<re2::StringPiece>(1);
+		auto linesNum = static_cast<int>(lines.size());
+		for (auto i = 0; i < linesNum && !cancelled; i++) {
+			const auto& line = lines[i];
+			if (expression)
+				ForEachRegexMatch(*expression, line, groups, &cancelled, [&](size_t begin, const vector<re2::StringPiece>& found) {
+					batch.push_back({i, static_cast<int>(begin), static_cast<int>(found[0].size())});
+				});
+			else
+				for (auto position = FindLiteral(line, pattern); position != string_view::npos;
+					 position = FindLiteral(line, pattern, position + pattern.size()))
+					batch.push_back({i, static_cast<int>(position), static_cast<int>(pattern.size())});
+
+			// Hand over early and often so the first hits can be highlighted while the scan goes on.
+			if (batch.size() >= matchesPerBatch || (i % linesPerBatch == linesPerBatch - 1))
+				Publish(batch);
+		}
+		Publish(batch);
+		running = false;
+	});
+}
+
+bool BuildReplaceAllEdits(const vector<string>& lines, const string& pattern, bool isRegex,
+						  const string& replacement, vector<TextEdit>& edits, string& error) {
+	PROFILE_SCOPE("Search::BuildReplaceAllEdits");
+	edits.clear();
+	if (pattern.empty())
+		return true;
+
+	if (!isRegex) {
+		auto matches = vector<SearchMatch>();
+		FindAllLiteral(lines, pattern, matches);
+		edits.reserve(matches.size());
+		for (const auto& match: matches)
+			edits.push_back({{match.line, match.column}, {match.line, match.column + match.length}, replacement});
+		return true;
+	}
+
+	auto expression = CompileRegex(pattern, error);
+	if (!expression)
+		return false;
+	auto groups = vector<re2::StringPiece>(static_cast<size_t>(expression->NumberOfCapturingGroups()) + 1);
+	auto linesNum = static_cast<int>(lines.size());
+	for (auto i = 0; i < linesNum; i++)
+		ForEachRegexMatch(*expression, lines[i], groups, nullptr, [&](size_t begin, const vector<re2::StringPiece>& found) {
+			auto column = static_cast<int>(begin);
+			edits.push_back({{i, column}, {i, column + static_cast<int>(found[0].size())},
+							 FormatReplacement(replacement, lines[i], found)});
+		});
+	return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "TextEdit.h"
+
+struct SearchMatch {
+	int line = 0;
+	int column = 0;
+	int length = 0;
+};
+
+// Position of the first occurrence of `needle` in `haystack` at or after `from`, or npos. Candidates are found
+// 16 bytes at a time by comparing the first and the last byte of the needle, then verified with memcmp.
+size_t FindLiteral(std::string_view haystack, std::string_view needle, size_t from = 0);
+
+void FindAllLiteral(const std::vector<std::string>& lines, std::string_view needle, std::vector<SearchMatch>& matches);
+
+// Matches never span lines; regular expressions use the syntax of RE2, matched in time linear in the line.
+struct Search {
+
+	std::string error = "";
+
+	~Search();
+
+	// Starts scanning `lines` on a background thread. The lines must not change until Cancel() returns.
+	void Start(const std::vector<std::string>& lines, std::string pattern, bool isRegex);
+	// Stops the scan and waits for the background thread; call before editing the searched lines.
+	void Cancel();
+	bool IsRunning() const { return running; }
+	// Appends matches found since the previous call, in document order. Returns whether any were appended.
+	bool TakeMatches(std::vector<SearchMatch>& matches);
+
+private:
+	std::thread worker;
+	std::atomic<bool> cancelled = false;
+	std::atomic<bool> running = false;
+	std::mutex pendingMutex;
+	std::vector<SearchMatch> pending;
+
+	void Publish(std::vector<SearchMatch>& batch);
+};
+
+// Builds one batch of edits replacing every match; regex replacements may refer to the match as $& and to its groups
+// as $1, $2, ...
+// Returns false and sets `error` when the pattern is not a valid regular expression.
+bool BuildReplaceAllEdits(const std::vector<std::string>& lines, const std::string& pattern, bool isRegex,
+						  const std::string& replacement, std::vector<TextEdit>& edits, std::string& error);
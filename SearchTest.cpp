@@ -0,0 +1,79 @@
+// Checks of find and Replace All on lines long enough to matter: a regex scan must neither crash nor stall on a
+// line of hundreds of thousands of characters. Run by ctest; prints what failed and exits non-zero.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Search.h"
+
+using namespace std;
+
+static int failures = 0;
+
+static void Check(bool condition, const char *what) {
+	if (!condition) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+static vector<SearchMatch> Scan(const vector<string>& lines, const string& pattern, bool isRegex, string *error = nullptr) {
+	auto search = Search();
+	auto matches = vector<SearchMatch>();
+	search.Start(lines, pattern, isRegex);
+	while (search.IsRunning())
+		this_thread::sleep_for(chrono::milliseconds(1));
+	search.TakeMatches(matches);
+	if (error)
+		*error = search.error;
+	return matches;
+}
+
+int main() {
+	for (auto length: {10'000, 100'000, 1'000'000}) {
+		auto line = string(static_cast<size_t>(length), 'x');
+		line.front() = 'a';
+		line.back() = 'b';
+		auto lines = vector<string> {"a b", line, "b a"};
+		auto matches = Scan(lines, "a.*b", true);
+		Check(matches.size() == 2, "a.*b matches once on each line that has a before b");
+		Check(matches.size() == 2 && matches[1].line == 1 && matches[1].column == 0 && matches[1].length == length,
+			  "a.*b takes the whole long line");
+		Check(Scan(lines, "((x)|(a))*b", true).size() == 3, "nested groups repeated over a long line");
+		Check(Scan(lines, "x+c", true).empty(), "a failing search over a long line");
+	}
+
+	{
+		auto lines = vector<string> {string(200'000, 'x')};
+		auto search = Search();
+		search.Start(lines, "x", true);
+		auto start = chrono::steady_clock::now();
+		search.Cancel();
+		Check(chrono::steady_clock::now() - start < chrono::seconds(1), "cancelling a scan of a long line is prompt");
+	}
+
+	{
+		auto error = string();
+		Scan({"abc"}, "a(b", true, &error);
+		Check(!error.empty(), "an invalid pattern is reported through error");
+	}
+
+	{
+		auto lines = vector<string> {"key=value; other=thing", string(150'000, 'y') + "k=v"};
+		auto edits = vector<TextEdit>();
+		auto error = string();
+		Check(BuildReplaceAllEdits(lines, "(\\w+)=(\\w+)", true, "$2:$1 ($&) $$", edits, error), "Replace All with groups");
+		Check(edits.size() == 3 && edits[0].text == "value:key (key=value) $" && edits[1].text == "thing:other (other=thing) $",
+			  "groups, the match and dollars are substituted");
+		Check(edits.size() == 3 && edits[2].from.line == 1 && edits[2].from.column == 0 && edits[2].to.column == 150'003,
+			  "a match spanning a long line is replaced whole");
+		Check(BuildReplaceAllEdits({"ab"}, "x*", true, "-", edits, error) && edits.size() == 3,
+			  "empty matches move on by a character");
+	}
+
+	if (failures == 0)
+		printf("All search checks passed.\n");
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,274 @@
+#include "Session.h"
+#include "Profiler.h"
+#include <bit>
+#include <climits>
+#include <cstdio>
+#include <filesystem>
+#include <string_view>
+
+using namespace std;
+
+static const char magic[4] = {'T', 'X', 'S', '1'}; // the digit is the version; another one is not read
+static const size_t headerSize = sizeof(magic) + 12; // payload size and checksum
+
+// Encoding
+
+static void PutFixed(string& out, uint64_t value, int bytes) {
+	for (auto i = 0; i < bytes; i++)
+		out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+static bool GetFixed(string_view& data, int bytes, uint64_t& value) {
+	if (data.size() < static_cast<size_t>(bytes))
+		return false;
+	value = 0;
+	for (auto i = 0; i < bytes; i++)
+		value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+	data.remove_prefix(bytes);
+	return true;
+}
+
+static void PutVarint(string& out, uint64_t value) {
+	for (; value >= 0x80; value >>= 7)
+		out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+	out.push_back(static_cast<char>(value));
+}
+
+static bool GetVarint(string_view& data, uint64_t& value) {
+	value = 0;
+	for (auto shift = 0; shift < 64 && !data.empty(); shift += 7) {
+		auto byte = static_cast<unsigned char>(data.front());
+		data.remove_prefix(1);
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if (byte < 0x80)
+			return true;
+	}
+	return false;
+}
+
+static bool GetInt(string_view& data, int& value) {
+	auto wide = uint64_t(0);
+	if (!GetVarint(data, wide) || wide > INT_MAX)
+		return false;
+	value = static_cast<int>(wide);
+	return true;
+}
+
+// A count of items at least `itemSize` bytes each, so a damaged count cannot ask for more than is there.
+static bool GetCount(string_view& data, size_t itemSize, size_t& count) {
+	auto wide = uint64_t(0);
+	if (!GetVarint(data, wide) || wide > data.size() / itemSize)
+		return false;
+	count = static_cast<size_t>(wide);
+	return true;
+}
+
+static void PutPosition(string& out, TextPosition position) {
+	PutVarint(out, static_cast<uint64_t>(position.line));
+	PutVarint(out, static_cast<uint64_t>(position.column));
+}
+
+static bool GetPosition(string_view& data, TextPosition& position) {
+	return GetInt(data, position.line) && GetInt(data, position.column);
+}
+
+static uint32_t Checksum(string_view data) {
+	auto hash = 2166136261u; // FNV-1a
+	for (auto c: data)
+		hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+	return hash;
+}
+
+static void EncodeDocument(string& out, const SessionDocument& document) {
+	PutVarint(out, document.path.size());
+	out.append(document.path);
+	PutFixed(out, static_cast<uint64_t>(document.stamp.modifiedTime), 8);
+	PutVarint(out, document.stamp.size);
+	PutFixed(out, document.stamp.hash, 8);
+	// Line counts only grow from block to block and checkpoints are in order, so both are stored as differences.
+	PutVarint(out, document.blockLines.size());
+	auto previous = uint64_t(0);
+	for (auto lines: document.blockLines) {
+		PutVarint(out, lines - previous);
+		previous = lines;
+	}
+	PutVarint(out, document.lexerCheckpoints.size());
+	auto previousLine = 0;
+	for (auto position: document.lexerCheckpoints) {
+		PutPosition(out, TextPosition {position.line - previousLine, position.column});
+		previousLine = position.line;
+	}
+	PutVarint(out, document.cursors.size());
+	for (const auto& [head, anchor]: document.cursors) {
+		PutPosition(out, head);
+		PutPosition(out, anchor);
+	}
+	PutFixed(out, bit_cast<uint32_t>(document.topOffset), 4);
+	PutFixed(out, bit_cast<uint32_t>(document.leftOffset), 4);
+}
+
+static bool DecodeDocument(string_view& data, SessionDocument& document) {
+	auto size = size_t(0);
+	if (!GetCount(data, 1, size))
+		return false;
+	document.path = data.substr(0, size);
+	data.remove_prefix(size);
+	auto modifiedTime = uint64_t(0), hash = uint64_t(0);
+	if (!GetFixed(data, 8, modifiedTime) || !GetVarint(data, document.stamp.size) || !GetFixed(data, 8, hash))
+		return false;
+	document.stamp.modifiedTime = static_cast<int64_t>(modifiedTime);
+	document.stamp.hash = hash;
+
+	if (!GetCount(data, 1, size))
+		return false;
+	document.blockLines.resize(size);
+	auto lines = uint64_t(0);
+	for (auto& blockLines: document.blockLines) {
+		auto difference = uint64_t(0);
+		if (!GetVarint(data, difference))
+			return false;
+		blockLines = lines += difference;
+	}
+	if (!GetCount(data, 2, size))
+		return false;
+	document.lexerCheckpoints.resize(size);
+	auto line = 0;
+	for (auto& position: document.lexerCheckpoints) {
+		if (!GetPosition(data, position) || position.line > INT_MAX - line)
+			return false;
+		line = position.line += line;
+	}
+	if (!GetCount(data, 4, size))
+		return false;
+	document.cursors.resize(size);
+	for (auto& [head, anchor]: document.cursors)
+		if (!GetPosition(data, head) || !GetPosition(data, anchor))
+			return false;
+	auto topOffset = uint64_t(0), leftOffset = uint64_t(0);
+	if (!GetFixed(data, 4, topOffset) || !GetFixed(data, 4, leftOffset))
+		return false;
+	document.topOffset = bit_cast<float>(static_cast<uint32_t>(topOffset));
+	document.leftOffset = bit_cast<float>(static_cast<uint32_t>(leftOffset));
+	return true;
+}
+
+string EncodeSession(const Session& session) {
+	auto payload = string();
+	PutVarint(payload, session.activeDocument);
+	PutVarint(payload, session.documents.size());
+	for (const auto& document: session.documents)
+		EncodeDocument(payload, document);
+	auto encoded = string(magic, sizeof(magic));
+	PutFixed(encoded, payload.size(), 8);
+	PutFixed(encoded, Checksum(payload), 4);
+	encoded.append(payload);
+	return encoded;
+}
+
+bool ReadSession(const string& path, Session& session) {
+	PROFILE_SCOPE("ReadSession");
+	auto contents = FileContents();
+	auto buffer = string();
+	if (!contents.Load(path, buffer, 0))
+		return false;
+	auto data = contents.data;
+	auto payloadSize = uint64_t(0), checksum = uint64_t(0);
+	if (data.size() < headerSize || data.substr(0, sizeof(magic)) != string_view(magic, sizeof(magic)))
+		return false;
+	data.remove_prefix(sizeof(magic));
+	if (!GetFixed(data, 8, payloadSize) || !GetFixed(data, 4, checksum) || payloadSize != data.size() ||
+		Checksum(data) != checksum)
+		return false;
+
+	auto read = Session();
+	auto activeDocument = uint64_t(0);
+	auto documentsNum = size_t(0);
+	if (!GetVarint(data, activeDocument) || !GetCount(data, 1, documentsNum))
+		return false;
+	read.activeDocument = static_cast<size_t>(activeDocument);
+	read.documents.resize(documentsNum);
+	for (auto& document: read.documents)
+		if (!DecodeDocument(data, document))
+			return false;
+	if (!data.empty() || (read.activeDocument >= read.documents.size() && !read.documents.empty()))
+		return false;
+	session = move(read);
+	return true;
+}
+
+static bool WriteSessionFile(const string& path, string_view encoded) {
+	PROFILE_SCOPE("SessionWriter::Write");
+	auto temporaryPath = path + ".tmp";
+	auto file = fopen(temporaryPath.c_str(), "wb");
+	if (!file)
+		return false;
+	auto written = fwrite(encoded.data(), 1, encoded.size(), file) == encoded.size();
+	written = fclose(file) == 0 && written;
+	auto error = error_code();
+	if (written)
+		filesystem::rename(temporaryPath, path, error);
+	if (!written || error) {
+		filesystem::remove(temporaryPath, error);
+		return false;
+	}
+	return true;
+}
+
+// SessionWriter
+
+SessionWriter::~SessionWriter() {
+	Stop();
+}
+
+void SessionWriter::Start(string sessionPath) {
+	Stop();
+	path = move(sessionPath);
+	stopping = false;
+	failed = false;
+	writer = thread([this]() { Run(); });
+}
+
+void SessionWriter::Write(const Session& session) {
+	if (!writer.joinable())
+		return;
+	auto encoded = EncodeSession(session);
+	{
+		lock_guard lock(mutex);
+		pending = move(encoded);
+	}
+	changed.notify_all();
+}
+
+void SessionWriter::Stop() {
+	if (!writer.joinable())
+		return;
+	{
+		lock_guard lock(mutex);
+		stopping = true;
+	}
+	changed.notify_all();
+	writer.join();
+}
+
+void SessionWriter::Run() {
+	auto written = string(), writing = string();
+	unique_lock lock(mutex);
+	for (;;) {
+		changed.wait(lock, [&]() { return !pending.empty() || stopping; });
+		auto stop = stopping;
+		writing.swap(pending);
+		pending.clear();
+		lock.unlock();
+
+		if (!writing.empty() && writing != written) {
+			if (WriteSessionFile(path, writing))
+				written.swap(writing);
+			else
+				failed = true;
+		}
+		writing.clear();
+		if (stop)
+			return;
+		lock.lock();
+	}
+}
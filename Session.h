@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "TextEdit.h"
+#include "TextFile.h"
+
+// What the editor had open, so that the next start picks up there without redoing work that only depends on the
+// files. Derived data is kept with the stamp of the file it was derived from and only used while the file still has
+// that stamp, hash included.
+struct SessionDocument {
+	std::string path;
+	FileStamp stamp; // not known when the document had unsaved changes; then nothing derived is kept
+	std::vector<uint64_t> blockLines; // see ReadLines()
+	std::vector<TextPosition> lexerCheckpoints; // verified ones only
+	std::vector<std::pair<TextPosition, TextPosition>> cursors; // head and anchor, the primary one first
+	float topOffset = 0;
+	float leftOffset = 0;
+};
+
+struct Session {
+	std::vector<SessionDocument> documents;
+	size_t activeDocument = 0;
+};
+
+std::string EncodeSession(const Session& session);
+// Maps the snapshot at `path`. Returns false, leaving `session` alone, when there is none, or it was written by
+// another version, or it is damaged.
+bool ReadSession(const std::string& path, Session& session);
+
+// Writes snapshots on a thread of its own, the last one given replacing any not written yet, and skips those that
+// are the same as the one before. A snapshot goes to a temporary file renamed over the last, so one is always whole.
+struct SessionWriter {
+
+	~SessionWriter(); // writes what is pending
+
+	void Start(std::string sessionPath);
+	void Write(const Session& session);
+	void Stop(); // writes what is pending
+	bool Failed() const { return failed; }
+
+private:
+	std::string path;
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::string pending; // encoded, waiting for the writer
+	bool stopping = false;
+	std::atomic<bool> failed = false;
+
+	void Run();
+};
@@ -0,0 +1,473 @@
+#include "SymbolIndex.h"
+#include "Jobs.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <queue>
+#include <utility>
+
+using namespace std;
+
+static const size_t filesPerTask = 16;
+
+// SymbolIndex
+
+SymbolIndex::SymbolIndex() {
+	AddNode(TrieNode());
+}
+
+int SymbolIndex::Find(string_view name) const {
+	auto node = Descend(name);
+	return node < 0 ? -1 : Node(node).symbol;
+}
+
+int SymbolIndex::FileOf(const string& path) const {
+	auto found = fileIds.find(path);
+	return found == fileIds.end() ? -1 : found->second;
+}
+
+int SymbolIndex::FileFor(const string& path) {
+	if (auto file = FileOf(path); file >= 0)
+		return file;
+	files.emplace_back().path = path;
+	fileIds.emplace(path, static_cast<int>(files.size()) - 1);
+	return static_cast<int>(files.size()) - 1;
+}
+
+int SymbolIndex::AddNode(const TrieNode& node) {
+	if (trieNodesNum % trieBlockNodes == 0)
+		trieBlocks.push_back(make_unique<TrieNode[]>(trieBlockNodes));
+	Node(trieNodesNum) = node;
+	return trieNodesNum++;
+}
+
+int SymbolIndex::Descend(string_view name) const {
+	auto node = 0;
+	for (auto character: name) {
+		node = Node(node).firstChild;
+		while (node >= 0 && Node(node).character < character)
+			node = Node(node).nextSibling;
+		if (node < 0 || Node(node).character != character)
+			return -1;
+	}
+	return node;
+}
+
+int SymbolIndex::Intern(string_view name) {
+	auto node = 0;
+	for (auto character: name) {
+		auto previous = -1, child = Node(node).firstChild;
+		while (child >= 0 && Node(child).character < character) {
+			previous = child;
+			child = Node(child).nextSibling;
+		}
+		if (child < 0 || Node(child).character != character) {
+			auto created = AddNode(TrieNode {node, -1, child, -1, 0, character});
+			(previous < 0 ? Node(node).firstChild : Node(previous).nextSibling) = created;
+			child = created;
+		}
+		node = child;
+	}
+	if (Node(node).symbol >= 0)
+		return Node(node).symbol;
+
+	// Long names get a block of their own rather than wasting the rest of the current one.
+	char *storage = nullptr;
+	if (name.size() > blockSize / 16) {
+		blocks.push_back(make_unique<char[]>(name.size()));
+		storage = blocks.back().get();
+	}
+	else {
+		if (name.size() > blockLeft) {
+			blocks.push_back(make_unique<char[]>(blockSize));
+			blockCursor = blocks.back().get();
+			blockLeft = blockSize;
+		}
+		storage = blockCursor;
+		blockCursor += name.size();
+		blockLeft -= name.size();
+	}
+	memcpy(storage, name.data(), name.size());
+
+	auto symbol = static_cast<int>(names.size());
+	names.emplace_back(storage, name.size());
+	counts.push_back(0);
+	isTouched.push_back(false);
+	symbolNodes.push_back(node);
+	Node(node).symbol = symbol;
+	return symbol;
+}
+
+void SymbolIndex::AddCount(int symbol, int delta) {
+	counts[symbol] += delta;
+	if (!isTouched[symbol]) {
+		isTouched[symbol] = true;
+		touched.push_back(symbol);
+	}
+}
+
+void SymbolIndex::UpdateTrie() {
+	// Many changed counts, as when a scanned file is added, are cheaper to redo for the whole trie in one pass.
+	if (touched.size() > static_cast<size_t>(trieNodesNum / 16)) {
+		for (auto node = 0; node < trieNodesNum; node++) {
+			auto& current = Node(node);
+			current.best = current.symbol >= 0 ? counts[current.symbol] : 0;
+		}
+		for (auto node = trieNodesNum - 1; node > 0; node--) {
+			auto& parent = Node(Node(node).parent);
+			parent.best = max(parent.best, Node(node).best);
+		}
+	}
+	else
+		for (auto symbol: touched) {
+			// Bottom up, until a node whose best count stays as it was: nothing above it changes then. Only a node
+			// whose best came from a child that dropped has to look at all its children again.
+			auto node = symbolNodes[symbol];
+			auto best = counts[symbol];
+			for (auto child = Node(node).firstChild; child >= 0; child = Node(child).nextSibling)
+				best = max(best, Node(child).best);
+			auto previous = exchange(Node(node).best, best);
+			while (best != previous && (node = Node(node).parent) >= 0) {
+				auto& current = Node(node);
+				if (best == current.best || (best < current.best && previous < current.best))
+					break;
+				if (best < current.best) {
+					best = current.symbol >= 0 ? counts[current.symbol] : 0;
+					for (auto child = current.firstChild; child >= 0; child = Node(child).nextSibling)
+						best = max(best, Node(child).best);
+				}
+				previous = exchange(current.best, best);
+			}
+		}
+	for (auto symbol: touched)
+		isTouched[symbol] = false;
+	touched.clear();
+}
+
+void SymbolIndex::ClearOccurrences(File& file) {
+	for (const auto& line: file.lines)
+		for (const auto& occurrence: line)
+			AddCount(occurrence.symbol, -1);
+	for (const auto& occurrence: file.occurrences)
+		AddCount(occurrence.name, -1);
+	file.lines.clear();
+	file.occurrences.clear();
+}
+
+void SymbolIndex::IndexLine(File& file, const vector<string>& lines, int line, Lexer *lexer) {
+	auto& occurrences = file.lines[line];
+	for (const auto& occurrence: occurrences)
+		AddCount(occurrence.symbol, -1);
+	occurrences.clear();
+	const auto& text = lines[line];
+	if (!lexer || text.empty())
+		return;
+	lexer->lines = const_cast<vector<string> *>(&lines);
+	lexer->Reset(TextPosition {line, 0}, TextPosition {line, static_cast<int>(text.size())});
+	for (lexer->NextToken(); lexer->currentToken.type != EOF; lexer->NextToken()) {
+		if (!lexer->IsIdentifier(lexer->currentToken.type))
+			continue;
+		auto symbol = Intern(lexer->currentToken.text);
+		auto column = static_cast<int>(lexer->currentToken.text.data() - lexer->sourceCode.data());
+		occurrences.push_back(SymbolOccurrence {symbol, column});
+		AddCount(symbol, 1);
+	}
+}
+
+int SymbolIndex::OpenDocument(const string& path, int linesNum, bool unchanged) {
+	auto file = FileFor(path);
+	auto& document = files[file];
+	document.isDocument = true;
+	// A scan since it was closed replaced its lines with a flat list.
+	if (!unchanged || !document.occurrences.empty() || static_cast<int>(document.lines.size()) != linesNum)
+		ResetDocument(file, linesNum);
+	return file;
+}
+
+void SymbolIndex::CloseDocument(int file) {
+	files[file].isDocument = false;
+}
+
+void SymbolIndex::ResetDocument(int file, int linesNum) {
+	auto& document = files[file];
+	ClearOccurrences(document);
+	document.lines.resize(static_cast<size_t>(linesNum));
+	document.sweepLine = 0;
+	UpdateTrie();
+}
+
+void SymbolIndex::ApplyLineChanges(int file, const vector<string>& lines, const vector<LineChange>& changes,
+								   Lexer *lexer) {
+	if (changes.empty())
+		return;
+	PROFILE_SCOPE("SymbolIndex::ApplyLineChanges");
+	auto& document = files[file];
+	// The lines added so far, moved along by every later change, since one may land before them or replace them.
+	auto added = vector<pair<int, int>>();
+	for (const auto& change: changes) {
+		auto removedEnd = change.line + change.removedLines;
+		for (auto line = change.line; line < removedEnd; line++)
+			for (const auto& occurrence: document.lines[line])
+				AddCount(occurrence.symbol, -1);
+		::ApplyLineChanges(document.lines, {change});
+		if (change.line < document.sweepLine)
+			document.sweepLine = max(change.line, document.sweepLine + change.addedLines - change.removedLines);
+
+		auto shift = change.addedLines - change.removedLines;
+		for (size_t i = 0, rangesNum = added.size(); i < rangesNum; i++) {
+			auto [begin, end] = added[i];
+			added[i] = {begin, min(end, change.line)};
+			if (end > removedEnd)
+				added.emplace_back(max(begin, removedEnd) + shift, end + shift);
+		}
+		added.emplace_back(change.line, change.line + change.addedLines);
+		erase_if(added, [](const pair<int, int>& range) { return range.first >= range.second; });
+	}
+	for (auto [begin, end]: added)
+		for (auto line = begin; line < end; line++)
+			IndexLine(document, lines, line, lexer);
+	UpdateTrie();
+}
+
+bool SymbolIndex::Sweep(int file, const vector<string>& lines, Lexer *lexer, int budget) {
+	auto& document = files[file];
+	auto end = min(static_cast<int>(lines.size()), document.sweepLine + budget);
+	if (document.sweepLine < end) {
+		PROFILE_SCOPE("SymbolIndex::Sweep");
+		for (auto line = document.sweepLine; line < end; line++)
+			IndexLine(document, lines, line, lexer);
+		document.sweepLine = end;
+		UpdateTrie();
+	}
+	return document.sweepLine < static_cast<int>(lines.size());
+}
+
+void SymbolIndex::AddFile(ScannedFile&& scanned) {
+	if (auto existing = FileOf(scanned.path); existing >= 0 && files[existing].isDocument)
+		return;
+	PROFILE_SCOPE("SymbolIndex::AddFile");
+	auto& file = files[FileFor(scanned.path)];
+	ClearOccurrences(file);
+	auto fileSymbols = vector<int>(scanned.names.size());
+	for (size_t i = 0; i < scanned.names.size(); i++)
+		fileSymbols[i] = Intern(scanned.names[i]);
+	for (auto& occurrence: scanned.occurrences) {
+		occurrence.name = fileSymbols[occurrence.name];
+		AddCount(occurrence.name, 1);
+	}
+	file.occurrences = move(scanned.occurrences);
+	UpdateTrie();
+}
+
+void SymbolIndex::Complete(string_view prefix, int maxResults, vector<SymbolCompletion>& results) const {
+	results.clear();
+	auto node = Descend(prefix);
+	if (node < 0)
+		return;
+
+	// Best first: a subtree is opened when its best count is the highest left, and a symbol is taken when its
+	// own count is, so the results come out in order after visiting about as many nodes as their names have.
+	struct Candidate {
+		int count = 0;
+		int node = 0;
+		bool isSymbol = false;
+	};
+	auto isWorse = [](const Candidate& a, const Candidate& b) {
+		if (a.count != b.count)
+			return a.count < b.count;
+		if (a.isSymbol != b.isSymbol)
+			return !a.isSymbol;
+		return a.node > b.node;
+	};
+	auto candidates = priority_queue<Candidate, vector<Candidate>, decltype(isWorse)>(isWorse);
+	if (Node(node).best > 0)
+		candidates.push(Candidate {Node(node).best, node, false});
+	while (!candidates.empty() && static_cast<int>(results.size()) < maxResults) {
+		auto candidate = candidates.top();
+		candidates.pop();
+		const auto& current = Node(candidate.node);
+		if (candidate.isSymbol) {
+			results.push_back(SymbolCompletion {names[current.symbol], current.symbol, candidate.count});
+			continue;
+		}
+		if (current.symbol >= 0 && counts[current.symbol] > 0)
+			candidates.push(Candidate {counts[current.symbol], candidate.node, true});
+		for (auto child = current.firstChild; child >= 0; child = Node(child).nextSibling)
+			if (Node(child).best > 0)
+				candidates.push(Candidate {Node(child).best, child, false});
+	}
+}
+
+void SymbolIndex::Locations(int symbol, int maxResults, vector<SymbolLocation>& locations, int preferredFile) const {
+	locations.clear();
+	auto collect = [&](int index) {
+		const auto& file = files[index];
+		auto linesNum = static_cast<int>(file.lines.size());
+		for (auto line = 0; line < linesNum; line++)
+			for (const auto& occurrence: file.lines[line]) {
+				if (static_cast<int>(locations.size()) >= maxResults)
+					return;
+				if (occurrence.symbol == symbol)
+					locations.push_back(SymbolLocation {index, line, occurrence.column});
+			}
+		for (const auto& occurrence: file.occurrences) {
+			if (static_cast<int>(locations.size()) >= maxResults)
+				return;
+			if (occurrence.name == symbol)
+				locations.push_back(SymbolLocation {index, occurrence.line, occurrence.column});
+		}
+	};
+	if (symbol < 0 || symbol >= SymbolsNum() || counts[symbol] == 0)
+		return;
+	if (preferredFile >= 0 && preferredFile < FilesNum())
+		collect(preferredFile);
+	for (auto file = 0; file < FilesNum(); file++)
+		if (file != preferredFile)
+			collect(file);
+}
+
+// SymbolIndexer
+
+struct SymbolIndexer::State {
+	string root;
+	atomic<bool> cancelled = false;
+	atomic<int> tasks = 0; // queued or running
+	atomic<int> filesIndexed = 0;
+	atomic<int> scannedNum = 0;
+	mutex scannedMutex;
+	vector<ScannedFile> scanned;
+};
+
+static bool IsSourceFile(const string& name) {
+	static const string extensions[] = {".c", ".cc", ".cpp", ".cxx", ".h", ".hh", ".hpp", ".hxx", ".inl", ".ipp"};
+	auto dot = name.rfind('.');
+	return dot != string::npos && find(begin(extensions), end(extensions), name.substr(dot)) != end(extensions);
+}
+
+static bool ScanSourceFile(const string& path, CppLexer& lexer, ScannedFile& scanned) {
+	auto file = ifstream(path, ios::binary);
+	if (!file.is_open())
+		return false;
+	lexer.ResetSource(string(istreambuf_iterator<char>(file), istreambuf_iterator<char>()));
+	scanned.path = path;
+	auto localNames = unordered_map<string_view, int>();
+	auto line = 0;
+	size_t lineStart = 0;
+	for (lexer.NextToken(); lexer.currentToken.type != EOF; lexer.NextToken()) {
+		const auto& text = lexer.currentToken.text;
+		auto offset = static_cast<size_t>(text.data() - lexer.sourceCode.data());
+		if (lexer.IsIdentifier(lexer.currentToken.type)) {
+			auto [name, added] = localNames.emplace(text, static_cast<int>(scanned.names.size()));
+			if (added)
+				scanned.names.emplace_back(text);
+			scanned.occurrences.push_back(ScannedFile::Occurrence {name->second, line, static_cast<int>(offset - lineStart)});
+			continue;
+		}
+		for (auto newline = text.find('\n'); newline != string_view::npos; newline = text.find('\n', newline + 1)) {
+			line++;
+			lineStart = offset + newline + 1;
+		}
+	}
+	return true;
+}
+
+// Counts the task as queued until it has run, so IsRunning() is true while anything is left. Nobody waits for the
+// index, so every task gives way to the rest of the editor's work.
+static void Spawn(ThreadPool& pool, const shared_ptr<SymbolIndexer::State>& state, function<void()> task) {
+	state->tasks++;
+	pool.Submit(TaskPriority::Background, [state, task = move(task)]() {
+		if (!state->cancelled)
+			task();
+		state->tasks--;
+	});
+}
+
+static void ScanSourceFiles(SymbolIndexer::State& state, const vector<string>& paths) {
+	PROFILE_SCOPE("SymbolIndexer::ScanFiles");
+	auto lexer = CppLexer();
+	auto scanned = vector<ScannedFile>();
+	for (const auto& path: paths) {
+		if (state.cancelled)
+			return;
+		if (ScanSourceFile(path, lexer, scanned.emplace_back()))
+			state.filesIndexed++;
+		else
+			scanned.pop_back();
+	}
+	lock_guard lock(state.scannedMutex);
+	state.scanned.insert(state.scanned.end(), make_move_iterator(scanned.begin()), make_move_iterator(scanned.end()));
+	state.scannedNum = static_cast<int>(state.scanned.size());
+}
+
+static void ScanDirectory(ThreadPool& pool, const shared_ptr<SymbolIndexer::State>& state, const string& directory) {
+	auto batch = vector<string>();
+	auto error = error_code();
+	auto entries = filesystem::directory_iterator(directory, error);
+	for (; !error && entries != filesystem::directory_iterator() && !state->cancelled; entries.increment(error)) {
+		auto name = entries->path().filename().string();
+		if (name.empty() || name.front() == '.')
+			continue;
+		auto statusError = error_code();
+		auto status = entries->symlink_status(statusError);
+		if (statusError)
+			continue;
+		auto path = entries->path().string();
+		if (filesystem::is_directory(status))
+			Spawn(pool, state, [&pool, state, path]() { ScanDirectory(pool, state, path); });
+		else if (filesystem::is_regular_file(status) && IsSourceFile(name)) {
+			batch.push_back(move(path));
+			if (batch.size() >= filesPerTask) {
+				Spawn(pool, state, [state = state.get(), paths = move(batch)]() { ScanSourceFiles(*state, paths); });
+				batch.clear();
+			}
+		}
+	}
+	ScanSourceFiles(*state, batch);
+}
+
+SymbolIndexer::~SymbolIndexer() {
+	Cancel();
+}
+
+void SymbolIndexer::Start(const string& root) {
+	Cancel();
+	state = make_shared<State>();
+	state->root = root;
+	Spawn(JobPool(), state, [state = state]() { ScanDirectory(JobPool(), state, state->root); });
+}
+
+void SymbolIndexer::Cancel() {
+	if (state)
+		state->cancelled = true;
+	state = nullptr;
+}
+
+bool SymbolIndexer::IsRunning() const {
+	return state && (state->tasks > 0 || state->scannedNum > 0);
+}
+
+int SymbolIndexer::FilesIndexed() const {
+	return state ? state->filesIndexed.load() : 0;
+}
+
+bool SymbolIndexer::MergeInto(SymbolIndex& index, int budget) {
+	if (!state || state->scannedNum == 0)
+		return false;
+	PROFILE_SCOPE("SymbolIndexer::MergeInto");
+	auto taken = vector<ScannedFile>();
+	{
+		lock_guard lock(state->scannedMutex);
+		auto occurrences = 0;
+		while (!state->scanned.empty() && occurrences < budget) {
+			occurrences += static_cast<int>(state->scanned.back().occurrences.size());
+			taken.push_back(move(state->scanned.back()));
+			state->scanned.pop_back();
+		}
+		state->scannedNum = static_cast<int>(state->scanned.size());
+	}
+	for (auto& file: taken)
+		index.AddFile(move(file));
+	return !taken.empty();
+}
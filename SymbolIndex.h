@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "Lexer.h"
+#include "TextEdit.h"
+
+struct SymbolOccurrence {
+	int symbol = 0;
+	int column = 0; // in bytes
+};
+
+struct SymbolLocation {
+	int file = 0;
+	int line = 0;
+	int column = 0;
+};
+
+struct SymbolCompletion {
+	std::string_view name; // valid as long as the index
+	int symbol = 0;
+	int count = 0;
+};
+
+// The identifiers of a file lexed whole, numbered within the file; SymbolIndex::AddFile() interns them.
+struct ScannedFile {
+	struct Occurrence {
+		int name = 0; // into `names`, or a symbol once added to an index
+		int line = 0;
+		int column = 0;
+	};
+	std::string path;
+	std::vector<std::string> names;
+	std::vector<Occurrence> occurrences; // in file order
+};
+
+// Which identifiers occur where in a set of files. Every name is interned once into blocks of characters that never
+// move, and a trie over the names keeps in every node the highest occurrence count below it, so the most frequent
+// completions of a prefix are found by visiting little more than their own nodes. The trie is also what names are
+// looked up in, and its nodes live in blocks too, so a growing index never pauses to rehash or copy it all.
+//
+// An open document keeps its occurrences per line, so an edit replaces just the lines it changed; like the minimap,
+// those lines are lexed on their own, so words inside a block comment spanning lines count as identifiers. Files
+// scanned from disk were lexed whole and keep one flat list. A closed document keeps its lines until the file is
+// scanned again, so it is opened again without indexing them anew while they have not changed.
+struct SymbolIndex {
+
+	SymbolIndex();
+
+	int SymbolsNum() const { return static_cast<int>(names.size()); }
+	std::string_view Name(int symbol) const { return names[symbol]; }
+	// Occurrences in all files.
+	int Count(int symbol) const { return counts[symbol]; }
+	// -1 when the name never occurred.
+	int Find(std::string_view name) const;
+
+	int FilesNum() const { return static_cast<int>(files.size()); }
+	const std::string& Path(int file) const { return files[file].path; }
+	// -1 when the path is not indexed.
+	int FileOf(const std::string& path) const;
+
+	// Makes `path` a document whose lines Sweep() indexes and ApplyLineChanges() keeps up, replacing what was indexed
+	// of it before, unless `unchanged`: its lines are those it was closed with, whose occurrences are then kept if
+	// it was not scanned since. Returns its file.
+	int OpenDocument(const std::string& path, int linesNum, bool unchanged = false);
+	// Keeps the occurrences of a document that is no longer edited, as if it had been scanned from disk.
+	void CloseDocument(int file);
+	// Every line is indexed anew, a slice at a time by Sweep().
+	void ResetDocument(int file, int linesNum);
+	// Indexes the changed lines right away; `lexer` may be null, which finds no identifiers.
+	void ApplyLineChanges(int file, const std::vector<std::string>& lines, const std::vector<LineChange>& changes,
+						  Lexer *lexer);
+	// Indexes up to `budget` lines not indexed since ResetDocument(). Returns whether lines are left.
+	bool Sweep(int file, const std::vector<std::string>& lines, Lexer *lexer, int budget);
+	// Adds or replaces a file scanned from disk, unless its path is an open document.
+	void AddFile(ScannedFile&& scanned);
+
+	// The `maxResults` identifiers starting with `prefix` that occur most often, most frequent first.
+	void Complete(std::string_view prefix, int maxResults, std::vector<SymbolCompletion>& results) const;
+	// Up to `maxResults` places where `symbol` occurs: those in `preferredFile` first, then file by file.
+	void Locations(int symbol, int maxResults, std::vector<SymbolLocation>& locations, int preferredFile = -1) const;
+
+private:
+	struct File {
+		std::string path;
+		bool isDocument = false;
+		int sweepLine = 0;
+		std::vector<std::vector<SymbolOccurrence>> lines; // of a document
+		std::vector<ScannedFile::Occurrence> occurrences; // of any other file, by symbol
+	};
+	struct TrieNode {
+		int parent = -1; // created before its children, so always at a lower index
+		int firstChild = -1;
+		int nextSibling = -1; // siblings are sorted by character
+		int symbol = -1; // the name ending here
+		int best = 0; // highest count of a symbol in the subtree
+		char character = 0;
+	};
+	static constexpr size_t blockSize = 64 * 1024;
+	static constexpr int trieBlockNodes = 16 * 1024;
+
+	std::vector<std::unique_ptr<char[]>> blocks;
+	char *blockCursor = nullptr; // free space of the block names are added to
+	size_t blockLeft = 0;
+	std::vector<std::string_view> names;
+	std::vector<int> counts;
+	std::vector<int> symbolNodes; // where each name ends in the trie
+	std::vector<std::unique_ptr<TrieNode[]>> trieBlocks;
+	int trieNodesNum = 0; // node 0 is the root
+	// Symbols whose count changed since the trie was last brought up to date.
+	std::vector<int> touched;
+	std::vector<bool> isTouched;
+	std::vector<File> files;
+	std::unordered_map<std::string, int> fileIds;
+
+	TrieNode& Node(int node) { return trieBlocks[node / trieBlockNodes][node % trieBlockNodes]; }
+	const TrieNode& Node(int node) const { return trieBlocks[node / trieBlockNodes][node % trieBlockNodes]; }
+	int AddNode(const TrieNode& node);
+	// The node `name` ends at, or -1.
+	int Descend(std::string_view name) const;
+	int Intern(std::string_view name);
+	void AddCount(int symbol, int delta);
+	void UpdateTrie();
+	int FileFor(const std::string& path);
+	void ClearOccurrences(File& file);
+	void IndexLine(File& file, const std::vector<std::string>& lines, int line, Lexer *lexer);
+};
+
+// Lexes the C and C++ sources under a directory on the JobPool, as Background tasks of a few files each, for
+// MergeInto() to add to a SymbolIndex on the UI thread a slice at a time. Hidden entries and symbolic links are skipped.
+struct SymbolIndexer {
+
+	~SymbolIndexer();
+
+	void Start(const std::string& root);
+	// Returns right away; tasks still queued return as soon as they run.
+	void Cancel();
+	// Whether files are still being lexed or waiting to be merged.
+	bool IsRunning() const;
+	int FilesIndexed() const;
+	// Adds lexed files to `index` until about `budget` occurrences were added. Returns whether any were.
+	bool MergeInto(SymbolIndex& index, int budget);
+
+	// What the tasks of one run share; they keep it alive past Cancel().
+	struct State;
+
+private:
+	std::shared_ptr<State> state;
+};
@@ -0,0 +1,91 @@
+#include "TextBatch.h"
+#include "Profiler.h"
+#include <rlgl.h>
+#include <algorithm>
+
+using namespace std;
+
+static const int quadsPerChunk = 1024; // well below rlgl's default batch, so a chunk never splits across a flush
+
+void TextBatch::Clear() {
+	for (auto& group: groups)
+		group.quads.clear();
+}
+
+bool TextBatch::Add(GlyphAtlas& atlas, int codepoint, Vector2 position, float scale, Color color) {
+	if (codepoint == ' ')
+		return true;
+	auto glyph = atlas.Find(codepoint);
+	if (!glyph || !glyph->ready)
+		return false;
+	if (glyph->page < 0)
+		return true;
+	Add(atlas.PageTexture(glyph->page), glyph->source, Rectangle {
+		position.x + glyph->offset.x * scale, position.y + glyph->offset.y * scale,
+		glyph->source.width * scale, glyph->source.height * scale
+	}, color);
+	return true;
+}
+
+void TextBatch::Add(const Font& font, int codepoint, Vector2 position, float size, Color color) {
+	if (codepoint == ' ' || font.texture.id == 0 || !font.recs || !font.glyphs)
+		return;
+	auto index = GetGlyphIndex(font, codepoint);
+	auto scale = size / static_cast<float>(font.baseSize);
+	auto padding = static_cast<float>(font.glyphPadding);
+	const auto& rectangle = font.recs[index];
+	auto source = Rectangle {
+		rectangle.x - padding, rectangle.y - padding, rectangle.width + 2 * padding, rectangle.height + 2 * padding
+	};
+	Add(font.texture, source, Rectangle {
+		position.x + (static_cast<float>(font.glyphs[index].offsetX) - padding) * scale,
+		position.y + (static_cast<float>(font.glyphs[index].offsetY) - padding) * scale,
+		source.width * scale, source.height * scale
+	}, color);
+}
+
+void TextBatch::Add(const Texture2D& texture, const Rectangle& source, const Rectangle& destination, Color color) {
+	auto group = find_if(groups.begin(), groups.end(), [&](const Group& group) { return group.texture.id == texture.id; });
+	if (group == groups.end())
+		group = groups.insert(groups.end(), Group {texture, {}});
+	auto width = static_cast<float>(texture.width), height = static_cast<float>(texture.height);
+	group->quads.push_back(Quad {
+		destination.x, destination.y, destination.x + destination.width, destination.y + destination.height,
+		source.x / width, source.y / height, (source.x + source.width) / width, (source.y + source.height) / height,
+		color
+	});
+}
+
+void TextBatch::Draw(Vector2 offset) const {
+	PROFILE_SCOPE("TextBatch::Draw");
+	for (const auto& group: groups)
+		for (size_t first = 0; first < group.quads.size(); first += quadsPerChunk) {
+			auto last = min(group.quads.size(), first + quadsPerChunk);
+			rlCheckRenderBatchLimit(static_cast<int>(last - first) * 4);
+			rlSetTexture(group.texture.id);
+			rlBegin(RL_QUADS);
+			for (auto i = first; i < last; i++) {
+				const auto& quad = group.quads[i];
+				auto left = quad.left + offset.x, top = quad.top + offset.y;
+				auto right = quad.right + offset.x, bottom = quad.bottom + offset.y;
+				rlColor4ub(quad.color.r, quad.color.g, quad.color.b, quad.color.a);
+				rlTexCoord2f(quad.u0, quad.v0);
+				rlVertex2f(left, top);
+				rlTexCoord2f(quad.u0, quad.v1);
+				rlVertex2f(left, bottom);
+				rlTexCoord2f(quad.u1, quad.v1);
+				rlVertex2f(right, bottom);
+				rlTexCoord2f(quad.u1, quad.v0);
+				rlVertex2f(right, top);
+			}
+			rlEnd();
+			rlSetTexture(0);
+		}
+}
+
+int TextBatch::QuadsNum() const {
+	auto count = 0;
+	for (const auto& group: groups)
+		count += static_cast<int>(group.quads.size());
+	return count;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <raylib.h>
+#include <vector>
+#include "GlyphAtlas.h"
+
+// Glyph quads of a block of text, built once and then submitted every frame with one rlBegin/rlEnd per texture,
+// instead of a DrawTexturePro call per glyph. Clear keeps the memory, so rebuilding allocates nothing once warm.
+struct TextBatch {
+
+	void Clear();
+	// Adds the glyph with its pen at `position`. False when the glyph is not drawable yet (it only shows once the atlas
+	// has uploaded it), so the batch should be rebuilt next frame.
+	bool Add(GlyphAtlas& atlas, int codepoint, Vector2 position, float scale, Color color);
+	// The same from a raylib font, for when no atlas is loaded.
+	void Add(const Font& font, int codepoint, Vector2 position, float size, Color color);
+	// Submits every quad moved by `offset`.
+	void Draw(Vector2 offset = {0, 0}) const;
+
+	bool IsEmpty() const { return QuadsNum() == 0; }
+	int QuadsNum() const;
+
+private:
+	struct Quad {
+		float left, top, right, bottom;
+		float u0, v0, u1, v1;
+		Color color;
+	};
+	struct Group {
+		Texture2D texture;
+		std::vector<Quad> quads;
+	};
+	std::vector<Group> groups; // one per texture; kept when cleared, with their capacity
+
+	void Add(const Texture2D& texture, const Rectangle& source, const Rectangle& destination, Color color);
+};
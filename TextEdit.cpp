@@ -0,0 +1,152 @@
+#include "TextEdit.h"
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+using namespace std;
+
+static int CountNewlines(const string& text) {
+	return static_cast<int>(count(text.begin(), text.end(), '\n'));
+}
+
+// Rebuilds lines [edits[begin].from.line, edits[end - 1].to.line] (shifted by `lineDelta`) with the edits applied,
+// splices the result back in, and returns how many lines were added.
+static int ApplyCluster(vector<string>& lines, const vector<TextEdit>& edits, size_t begin, size_t end,
+						int lineDelta, vector<TextPosition>& ends, vector<LineChange> *changes) {
+
+	const auto& first = edits[begin];
+	if (end - begin == 1 && first.from.line == first.to.line && first.text.find('\n') == string::npos) {
+		auto& line = lines[first.from.line + lineDelta];
+		line.replace(first.from.column, first.to.column - first.from.column, first.text);
+		ends.push_back({first.from.line + lineDelta, first.from.column + static_cast<int>(first.text.size())});
+		if (changes)
+			changes->push_back({first.from.line + lineDelta, 1, 1});
+		return 0;
+	}
+
+	auto firstLine = first.from.line + lineDelta;
+	auto lastLine = edits[end - 1].to.line + lineDelta;
+	auto replacement = vector<string>();
+	auto addedLines = 0;
+	for (auto i = begin; i < end; i++)
+		addedLines += CountNewlines(edits[i].text) - (edits[i].to.line - edits[i].from.line);
+	replacement.reserve(max(1, lastLine - firstLine + 1 + addedLines));
+	auto current = string();
+	auto source = TextPosition {firstLine, 0};
+
+	auto copyTo = [&](TextPosition target) {
+		while (source.line < target.line) {
+			if (current.empty() && source.column == 0)
+				replacement.push_back(move(lines[source.line]));
+			else {
+				current.append(lines[source.line], source.column);
+				replacement.push_back(move(current));
+			}
+			current.clear();
+			source = TextPosition {source.line + 1, 0};
+		}
+		current.append(lines[source.line], source.column, target.column - source.column);
+		source = target;
+	};
+
+	for (auto i = begin; i < end; i++) {
+		const auto& edit = edits[i];
+		copyTo(TextPosition {edit.from.line + lineDelta, edit.from.column});
+		size_t start = 0;
+		for (auto newline = edit.text.find('\n'); newline != string::npos; newline = edit.text.find('\n', start)) {
+			current.append(edit.text, start, newline - start);
+			replacement.push_back(move(current));
+			current.clear();
+			start = newline + 1;
+		}
+		current.append(edit.text, start);
+		ends.push_back({firstLine + static_cast<int>(replacement.size()), static_cast<int>(current.size())});
+		source = TextPosition {edit.to.line + lineDelta, edit.to.column};
+	}
+	copyTo(TextPosition {lastLine, static_cast<int>(lines[lastLine].size())});
+	replacement.push_back(move(current));
+
+	auto regionSize = lastLine - firstLine + 1;
+	auto replacementSize = static_cast<int>(replacement.size());
+	auto common = min(regionSize, replacementSize);
+	move(replacement.begin(), replacement.begin() + common, lines.begin() + firstLine);
+	if (replacementSize > regionSize)
+		lines.insert(lines.begin() + firstLine + common,
+					 make_move_iterator(replacement.begin() + common), make_move_iterator(replacement.end()));
+	else if (replacementSize < regionSize)
+		lines.erase(lines.begin() + firstLine + common, lines.begin() + firstLine + regionSize);
+	if (changes)
+		changes->push_back({firstLine, regionSize, replacementSize});
+	return replacementSize - regionSize;
+}
+
+vector<TextPosition> ApplyEdits(vector<string>& lines, const vector<TextEdit>& edits, vector<LineChange> *changes) {
+	auto ends = vector<TextPosition>();
+	ends.reserve(edits.size());
+	if (edits.empty())
+		return ends;
+
+	// Edits chained on shared lines form a cluster that has to be rebuilt together.
+	auto clusters = vector<size_t> {0};
+	auto clustersChangingLineCount = 0;
+	auto lineCountChange = 0;
+	for (size_t i = 0; i < edits.size(); i++) {
+		assert(edits[i].from <= edits[i].to);
+		assert(i == 0 || edits[i - 1].to <= edits[i].from);
+		if (i > 0 && edits[i].from.line != edits[i - 1].to.line) {
+			clustersChangingLineCount += lineCountChange != 0;
+			lineCountChange = 0;
+			clusters.push_back(i);
+		}
+		lineCountChange += CountNewlines(edits[i].text) - (edits[i].to.line - edits[i].from.line);
+	}
+	clustersChangingLineCount += lineCountChange != 0;
+	clusters.push_back(edits.size());
+
+	// Splicing clusters one by one shifts the tail of the document once per cluster that adds or removes
+	// lines, so when there are several of those, rebuild everything from the first to the last edit instead.
+	if (clustersChangingLineCount > 1) {
+		ApplyCluster(lines, edits, 0, edits.size(), 0, ends, changes);
+		return ends;
+	}
+
+	auto lineDelta = 0;
+	for (size_t i = 0; i + 1 < clusters.size(); i++)
+		lineDelta += ApplyCluster(lines, edits, clusters[i], clusters[i + 1], lineDelta, ends, changes);
+	return ends;
+}
+
+optional<TextPosition> MovePosition(const TextPosition& position, const TextEdit& edit, const TextPosition& end) {
+	if (position < edit.from)
+		return position;
+	if (position < edit.to)
+		return nullopt;
+	return position.line == edit.to.line
+		   ? TextPosition {end.line, end.column + position.column - edit.to.column}
+		   : TextPosition {position.line + end.line - edit.to.line, position.column};
+}
+
+TextEdit ReplaceLinesEdit(const vector<string>& lines, int firstLine, int removedLines, const vector<string>& addedLines) {
+	auto linesNum = static_cast<int>(lines.size());
+	auto edit = TextEdit();
+	if (firstLine + removedLines < linesNum) {
+		// Up to the start of the next line, so every added line brings its own newline.
+		edit.from = {firstLine, 0};
+		edit.to = {firstLine + removedLines, 0};
+		for (const auto& line: addedLines)
+			edit.text.append(line).push_back('\n');
+	}
+	else if (firstLine > 0) {
+		// Through the end of the text: from the end of the line before, so every added line starts with a newline.
+		edit.from = {firstLine - 1, static_cast<int>(lines[firstLine - 1].size())};
+		edit.to = {linesNum - 1, static_cast<int>(lines[linesNum - 1].size())};
+		for (const auto& line: addedLines)
+			edit.text.append("\n").append(line);
+	}
+	else {
+		edit.to = {linesNum - 1, static_cast<int>(lines[linesNum - 1].size())};
+		for (size_t i = 0; i < addedLines.size(); i++)
+			edit.text.append(i > 0 ? "\n" : "").append(addedLines[i]);
+	}
+	return edit;
+}
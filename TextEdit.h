@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <compare>
+#include <algorithm>
+#include <optional>
+
+struct TextPosition {
+	int line = 0;
+	int column = 0; // byte offset into the line
+	auto operator<=>(const TextPosition&) const = default;
+};
+
+// Replaces the range [from, to) with `text`, which may contain '\n'.
+struct TextEdit {
+	TextPosition from;
+	TextPosition to;
+	std::string text = "";
+};
+
+// `removedLines` lines starting at `line` were replaced by `addedLines` new ones. Changes are reported in the
+// order they were applied, so each `line` already accounts for the lines added or removed by earlier changes;
+// splicing them in order keeps any per-line side table in step with the document.
+struct LineChange {
+	int line = 0;
+	int removedLines = 0;
+	int addedLines = 0;
+};
+
+// Applies edits that are sorted by position and do not overlap, as one batch: every affected line is rebuilt
+// once and lines are shifted at most once, no matter how many edits there are. Returns, for every edit, the
+// position right after its inserted text in the resulting document.
+std::vector<TextPosition> ApplyEdits(std::vector<std::string>& lines, const std::vector<TextEdit>& edits,
+									 std::vector<LineChange> *changes = nullptr);
+
+// The edit that replaces `removedLines` whole lines starting at `firstLine` with `addedLines`. `lines` must not be
+// empty; replacing all of them with nothing leaves one empty line.
+TextEdit ReplaceLinesEdit(const std::vector<std::string>& lines, int firstLine, int removedLines,
+						  const std::vector<std::string>& addedLines);
+
+// Where `position` ends up after `edit`, whose inserted text ended at `end`; nullopt when the edit replaced it.
+std::optional<TextPosition> MovePosition(const TextPosition& position, const TextEdit& edit, const TextPosition& end);
+
+// Splices a per-line side table the same way the lines were changed; new entries are `value`.
+template<typename T>
+void ApplyLineChanges(std::vector<T>& table, const std::vector<LineChange>& changes, const T& value = T()) {
+	for (const auto& change: changes) {
+		auto common = std::min(change.removedLines, change.addedLines);
+		std::fill(table.begin() + change.line, table.begin() + change.line + common, value);
+		if (change.addedLines > change.removedLines)
+			table.insert(table.begin() + change.line + common, change.addedLines - common, value);
+		else if (change.removedLines > change.addedLines)
+			table.erase(table.begin() + change.line + common, table.begin() + change.line + change.removedLines);
+	}
+}
@@ -0,0 +1,268 @@
+#include "TextFile.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+static const uint64_t hashBasis = 14695981039346656037ull; // FNV-1a, over the hashes of the blocks
+static const uint64_t hashPrime = 1099511628211ull;
+
+FileContents::~FileContents() {
+#if defined(__unix__) || defined(__APPLE__)
+	if (mapping)
+		munmap(mapping, mappedSize);
+#endif
+}
+
+bool FileContents::Load(const string& path, string& buffer, uint64_t mapFrom) {
+#if defined(__unix__) || defined(__APPLE__)
+	auto file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (file < 0)
+		return false;
+	struct stat status = {};
+	auto loaded = fstat(file, &status) == 0;
+	auto size = loaded ? static_cast<size_t>(status.st_size) : 0;
+	if (loaded && size >= mapFrom && size > 0) {
+		mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (mapping == MAP_FAILED) {
+			mapping = nullptr;
+			loaded = false;
+		}
+		else {
+			mappedSize = size;
+			madvise(mapping, size, MADV_SEQUENTIAL);
+			data = string_view(static_cast<const char *>(mapping), size);
+		}
+	}
+	else if (loaded) {
+		buffer.resize(size);
+		size_t done = 0;
+		while (done < size) {
+			auto bytes = read(file, buffer.data() + done, size - done);
+			if (bytes < 0 && errno == EINTR)
+				continue;
+			if (bytes <= 0)
+				break;
+			done += static_cast<size_t>(bytes);
+		}
+		data = string_view(buffer.data(), done); // shorter when the file was truncated meanwhile
+	}
+	close(file);
+	return loaded;
+#else
+	auto file = ifstream(path, ios::binary);
+	if (!file.is_open())
+		return false;
+	buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+	data = buffer;
+	return true;
+#endif
+}
+
+size_t CountNewlines(string_view text) {
+	auto data = text.data();
+	auto size = text.size();
+	size_t count = 0, i = 0;
+#if defined(__SSE2__)
+	auto newlines = _mm_set1_epi8('\n');
+	for (; i + 16 <= size; i += 16) {
+		auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+		count += static_cast<size_t>(popcount(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newlines)))));
+	}
+#elif defined(__ARM_NEON)
+	auto newlines = vdupq_n_u8('\n');
+	for (; i + 16 <= size; i += 16) {
+		auto equal = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(data + i)), newlines);
+		// Narrowed to four bits per byte, as in FindLiteral().
+		auto mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+		count += static_cast<size_t>(popcount(mask)) / 4;
+	}
+#endif
+	for (; i < size; i++)
+		count += data[i] == '\n';
+	return count;
+}
+
+static int64_t ModifiedTime(const string& path) {
+	auto error = error_code();
+	return filesystem::last_write_time(path, error).time_since_epoch().count();
+}
+
+bool ReadLines(const string& path, ThreadPool& pool, vector<string>& lines, FileStamp& stamp,
+			   vector<uint64_t>& blockLines, vector<string> *copy) {
+	PROFILE_SCOPE("TextFile::Read");
+	auto modifiedTime = ModifiedTime(path);
+	auto buffer = string();
+	auto contents = FileContents();
+	if (!contents.Load(path, buffer))
+		return false;
+	auto data = contents.data;
+	auto blocksNum = (data.size() + textBlockSize - 1) / textBlockSize;
+
+	// A line starts in the block that holds its first byte, after the newline ending the line before.
+	auto starts = vector<uint64_t>();
+	if (stamp.modifiedTime == modifiedTime && stamp.size == data.size() && blockLines.size() == blocksNum + 1)
+		starts = blockLines;
+	auto count = [&]() {
+		starts.assign(blocksNum + 1, 0);
+		pool.ForEach(blocksNum, [&](size_t index) {
+			auto from = index * textBlockSize;
+			auto to = min(from + textBlockSize, data.size());
+			// The newline before the block starts its first line; the last newline of the file starts none.
+			starts[index + 1] = index == 0 ? 1 + CountNewlines(data.substr(0, to - 1))
+										   : CountNewlines(data.substr(from - 1, to - from));
+		});
+		for (size_t i = 0; i < blocksNum; i++)
+			starts[i + 1] += starts[i];
+	};
+	if (starts.empty())
+		count();
+
+	auto read = vector<string>(), readCopy = vector<string>();
+	auto hashes = vector<uint64_t>(blocksNum);
+	auto miscounted = atomic<bool>(false);
+	auto split = [&]() {
+		read.clear();
+		read.resize(starts.back());
+		readCopy.clear();
+		readCopy.resize(copy ? starts.back() : 0);
+		pool.ForEach(blocksNum, [&](size_t index) {
+			auto from = index * textBlockSize;
+			auto to = min(from + textBlockSize, data.size());
+			hashes[index] = std::hash<string_view>()(data.substr(from, to - from));
+			auto line = starts[index];
+			auto position = index == 0 ? size_t(0) : min(data.find('\n', from - 1), data.size() - 1) + 1;
+			for (; position < to; line++) {
+				auto end = data.find('\n', position);
+				if (end == string_view::npos)
+					end = data.size();
+				if (line >= starts[index + 1]) {
+					miscounted = true;
+					return;
+				}
+				read[line].assign(data.data() + position, end - position);
+				if (copy)
+					readCopy[line] = read[line];
+				position = end + 1;
+			}
+			if (line != starts[index + 1])
+				miscounted = true;
+		});
+	};
+	split();
+	// Counts kept from before may be off if the file was changed within the same tick; then they are counted again.
+	if (miscounted) {
+		miscounted = false;
+		count();
+		split();
+	}
+	if (read.empty()) {
+		read.push_back("");
+		readCopy.resize(copy ? 1 : 0);
+	}
+
+	stamp = FileStamp {modifiedTime, data.size(), hashBasis};
+	for (auto hash: hashes)
+		stamp.hash = (stamp.hash ^ hash) * hashPrime;
+	stamp.hash = max<uint64_t>(stamp.hash, 1);
+	blockLines = move(starts);
+	lines = move(read);
+	if (copy)
+		*copy = move(readCopy);
+	return true;
+}
+
+bool ReadLineRange(const string& path, const FileStamp& stamp, const vector<uint64_t>& blockLines, uint64_t from,
+				   uint64_t to, vector<string>& lines) {
+	PROFILE_SCOPE("TextFile::ReadLineRange");
+	if (!stamp.IsKnown() || stamp.modifiedTime != ModifiedTime(path))
+		return false;
+	auto buffer = string();
+	auto contents = FileContents();
+	if (!contents.Load(path, buffer))
+		return false;
+	auto data = contents.data;
+	auto blocksNum = (data.size() + textBlockSize - 1) / textBlockSize;
+	if (data.size() != stamp.size || blockLines.size() != blocksNum + 1)
+		return false;
+	const auto& starts = blockLines;
+	to = min(to, starts.back());
+	lines.clear();
+	if (from >= to)
+		return true;
+	lines.reserve(to - from);
+	// The block the first line starts in, as in ReadLines().
+	auto index = static_cast<size_t>(upper_bound(starts.begin(), starts.end(), from) - starts.begin()) - 1;
+	auto position = index == 0 ? size_t(0) : min(data.find('\n', index * textBlockSize - 1), data.size() - 1) + 1;
+	for (auto line = starts[index]; line < to && position <= data.size(); line++) {
+		auto end = data.find('\n', position);
+		if (end == string_view::npos)
+			end = data.size();
+		if (line >= from)
+			lines.emplace_back(data.data() + position, end - position);
+		position = end + 1;
+	}
+	return true;
+}
+
+bool WriteLines(const string& path, const vector<string>& lines, FileStamp& stamp, vector<uint64_t>& blockLines) {
+	PROFILE_SCOPE("TextFile::Write");
+	auto file = ofstream(path, ios::binary | ios::trunc);
+	if (!file.is_open())
+		return false;
+	auto hash = hashBasis;
+	auto blockStarts = vector<uint64_t>(); // lines starting in each block
+	auto pending = string();
+	uint64_t size = 0;
+	// Whole blocks are hashed and written as they fill up, the last one when everything else is.
+	auto write = [&](bool last) {
+		size_t taken = 0;
+		for (; taken < pending.size() && (last || pending.size() - taken >= textBlockSize); taken += textBlockSize) {
+			auto text = string_view(pending).substr(taken, textBlockSize);
+			hash = (hash ^ std::hash<string_view>()(text)) * hashPrime;
+			file.write(text.data(), static_cast<streamsize>(text.size()));
+		}
+		pending.erase(0, taken);
+	};
+	for (const auto& line: lines) {
+		auto block = size / textBlockSize;
+		if (blockStarts.size() <= block)
+			blockStarts.resize(block + 1, 0);
+		blockStarts[block]++;
+		size += line.size() + 1;
+		pending += line;
+		pending.push_back('\n');
+		if (pending.size() >= 2 * textBlockSize)
+			write(false);
+	}
+	write(true);
+	file.close();
+	if (!file)
+		return false;
+	blockStarts.resize((size + textBlockSize - 1) / textBlockSize, 0);
+	blockLines.assign(1, 0);
+	for (auto starts: blockStarts)
+		blockLines.push_back(blockLines.back() + starts);
+	stamp = FileStamp {ModifiedTime(path), size, max<uint64_t>(hash, 1)};
+	return true;
+}
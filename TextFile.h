@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ThreadPool.h"
+
+// The contents of a file: mapped when at least `mapFrom` bytes, otherwise read into `buffer`.
+struct FileContents {
+	static constexpr uint64_t mapThreshold = 1 << 20;
+
+	std::string_view data;
+
+	FileContents() = default;
+	FileContents(const FileContents&) = delete;
+	FileContents& operator=(const FileContents&) = delete;
+	~FileContents();
+
+	bool Load(const std::string& path, std::string& buffer, uint64_t mapFrom = mapThreshold);
+
+private:
+	void *mapping = nullptr;
+	size_t mappedSize = 0;
+};
+
+size_t CountNewlines(std::string_view text);
+
+// A file as it was read or written, to tell later whether what was derived from it still holds.
+struct FileStamp {
+	int64_t modifiedTime = 0; // ticks of std::filesystem::file_time_type
+	uint64_t size = 0;
+	uint64_t hash = 0; // of the bytes, a block at a time; 0 when not known
+
+	bool operator==(const FileStamp&) const = default;
+	bool IsKnown() const { return hash != 0; }
+};
+
+// Lines of a text file are read and written in blocks of this many bytes; `blockLines` lists how many lines start
+// before each block, so that every block can be split straight into its place.
+static constexpr size_t textBlockSize = 1 << 20;
+
+// Reads the file at `path` into `lines`, split like std::getline, at least one, and into `copy` too when given. The
+// blocks are split and hashed side by side on `pool`; their lines are counted first, unless `blockLines` comes with a
+// `stamp` of the same modified time and size. Fills `stamp` and `blockLines` for what was read. Returns false, leaving
+// the rest alone, when the file cannot be read.
+bool ReadLines(const std::string& path, ThreadPool& pool, std::vector<std::string>& lines, FileStamp& stamp,
+			   std::vector<uint64_t>& blockLines, std::vector<std::string> *copy = nullptr);
+// Reads lines `from` to `to` of the file at `path` into `lines`, fewer past its end, by the `blockLines` of a `stamp`
+// of the same modified time and size, without reading the blocks around them, e.g. to show those lines first while
+// the rest is read. Returns false when the file cannot be read or no longer matches them.
+bool ReadLineRange(const std::string& path, const FileStamp& stamp, const std::vector<uint64_t>& blockLines,
+				   uint64_t from, uint64_t to, std::vector<std::string>& lines);
+// Writes `lines`, each followed by a newline, and fills `stamp` and `blockLines` for what was written.
+bool WriteLines(const std::string& path, const std::vector<std::string>& lines, FileStamp& stamp,
+				std::vector<uint64_t>& blockLines);
@@ -0,0 +1,112 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+using namespace std;
+
+// Set on the pool's own threads, so Submit() can tell them apart.
+static thread_local ThreadPool *currentPool = nullptr;
+static thread_local int currentWorker = -1;
+// Of the task running on this thread, which the tasks it submits inherit.
+static thread_local auto currentPriority = TaskPriority::Normal;
+
+ThreadPool::ThreadPool(int threadsNum) {
+	if (threadsNum <= 0)
+		threadsNum = max(1, static_cast<int>(thread::hardware_concurrency()));
+	for (auto i = 0; i < threadsNum; i++)
+		workers.push_back(make_unique<Worker>());
+	// Started once every deque exists, since any worker may steal from any other.
+	for (auto i = 0; i < threadsNum; i++)
+		workers[static_cast<size_t>(i)]->thread = thread([this, i]() { Run(i); });
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto& worker: workers)
+		worker->thread.join();
+}
+
+void ThreadPool::Submit(function<void()> task) {
+	Submit(currentPriority, move(task));
+}
+
+void ThreadPool::Submit(TaskPriority priority, function<void()> task) {
+	auto index = currentPool == this ? currentWorker : static_cast<int>(nextWorker++ % workers.size());
+	{
+		auto& worker = *workers[static_cast<size_t>(index)];
+		lock_guard lock(worker.mutex);
+		worker.tasks[static_cast<int>(priority)].push_back(move(task));
+	}
+	{
+		lock_guard lock(sleepMutex);
+		queued++;
+	}
+	wake.notify_one();
+}
+
+void ThreadPool::ForEach(size_t count, const function<void(size_t)>& work) {
+	struct Progress {
+		atomic<size_t> next = 0;
+		atomic<size_t> done = 0;
+	};
+	// Outlives this call in the tasks that start late; those never touch `work`.
+	auto progress = make_shared<Progress>();
+	auto run = [progress, count, &work]() {
+		for (size_t index; (index = progress->next++) < count;) {
+			work(index);
+			if (++progress->done == count)
+				progress->done.notify_all();
+		}
+	};
+	for (size_t i = 1; i < min(workers.size() + 1, count); i++)
+		Submit(TaskPriority::Visible, run);
+	run();
+	for (auto done = progress->done.load(); done < count; done = progress->done.load())
+		progress->done.wait(done);
+}
+
+bool ThreadPool::Take(int index, function<void()>& task, TaskPriority& priority) {
+	auto workersNum = static_cast<int>(workers.size());
+	for (auto level = 0; level < prioritiesNum; level++)
+		for (auto i = 0; i < workersNum; i++) {
+			auto& worker = *workers[static_cast<size_t>((index + i) % workersNum)];
+			lock_guard lock(worker.mutex);
+			auto& tasks = worker.tasks[level];
+			if (tasks.empty())
+				continue;
+			if (i == 0) {
+				task = move(tasks.back());
+				tasks.pop_back();
+			}
+			else {
+				task = move(tasks.front());
+				tasks.pop_front();
+			}
+			priority = static_cast<TaskPriority>(level);
+			queued--;
+			return true;
+		}
+	return false;
+}
+
+void ThreadPool::Run(int index) {
+	currentPool = this;
+	currentWorker = index;
+	auto task = function<void()>();
+	auto priority = TaskPriority();
+	while (true) {
+		if (Take(index, task, priority)) {
+			currentPriority = priority;
+			task();
+			task = nullptr;
+			continue;
+		}
+		auto lock = unique_lock(sleepMutex);
+		wake.wait(lock, [&]() { return stopping || queued > 0; });
+		if (stopping)
+			return;
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// What a task is for, in the order workers take them: work the user waits to see, e.g. the file being opened or text
+// being decompressed for the viewport, then work they asked for, then work nobody waits for, like indexing.
+enum class TaskPriority {
+	Visible, Normal, Background
+};
+
+// Worker threads, one per core by default, each with a deque per priority. A worker runs the task it queued last
+// first, so a task that splits its work keeps the pieces on the thread that has their data warm; a worker out of
+// tasks steals the oldest one of another, which is usually the biggest piece left. Tasks still queued when the pool
+// is destroyed are dropped without running.
+struct ThreadPool {
+
+	explicit ThreadPool(int threadsNum = 0);
+	~ThreadPool();
+
+	int ThreadsNum() const { return static_cast<int>(workers.size()); }
+	// From a worker of this pool the task goes on that worker's deque, from any other thread on the next one's. A worker
+	// takes every task of a higher priority, its own or stolen, before one of a lower priority; a task already running
+	// is not interrupted.
+	void Submit(TaskPriority priority, std::function<void()> task);
+	// With the priority of the task that submits it, or Normal from a thread that is not running one.
+	void Submit(std::function<void()> task);
+	// Runs `work` for every index in [0, count) on the workers and the calling thread, and returns when all have run.
+	// Workers that get to it after every index was taken return at once, so a busy pool only means fewer helpers. The
+	// caller waits, so the helpers are Visible.
+	void ForEach(size_t count, const std::function<void(size_t)>& work);
+
+private:
+	static constexpr int prioritiesNum = 3;
+
+	struct Worker {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks[prioritiesNum]; // by TaskPriority
+		std::thread thread;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::atomic<bool> stopping = false;
+	std::atomic<unsigned> nextWorker = 0;
+	// Queued tasks not taken by any worker yet; changed under `sleepMutex` when it goes up, so no wake-up is lost.
+	std::atomic<int> queued = 0;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+
+	void Run(int index);
+	bool Take(int index, std::function<void()>& task, TaskPriority& priority);
+};
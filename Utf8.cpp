@@ -0,0 +1,224 @@
+#include "Utf8.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+bool IsAscii(string_view text) {
+	auto data = text.data();
+	auto size = text.size();
+	size_t i = 0;
+#if defined(__SSE2__)
+	auto bits = _mm_setzero_si128();
+	for (; i + 16 <= size; i += 16)
+		bits = _mm_or_si128(bits, _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)));
+	if (_mm_movemask_epi8(bits) != 0)
+		return false;
+#elif defined(__ARM_NEON)
+	auto bits = vdupq_n_u8(0);
+	for (; i + 16 <= size; i += 16)
+		bits = vorrq_u8(bits, vld1q_u8(reinterpret_cast<const uint8_t *>(data + i)));
+	if (vmaxvq_u8(bits) >= 0x80)
+		return false;
+#endif
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		if (word & 0x8080808080808080ull)
+			return false;
+	}
+	for (; i < size; i++)
+		if (static_cast<unsigned char>(data[i]) >= 0x80)
+			return false;
+	return true;
+}
+
+string EncodeUtf8(int codepoint) {
+	auto text = string();
+	if (codepoint < 0 || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF))
+		codepoint = 0xFFFD;
+	if (codepoint < 0x80)
+		text.push_back(static_cast<char>(codepoint));
+	else if (codepoint < 0x800) {
+		text.push_back(static_cast<char>(0xC0 | codepoint >> 6));
+		text.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+	}
+	else if (codepoint < 0x10000) {
+		text.push_back(static_cast<char>(0xE0 | codepoint >> 12));
+		text.push_back(static_cast<char>(0x80 | (codepoint >> 6 & 0x3F)));
+		text.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+	}
+	else {
+		text.push_back(static_cast<char>(0xF0 | codepoint >> 18));
+		text.push_back(static_cast<char>(0x80 | (codepoint >> 12 & 0x3F)));
+		text.push_back(static_cast<char>(0x80 | (codepoint >> 6 & 0x3F)));
+		text.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+	}
+	return text;
+}
+
+int DecodeUtf8(string_view text, size_t& offset) {
+	auto lead = static_cast<unsigned char>(text[offset]);
+	if (lead < 0x80) {
+		offset++;
+		return lead;
+	}
+	auto length = lead >= 0xF0 && lead < 0xF5 ? 4 : lead >= 0xE0 && lead < 0xF0 ? 3 : lead >= 0xC2 && lead < 0xE0 ? 2 : 0;
+	if (length == 0 || offset + length > text.size()) {
+		offset++;
+		return 0xFFFD;
+	}
+	auto codepoint = static_cast<int>(lead & (0x7F >> length));
+	for (auto i = 1; i < length; i++) {
+		auto c = static_cast<unsigned char>(text[offset + i]);
+		if ((c & 0xC0) != 0x80) {
+			offset++;
+			return 0xFFFD;
+		}
+		codepoint = codepoint << 6 | (c & 0x3F);
+	}
+	// Overlong forms and surrogates are malformed too.
+	static const int minimum[] = {0, 0, 0x80, 0x800, 0x10000};
+	if (codepoint < minimum[length] || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+		offset++;
+		return 0xFFFD;
+	}
+	offset += length;
+	return codepoint;
+}
+
+static bool ExtendsCluster(int codepoint) {
+	return (codepoint >= 0x0300 && codepoint <= 0x036F) || // combining diacritical marks
+		   (codepoint >= 0x1AB0 && codepoint <= 0x1AFF) ||
+		   (codepoint >= 0x1DC0 && codepoint <= 0x1DFF) ||
+		   (codepoint >= 0x20D0 && codepoint <= 0x20FF) ||
+		   (codepoint >= 0xFE20 && codepoint <= 0xFE2F) ||
+		   (codepoint >= 0xFE00 && codepoint <= 0xFE0F) || // variation selectors
+		   (codepoint >= 0xE0100 && codepoint <= 0xE01EF) ||
+		   (codepoint >= 0x1F3FB && codepoint <= 0x1F3FF) || // emoji skin tones
+		   codepoint == 0x200D; // zero width joiner
+}
+
+static bool IsRegionalIndicator(int codepoint) {
+	return codepoint >= 0x1F1E6 && codepoint <= 0x1F1FF;
+}
+
+size_t NextClusterStart(string_view text, size_t offset) {
+	if (offset >= text.size())
+		return text.size();
+	auto first = DecodeUtf8(text, offset);
+	auto previous = first;
+	while (offset < text.size() && static_cast<unsigned char>(text[offset]) >= 0x80) {
+		auto next = offset;
+		auto codepoint = DecodeUtf8(text, next);
+		auto joined = ExtendsCluster(codepoint) || previous == 0x200D ||
+					  (IsRegionalIndicator(first) && IsRegionalIndicator(codepoint) && previous == first);
+		if (!joined)
+			break;
+		previous = codepoint;
+		offset = next;
+	}
+	return offset;
+}
+
+// ColumnIndex
+
+bool ColumnIndex::IsAsciiLine(int line) {
+	if (kinds.size() != lines.size())
+		Clear();
+	auto& kind = kinds[line];
+	if (kind == LineKind::Unknown)
+		kind = IsAscii(lines[line]) ? LineKind::Ascii : LineKind::Mixed;
+	return kind == LineKind::Ascii;
+}
+
+const ColumnIndex::MixedLine *ColumnIndex::Mixed(int line) {
+	if (IsAsciiLine(line))
+		return nullptr;
+	auto [entry, inserted] = mixedLines.try_emplace(line);
+	if (inserted) {
+		const auto& text = lines[line];
+		auto& mixed = entry->second;
+		for (size_t offset = 0; offset < text.size(); offset = NextClusterStart(text, offset)) {
+			if (mixed.width % stride == 0)
+				mixed.starts.push_back(static_cast<int>(offset));
+			mixed.width++;
+		}
+	}
+	return &entry->second;
+}
+
+int ColumnIndex::Width(int line) {
+	auto mixed = Mixed(line);
+	return mixed ? mixed->width : static_cast<int>(lines[line].size());
+}
+
+int ColumnIndex::ColumnOf(int line, int byte) {
+	auto mixed = Mixed(line);
+	if (!mixed)
+		return byte;
+	const auto& text = lines[line];
+	if (byte >= static_cast<int>(text.size()))
+		return mixed->width + byte - static_cast<int>(text.size());
+	auto entry = upper_bound(mixed->starts.begin(), mixed->starts.end(), byte) - 1;
+	auto column = static_cast<int>(entry - mixed->starts.begin()) * stride;
+	for (auto offset = static_cast<size_t>(*entry);; column++) {
+		offset = NextClusterStart(text, offset);
+		if (offset > static_cast<size_t>(byte))
+			return column;
+	}
+}
+
+int ColumnIndex::ByteOf(int line, int column) {
+	auto mixed = Mixed(line);
+	if (!mixed)
+		return column;
+	const auto& text = lines[line];
+	if (column >= mixed->width)
+		return static_cast<int>(text.size()) + column - mixed->width;
+	auto offset = static_cast<size_t>(mixed->starts[column / stride]);
+	for (auto i = 0; i < column % stride; i++)
+		offset = NextClusterStart(text, offset);
+	return static_cast<int>(offset);
+}
+
+int ColumnIndex::NextBoundary(int line, int byte) {
+	if (IsAsciiLine(line))
+		return byte + 1;
+	return static_cast<int>(NextClusterStart(lines[line], byte));
+}
+
+int ColumnIndex::PreviousBoundary(int line, int byte) {
+	if (IsAsciiLine(line))
+		return byte - 1;
+	auto start = ByteOf(line, ColumnOf(line, byte));
+	return start < byte ? start : ByteOf(line, ColumnOf(line, byte) - 1);
+}
+
+void ColumnIndex::ApplyLineChanges(const vector<LineChange>& changes) {
+	if (kinds.empty())
+		return;
+	for (const auto& change: changes) {
+		auto delta = change.addedLines - change.removedLines;
+		for (auto line = change.line; line < change.line + change.removedLines; line++)
+			mixedLines.erase(line);
+		if (delta != 0 && !mixedLines.empty()) {
+			auto shifted = unordered_map<int, MixedLine>();
+			for (auto& [line, mixed]: mixedLines)
+				shifted.emplace(line >= change.line + change.removedLines ? line + delta : line, std::move(mixed));
+			mixedLines = std::move(shifted);
+		}
+	}
+	::ApplyLineChanges(kinds, changes, LineKind::Unknown);
+}
+
+void ColumnIndex::Clear() {
+	kinds.assign(lines.size(), LineKind::Unknown);
+	mixedLines.clear();
+}
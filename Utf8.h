@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "TextEdit.h"
+
+// Whether every byte is below 0x80; checks 16 bytes at a time.
+bool IsAscii(std::string_view text);
+
+std::string EncodeUtf8(int codepoint);
+// Decodes the code point starting at `offset` and moves `offset` past it. Malformed bytes decode one at a time
+// as U+FFFD, so any byte sequence can be walked.
+int DecodeUtf8(std::string_view text, size_t& offset);
+
+// Start of the grapheme cluster after the one starting at `offset`. Clusters are approximated as a code point
+// followed by combining marks, variation selectors, emoji modifiers and ZWJ-joined code points; a pair of regional
+// indicators (a flag) is one cluster too.
+size_t NextClusterStart(std::string_view text, size_t offset);
+
+// Maps byte offsets in lines to display columns, one per grapheme cluster.
+//
+// Whether a line is pure ASCII is checked once and remembered, and then a byte is a column. Other lines get a
+// sparse index of where every 64th cluster starts, built the first time they are asked about.
+struct ColumnIndex {
+
+	explicit ColumnIndex(const std::vector<std::string>& lines) : lines(lines) {}
+
+	bool IsAsciiLine(int line);
+	int Width(int line);
+	// Column of the cluster containing `byte`; past the end of the line, every byte is a column.
+	int ColumnOf(int line, int byte);
+	// Byte offset of the cluster at `column`; past the end of the line, every column is a byte.
+	int ByteOf(int line, int column);
+	int NextBoundary(int line, int byte);
+	int PreviousBoundary(int line, int byte);
+
+	// Keeps the cache in step with an edit; only the changed lines are forgotten.
+	void ApplyLineChanges(const std::vector<LineChange>& changes);
+	void Clear();
+
+private:
+	static const int stride = 64; // clusters between two entries of a sparse index
+
+	enum class LineKind : uint8_t { Unknown, Ascii, Mixed };
+	struct MixedLine {
+		int width = 0;
+		std::vector<int> starts; // byte offset of cluster i * stride
+	};
+
+	const std::vector<std::string>& lines;
+	std::vector<LineKind> kinds;
+	std::unordered_map<int, MixedLine> mixedLines;
+
+	const MixedLine *Mixed(int line);
+};
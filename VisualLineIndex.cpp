@@ -0,0 +1,283 @@
+#include "VisualLineIndex.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <bit>
+#include <iterator>
+#include <numeric>
+
+using namespace std;
+
+// Lines a block is made with. It is split once it holds twice as many, and merged with its neighbours once it holds
+// less than a quarter.
+static const int blockLines = 256;
+
+static void AddToTree(vector<int>& tree, size_t block, int delta) {
+	for (auto i = block + 1; i < tree.size(); i += i & -i)
+		tree[i] += delta;
+}
+
+static int SumBefore(const vector<int>& tree, size_t block) {
+	auto sum = 0;
+	for (auto i = block; i > 0; i -= i & -i)
+		sum += tree[i];
+	return sum;
+}
+
+// Descends the tree for the most blocks that sum to no more than `remaining`, which is left with the rest.
+static size_t BlocksWithin(const vector<int>& tree, int& remaining) {
+	size_t position = 0;
+	for (auto step = bit_floor(tree.size()); step > 0; step >>= 1)
+		if (position + step < tree.size() && tree[position + step] <= remaining) {
+			position += step;
+			remaining -= tree[position];
+		}
+	return position;
+}
+
+void VisualLineIndex::BuildTrees() {
+	// Linear-time construction: every node passes its sums on to its parent once.
+	auto size = blocks.size();
+	lineTree.assign(size + 1, 0);
+	rowTree.assign(size + 1, 0);
+	for (size_t i = 1; i <= size; i++) {
+		lineTree[i] += static_cast<int>(blocks[i - 1].rows.size());
+		rowTree[i] += blocks[i - 1].rowsNum;
+		auto parent = i + (i & -i);
+		if (parent <= size) {
+			lineTree[parent] += lineTree[i];
+			rowTree[parent] += rowTree[i];
+		}
+	}
+}
+
+pair<size_t, int> VisualLineIndex::Locate(int line) const {
+	if (line >= linesNum)
+		return {blocks.size() - 1, static_cast<int>(blocks.back().rows.size())};
+	// Blocks emptied by an erase add no lines, so the descent passes them.
+	auto offset = line;
+	auto block = BlocksWithin(lineTree, offset);
+	return {block, offset};
+}
+
+int VisualLineIndex::Rows(int line) const {
+	auto [block, offset] = Locate(line);
+	return blocks[block].rows[offset];
+}
+
+bool VisualLineIndex::IsHidden(int line) const {
+	auto [block, offset] = Locate(line);
+	return blocks[block].hidden[offset];
+}
+
+void VisualLineIndex::MeasureAll(const vector<string>& lines) {
+	totalRows = 0;
+	auto line = 0;
+	for (auto& block: blocks) {
+		block.rowsNum = 0;
+		for (size_t i = 0; i < block.rows.size(); i++, line++) {
+			block.rows[i] = RowsOf(lines, line, block.hidden[i]);
+			block.rowsNum += block.rows[i];
+		}
+		totalRows += block.rowsNum;
+	}
+	BuildTrees();
+	sweepLine = LinesNum();
+}
+
+void VisualLineIndex::Measure(const vector<string>& lines, int firstLine, int lastLine,
+							  const vector<pair<int, int>> *hiddenRanges) {
+	firstLine = max(firstLine, 0);
+	lastLine = min(lastLine, LinesNum() - 1);
+	if (firstLine > lastLine)
+		return;
+	auto [block, offset] = Locate(firstLine);
+	auto range = size_t(0);
+	// A block at a time, so the tree is updated once for each.
+	for (auto line = firstLine; line <= lastLine; block++, offset = 0) {
+		auto& rows = blocks[block].rows;
+		auto& hidden = blocks[block].hidden;
+		auto delta = 0;
+		for (; offset < static_cast<int>(rows.size()) && line <= lastLine; offset++, line++) {
+			if (hiddenRanges) {
+				while (range < hiddenRanges->size() && (*hiddenRanges)[range].second < line)
+					range++;
+				hidden[offset] = range < hiddenRanges->size() && (*hiddenRanges)[range].first <= line;
+			}
+			auto count = RowsOf(lines, line, hidden[offset]);
+			delta += count - rows[offset];
+			rows[offset] = count;
+		}
+		if (delta != 0) {
+			blocks[block].rowsNum += delta;
+			totalRows += delta;
+			AddToTree(rowTree, block, delta);
+		}
+	}
+}
+
+void VisualLineIndex::InsertLines(const vector<string>& lines, int line, int count) {
+	if (blocks.empty()) {
+		blocks.emplace_back();
+		BuildTrees();
+	}
+	auto [block, offset] = Locate(line);
+	auto& rows = blocks[block].rows;
+	rows.insert(rows.begin() + offset, static_cast<size_t>(count), 0);
+	blocks[block].hidden.insert(blocks[block].hidden.begin() + offset, static_cast<size_t>(count), char(false));
+	auto added = 0;
+	for (auto i = 0; i < count; i++)
+		added += rows[offset + i] = RowsOf(lines, line + i, false);
+	blocks[block].rowsNum += added;
+	linesNum += count;
+	totalRows += added;
+	AddToTree(lineTree, block, count);
+	AddToTree(rowTree, block, added);
+	Rebalance(block, block);
+}
+
+void VisualLineIndex::EraseLines(int line, int count) {
+	auto [block, offset] = Locate(line);
+	auto firstBlock = block;
+	for (; count > 0; block++, offset = 0) {
+		auto& rows = blocks[block].rows;
+		auto& hidden = blocks[block].hidden;
+		auto erased = min(count, static_cast<int>(rows.size()) - offset);
+		auto erasedRows = accumulate(rows.begin() + offset, rows.begin() + offset + erased, 0);
+		rows.erase(rows.begin() + offset, rows.begin() + offset + erased);
+		hidden.erase(hidden.begin() + offset, hidden.begin() + offset + erased);
+		blocks[block].rowsNum -= erasedRows;
+		linesNum -= erased;
+		totalRows -= erasedRows;
+		AddToTree(lineTree, block, -erased);
+		AddToTree(rowTree, block, -erasedRows);
+		count -= erased;
+	}
+	Rebalance(firstBlock, block - 1);
+}
+
+void VisualLineIndex::Rebalance(size_t firstBlock, size_t lastBlock) {
+	auto fits = [&](const Block& block) {
+		auto size = block.rows.size();
+		return size > 0 && size <= 2 * blockLines && (size >= blockLines / 4 || blocks.size() == 1);
+	};
+	if (all_of(blocks.begin() + static_cast<ptrdiff_t>(firstBlock), blocks.begin() + static_cast<ptrdiff_t>(lastBlock) + 1, fits))
+		return;
+	PROFILE_SCOPE("VisualLineIndex::Rebalance");
+	// The neighbours are dealt out again too, so a small block always has lines to merge with.
+	auto from = firstBlock > 0 ? firstBlock - 1 : 0, to = min(lastBlock + 1, blocks.size() - 1);
+	auto rows = vector<int>();
+	auto hidden = vector<char>();
+	for (auto i = from; i <= to; i++) {
+		rows.insert(rows.end(), blocks[i].rows.begin(), blocks[i].rows.end());
+		hidden.insert(hidden.end(), blocks[i].hidden.begin(), blocks[i].hidden.end());
+	}
+	auto size = rows.size();
+	auto blocksNum = size == 0 ? 0 : max<size_t>(1, (size + blockLines / 2) / blockLines);
+	auto dealt = vector<Block>(blocksNum);
+	for (size_t i = 0; i < blocksNum; i++) {
+		auto first = static_cast<ptrdiff_t>(size * i / blocksNum), last = static_cast<ptrdiff_t>(size * (i + 1) / blocksNum);
+		dealt[i].rows.assign(rows.begin() + first, rows.begin() + last);
+		dealt[i].hidden.assign(hidden.begin() + first, hidden.begin() + last);
+		dealt[i].rowsNum = accumulate(dealt[i].rows.begin(), dealt[i].rows.end(), 0);
+	}
+	blocks.erase(blocks.begin() + static_cast<ptrdiff_t>(from), blocks.begin() + static_cast<ptrdiff_t>(to) + 1);
+	blocks.insert(blocks.begin() + static_cast<ptrdiff_t>(from), make_move_iterator(dealt.begin()), make_move_iterator(dealt.end()));
+	BuildTrees();
+}
+
+void VisualLineIndex::Reset(const vector<string>& lines, int newColumns) {
+	PROFILE_SCOPE("VisualLineIndex::Reset");
+	columns = newColumns;
+	linesNum = static_cast<int>(lines.size());
+	blocks.resize((lines.size() + blockLines - 1) / blockLines);
+	for (size_t i = 0; i < blocks.size(); i++) {
+		auto size = min<size_t>(blockLines, lines.size() - i * blockLines);
+		blocks[i].rows.resize(size);
+		blocks[i].hidden.assign(size, false);
+	}
+	MeasureAll(lines);
+}
+
+void VisualLineIndex::SetColumns(int newColumns) {
+	if (newColumns == columns)
+		return;
+	columns = newColumns;
+	sweepLine = 0;
+}
+
+void VisualLineIndex::Refresh(const vector<string>& lines, int firstLine, int lastLine) {
+	Measure(lines, firstLine, lastLine, nullptr);
+}
+
+bool VisualLineIndex::Sweep(const vector<string>& lines, int budget) {
+	if (!IsSweeping())
+		return false;
+	PROFILE_SCOPE("VisualLineIndex::Sweep");
+	auto lastLine = min(LinesNum(), sweepLine + budget);
+	// A long sweep touches most lines anyway, so rebuilding the trees beats updating them block by block.
+	if (sweepLine == 0 && lastLine == LinesNum()) {
+		MeasureAll(lines);
+		return false;
+	}
+	Refresh(lines, sweepLine, lastLine - 1);
+	sweepLine = lastLine;
+	return IsSweeping();
+}
+
+void VisualLineIndex::ApplyLineChanges(const vector<string>& lines, const vector<LineChange>& changes) {
+	static const auto noneHidden = vector<pair<int, int>>();
+	// One change after another: each one's line already counts the lines added and removed by those before it.
+	for (const auto& change: changes) {
+		auto common = min(change.removedLines, change.addedLines);
+		Measure(lines, change.line, change.line + common - 1, &noneHidden);
+		if (change.addedLines > common)
+			InsertLines(lines, change.line + common, change.addedLines - common);
+		else if (change.removedLines > common)
+			EraseLines(change.line + common, change.removedLines - common);
+		if (change.line < sweepLine)
+			sweepLine = max(change.line, sweepLine + change.addedLines - change.removedLines);
+	}
+}
+
+void VisualLineIndex::SetHidden(const vector<string>& lines, int firstLine, int lastLine,
+								const vector<pair<int, int>>& hiddenRanges) {
+	PROFILE_SCOPE("VisualLineIndex::SetHidden");
+	Measure(lines, firstLine, lastLine, &hiddenRanges);
+}
+
+int VisualLineIndex::FirstShownLine(int line) const {
+	auto row = RowOfLine(line);
+	// Hidden lines add nothing to the sums, so the row starting at `line` belongs to the next line shown.
+	return row < totalRows ? LineAtRow(row) : LinesNum();
+}
+
+int VisualLineIndex::PreviousShownLine(int line) const {
+	auto row = RowOfLine(line);
+	return row > 0 ? LineAtRow(row - 1) : -1;
+}
+
+int VisualLineIndex::RowOfLine(int line) const {
+	line = clamp(line, 0, LinesNum());
+	if (line == LinesNum())
+		return totalRows;
+	auto [block, offset] = Locate(line);
+	const auto& rows = blocks[block].rows;
+	return SumBefore(rowTree, block) + accumulate(rows.begin(), rows.begin() + offset, 0);
+}
+
+int VisualLineIndex::LineAtRow(int row, int *rowInLine) const {
+	if (linesNum == 0) {
+		if (rowInLine) *rowInLine = 0;
+		return 0;
+	}
+	row = clamp(row, 0, totalRows - 1);
+	// Descend the tree for the block of the row, then walk it for the last line whose first row is <= row.
+	auto remaining = row;
+	auto block = BlocksWithin(rowTree, remaining);
+	const auto& rows = blocks[block].rows;
+	auto offset = size_t(0);
+	for (; rows[offset] <= remaining; offset++)
+		remaining -= rows[offset];
+	if (rowInLine) *rowInLine = remaining;
+	return SumBefore(lineTree, block) + static_cast<int>(offset);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "TextEdit.h"
+
+// Maps logical lines to visual rows when long lines are soft-wrapped. Lines are kept in blocks of a few hundred, and
+// the lines and rows of the blocks are summed in Fenwick trees, so converting either way, updating a line, and
+// inserting or erasing lines all cost O(log n) plus a pass over one block. Hidden lines, e.g. folded away, take no
+// rows, so the same lookups skip them.
+//
+// After the wrap width changes the old row counts are kept as estimates: the caller refreshes the visible lines
+// first and lets Sweep() correct the rest a slice at a time.
+struct VisualLineIndex {
+
+	// Visual rows taken by a line `length` columns long; `columns` <= 0 turns wrapping off.
+	static int RowsFor(int length, int columns) {
+		return columns > 0 && length > columns ? (length + columns - 1) / columns : 1;
+	}
+
+	// Display columns of a line; the byte length when not set.
+	std::function<int(int line)> lineWidth = nullptr;
+
+	int Columns() const { return columns; }
+	int LinesNum() const { return linesNum; }
+	int TotalRows() const { return totalRows; }
+	int Rows(int line) const;
+	bool IsHidden(int line) const;
+	bool IsSweeping() const { return sweepLine < LinesNum(); }
+
+	// Recomputes every line and shows the hidden ones; O(n).
+	void Reset(const std::vector<std::string>& lines, int newColumns);
+	// Keeps the current rows as estimates until they are refreshed.
+	void SetColumns(int newColumns);
+	void Refresh(const std::vector<std::string>& lines, int firstLine, int lastLine);
+	// Refreshes up to `budget` stale lines; returns whether any are left.
+	bool Sweep(const std::vector<std::string>& lines, int budget);
+	// Brings the index in line with an edit; only the changed lines are measured. Changed lines are shown.
+	void ApplyLineChanges(const std::vector<std::string>& lines, const std::vector<LineChange>& changes);
+	// Hides the lines of `hiddenRanges` (sorted [first, last] pairs inside the span) and shows the rest of
+	// [firstLine, lastLine].
+	void SetHidden(const std::vector<std::string>& lines, int firstLine, int lastLine,
+				   const std::vector<std::pair<int, int>>& hiddenRanges);
+
+	// The first line at or after `line` that is shown, or LinesNum() when there is none; O(log n).
+	int FirstShownLine(int line) const;
+	int NextShownLine(int line) const { return FirstShownLine(line + 1); }
+	// The last line before `line` that is shown, or -1 when there is none; O(log n).
+	int PreviousShownLine(int line) const;
+
+	// First visual row of `line`.
+	int RowOfLine(int line) const;
+	// Line shown on visual row `row` (clamped to the document) and which of its rows that is.
+	int LineAtRow(int row, int *rowInLine = nullptr) const;
+
+private:
+	struct Block {
+		std::vector<int> rows;
+		std::vector<char> hidden;
+		int rowsNum = 0;
+	};
+
+	int columns = 0;
+	int linesNum = 0;
+	int totalRows = 0;
+	int sweepLine = 0;
+	std::vector<Block> blocks;
+	// 1-based Fenwick trees over the lines and the rows of `blocks`.
+	std::vector<int> lineTree;
+	std::vector<int> rowTree;
+
+	// Measures the line only when wrapping is on.
+	int RowsOf(const std::vector<std::string>& lines, int line, bool isHidden) const {
+		if (isHidden)
+			return 0;
+		// A line is never wider than its byte length, so one that fits in bytes is not measured.
+		if (columns <= 0 || static_cast<int>(lines[line].size()) <= columns)
+			return 1;
+		return RowsFor(lineWidth ? lineWidth(line) : static_cast<int>(lines[line].size()), columns);
+	}
+	// The block holding `line` and where in it; a line past the end is at the end of the last block.
+	std::pair<size_t, int> Locate(int line) const;
+	void MeasureAll(const std::vector<std::string>& lines);
+	// Remeasures [firstLine, lastLine], hiding the lines of `hiddenRanges` and showing the rest when it is given.
+	void Measure(const std::vector<std::string>& lines, int firstLine, int lastLine,
+				 const std::vector<std::pair<int, int>> *hiddenRanges);
+	void InsertLines(const std::vector<std::string>& lines, int line, int count);
+	void EraseLines(int line, int count);
+	// Splits the blocks of [firstBlock, lastBlock] grown too large and merges those shrunk too small or emptied.
+	void Rebalance(size_t firstBlock, size_t lastBlock);
+	void BuildTrees();
+};
@@ -1,16 +1,37 @@
 #include "Widgets.h"
-#include <queue>
+#include "Jobs.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
 #include <iostream>
 #include <format>
 #include <functional>
+#include <utility>
 
 using namespace std;
 
 namespace UI {
 
+	static const float scrollBarWidth = 10.f;
+	static const int visualLinesSweepBudget = 200'000;
+	static const int lexerLookahead = 64; // extra bytes lexed past the right edge, so cut-off keywords still color
+	static const int lexerCatchUpBudget = 256 << 10; // bytes lexed per frame to reach text that has no checkpoint yet
+	static const int minimapSweepBudget = 10'000; // lines summarized per frame after a document was loaded
+	static const int foldSweepBudget = 128 << 10; // bytes lexed per frame to find the regions that fold
+	static const float minimapMaxRowHeight = 3;
+	static const double completionsBudget = .004; // seconds per tick spent applying what background jobs found
+	static bool redrawRequested = false;
+	static const Color changeAddedColor = {80, 170, 80, 255};
+	static const Color changeModifiedColor = {80, 130, 210, 255};
+	static const Color changeDeletedColor = {210, 80, 80, 255};
+
 	static shared_ptr <UIWidget> lastHoveredLeafWidget = nullptr;
 	static shared_ptr <Button> mouseDownButton = nullptr;
 	static shared_ptr <Input> activeInput = nullptr;
+	static shared_ptr <Input> mouseSelectingInput = nullptr;
+	static shared_ptr <Minimap> draggedMinimap = nullptr;
+	static Vector2 mouseSelectionStart = {0, 0};
 
 	static float GetScaledFontSize(float fontSize) {
 		return fontSize / GetWindowScaleDPI().y;
@@ -20,18 +41,62 @@ namespace UI {
 						   static_cast<int>(rectangle.width), static_cast<int>(rectangle.height));
 	}
 
-	Font font;
+	GlyphAtlas glyphAtlas;
+	FontMetrics fontMetrics;
+
+	void UpdateFontMetrics() {
+		if (!glyphAtlas.IsLoaded()) {
+			fontMetrics.size = 16;
+			fontMetrics.lineHeight = fontMetrics.size;
+			fontMetrics.letterWidth = MeasureTextEx(GetFontDefault(), "A", fontMetrics.size, 0).x;
+			return;
+		}
+		fontMetrics.size = GetScaledFontSize(static_cast<float>(glyphAtlas.Size()));
+		fontMetrics.lineHeight = fontMetrics.size;
+		auto glyph = glyphAtlas.Find('A');
+		fontMetrics.letterWidth = glyph ? glyph->advance * fontMetrics.size / static_cast<float>(glyphAtlas.Size()) : fontMetrics.size / 2;
+	}
 
 	Color YiqContrast(const Color& color) {
 		auto yiq = (299 * color.r + 587 * color.g + 114 * color.b) / 1000;
 		return (yiq >= 128) ? BLACK : WHITE;
 	}
 
-	Vector2 MeasureText(const string& text) {
-		return MeasureTextEx(font, text.c_str(), GetScaledFontSize(font.baseSize), 0);
+	// Scale from the pixel size glyphs are rasterized at to the size they are drawn at.
+	static float GlyphScale() {
+		return fontMetrics.size / static_cast<float>(glyphAtlas.Size());
 	}
-	void DrawText(const string& text, int x, int y, Color color) {
-		DrawTextEx(font, text.c_str(), Vector2 {static_cast<float>(x), static_cast<float>(y)}, GetScaledFontSize(font.baseSize), 0, color);
+
+	// raylib wants text to end with a zero.
+	static FrameString TerminatedText(string_view text) {
+		return FrameString(text);
+	}
+
+	Vector2 MeasureText(string_view text) {
+		if (!glyphAtlas.IsLoaded())
+			return MeasureTextEx(GetFontDefault(), TerminatedText(text).c_str(), fontMetrics.size, 0);
+		auto width = 0.f;
+		for (size_t offset = 0; offset < text.size();)
+			if (auto glyph = glyphAtlas.Find(DecodeUtf8(text, offset)))
+				width += glyph->advance;
+		return Vector2 {width * GlyphScale(), fontMetrics.lineHeight};
+	}
+	void DrawText(string_view text, int x, int y, Color color) {
+		if (!glyphAtlas.IsLoaded()) {
+			DrawTextEx(GetFontDefault(), TerminatedText(text).c_str(), Vector2 {static_cast<float>(x), static_cast<float>(y)}, fontMetrics.size, 0, color);
+			return;
+		}
+		// One batch for the whole string; glyphs rasterized in this frame show from the next one.
+		static auto batch = TextBatch();
+		batch.Clear();
+		auto position = Vector2 {0, 0};
+		for (size_t offset = 0; offset < text.size();) {
+			auto codepoint = DecodeUtf8(text, offset);
+			batch.Add(glyphAtlas, codepoint, position, GlyphScale(), color);
+			if (auto glyph = glyphAtlas.Find(codepoint))
+				position.x += glyph->advance * GlyphScale();
+		}
+		batch.Draw(Vector2 {static_cast<float>(x), static_cast<float>(y)});
 	}
 
 	// Label implementation
@@ -74,14 +139,15 @@ namespace UI {
 		if (visibility == Visibility::Collapsed)
 			return;
 
-		auto color = isActive ? BLACK : isHovered ? GRAY : LIGHTGRAY;
+		auto color = isActive ? BLACK : isSelected ? DARKGRAY : isHovered ? GRAY : LIGHTGRAY;
 		auto fontColor = YiqContrast(color);
 
 		DrawRectangleRec(layout, color);
 		DrawRectangleLinesEx(layout, 1, Fade(BLACK, .25f));
 		BeginScissorMode(layout);
-		auto horizontalPadding = max(0.f, (layout.width - MeasureText(Text()).x) / 2);
-		auto verticalPadding = max(0.f, (layout.height - font.baseSize / GetWindowScaleDPI().y) / 2);
+		auto text = Text();
+		auto horizontalPadding = max(0.f, (layout.width - MeasureText(text).x) / 2);
+		auto verticalPadding = max(0.f, (layout.height - fontMetrics.lineHeight) / 2);
 		DrawText(text, static_cast<int>(layout.x + horizontalPadding),
 				 static_cast<int>(layout.y + verticalPadding), fontColor);
 		EndScissorMode();
@@ -90,18 +156,17 @@ namespace UI {
 	// Input
 
 	Input::Input(std::vector<std::string>& lines, Color color, const Margin& padding)
-		: Label("a", color, padding), lines(lines) {}
+		: Label("a", color, padding), lines(lines), columnIndex(lines) {
+		visualLines.lineWidth = [this](int line) { return columnIndex.Width(line); };
+	}
 
 	Vector2 Input::MinSize() const {
 		if (visibility == Visibility::Collapsed)
 			return Vector2 {0, 0};
-		auto lineHeight = font.baseSize / GetWindowScaleDPI().y;
-		auto minWidth = 0.f;
-		auto minHeight = 0.f;
-		for (const auto& line: lines) {
-			minWidth = max(minWidth, static_cast<float>(MeasureText(line).x));
-			minHeight += lineHeight;
-		}
+		// The font is monospace, so the longest line is the widest one.
+		auto lineHeight = fontMetrics.lineHeight;
+		auto minWidth = softWrap ? 0.f : static_cast<float>(LongestLineLength()) * fontMetrics.letterWidth;
+		auto minHeight = static_cast<float>(lines.size()) * lineHeight;
 		minHeight = max(minHeight, lineHeight); // Ensure at least one line height
 		minWidth += padding.left + padding.right;
 		minHeight += padding.top + padding.bottom;
@@ -126,18 +191,21 @@ namespace UI {
 	void Input::Draw() {
 		if (visibility == Visibility::Collapsed)
 			return;
+		PROFILE_SCOPE("Input::Draw");
 
 		//auto backgroundColor = isActive || isHovered ? GRAY : LIGHTGRAY;
 
 		DrawRectangleRec(layout, WHITE);
 
-		auto letterHeight = font.baseSize / GetWindowScaleDPI().y;
-		auto contentHeight = static_cast<float>(lines.size()) * letterHeight + padding.top + padding.bottom;
+		UpdateVisualLines();
+		UpdateFolds();
+
+		auto letterHeight = fontMetrics.lineHeight;
+		auto contentHeight = static_cast<float>(visualLines.TotalRows()) * letterHeight + padding.top + padding.bottom;
 		auto visibleHeight = layout.height;
-		auto letterWidth = MeasureText("A").x;
+		auto letterWidth = fontMetrics.letterWidth;
 
 		if (contentHeight > visibleHeight) {
-			auto scrollBarWidth = 10.f;
 			auto totalSpan = contentHeight + visibleHeight;
 			auto scrollBarHeight = layout.height * (visibleHeight / totalSpan);
 			auto scrollBarY = layout.y + (topOffset / totalSpan) * layout.height;
@@ -149,6 +217,20 @@ namespace UI {
 				LIGHTGRAY
 			);
 		}
+		if (!softWrap) {
+			auto contentWidth = static_cast<float>(LongestLineLength()) * letterWidth + padding.left + padding.right;
+			auto visibleWidth = layout.width;
+			if (contentWidth > visibleWidth) {
+				auto totalSpan = contentWidth + visibleWidth;
+				DrawRectangle(
+					static_cast<int>(layout.x + (leftOffset / totalSpan) * layout.width),
+					static_cast<int>(layout.y + layout.height - scrollBarWidth),
+					static_cast<int>(layout.width * (visibleWidth / totalSpan)),
+					static_cast<int>(scrollBarWidth),
+					LIGHTGRAY
+				);
+			}
+		}
 
 		if (activeInput.get() == this) {
 			float thickness = 2;
@@ -158,47 +240,457 @@ namespace UI {
 
 		BeginScissorMode(layout);
 
-		auto y = layout.y + padding.top - topOffset;
-		auto startX = layout.x + padding.left;
-		if (!lexer)
-			for (auto i = 0; i < lines.size(); i++) {
-				const auto& line = lines[i];
-				DrawText(line, static_cast<int>(layout.x + padding.left),
-						 static_cast<int>(y), BLACK);
-				y += letterHeight;
+		auto firstVisibleLine = 0, lastVisibleLine = 0;
+		VisibleLines(firstVisibleLine, lastVisibleLine);
+
+		// Matches do not overlap, so their ends are sorted too and each visible line is two binary searches.
+		for (auto line = firstVisibleLine; !highlights.empty() && line <= lastVisibleLine; line = visualLines.NextShownLine(line)) {
+			auto from = 0, to = 0;
+			VisibleColumns(line, from, to);
+			auto highlight = lower_bound(highlights.begin(), highlights.end(), TextPosition {line, from},
+										 [](const SearchMatch& match, const TextPosition& position) {
+											 return TextPosition {match.line, match.column + max(1, match.length)} <= position;
+										 });
+			for (; highlight != highlights.end() && highlight->line == line && highlight->column <= to; ++highlight)
+				DrawSpan(highlight->line, highlight->column, highlight->column + max(1, highlight->length),
+						 Fade(YELLOW, .5f));
+		}
+
+		auto isActiveInput = activeInput.get() == this;
+		m_drawnCursors.clear();
+		if (isActiveInput)
+			Cursors(m_drawnCursors);
+		const auto& cursors = m_drawnCursors;
+		{
+			auto cursor = lower_bound(cursors.begin(), cursors.end(), firstVisibleLine,
+									  [](const Cursor& cursor, int line) { return cursor.End().line < line; });
+			for (; cursor != cursors.end() && cursor->Begin().line <= lastVisibleLine; ++cursor) {
+				if (!cursor->HasSelection())
+					continue;
+				auto begin = cursor->Begin(), end = cursor->End();
+				for (auto line = visualLines.FirstShownLine(max(begin.line, firstVisibleLine));
+					 line <= min(end.line, lastVisibleLine); line = visualLines.NextShownLine(line)) {
+					auto from = line == begin.line ? begin.column : 0;
+					// Selected line breaks show as one extra cell.
+					auto to = line == end.line ? end.column : static_cast<int>(lines[line].size()) + 1;
+					DrawSpan(line, from, to, Fade(SKYBLUE, .5f));
+				}
+			}
+		}
+
+		// Only the visible columns of the visible lines are drawn, so a line megabytes long costs no more than a
+		// short one.
+		UpdateTextQuads();
+		{
+			PROFILE_SCOPE("Input::Draw/Text");
+			auto left = layout.x + padding.left - leftOffset;
+			auto top = layout.y + padding.top - topOffset;
+			for (auto line = firstVisibleLine; line <= lastVisibleLine; line = visualLines.NextShownLine(line)) {
+				if (auto quads = lineQuads.find(line); quads != lineQuads.end())
+					quads->second.batch.Draw(Vector2 {left, top + fontMetrics.lineHeight * static_cast<float>(visualLines.RowOfLine(line))});
+				// A folded line ends in a marker for the lines it hides.
+				if (line + 1 < visualLines.LinesNum() && visualLines.IsHidden(line + 1)) {
+					auto point = PointOfCell(line, columnIndex.Width(line) + 1);
+					DrawRectangle(static_cast<int>(point.x), static_cast<int>(point.y), static_cast<int>(letterWidth * 3),
+								  static_cast<int>(letterHeight), Fade(LIGHTGRAY, .5f));
+					DrawText("...", static_cast<int>(point.x), static_cast<int>(point.y), GRAY);
+				}
+			}
+		}
+
+		// Over the text, which reaches into the padding when scrolled sideways.
+		if (diff) {
+			diff->Update();
+			DrawChangeGutter(firstVisibleLine, lastVisibleLine);
+			if (diff->IsBusy())
+				redrawRequested = true;
+		}
+
+		// draw cursors
+		for (const auto& cursor: cursors)
+			if (cursor.head.line >= firstVisibleLine && cursor.head.line <= lastVisibleLine && !visualLines.IsHidden(cursor.head.line)) {
+				auto point = PointOf(cursor.head);
+				DrawRectangle(static_cast<int>(point.x), static_cast<int>(point.y), 2, letterHeight, BLACK);
+			}
+
+		//auto s = std::format("Content height: {:.2f}, Visible height: {:.2f}, Top offset: {:.2f}",
+		//					 contentHeight, visibleHeight, topOffset);
+		//DrawText(s, static_cast<int>(layout.x + padding.left), static_cast<int>(layout.y + padding.top), LIGHTGRAY);
+
+		EndScissorMode();
+	}
+
+	void Input::UpdateTextQuads() {
+		PROFILE_SCOPE("Input::UpdateTextQuads");
+		auto firstVisibleLine = 0, lastVisibleLine = 0;
+		VisibleLines(firstVisibleLine, lastVisibleLine);
+		for (auto quads = lineQuads.begin(); quads != lineQuads.end();)
+			if (quads->first < firstVisibleLine || quads->first > lastVisibleLine) {
+				auto next = std::next(quads);
+				spareLineQuads.push_back(lineQuads.extract(quads));
+				quads = next;
 			}
-		else {
-			auto x = startX;
-			lexer->lines = &lines;
-			lexer->Reset();
+			else
+				++quads;
+
+		auto isCurrent = [&](int line) {
+			auto quads = lineQuads.find(line);
+			if (quads == lineQuads.end())
+				return false;
+			auto from = 0, to = 0;
+			VisibleColumns(line, from, to);
+			const auto& built = quads->second;
+			return built.complete && built.from == from && built.to == to && built.columns == visualLines.Columns()
+				   && built.atlasGeneration == glyphAtlas.Generation();
+		};
+
+		if (!lexer) {
+			for (auto line = firstVisibleLine; line <= lastVisibleLine; line = visualLines.NextShownLine(line))
+				if (!isCurrent(line))
+					BuildLineText(line);
+			return;
+		}
+
+		// Windows of consecutive short lines are lexed in one run; a long line gets a run of its own that starts at
+		// the checkpoint closest to its visible columns. Lines whose quads are still current are not lexed at all, and
+		// neither are the lines a fold hides.
+		auto runFrom = TextPosition(), runTo = TextPosition();
+		auto hasRun = false;
+		for (auto line = firstVisibleLine; line <= lastVisibleLine; line = visualLines.NextShownLine(line)) {
+			if (isCurrent(line)) {
+				if (hasRun)
+					BuildTokens(runFrom, runTo);
+				hasRun = false;
+				continue;
+			}
+			auto length = static_cast<int>(lines[line].size());
+			auto from = 0, to = 0;
+			VisibleColumns(line, from, to);
+			from = min(columnIndex.ByteOf(line, from), length);
+			to = min(columnIndex.ByteOf(line, to) + lexerLookahead, length);
+			auto continuesRun = hasRun && line == runTo.line + 1 && runTo.column == static_cast<int>(lines[runTo.line].size())
+								&& from <= LexerCheckpoints::spacing;
+			if (hasRun && !continuesRun)
+				BuildTokens(runFrom, runTo);
+			if (!continuesRun)
+				runFrom = TextPosition {line, from};
+			runTo = TextPosition {line, to};
+			hasRun = true;
+		}
+		if (hasRun)
+			BuildTokens(runFrom, runTo);
+	}
+
+	Input::LineQuads& Input::StartLineQuads(int line) {
+		auto quads = lineQuads.find(line);
+		if (quads == lineQuads.end() && !spareLineQuads.empty()) {
+			spareLineQuads.back().key() = line;
+			quads = lineQuads.insert(std::move(spareLineQuads.back())).position;
+			spareLineQuads.pop_back();
+		}
+		else if (quads == lineQuads.end())
+			quads = lineQuads.try_emplace(line).first;
+		auto& built = quads->second;
+		VisibleColumns(line, built.from, built.to);
+		built.columns = visualLines.Columns();
+		built.atlasGeneration = glyphAtlas.Generation();
+		built.complete = true;
+		built.batch.Clear();
+		return built;
+	}
+
+	void Input::InvalidateLineQuads(int firstLine) {
+		for (auto quads = lineQuads.begin(); quads != lineQuads.end();)
+			if (quads->first >= firstLine) {
+				auto next = std::next(quads);
+				spareLineQuads.push_back(lineQuads.extract(quads));
+				quads = next;
+			}
+			else
+				++quads;
+	}
+
+	// Adds the glyph of the cell `cell` of a line, in the line's own coordinates.
+	static void AddCellGlyph(Input::LineQuads& quads, int cell, int codepoint, Color color) {
+		auto rowInLine = quads.columns > 0 ? cell / quads.columns : 0;
+		auto position = Vector2 {
+			fontMetrics.letterWidth * static_cast<float>(cell - rowInLine * quads.columns),
+			fontMetrics.lineHeight * static_cast<float>(rowInLine)
+		};
+		if (glyphAtlas.IsLoaded())
+			quads.complete = quads.batch.Add(glyphAtlas, codepoint, position, GlyphScale(), color) && quads.complete;
+		else
+			quads.batch.Add(GetFontDefault(), codepoint, position, fontMetrics.size, color);
+	}
+
+	void Input::BuildLineText(int line) {
+		auto& quads = StartLineQuads(line);
+		const auto& text = lines[line];
+		auto cell = quads.from;
+		auto to = min(quads.to, columnIndex.Width(line));
+		for (auto offset = static_cast<size_t>(columnIndex.ByteOf(line, cell)); cell < to; cell++) {
+			auto next = columnIndex.NextBoundary(line, static_cast<int>(offset));
+			while (offset < static_cast<size_t>(next))
+				AddCellGlyph(quads, cell, DecodeUtf8(text, offset), color);
+		}
+	}
+
+	void Input::BuildTokens(const TextPosition& from, const TextPosition& to) {
+		auto visibleLine = -1, visibleFrom = 0, visibleTo = 0;
+		auto visibleLineIsAscii = true;
+		LineQuads *quads = nullptr;
+		lexer->lines = &lines;
+
+		// Far from any checkpoint, e.g. right after opening a huge file, the text is drawn plain while the
+		// checkpoints are caught up a slice per frame.
+		auto catchUpEndFrom = [&](TextPosition catchUpEnd) {
+			for (auto budget = lexerCatchUpBudget; catchUpEnd < from;) {
+				auto lineEnd = catchUpEnd.line == from.line ? from.column : static_cast<int>(lines[catchUpEnd.line].size());
+				if (lineEnd - catchUpEnd.column >= budget) {
+					catchUpEnd.column += budget;
+					break;
+				}
+				budget -= lineEnd - catchUpEnd.column + 1;
+				catchUpEnd = catchUpEnd.line == from.line ? from : TextPosition {catchUpEnd.line + 1, 0};
+			}
+			return catchUpEnd;
+		};
+
+		auto catchingUp = false;
+		for (auto restart = true; exchange(restart, false);) {
+			auto start = lexerCheckpoints.Before(from);
+			// Below a fold, lexing can start where its hidden text ends instead of going through it. That start is no
+			// checkpoint, so the checkpoints are neither verified nor recorded from it.
+			auto resume = folds ? folds->ResumeBefore(from) : TextPosition();
+			auto resumed = start < resume && catchUpEndFrom(resume) == from;
+			if (resumed)
+				start = resume;
+			auto catchUpEnd = catchUpEndFrom(start);
+			catchingUp = catchUpEnd < from;
+			lexer->Reset(start, catchingUp ? catchUpEnd : to);
+			// Every line of the run starts out empty, also after a restart and when no token reaches it.
+			for (auto line = from.line; line <= to.line; line++)
+				StartLineQuads(line);
+			visibleLine = -1;
+
+			auto position = start, lastCheckpoint = start;
+			auto bytesSinceCheckpoint = 0;
 			lexer->NextToken();
 			while (lexer->currentToken.type != EOF) {
+				// Once lexing has caught up with the checkpoints moved by an edit, skip ahead to the visible text.
+				if (!resumed && lexerCheckpoints.Verify(position) && position < lexerCheckpoints.Before(from)) {
+					restart = true;
+					break;
+				}
+				// Every token start is a place lexing can resume from later.
+				if (!resumed && bytesSinceCheckpoint >= LexerCheckpoints::spacing) {
+					lexerCheckpoints.Record(lastCheckpoint, position);
+					lastCheckpoint = position;
+					bytesSinceCheckpoint = 0;
+				}
+				auto text = lexer->currentToken.text;
+				bytesSinceCheckpoint += static_cast<int>(text.size());
 				auto color = lexer->currentToken.type < colors.size() ? colors[lexer->currentToken.type] : BLACK;
-				for (char c : lexer->currentToken.text) {
-					if (c == '\n'){
-						x = startX;
-						y += letterHeight;
-						continue;
+				for (size_t offset = 0; offset < text.size();) {
+					auto newline = text.find('\n', offset);
+					auto pieceLength = static_cast<int>((newline == string_view::npos ? text.size() : newline) - offset);
+					if (position.line >= from.line && !catchingUp) {
+						if (position.line != visibleLine) {
+							visibleLine = position.line;
+							quads = &lineQuads[visibleLine];
+							visibleLineIsAscii = columnIndex.IsAsciiLine(visibleLine);
+							visibleFrom = columnIndex.ByteOf(visibleLine, quads->from);
+							visibleTo = columnIndex.ByteOf(visibleLine, quads->to);
+						}
+						auto begin = max(position.column, visibleFrom);
+						auto end = min(position.column + pieceLength, visibleTo);
+						if (visibleLineIsAscii)
+							for (auto column = begin; column < end; column++)
+								AddCellGlyph(*quads, column, text[offset + column - position.column], color);
+						else if (begin < end) {
+							// A cluster is drawn in the color of the token its first byte is in; the lexer may
+							// well have split its bytes into several tokens.
+							const auto& line = lines[visibleLine];
+							auto cell = columnIndex.ColumnOf(visibleLine, begin);
+							auto cluster = columnIndex.ByteOf(visibleLine, cell);
+							if (cluster < begin) {
+								cluster = static_cast<int>(NextClusterStart(line, cluster));
+								cell++;
+							}
+							for (; cluster < end; cell++) {
+								auto next = NextClusterStart(line, cluster);
+								for (size_t i = cluster; i < next;)
+									AddCellGlyph(*quads, cell, DecodeUtf8(line, i), color);
+								cluster = static_cast<int>(next);
+							}
+						}
 					}
-					DrawTextCodepoint(font, c, Vector2 {x, y}, GetScaledFontSize(font.baseSize), color);
-					x += letterWidth;
+					position.column += pieceLength;
+					if (newline == string_view::npos)
+						break;
+					position = TextPosition {position.line + 1, 0};
+					offset = newline + 1;
 				}
 				lexer->NextToken();
 			}
 		}
 
-		// draw cursor
-		if (activeInput.get() == this)
-			DrawRectangle(
-				static_cast<int>(layout.x + padding.left + letterWidth * CursorColumn()),
-				static_cast<int>(layout.y + padding.top + letterHeight * CursorLine() - topOffset),
-				2, letterHeight, BLACK);
+		if (catchingUp) {
+			for (auto line = from.line; line <= to.line; line++) {
+				BuildLineText(line);
+				lineQuads[line].complete = false;
+			}
+			redrawRequested = true;
+		}
+	}
 
-		//auto s = std::format("Content height: {:.2f}, Visible height: {:.2f}, Top offset: {:.2f}",
-		//					 contentHeight, visibleHeight, topOffset);
-		//DrawText(s, static_cast<int>(layout.x + padding.left), static_cast<int>(layout.y + padding.top), LIGHTGRAY);
+	int Input::WrapColumns() const {
+		if (!softWrap || layout.width <= 0)
+			return 0;
+		auto width = layout.width - padding.left - padding.right - scrollBarWidth;
+		return max(1, static_cast<int>(width / fontMetrics.letterWidth));
+	}
 
-		EndScissorMode();
+	void Input::UpdateVisualLines() {
+		if (softWrap)
+			leftOffset = 0;
+		if (visualLines.LinesNum() != static_cast<int>(lines.size())) {
+			visualLines.Reset(lines, WrapColumns());
+			UpdateHiddenLines({0, INT_MAX});
+			return;
+		}
+		visualLines.SetColumns(WrapColumns());
+		if (!visualLines.IsSweeping())
+			return;
+		// The visible lines are exact right away, the rest follows over the next frames.
+		auto firstLine = 0, lastLine = 0;
+		VisibleLines(firstLine, lastLine);
+		visualLines.Refresh(lines, firstLine, lastLine);
+		VisibleLines(firstLine, lastLine);
+		visualLines.Refresh(lines, firstLine, lastLine);
+		if (visualLines.Sweep(lines, visualLinesSweepBudget))
+			redrawRequested = true;
+	}
+
+	void Input::UpdateFolds() {
+		if (!folds || !lexer)
+			return;
+		UpdateHiddenLines(folds->Sweep(lines, *lexer, foldSweepBudget));
+		if (folds->IsSweeping())
+			redrawRequested = true;
+	}
+
+	void Input::UpdateHiddenLines(pair<int, int> changed) {
+		if (!folds || visualLines.LinesNum() != static_cast<int>(lines.size()))
+			return;
+		auto first = max(changed.first, 0), last = min(changed.second, visualLines.LinesNum() - 1);
+		if (first <= last)
+			visualLines.SetHidden(lines, first, last, folds->HiddenSpans(first, last));
+	}
+
+	void Input::FoldAtCursor(bool folded) {
+		UpdateHiddenLines(folds->SetFolded(CursorLine(), folded));
+		MoveCursorsOutOfFolds();
+	}
+
+	void Input::FoldAll(bool folded) {
+		UpdateHiddenLines(folds->SetAllFolded(folded));
+		MoveCursorsOutOfFolds();
+	}
+
+	void Input::MoveCursorsOutOfFolds() {
+		if (visualLines.LinesNum() != static_cast<int>(lines.size()))
+			return;
+		erase_if(m_extraCursors, [&](const Cursor& cursor) { return visualLines.IsHidden(cursor.head.line); });
+		if (!visualLines.IsHidden(CursorLine()))
+			return;
+		m_selectionAnchor.reset();
+		SetCursorLine(visualLines.PreviousShownLine(CursorLine()));
+		SetCursorColumn(static_cast<int>(Line().size()));
+	}
+
+	void Input::VisibleRows(int& firstRow, int& lastRow) const {
+		auto letterHeight = fontMetrics.lineHeight;
+		firstRow = static_cast<int>(max(0.f, topOffset - padding.top) / letterHeight);
+		lastRow = static_cast<int>(max(0.f, topOffset - padding.top + layout.height) / letterHeight);
+	}
+
+	void Input::VisibleLines(int& firstLine, int& lastLine) const {
+		auto firstRow = 0, lastRow = 0;
+		VisibleRows(firstRow, lastRow);
+		firstLine = visualLines.LineAtRow(firstRow);
+		lastLine = visualLines.LineAtRow(lastRow);
+	}
+
+	void Input::VisibleColumns(int line, int& from, int& to) const {
+		auto columns = visualLines.Columns();
+		if (columns > 0) {
+			auto firstRow = 0, lastRow = 0;
+			VisibleRows(firstRow, lastRow);
+			auto lineRow = visualLines.RowOfLine(line);
+			from = max(0, firstRow - lineRow) * columns;
+			to = (min(lastRow - lineRow, visualLines.Rows(line) - 1) + 1) * columns;
+			return;
+		}
+		from = static_cast<int>(leftOffset / fontMetrics.letterWidth);
+		to = from + static_cast<int>(layout.width / fontMetrics.letterWidth) + 2;
+	}
+
+	Vector2 Input::PointOf(const TextPosition& position) const {
+		return PointOfCell(position.line, columnIndex.ColumnOf(position.line, position.column));
+	}
+
+	Vector2 Input::PointOfCell(int line, int cell) const {
+		auto columns = visualLines.Columns();
+		auto rowInLine = columns > 0 ? min(cell / columns, visualLines.Rows(line) - 1) : 0;
+		auto row = visualLines.RowOfLine(line) + rowInLine;
+		return Vector2 {
+			layout.x + padding.left - leftOffset + fontMetrics.letterWidth * static_cast<float>(cell - rowInLine * columns),
+			layout.y + padding.top - topOffset + fontMetrics.lineHeight * static_cast<float>(row)
+		};
+	}
+
+	void Input::DrawSpan(int line, int from, int to, Color color) const {
+		auto columns = visualLines.Columns();
+		// Clip to the view; a selection can span a whole multi-megabyte line.
+		auto visibleFrom = 0, visibleTo = 0;
+		VisibleColumns(line, visibleFrom, visibleTo);
+		from = max(columnIndex.ColumnOf(line, from), visibleFrom);
+		to = min(columnIndex.ColumnOf(line, to), visibleTo + 1);
+		while (from < to) {
+			auto end = columns > 0 ? min(to, (from / columns + 1) * columns) : to;
+			auto point = PointOfCell(line, from);
+			DrawRectangle(static_cast<int>(point.x), static_cast<int>(point.y),
+						  static_cast<int>(fontMetrics.letterWidth * static_cast<float>(end - from)),
+						  static_cast<int>(fontMetrics.lineHeight), color);
+			from = end;
+		}
+	}
+
+	void Input::DrawChangeGutter(int firstLine, int lastLine) const {
+		PROFILE_SCOPE("Input::DrawChangeGutter");
+		const auto& hunks = diff->Hunks();
+		auto x = layout.x + 3; // inside the focus outline
+		auto top = layout.y + padding.top - topOffset;
+		auto yOf = [&](int line) { return top + fontMetrics.lineHeight * static_cast<float>(visualLines.RowOfLine(line)); };
+		auto hunk = lower_bound(hunks.begin(), hunks.end(), firstLine, [](const LineDiff::Hunk& hunk, int line) {
+			return hunk.from[LineDiff::Buffer] + hunk.count[LineDiff::Buffer] < line;
+		});
+		for (; hunk != hunks.end() && hunk->from[LineDiff::Buffer] <= lastLine + 1; ++hunk) {
+			auto from = hunk->from[LineDiff::Buffer], count = hunk->count[LineDiff::Buffer];
+			if (count == 0) {
+				// Deleted lines: a mark on the boundary where they were.
+				DrawRectangleRec(Rectangle {x, yOf(from) - 2, 5, 4}, changeDeletedColor);
+				continue;
+			}
+			// Lines that replaced as many old ones count as modified, the rest as added.
+			auto modified = min(count, hunk->count[LineDiff::Baseline]);
+			if (modified > 0)
+				DrawRectangleRec(Rectangle {x, yOf(from), 3, yOf(from + modified) - yOf(from)}, changeModifiedColor);
+			if (modified < count)
+				DrawRectangleRec(Rectangle {x, yOf(from + modified), 3, yOf(from + count) - yOf(from + modified)},
+								 changeAddedColor);
+		}
 	}
 
 	int Input::CursorLine() {
@@ -208,9 +700,16 @@ namespace UI {
 	void Input::SetCursorLine(int line) {
 		m_cursorLine = clamp(line, 0, static_cast<int>(lines.size()) - 1);
 	}
+	// Moves a byte offset back to the start of the UTF-8 sequence it points into.
+	static int SnapToCodepoint(const string& line, int column) {
+		while (column > 0 && column < static_cast<int>(line.size()) && (line[column] & 0xC0) == 0x80)
+			column--;
+		return column;
+	}
+
 	int Input::CursorColumn() {
 		auto line = CursorLine();
-		return clamp(m_cursorDesiredColumn, 0, static_cast<int>(lines[line].size()));
+		return SnapToCodepoint(lines[line], clamp(m_cursorDesiredColumn, 0, static_cast<int>(lines[line].size())));
 	}
 	void Input::SetCursorColumn(int column) {
 		auto line = CursorLine();
@@ -221,121 +720,682 @@ namespace UI {
 		return lines[line];
 	}
 
-	bool Input::HandleChar(int c) {
-		auto& line = Line();
-		auto column = CursorColumn();
-		line.insert(line.begin() + column, static_cast<char>(c));
-		SetCursorColumn(column + 1);
+	bool IsCommandKeyDown() {
+		return IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL) ||
+			   IsKeyDown(KEY_LEFT_SUPER) || IsKeyDown(KEY_RIGHT_SUPER);
+	}
+	bool IsShiftKeyDown() {
+		return IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+	}
+	bool IsAltKeyDown() {
+		return IsKeyDown(KEY_LEFT_ALT) || IsKeyDown(KEY_RIGHT_ALT);
+	}
+
+	// Cursors
+
+	static TextPosition ClampPosition(const vector<string>& lines, TextPosition position) {
+		position.line = clamp(position.line, 0, static_cast<int>(lines.size()) - 1);
+		position.column = clamp(position.column, 0, static_cast<int>(lines[position.line].size()));
+		position.column = SnapToCodepoint(lines[position.line], position.column);
+		return position;
+	}
+
+	vector<Cursor> Input::Cursors(int *primaryIndex) {
+		auto cursors = vector<Cursor>();
+		Cursors(cursors, primaryIndex);
+		return cursors;
+	}
+
+	void Input::Cursors(vector<Cursor>& cursors, int *primaryIndex) {
+		auto primaryHead = TextPosition {CursorLine(), CursorColumn()};
+		auto primary = Cursor {primaryHead, m_selectionAnchor ? ClampPosition(lines, *m_selectionAnchor) : primaryHead};
+
+		cursors.clear();
+		cursors.reserve(m_extraCursors.size() + 1);
+		cursors.push_back(primary);
+		for (const auto& cursor: m_extraCursors)
+			cursors.push_back(Cursor {ClampPosition(lines, cursor.head), ClampPosition(lines, cursor.anchor)});
+		if (cursors.size() == 1) {
+			if (primaryIndex) *primaryIndex = 0;
+			return;
+		}
+
+		// Cursors are kept sorted, so this is usually a no-op pass.
+		if (!is_sorted(cursors.begin() + 1, cursors.end(),
+					   [](const Cursor& a, const Cursor& b) { return a.Begin() < b.Begin(); }))
+			sort(cursors.begin() + 1, cursors.end(), [](const Cursor& a, const Cursor& b) { return a.Begin() < b.Begin(); });
+		auto insertAt = lower_bound(cursors.begin() + 1, cursors.end(), primary,
+									[](const Cursor& a, const Cursor& b) { return a.Begin() < b.Begin(); });
+		rotate(cursors.begin(), cursors.begin() + 1, insertAt);
+		auto primaryAt = static_cast<int>(insertAt - cursors.begin()) - 1;
+
+		// Merge cursors that touch or overlap.
+		auto merged = 0;
+		for (auto i = 1; i < static_cast<int>(cursors.size()); i++) {
+			auto& last = cursors[merged];
+			const auto& cursor = cursors[i];
+			auto touches = cursor.Begin() == last.End() && (!cursor.HasSelection() || !last.HasSelection());
+			if (cursor.Begin() < last.End() || touches) {
+				auto begin = last.Begin(), end = max(last.End(), cursor.End());
+				last = last.head >= last.anchor ? Cursor {end, begin} : Cursor {begin, end};
+				if (i == primaryAt) primaryAt = merged;
+			}
+			else {
+				cursors[++merged] = cursor;
+				if (i == primaryAt) primaryAt = merged;
+			}
+		}
+		cursors.resize(merged + 1);
+		if (primaryIndex) *primaryIndex = primaryAt;
+	}
+
+	void Input::SetCursors(vector<Cursor> cursors, int primaryIndex) {
+		const auto& primary = cursors[primaryIndex];
+		SetCursorLine(primary.head.line);
+		SetCursorColumn(primary.head.column);
+		m_selectionAnchor = primary.HasSelection() ? optional(primary.anchor) : nullopt;
+		cursors.erase(cursors.begin() + primaryIndex);
+		m_extraCursors = std::move(cursors);
+	}
+
+	void Input::ClearExtraCursors() {
+		m_extraCursors.clear();
+		m_selectionAnchor = nullopt;
+	}
+
+	string Input::SelectedText() {
+		auto text = string();
+		auto first = true;
+		for (const auto& cursor: Cursors()) {
+			if (!cursor.HasSelection())
+				continue;
+			if (!first)
+				text.push_back('\n');
+			first = false;
+			auto begin = cursor.Begin(), end = cursor.End();
+			for (auto line = begin.line; line <= end.line; line++) {
+				auto from = line == begin.line ? begin.column : 0;
+				auto to = line == end.line ? end.column : static_cast<int>(lines[line].size());
+				text.append(lines[line], from, to - from);
+				if (line != end.line)
+					text.push_back('\n');
+			}
+		}
+		return text;
+	}
+
+	bool Input::EditAtCursors(const function<TextEdit(const Cursor& cursor)>& makeEdit) {
+		PROFILE_SCOPE("Input::EditAtCursors");
+		auto primaryIndex = 0;
+		auto cursors = Cursors(&primaryIndex);
+		auto edits = vector<TextEdit>();
+		edits.reserve(cursors.size());
+		auto changesText = false;
+		for (const auto& cursor: cursors) {
+			auto edit = makeEdit(cursor);
+			// An edit may reach left of its cursor (Backspace), but never into the previous cursor's edit.
+			if (!edits.empty())
+				edit.from = max(edit.from, edits.back().to);
+			edit.to = max(edit.to, edit.from);
+			changesText = changesText || edit.from != edit.to || !edit.text.empty();
+			edits.push_back(std::move(edit));
+		}
+		if (!changesText)
+			return false;
+
+		auto ends = ApplyEditsToLines(edits);
+		for (size_t i = 0; i < cursors.size(); i++)
+			cursors[i] = Cursor {ends[i], ends[i]};
+		SetCursors(std::move(cursors), primaryIndex);
 		if (onChange) onChange();
 		return true;
 	}
 
+	bool Input::InsertAtCursors(const string& text) {
+		return EditAtCursors([&](const Cursor& cursor) { return TextEdit {cursor.Begin(), cursor.End(), text}; });
+	}
+
+	void Input::MoveCursors(const function<TextPosition(const Cursor& cursor)>& move, bool extendSelection) {
+		auto primaryIndex = 0;
+		auto cursors = Cursors(&primaryIndex);
+		for (auto& cursor: cursors) {
+			cursor.head = ClampPosition(lines, move(cursor));
+			if (!extendSelection)
+				cursor.anchor = cursor.head;
+		}
+		SetCursors(std::move(cursors), primaryIndex);
+		// Moving may have made cursors collide.
+		SetCursors(Cursors(&primaryIndex), primaryIndex);
+	}
+
+	TextPosition Input::PreviousPosition(const TextPosition& position) {
+		if (position.column > 0)
+			return {position.line, columnIndex.PreviousBoundary(position.line, position.column)};
+		if (position.line > 0)
+			return {position.line - 1, static_cast<int>(lines[position.line - 1].size())};
+		return position;
+	}
+
+	TextPosition Input::NextPosition(const TextPosition& position) {
+		if (position.column < static_cast<int>(lines[position.line].size()))
+			return {position.line, columnIndex.NextBoundary(position.line, position.column)};
+		if (position.line < static_cast<int>(lines.size()) - 1)
+			return {position.line + 1, 0};
+		return position;
+	}
+
+	// Bytes of non-ASCII characters count as word characters, so words in any script are selected whole.
+	static bool IsWordCharacter(char c) {
+		return isalnum(static_cast<unsigned char>(c)) || c == '_' || static_cast<unsigned char>(c) >= 0x80;
+	}
+
+	bool Input::AddCursorAtNextOccurrence() {
+		auto primaryIndex = 0;
+		auto cursors = Cursors(&primaryIndex);
+		auto& primary = cursors[primaryIndex];
+
+		// Without a selection, select the word under the primary cursor first.
+		if (!primary.HasSelection()) {
+			const auto& line = lines[primary.head.line];
+			auto begin = primary.head.column, end = primary.head.column;
+			while (begin > 0 && IsWordCharacter(line[begin - 1])) begin--;
+			while (end < static_cast<int>(line.size()) && IsWordCharacter(line[end])) end++;
+			if (begin == end)
+				return false;
+			primary = Cursor {{primary.head.line, end}, {primary.head.line, begin}};
+			SetCursors(std::move(cursors), primaryIndex);
+			return true;
+		}
+		if (primary.Begin().line != primary.End().line)
+			return false;
+
+		const auto& selected = lines[primary.head.line];
+		auto needle = selected.substr(primary.Begin().column, primary.End().column - primary.Begin().column);
+		auto linesNum = static_cast<int>(lines.size());
+		auto start = cursors.back().End();
+		// Search forward from the last cursor and wrap around once.
+		for (auto i = 0; i <= linesNum; i++) {
+			auto lineIndex = (start.line + i) % linesNum;
+			auto from = i == 0 ? static_cast<size_t>(start.column) : 0;
+			auto found = FindLiteral(lines[lineIndex], needle, from);
+			if (found == string_view::npos)
+				continue;
+			auto begin = TextPosition {lineIndex, static_cast<int>(found)};
+			auto end = TextPosition {lineIndex, static_cast<int>(found + needle.size())};
+			if (any_of(cursors.begin(), cursors.end(), [&](const Cursor& cursor) { return cursor.Begin() == begin; }))
+				return false;
+			m_extraCursors.push_back(Cursor {end, begin});
+			SetCursors(Cursors(&primaryIndex), primaryIndex);
+			return true;
+		}
+		return false;
+	}
+
+	bool Input::AddCursorsAtMatches(const vector<SearchMatch>& matches) {
+		if (matches.empty())
+			return false;
+		auto head = TextPosition {CursorLine(), CursorColumn()};
+		auto cursors = vector<Cursor>();
+		cursors.reserve(matches.size());
+		for (const auto& match: matches)
+			cursors.push_back(Cursor {{match.line, match.column + match.length}, {match.line, match.column}});
+		// The first match at or after the old primary cursor becomes the primary one.
+		auto primary = lower_bound(cursors.begin(), cursors.end(), head,
+								   [](const Cursor& cursor, const TextPosition& position) { return cursor.End() < position; });
+		auto primaryIndex = primary == cursors.end() ? 0 : static_cast<int>(primary - cursors.begin());
+		SetCursors(std::move(cursors), primaryIndex);
+		return true;
+	}
+
+	// Editing
+
+	bool Input::HandleChar(int c) {
+		return InsertAtCursors(EncodeUtf8(c));
+	}
+
 	bool Input::HandleKey(int key) {
-		auto cursorLine = CursorLine();
-		auto cursorColumn = CursorColumn();
-		auto& line = Line();
-		switch (key) {
-			case KEY_LEFT:
-				if (cursorColumn > 0) {
-					SetCursorColumn(cursorColumn - 1);
+		if (onKey && onKey(key))
+			return true;
+		auto extend = IsShiftKeyDown();
+
+		if (IsCommandKeyDown()) {
+			switch (key) {
+				case KEY_A:
+					ClearExtraCursors();
+					m_selectionAnchor = TextPosition {0, 0};
+					SetCursorLine(static_cast<int>(lines.size()) - 1);
+					SetCursorColumn(static_cast<int>(Line().size()));
 					return true;
-				}
-				else if (cursorLine > 0) {
-					SetCursorLine(cursorLine - 1);
-					SetCursorColumn(Line().size());
+				case KEY_C:
+				case KEY_X: {
+					auto text = SelectedText();
+					if (text.empty())
+						return false;
+					SetClipboardText(text.c_str());
+					if (key == KEY_X)
+						InsertAtCursors("");
 					return true;
 				}
-				break;
-			case KEY_UP:
-				if (cursorLine > 0) {
-					SetCursorLine(cursorLine - 1);
-					return true;
+				case KEY_V: {
+					auto clipboard = GetClipboardText();
+					if (!clipboard)
+						return false;
+					auto text = string(clipboard);
+					// With one clipboard line per cursor, every cursor gets its own line.
+					auto pieces = vector<string>();
+					for (size_t start = 0;;) {
+						auto newline = text.find('\n', start);
+						pieces.push_back(text.substr(start, newline - start));
+						if (newline == string::npos) break;
+						start = newline + 1;
+					}
+					if (pieces.size() > 1 && pieces.size() == m_extraCursors.size() + 1) {
+						auto next = 0;
+						return EditAtCursors([&](const Cursor& cursor) {
+							return TextEdit {cursor.Begin(), cursor.End(), pieces[next++]};
+						});
+					}
+					return InsertAtCursors(text);
 				}
-				else if (cursorColumn > 0) {
-					SetCursorColumn(0);
+				case KEY_D:
+					return AddCursorAtNextOccurrence();
+				// Ctrl+Shift+[ and ] fold and unfold at the cursor, Ctrl+Alt+[ and ] everything.
+				case KEY_LEFT_BRACKET:
+				case KEY_RIGHT_BRACKET:
+					if (!folds || (!extend && !IsAltKeyDown()))
+						return false;
+					if (IsAltKeyDown())
+						FoldAll(key == KEY_LEFT_BRACKET);
+					else
+						FoldAtCursor(key == KEY_LEFT_BRACKET);
 					return true;
+				case KEY_L: {
+					if (!extend)
+						return false;
+					if (AddCursorsAtMatches(highlights))
+						return true;
+					// Without search results, put a cursor on every occurrence of the selection.
+					if (!m_selectionAnchor && !AddCursorAtNextOccurrence())
+						return false;
+					auto primary = Cursors()[0];
+					if (primary.Begin().line != primary.End().line)
+						return false;
+					auto needle = string_view(lines[primary.head.line])
+						.substr(primary.Begin().column, primary.End().column - primary.Begin().column);
+					auto matches = vector<SearchMatch>();
+					FindAllLiteral(lines, needle, matches);
+					return AddCursorsAtMatches(matches);
 				}
-				break;
+			}
+		}
+
+		// The line above or below, past the lines folded away.
+		auto lineAfter = [&](int line, int direction) {
+			if (visualLines.LinesNum() != static_cast<int>(lines.size()))
+				return line + direction;
+			return direction < 0 ? visualLines.PreviousShownLine(line) : visualLines.NextShownLine(line);
+		};
+
+		// The primary cursor remembers the cell it came from, so it survives moving across shorter lines.
+		auto verticalMove = [&](int direction) {
+			auto primaryHead = TextPosition {CursorLine(), CursorColumn()};
+			auto desiredCell = columnIndex.ColumnOf(primaryHead.line, m_cursorDesiredColumn);
+			auto lastLine = static_cast<int>(lines.size()) - 1;
+			auto primaryLine = lineAfter(primaryHead.line, direction);
+			auto keepsColumn = primaryLine >= 0 && primaryLine <= lastLine;
+			MoveCursors([&](const Cursor& cursor) {
+				auto line = lineAfter(cursor.head.line, direction);
+				if (line < 0) return TextPosition {0, 0};
+				if (line > lastLine) return TextPosition {lastLine, static_cast<int>(lines[lastLine].size())};
+				auto cell = cursor.head == primaryHead ? desiredCell : columnIndex.ColumnOf(cursor.head.line, cursor.head.column);
+				return TextPosition {line, columnIndex.ByteOf(line, cell)};
+			}, extend);
+			if (keepsColumn)
+				m_cursorDesiredColumn = columnIndex.ByteOf(primaryLine, desiredCell);
+		};
+
+		// Alt+Shift+Up/Down adds a cursor on the line above/below each cursor (a keyboard column selection).
+		if (IsAltKeyDown() && extend && (key == KEY_UP || key == KEY_DOWN)) {
+			auto direction = key == KEY_UP ? -1 : 1;
+			auto added = false;
+			for (const auto& cursor: Cursors()) {
+				auto line = lineAfter(cursor.head.line, direction);
+				if (line < 0 || line >= static_cast<int>(lines.size()))
+					continue;
+				auto cell = min(columnIndex.ColumnOf(cursor.head.line, cursor.head.column), columnIndex.Width(line));
+				auto column = columnIndex.ByteOf(line, cell);
+				m_extraCursors.push_back(Cursor {{line, column}, {line, column}});
+				added = true;
+			}
+			return added;
+		}
+
+		switch (key) {
+			case KEY_ESCAPE:
+				if (m_extraCursors.empty() && !m_selectionAnchor)
+					return false;
+				ClearExtraCursors();
+				return true;
+			case KEY_LEFT:
+				MoveCursors([&](const Cursor& cursor) {
+					return cursor.HasSelection() && !extend ? cursor.Begin() : PreviousPosition(cursor.head);
+				}, extend);
+				return true;
 			case KEY_RIGHT:
-				if (cursorColumn < static_cast<int>(line.size())) {
-					SetCursorColumn(cursorColumn + 1);
-					return true;
-				}
-				else if (cursorLine < static_cast<int>(lines.size()) - 1) {
-					SetCursorLine(cursorLine + 1);
-					SetCursorColumn(0);
-					return true;
-				}
-				break;
-			case KEY_BACKSPACE:
-				if (cursorColumn > 0) {
-					line.erase(line.begin() + cursorColumn - 1);
-					SetCursorColumn(cursorColumn - 1);
-					if (onChange) onChange();
-					return true;
-				}
-				else if (cursorLine > 0) {
-					SetCursorLine(cursorLine - 1);
-					auto previousLineLength = lines[cursorLine - 1].size();
-					lines[cursorLine - 1] += lines[cursorLine];
-					lines.erase(lines.begin() + cursorLine);
-					SetCursorColumn(previousLineLength);
-					if (onChange) onChange();
-					return true;
-				}
-				break;
-			case KEY_ENTER: {// we need to break current line in two
-				auto newLine = line.substr(cursorColumn);
-				line.erase(line.begin() + cursorColumn, line.end());
-				lines.insert(lines.begin() + cursorLine + 1, newLine);
-				SetCursorLine(cursorLine + 1);
-				SetCursorColumn(0);
-				if (onChange) onChange();
+				MoveCursors([&](const Cursor& cursor) {
+					return cursor.HasSelection() && !extend ? cursor.End() : NextPosition(cursor.head);
+				}, extend);
+				return true;
+			case KEY_UP:
+				verticalMove(-1);
 				return true;
-			}
 			case KEY_DOWN:
-				if (cursorLine < static_cast<int>(lines.size()) - 1) {
-					SetCursorLine(cursorLine + 1);
-					return true;
-				}
-				else if (cursorColumn < static_cast<int>(line.size())) {
-					SetCursorColumn(line.size());
+				verticalMove(1);
+				return true;
+			case KEY_BACKSPACE:
+				return EditAtCursors([&](const Cursor& cursor) {
+					return cursor.HasSelection()
+						   ? TextEdit {cursor.Begin(), cursor.End()}
+						   : TextEdit {PreviousPosition(cursor.head), cursor.head};
+				});
+			case KEY_DELETE:
+				return EditAtCursors([&](const Cursor& cursor) {
+					return cursor.HasSelection()
+						   ? TextEdit {cursor.Begin(), cursor.End()}
+						   : TextEdit {cursor.head, NextPosition(cursor.head)};
+				});
+			case KEY_ENTER: // we need to break current line in two
+				if (onEnter) {
+					onEnter();
 					return true;
 				}
-				break;
+				return InsertAtCursors("\n");
 			case KEY_TAB:
-				for (auto i = 0; i < 4; i++)
-					HandleChar(' ');
-				if (onChange) onChange();
-				return true;
+				return InsertAtCursors("    ");
 		}
 
 		return false;
 	}
 
+	vector<TextPosition> Input::ApplyEditsToLines(const vector<TextEdit>& edits) {
+		if (onBeforeEdit) onBeforeEdit();
+		auto inSync = visualLines.LinesNum() == static_cast<int>(lines.size());
+		auto changes = vector<LineChange>();
+		auto ends = ::ApplyEdits(lines, edits, &changes);
+		columnIndex.ApplyLineChanges(changes);
+		if (inSync)
+			visualLines.ApplyLineChanges(lines, changes);
+		if (folds) {
+			UpdateHiddenLines(folds->ApplyEdits(edits, ends));
+			// The visual lines show every line a change rebuilt, folded or not.
+			for (const auto& change: changes) {
+				auto first = change.line, last = change.line + change.addedLines - 1;
+				if (!folds->HiddenSpans(first, last).empty())
+					UpdateHiddenLines({first, last});
+			}
+		}
+		lexerCheckpoints.ApplyEdits(edits, ends);
+		// Lexing can change colors anywhere after the first edit.
+		if (!edits.empty())
+			InvalidateLineQuads(edits.front().from.line);
+		if (m_longestLineLength >= 0)
+			for (const auto& change: changes)
+				for (auto line = change.line; line < change.line + change.addedLines; line++)
+					m_longestLineLength = max(m_longestLineLength, static_cast<int>(lines[line].size()));
+		if (diff)
+			diff->ApplyLineChanges(LineDiff::Buffer, lines, changes);
+		if (minimap)
+			minimap->ApplyLineChanges(lines, changes, lexer.get());
+		if (symbols && symbolsFile >= 0)
+			symbols->ApplyLineChanges(symbolsFile, lines, changes, lexer.get());
+		if (onEdit) onEdit(edits);
+		return ends;
+	}
+
+	void Input::OnLinesReplaced(std::vector<uint64_t> lineHashes) {
+		ClearExtraCursors();
+		columnIndex.Clear();
+		visualLines.Reset(lines, WrapColumns());
+		if (folds)
+			folds->Reset();
+		lexerCheckpoints.Clear();
+		InvalidateLineQuads(0);
+		m_longestLineLength = -1;
+		if (diff)
+			diff->Reset(LineDiff::Buffer, lines, std::move(lineHashes));
+		if (minimap)
+			minimap->Reset(static_cast<int>(lines.size()));
+		if (symbols && symbolsFile >= 0)
+			symbols->ResetDocument(symbolsFile, static_cast<int>(lines.size()));
+		SetTopOffset(topOffset);
+		SetLeftOffset(leftOffset);
+	}
+
+	void Input::ApplyEdits(const std::vector<TextEdit>& edits) {
+		if (edits.empty())
+			return;
+		auto ends = ApplyEditsToLines(edits);
+		ClearExtraCursors();
+		SetCursorLine(ends.back().line);
+		SetCursorColumn(ends.back().column);
+		if (onChange) onChange();
+	}
+
+	TextPosition Input::PositionAt(const Vector2& position) {
+		UpdateVisualLines();
+		auto letterHeight = fontMetrics.lineHeight;
+		auto letterWidth = fontMetrics.letterWidth;
+		auto relativeX = position.x - layout.x - padding.left + leftOffset;
+		auto relativeY = position.y - layout.y - padding.top + topOffset;
+		auto rowInLine = 0;
+		auto line = visualLines.LineAtRow(static_cast<int>(max(0.f, relativeY) / letterHeight), &rowInLine);
+		// Round to the nearest caret slot rather than the character under the pointer.
+		auto cell = static_cast<int>(max(0.f, relativeX / letterWidth + .5f));
+		auto columns = visualLines.Columns();
+		if (columns > 0)
+			cell = rowInLine * columns + min(cell, columns);
+		return TextPosition {line, columnIndex.ByteOf(line, min(cell, columnIndex.Width(line)))};
+	}
+
 	void Input::SetCursorFromPosition(const Vector2& position) {
 		if (visibility == Visibility::Collapsed)
 			return;
+		auto target = PositionAt(position);
+		ClearExtraCursors();
+		SetCursorLine(target.line);
+		SetCursorColumn(target.column);
+	}
 
-		auto letterHeight = font.baseSize / GetWindowScaleDPI().y;
-		auto letterWidth = MeasureText("A").x;
-		auto relativeX = position.x - layout.x - padding.left;
-		auto relativeY = position.y - layout.y - padding.top + topOffset;
+	void Input::ExtendSelectionToPosition(const Vector2& position) {
+		if (visibility == Visibility::Collapsed)
+			return;
+		auto anchor = m_selectionAnchor.value_or(TextPosition {CursorLine(), CursorColumn()});
+		m_extraCursors.clear();
+		SetCursors({Cursor {PositionAt(position), anchor}}, 0);
+	}
 
-		SetCursorLine(relativeY / letterHeight);
-		SetCursorColumn(relativeX / letterWidth);
+	void Input::AddCursorAtPosition(const Vector2& position) {
+		if (visibility == Visibility::Collapsed)
+			return;
+		auto target = PositionAt(position);
+		m_extraCursors.push_back(Cursor {target, target});
+		auto primaryIndex = 0;
+		SetCursors(Cursors(&primaryIndex), primaryIndex);
+	}
+
+	void Input::SelectBetweenPositions(const Vector2& from, const Vector2& to, bool columnMode) {
+		if (visibility == Visibility::Collapsed)
+			return;
+		auto anchor = PositionAt(from);
+		auto head = PositionAt(to);
+		if (!columnMode) {
+			ClearExtraCursors();
+			SetCursors({Cursor {head, anchor}}, 0);
+			return;
+		}
+		// Column selection uses the cells under the pointer, clamped to each line.
+		auto cellAt = [&](float x) {
+			return static_cast<int>(max(0.f, (x - layout.x - padding.left + leftOffset) / fontMetrics.letterWidth + .5f));
+		};
+		auto anchorCell = cellAt(from.x);
+		auto headCell = cellAt(to.x);
+		auto step = head.line >= anchor.line ? 1 : -1;
+		auto cursors = vector<Cursor>();
+		for (auto line = anchor.line;; line += step) {
+			auto width = columnIndex.Width(line);
+			cursors.push_back(Cursor {{line, columnIndex.ByteOf(line, min(headCell, width))},
+									  {line, columnIndex.ByteOf(line, min(anchorCell, width))}});
+			if (line == head.line) break;
+		}
+		if (step < 0)
+			reverse(cursors.begin(), cursors.end());
+		auto primaryIndex = step < 0 ? 0 : static_cast<int>(cursors.size()) - 1;
+		SetCursors(std::move(cursors), primaryIndex);
 	}
 
 	void Input::SetTopOffset(float newTopOffset) {
-		auto lineHeight = font.baseSize / GetWindowScaleDPI().y;
-		auto linesNum = static_cast<int>(lines.size());
-		auto contentHeight = linesNum * lineHeight;
+		UpdateVisualLines();
+		auto lineHeight = fontMetrics.lineHeight;
+		auto contentHeight = static_cast<float>(visualLines.TotalRows()) * lineHeight;
 		auto contentHeightWithPadding = contentHeight + padding.top + padding.bottom;
 		topOffset = clamp(newTopOffset, 0.f, contentHeightWithPadding);
 	}
 
+	void Input::SetLeftOffset(float newLeftOffset) {
+		if (softWrap) {
+			leftOffset = 0;
+			return;
+		}
+		auto contentWidth = static_cast<float>(LongestLineLength()) * fontMetrics.letterWidth;
+		leftOffset = clamp(newLeftOffset, 0.f, contentWidth + padding.left + padding.right);
+	}
+
+	int Input::LongestLineLength() const {
+		if (m_longestLineLength < 0) {
+			m_longestLineLength = 0;
+			for (const auto& line: lines)
+				m_longestLineLength = max(m_longestLineLength, static_cast<int>(line.size()));
+		}
+		return m_longestLineLength;
+	}
+
+	void Input::ScrollToCursor() {
+		if (layout.width <= 0 || layout.height <= 0)
+			return;
+		UpdateVisualLines();
+		if (folds && visualLines.IsHidden(CursorLine()))
+			UpdateHiddenLines(folds->Reveal(CursorLine()));
+		auto point = PointOf(TextPosition {CursorLine(), CursorColumn()});
+		auto top = layout.y + padding.top;
+		auto bottom = layout.y + layout.height - padding.bottom;
+		if (point.y < top)
+			SetTopOffset(topOffset - (top - point.y));
+		else if (point.y + fontMetrics.lineHeight > bottom)
+			SetTopOffset(topOffset + (point.y + fontMetrics.lineHeight - bottom));
+		if (softWrap)
+			return;
+		auto left = layout.x + padding.left;
+		auto right = layout.x + layout.width - padding.right - scrollBarWidth;
+		if (point.x < left)
+			SetLeftOffset(leftOffset - (left - point.x));
+		else if (point.x + fontMetrics.letterWidth > right)
+			SetLeftOffset(leftOffset + (point.x + fontMetrics.letterWidth - right));
+	}
+
 	// VerticalBox implementation
 
+	Minimap::Minimap(Input& input) : input(input) {
+		input.minimap = make_unique<MinimapSummary>();
+		input.minimap->Reset(static_cast<int>(input.lines.size()));
+	}
+
+	Minimap::~Minimap() {
+		// Widgets can outlive the window, and its textures with it.
+		if (texture.id != 0 && IsWindowReady())
+			UnloadTexture(texture);
+	}
+
+	Vector2 Minimap::MinSize() const {
+		if (visibility == Visibility::Collapsed)
+			return Vector2 {0, 0};
+		return Vector2 {width, 0};
+	}
+
+	void Minimap::LayoutWidget(const Rectangle& rectangle) {
+		layout = rectangle;
+	}
+
+	void Minimap::UpdatePixels() {
+		PROFILE_SCOPE("Minimap::UpdatePixels");
+		auto& summary = *input.minimap;
+		if (summary.Sweep(input.lines, input.lexer.get(), minimapSweepBudget))
+			redrawRequested = true;
+		// The finest level that fits, so a row is never less than a pixel high.
+		auto height = max(1.f, layout.height);
+		auto newLevel = 0;
+		while (newLevel + 1 < summary.LevelsNum() && static_cast<float>(summary.RowsNum(newLevel)) > height)
+			newLevel++;
+		auto rowsNum = summary.RowsNum(newLevel);
+		auto newRowHeight = clamp(floor(height / static_cast<float>(max(1, rowsNum))), 1.f, minimapMaxRowHeight);
+		if (newLevel == level && newRowHeight == rowHeight && summary.Generation() == pixelsGeneration)
+			return;
+		level = newLevel;
+		rowHeight = newRowHeight;
+		pixelsGeneration = summary.Generation();
+		pixels.resize(static_cast<size_t>(rowsNum) * MinimapSummary::buckets);
+		auto pixel = pixels.begin();
+		for (auto i = 0; i < rowsNum; i++) {
+			const auto& row = summary.At(level, i);
+			for (auto bucket = 0; bucket < MinimapSummary::buckets; bucket++, ++pixel) {
+				auto type = static_cast<size_t>(row.type[bucket]);
+				*pixel = type < colors.size() ? colors[type] : BLACK;
+				pixel->a = row.density[bucket];
+			}
+		}
+		pixelsUploaded = false;
+	}
+
+	void Minimap::Draw() {
+		if (visibility == Visibility::Collapsed)
+			return;
+		PROFILE_SCOPE("Minimap::Draw");
+		UpdatePixels();
+		DrawRectangleRec(layout, WHITE);
+		auto rowsNum = static_cast<int>(pixels.size()) / MinimapSummary::buckets;
+		if (rowsNum > 0) {
+			if (!pixelsUploaded) {
+				if (texture.id != 0 && texture.height == rowsNum)
+					UpdateTexture(texture, pixels.data());
+				else {
+					if (texture.id != 0)
+						UnloadTexture(texture);
+					texture = LoadTextureFromImage(Image {pixels.data(), MinimapSummary::buckets, rowsNum, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8});
+				}
+				pixelsUploaded = true;
+			}
+			auto source = Rectangle {0, 0, static_cast<float>(MinimapSummary::buckets), static_cast<float>(rowsNum)};
+			auto destination = Rectangle {layout.x, layout.y, layout.width, static_cast<float>(rowsNum) * rowHeight};
+			DrawTexturePro(texture, source, destination, Vector2 {0, 0}, 0, WHITE);
+		}
+
+		// The lines in view.
+		auto firstLine = 0, lastLine = 0;
+		input.VisibleLines(firstLine, lastLine);
+		auto scale = rowHeight / static_cast<float>(1 << level);
+		auto view = Rectangle {
+			layout.x, layout.y + static_cast<float>(firstLine) * scale,
+			layout.width, max(2.f, static_cast<float>(lastLine - firstLine + 1) * scale)
+		};
+		DrawRectangleRec(view, Fade(GRAY, .3f));
+		DrawRectangleLinesEx(layout, 1, Fade(BLACK, .25));
+	}
+
+	void Minimap::ScrollTo(float y) {
+		auto line = static_cast<int>((y - layout.y) / rowHeight * static_cast<float>(1 << level));
+		line = clamp(line, 0, static_cast<int>(input.lines.size()) - 1);
+		input.SetTopOffset(static_cast<float>(input.visualLines.RowOfLine(line)) * fontMetrics.lineHeight - input.layout.height / 2);
+	}
+
 	Vector2 VerticalBox::MinSize() const {
 		if (slots.empty() || visibility == Visibility::Collapsed)
 			return Vector2 {0, 0};
@@ -352,6 +1412,7 @@ namespace UI {
 	}
 
 	void VerticalBox::LayoutWidget(const Rectangle& rectangle) {
+		PROFILE_SCOPE("VerticalBox::LayoutWidget");
 
 		layout.x = rectangle.x;
 		layout.y = rectangle.y;
@@ -383,6 +1444,51 @@ namespace UI {
 		return slots.back();
 	}
 
+	// ListView implementation
+
+	ListView::Row::Row(ListView& list, int index)
+		: Button("", Margin{5, 5, 2, 2}), list(list), index(index) {
+		textLambda = [this]() {
+			auto item = this->list.firstItem + this->index;
+			return this->list.itemsNum && item < this->list.itemsNum() ? this->list.itemText(item) : FrameString();
+		};
+		onClick = [this]() {
+			auto item = this->list.firstItem + this->index;
+			if (this->list.itemsNum && item < this->list.itemsNum() && this->list.onItemClick)
+				this->list.onItemClick(item);
+		};
+	}
+
+	void ListView::Row::Draw() {
+		if (visibility == Visibility::Collapsed)
+			return;
+		auto selected = list.selectedItem >= 0 && list.firstItem + index == list.selectedItem;
+		DrawRectangleRec(layout, isActive || selected ? GRAY : isHovered ? LIGHTGRAY : backgroundColor);
+		BeginScissorMode(layout);
+		DrawText(Text(), static_cast<int>(layout.x + padding.left), static_cast<int>(layout.y + padding.top), color);
+		EndScissorMode();
+	}
+
+	ListView::ListView(int rowsNum) {
+		for (auto i = 0; i < rowsNum; i++)
+			AddSlot(make_shared<Row>(*this, i));
+	}
+
+	void ListView::Scroll(int items) {
+		auto rowsNum = static_cast<int>(slots.size());
+		auto count = itemsNum ? itemsNum() : 0;
+		firstItem = clamp(firstItem + items, 0, max(0, count - rowsNum));
+	}
+
+	void ListView::Select(int item) {
+		selectedItem = item;
+		auto rowsNum = static_cast<int>(slots.size());
+		if (item >= 0 && item < firstItem)
+			Scroll(item - firstItem);
+		else if (item >= firstItem + rowsNum)
+			Scroll(item - firstItem - rowsNum + 1);
+	}
+
 	// HorizontalBox implementation
 
 	Vector2 HorizontalBox::MinSize() const {
@@ -400,6 +1506,7 @@ namespace UI {
 	}
 
 	void HorizontalBox::LayoutWidget(const Rectangle& rectangle) {
+		PROFILE_SCOPE("HorizontalBox::LayoutWidget");
 
 		layout.x = rectangle.x;
 		layout.y = rectangle.y;
@@ -431,19 +1538,17 @@ namespace UI {
 		return slots.back();
 	}
 
-	static queue <shared_ptr<UIWidget>> widgetsToProcess;
+	// A queue read from the front by index, so that its memory is kept from one search to the next.
+	static vector <shared_ptr<UIWidget>> widgetsToProcess;
 
 	std::shared_ptr<UIWidget> FindLeafWidgetAtPosition(const std::shared_ptr<UIWidget>& root, const Vector2& position) {
 
-		while (!widgetsToProcess.empty())
-			widgetsToProcess.pop();
+		widgetsToProcess.clear();
+		widgetsToProcess.push_back(root);
 
-		widgetsToProcess.push(root);
+		for (size_t next = 0; next < widgetsToProcess.size(); next++) {
 
-		while (!widgetsToProcess.empty()) {
-
-			auto widget = widgetsToProcess.front();
-			widgetsToProcess.pop();
+			auto widget = widgetsToProcess[next];
 
 			if (widget->visibility == Visibility::Collapsed)
 				continue;
@@ -451,18 +1556,20 @@ namespace UI {
 			if (CheckCollisionPointRec(position, widget->layout)) {
 
 				if (widget->IsLeaf()) {
+					widgetsToProcess.clear(); // so that it holds no widget until the next search
 					return widget;
 				}
 
 				if (auto verticalBox = dynamic_pointer_cast<VerticalBox>(widget))
 					for (const auto& slot: verticalBox->slots)
-						widgetsToProcess.push(slot->widget);
+						widgetsToProcess.push_back(slot->widget);
 				else if (auto horizontalBox = dynamic_pointer_cast<HorizontalBox>(widget))
 					for (const auto& slot: horizontalBox->slots)
-						widgetsToProcess.push(slot->widget);
+						widgetsToProcess.push_back(slot->widget);
 			}
 		}
 
+		widgetsToProcess.clear();
 		return nullptr;
 	}
 
@@ -473,12 +1580,18 @@ namespace UI {
 		}
 	}
 
+	void SetActiveInput(const shared_ptr<Input>& input) {
+		ResetActiveInput();
+		activeInput = input;
+	}
+
 	static bool mouseWasMovedAtLeastOnce = false;
 
 	static std::unordered_map<int, double> nextKeyRepeatTime;
 	static std::vector<int> keysThisTick;
 
 	bool Tick(const std::shared_ptr<UIWidget>& root) {
+		PROFILE_SCOPE("UI::Tick");
 
 		keysThisTick.clear();
 		while (auto key = GetKeyPressed()) {
@@ -496,14 +1609,17 @@ namespace UI {
 			}
 
 
+		auto needRedraw = exchange(redrawRequested, false);
+		needRedraw = RunCompletions(completionsBudget) || needRedraw;
+		// Glyphs first drawn in the last frame were rasterized then and show once uploaded.
+		needRedraw = glyphAtlas.Upload() || needRedraw;
+
 		auto mouseDelta = GetMouseDelta();
 		if (mouseDelta.x != 0 || mouseDelta.y != 0)
 			mouseWasMovedAtLeastOnce = true;
 
 		if (!mouseWasMovedAtLeastOnce)
-			return false; // No mouse movement, no need to process input
-
-		auto needRedraw = false;
+			return needRedraw; // No mouse movement, no need to process input
 
 		auto mousePosition = GetMousePosition();
 		auto hoveredLeafWidget = FindLeafWidgetAtPosition(root, mousePosition);
@@ -527,6 +1643,23 @@ namespace UI {
 					button->isActive = false;
 					needRedraw = true;
 				}
+				if (auto row = dynamic_pointer_cast<ListView::Row>(button)) {
+					if (auto wheelMove = GetMouseWheelMove(); wheelMove != 0) {
+						row->list.Scroll(wheelMove > 0 ? -3 : 3);
+						needRedraw = true;
+					}
+				}
+			}
+			else if (auto minimap = dynamic_pointer_cast<Minimap>(hoveredLeafWidget)) {
+				if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
+					draggedMinimap = minimap;
+					minimap->ScrollTo(mousePosition.y);
+					needRedraw = true;
+				}
+				if (auto wheelMove = GetMouseWheelMove(); wheelMove != 0) {
+					minimap->input.SetTopOffset(minimap->input.TopOffset() - wheelMove * 10);
+					needRedraw = true;
+				}
 			}
 			else if (auto input = dynamic_pointer_cast<Input>(hoveredLeafWidget)) {
 				if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
@@ -535,33 +1668,68 @@ namespace UI {
 						needRedraw = true;
 					}
 					else {
-						input->SetCursorFromPosition(mousePosition);
+						// Alt+click adds a cursor, Shift+click extends the selection, dragging selects
+						// (in columns while Alt is held).
+						if (IsShiftKeyDown())
+							input->ExtendSelectionToPosition(mousePosition);
+						else if (IsAltKeyDown())
+							input->AddCursorAtPosition(mousePosition);
+						else
+							input->SetCursorFromPosition(mousePosition);
+						mouseSelectingInput = input;
+						mouseSelectionStart = mousePosition;
 						needRedraw = true;
 					}
 				}
-				auto wheelMove = GetMouseWheelMoveV().y;
+				// Shift turns the vertical wheel into a horizontal one.
+				auto wheel = GetMouseWheelMoveV();
+				auto wheelMove = IsShiftKeyDown() ? 0 : wheel.y;
+				auto horizontalWheelMove = IsShiftKeyDown() ? wheel.y : wheel.x;
 				if (wheelMove != 0) {
 					auto oldTopOffset = input->TopOffset();
 					input->SetTopOffset(input->TopOffset() - wheelMove * 10);
 					needRedraw = oldTopOffset != input->TopOffset() || needRedraw;
 				}
+				if (horizontalWheelMove != 0) {
+					auto oldLeftOffset = input->LeftOffset();
+					input->SetLeftOffset(input->LeftOffset() - horizontalWheelMove * 10);
+					needRedraw = oldLeftOffset != input->LeftOffset() || needRedraw;
+				}
 			}
 		}
 
+		if (mouseSelectingInput && IsMouseButtonDown(MOUSE_LEFT_BUTTON) && (mouseDelta.x != 0 || mouseDelta.y != 0)
+			&& !IsShiftKeyDown()) {
+			mouseSelectingInput->SelectBetweenPositions(mouseSelectionStart, mousePosition, IsAltKeyDown());
+			needRedraw = true;
+		}
+
+		if (draggedMinimap && IsMouseButtonDown(MOUSE_LEFT_BUTTON) && mouseDelta.y != 0) {
+			draggedMinimap->ScrollTo(mousePosition.y);
+			needRedraw = true;
+		}
+
 		if (IsMouseButtonReleased(MOUSE_LEFT_BUTTON)) {
 			mouseDownButton = nullptr;
+			mouseSelectingInput = nullptr;
+			draggedMinimap = nullptr;
 		}
 
-		if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && hoveredLeafWidget != activeInput) {
+		// Scrolling by the minimap keeps the keyboard in the text.
+		if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && hoveredLeafWidget != activeInput && !draggedMinimap) {
 			ResetActiveInput();
 			needRedraw = true;
 		}
 
-		if (activeInput) {
+		if (activeInput && !activeInput->locked) {
+			auto handled = false;
 			while (auto c = GetCharPressed())
-				needRedraw = activeInput->HandleChar(c) || needRedraw;
+				handled = activeInput->HandleChar(c) || handled;
 			for (const auto& key: keysThisTick)
-				needRedraw = activeInput->HandleKey(key) || needRedraw;
+				handled = activeInput->HandleKey(key) || handled;
+			if (handled)
+				activeInput->ScrollToCursor();
+			needRedraw = handled || needRedraw;
 		}
 
 		lastHoveredLeafWidget = hoveredLeafWidget;
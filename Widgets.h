@@ -2,19 +2,43 @@
 
 #include <raylib.h>
 #include <string>
+#include <string_view>
 #include <functional>
 #include <list>
 #include <unordered_map>
+#include <optional>
+#include <algorithm>
+#include "FoldIndex.h"
+#include "FrameArena.h"
+#include "GlyphAtlas.h"
 #include "Lexer.h"
+#include "LineDiff.h"
+#include "Minimap.h"
+#include "Search.h"
+#include "SymbolIndex.h"
+#include "TextBatch.h"
+#include "TextEdit.h"
+#include "Utf8.h"
+#include "VisualLineIndex.h"
 
 namespace UI {
 
 	Color YiqContrast(const Color& color);
 
-	extern Font font;
+	// Glyphs of the UI font; when it is not loaded, text falls back to raylib's built-in font.
+	extern GlyphAtlas glyphAtlas;
 
-	Vector2 MeasureText(const std::string& text);
-	void DrawText(const std::string& text, int x, int y, Color color);
+	// Cell metrics of the monospace font, cached so that text layout does not need a window.
+	struct FontMetrics {
+		float size = 16;
+		float lineHeight = 16;
+		float letterWidth = 8;
+	};
+	extern FontMetrics fontMetrics;
+	void UpdateFontMetrics();
+
+	Vector2 MeasureText(std::string_view text);
+	void DrawText(std::string_view text, int x, int y, Color color);
 
 	struct Margin {
 		float left = 0, right = 0, top = 0, bottom = 0;
@@ -51,9 +75,10 @@ namespace UI {
 		Color color = BLACK;
 		Margin padding = Margin();
 		Color backgroundColor = WHITE;
-		std::function<std::string()> textLambda = nullptr;
+		// Called every frame the label is measured or drawn, so it builds the text in the frame arena.
+		std::function<FrameString()> textLambda = nullptr;
 
-		std::string Text() const { return textLambda ? textLambda() : text; }
+		FrameString Text() const { return textLambda ? textLambda() : FrameString(text); }
 
 		explicit Label(std::string text, Color color = BLACK, const Margin& padding = Margin{5, 5, 5, 5});
 		Vector2 MinSize() const override;
@@ -65,18 +90,74 @@ namespace UI {
 	struct Button : public Label {
 
 		std::function<void()> onClick = nullptr;
+		bool isSelected = false; // drawn darker, like the tab that is shown
 
 		explicit Button(std::string text, const Margin& padding = Margin{10, 10, 5, 5});
 		void Draw() override;
 	};
 
+	bool IsCommandKeyDown(); // Control, or Command on macOS
+	bool IsShiftKeyDown();
+	bool IsAltKeyDown();
+
+	struct Cursor {
+		TextPosition head;   // where the caret is drawn
+		TextPosition anchor; // the other end of the selection; equal to head when nothing is selected
+		TextPosition Begin() const { return std::min(head, anchor); }
+		TextPosition End() const { return std::max(head, anchor); }
+		bool HasSelection() const { return head != anchor; }
+	};
+
 	struct Input : public Label {
 		std::unique_ptr<Lexer> lexer = nullptr;
 		std::vector<std::string>& lines;
+		// TextPosition columns are byte offsets; on screen every grapheme cluster takes one cell.
+		mutable ColumnIndex columnIndex;
 		int m_cursorDesiredColumn = 0;
 		int m_cursorLine = 0;
+		std::optional<TextPosition> m_selectionAnchor;
+		std::vector<Cursor> m_extraCursors;
+		std::vector<Cursor> m_drawnCursors; // refilled every frame, so drawing them allocates nothing once warm
 		std::function<void()> onChange = nullptr;
+		// Called right before the lines are modified, e.g. to stop background readers.
+		std::function<void()> onBeforeEdit = nullptr;
+		// Called with every batch right after it was applied, e.g. to journal it.
+		std::function<void(const std::vector<TextEdit>& edits)> onEdit = nullptr;
+		// When set, Enter calls it instead of breaking the line, e.g. in single-line fields.
+		std::function<void()> onEnter = nullptr;
+		// Sees every key first; returning true keeps it from the input, e.g. while a popup takes the arrows.
+		std::function<bool(int key)> onKey = nullptr;
+		// Takes no keys or characters, e.g. while its lines are still being read.
+		bool locked = false;
 		float topOffset = 0;
+		float leftOffset = 0; // horizontal scroll; always 0 while soft-wrapping
+		mutable int m_longestLineLength = -1; // in bytes, -1 until measured; may overestimate the cells
+		LexerCheckpoints lexerCheckpoints;
+		std::vector<SearchMatch> highlights; // sorted by position
+		bool softWrap = false;
+		VisualLineIndex visualLines;
+		// When set, lines changed since the last save are marked in the left padding.
+		std::unique_ptr<LineDiff> diff = nullptr;
+		// Kept up to date while a Minimap shows this input.
+		std::unique_ptr<MinimapSummary> minimap = nullptr;
+		// When set, the lines are document `symbolsFile` of this index, which edits keep up to date.
+		SymbolIndex *symbols = nullptr;
+		int symbolsFile = -1;
+		// When set, code regions can be folded; the regions are found a slice per frame and follow edits.
+		std::unique_ptr<FoldIndex> folds = nullptr;
+
+		// Glyph quads of one visible line, relative to the line's first cell, so scrolling reuses them.
+		struct LineQuads {
+			int from = 0, to = 0, columns = 0; // the visible cells and wrap width they were built for
+			uint64_t atlasGeneration = 0;
+			bool complete = true; // false when some glyph was not drawable yet or the line was drawn unlexed
+			TextBatch batch;
+		};
+		// Kept across frames for the visible lines only; a line is rebuilt when it or any line before it is edited,
+		// when its visible cells change, or when the atlas evicted glyphs.
+		std::unordered_map<int, LineQuads> lineQuads;
+		// Scrolled out, kept with their map nodes for the lines scrolled in next.
+		std::vector<std::unordered_map<int, LineQuads>::node_type> spareLineQuads;
 
 		int CursorLine();
 		void SetCursorLine(int line);
@@ -84,16 +165,105 @@ namespace UI {
 		void SetCursorColumn(int column);
 		std::string& Line();
 
+		// Every cursor, the primary one included, clamped to the text, sorted and with overlapping ones merged.
+		std::vector<Cursor> Cursors(int *primaryIndex = nullptr);
+		// The same into `cursors`, reusing its storage.
+		void Cursors(std::vector<Cursor>& cursors, int *primaryIndex = nullptr);
+		void SetCursors(std::vector<Cursor> cursors, int primaryIndex);
+		void ClearExtraCursors();
+		std::string SelectedText();
+		// Builds one edit per cursor and applies them all as a single batch; cursors end up after their edits.
+		bool EditAtCursors(const std::function<TextEdit(const Cursor& cursor)>& makeEdit);
+		bool InsertAtCursors(const std::string& text);
+		void MoveCursors(const std::function<TextPosition(const Cursor& cursor)>& move, bool extendSelection);
+		TextPosition PreviousPosition(const TextPosition& position);
+		TextPosition NextPosition(const TextPosition& position);
+		bool AddCursorAtNextOccurrence();
+		bool AddCursorsAtMatches(const std::vector<SearchMatch>& matches);
+
 		float TopOffset() const { return topOffset; }
 		void SetTopOffset(float newTopOffset);
+		float LeftOffset() const { return leftOffset; }
+		void SetLeftOffset(float newLeftOffset);
+		int LongestLineLength() const;
+		// Scrolls just enough to bring the primary cursor into view.
+		void ScrollToCursor();
 
 		Input (std::vector<std::string>& lines, Color color = BLACK, const Margin& padding = Margin{5, 5, 5, 5});
 		Vector2 MinSize() const override;
 		void Draw() override;
 		bool HandleChar(int c);
 		bool HandleKey(int key);
+		// Applies the edits as one change and puts the cursor after the last one.
+		void ApplyEdits(const std::vector<TextEdit>& edits);
+		// Every edit goes through here; keeps the derived per-line data in step and returns the edits' end positions.
+		std::vector<TextPosition> ApplyEditsToLines(const std::vector<TextEdit>& edits);
+		// Call after the lines were replaced from outside, e.g. when a file was loaded. `lineHashes` are the diff's
+		// hashes of the new lines when they were kept or worked out ahead, which spares hashing them again.
+		void OnLinesReplaced(std::vector<uint64_t> lineHashes = {});
+
+		int WrapColumns() const;
+		// Refreshes the visual line index for the current width, visible lines first.
+		void UpdateVisualLines();
+		// Sweeps the folds and hides the lines of the folded ones.
+		void UpdateFolds();
+		// Hides and shows the lines in [first, last] as the folds say, e.g. with what a FoldIndex call returned.
+		void UpdateHiddenLines(std::pair<int, int> changed);
+		// Folds or unfolds the region at the primary cursor; cursors folded away move to the line it starts on.
+		void FoldAtCursor(bool folded);
+		void FoldAll(bool folded);
+		void MoveCursorsOutOfFolds();
+		void VisibleRows(int& firstRow, int& lastRow) const;
+		void VisibleLines(int& firstLine, int& lastLine) const;
+		// Cells of `line` that are inside the view; `to` may lie past the end of the line.
+		void VisibleColumns(int line, int& from, int& to) const;
+		// Top-left corner of the character cell at `position`, in screen coordinates.
+		Vector2 PointOf(const TextPosition& position) const;
+		Vector2 PointOfCell(int line, int cell) const;
+		void DrawSpan(int line, int from, int to, Color color) const;
+		void DrawChangeGutter(int firstLine, int lastLine) const;
+		// Brings `lineQuads` up to date for the visible lines; everything but submitting them, so it runs headless.
+		void UpdateTextQuads();
+		LineQuads& StartLineQuads(int line);
+		void InvalidateLineQuads(int firstLine);
+		void BuildLineText(int line);
+		// Lexes [from, to) starting at the closest checkpoint and builds the quads of the visible characters.
+		void BuildTokens(const TextPosition& from, const TextPosition& to);
 
+		TextPosition PositionAt(const Vector2& position);
 		void SetCursorFromPosition(const Vector2& position);
+		void ExtendSelectionToPosition(const Vector2& position);
+		void AddCursorAtPosition(const Vector2& position);
+		// Selects from `from` to `to`; in column mode every line in between gets its own cursor.
+		void SelectBetweenPositions(const Vector2& from, const Vector2& to, bool columnMode);
+	};
+
+	// Gives `input` the keyboard; nullptr leaves no input focused.
+	void SetActiveInput(const std::shared_ptr<Input>& input);
+
+	// An overview of the whole text of an input, to put next to it: a row of pixels per line, or per group of lines
+	// in long documents, shaded by how much text each part holds and colored by its main token type. Clicking or
+	// dragging scrolls the input there. The pixels are a texture redrawn only when the summary changed.
+	struct Minimap : public UIWidget {
+		Input& input;
+		float width = 80;
+		int level = 0; // of the summary shown
+		float rowHeight = 1;
+		std::vector<Color> pixels; // a pixel per bucket and row
+		Texture2D texture = Texture2D();
+		uint64_t pixelsGeneration = 0;
+		bool pixelsUploaded = false;
+
+		explicit Minimap(Input& input);
+		~Minimap() override;
+		Vector2 MinSize() const override;
+		void LayoutWidget(const Rectangle& rectangle) override;
+		void Draw() override;
+		bool IsLeaf() const override { return true; }
+		// Brings the summary and `pixels` up to date; everything but drawing, so it runs headless.
+		void UpdatePixels();
+		// Scrolls the input so that the line shown at height `y` is in the middle.
+		void ScrollTo(float y);
 	};
 
 	struct VerticalBox : public UIWidget {
@@ -110,6 +280,30 @@ namespace UI {
 		bool IsLeaf() const override { return false; }
 	};
 
+	// A list of items too long to make a widget each: only as many rows as are shown are buttons, and the wheel
+	// scrolls the items through them.
+	struct ListView : public VerticalBox {
+		struct Row : public Button {
+			ListView& list;
+			int index = 0; // among the rows
+
+			Row(ListView& list, int index);
+			void Draw() override;
+		};
+
+		std::function<int()> itemsNum = nullptr;
+		std::function<FrameString(int item)> itemText = nullptr;
+		std::function<void(int item)> onItemClick = nullptr;
+		int firstItem = 0;
+		int selectedItem = -1; // highlighted, e.g. while chosen with the keyboard
+
+		explicit ListView(int rowsNum);
+		// Scrolls by `items`, keeping the last page full.
+		void Scroll(int items);
+		// Highlights `item` and scrolls it into view.
+		void Select(int item);
+	};
+
 	struct HorizontalBox : public UIWidget {
 		struct Slot {
 			std::shared_ptr<UIWidget> widget = nullptr;
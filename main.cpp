@@ -5,9 +5,22 @@
 #include <raylib.h>
 #include <functional>
 #include <format>
+#include <mutex>
 #include "Widgets.h"
 #include <filesystem>
 #include "Lexer.h"
+#include "Profiler.h"
+#include "Search.h"
+#include "EditJournal.h"
+#include "FileIndex.h"
+#include "FileWatch.h"
+#include "HibernatedLines.h"
+#include "Jobs.h"
+#include "LineDiff.h"
+#include "ProjectSearch.h"
+#include "Session.h"
+#include "SymbolIndex.h"
+#include "TextFile.h"
 
 using namespace std;
 using namespace std::filesystem;
@@ -17,15 +30,78 @@ static const int screenWidth = 800;
 static const int screenHeight = 600;
 static const char *windowTitle = "TextEd";
 static const int targetFPS = 60;
+#ifdef TEXTED_PROFILE
+static const char *traceFilePath = "texted-trace.json";
+#endif
+static const char *sessionFileName = ".texted-session"; // in the working directory
+static const double sessionWriteInterval = 5; // seconds
+static const int previewLexedLines = 1'000; // lines above the view a restored document's preview lexes from a checkpoint
 
 struct FileInfo {
 	vector<string> lines = {""};
 	vector<string> originalLines = {""};
 	optional<string> path;
 	bool wasModified = false;
+	bool changedOnDisk = false; // while modified, so the changes were not reloaded
+	// The file as last read or written, not known once it changed on disk.
+	FileStamp stamp;
+	vector<uint64_t> blockLines;
 };
 
 FileInfo fileInfo = FileInfo();
+// Unsaved edits of the open file, replayed when it is opened again after a crash.
+unique_ptr<EditJournal> editJournal = make_unique<EditJournal>();
+// Set when the file was reloaded from disk; the journal then still describes the file as it was before.
+bool journalOutdated = false;
+bool reloadingFromDisk = false;
+FileWatch fileWatch;
+vector<FileChange> fileChanges;
+
+// Open documents, one tab each (Ctrl+Tab, Ctrl+W). The one shown lives in the globals above and the text area;
+// the others hibernate: their lines are set aside, compressed in the background past a budget, and what the text
+// area derives from lines (line indexes, lexer checkpoints, the diff) is dropped, to be rebuilt lazily when shown.
+// The tabs likely to be shown next are kept uncompressed, and woken ahead on the JobPool if they were compressed.
+struct Document {
+	FileInfo info;
+	HibernatedLines lines;
+	HibernatedLines originalLines; // dropped when compressed if saved as they are, then copied from `lines`
+	bool originalIsLines = true;
+	unique_ptr<EditJournal> journal; // made when first shown
+	bool journalOutdated = false;
+	vector<UI::Cursor> cursors = {UI::Cursor()};
+	int primaryCursor = 0;
+	float topOffset = 0;
+	float leftOffset = 0;
+	uint64_t lastShown = 0;
+	// The file when the document was hidden, since it is not watched meanwhile.
+	file_time_type diskTime;
+	uintmax_t diskSize = 0;
+	// Verified while shown, so lexing resumes from them when shown again as it was.
+	vector<TextPosition> lexerCheckpoints;
+	// The diff's hashes of the lines and the saved lines, so showing it does not hash every line again; dropped when
+	// compressed, and worked out again when woken ahead. Empty when unknown.
+	vector<uint64_t> lineHashes;
+	vector<uint64_t> originalHashes;
+	bool loaded = true; // false for one restored from the last session, whose file is read when first shown
+	// Background jobs on the document as it was take tokens of these: `edits` is cancelled by every change to its
+	// lines, `lifetime` when the tab is closed or another file is read into it.
+	CancellationSource edits;
+	CancellationSource lifetime;
+};
+
+// Hidden documents keep their text as it is up to this much, the most recently shown first, so switching between a
+// few of them only moves vectors; the text of the others is compressed.
+static const size_t uncompressedTextBudget = 64 << 20;
+vector<unique_ptr<Document>> documents;
+size_t activeDocument = 0;
+uint64_t documentsShown = 0;
+bool tabsChanged = true; // the tab bar is rebuilt in the main loop, never from a click on one of its buttons
+// Set by Ctrl+W on a modified document, which is closed only by a second Ctrl+W before it is edited or switched from.
+bool discardRequested = false;
+// A tab asked for whose lines are being woken on the JobPool; it is shown once they are.
+Document *documentToShow = nullptr;
+string sessionPath;
+SessionWriter sessionWriter;
 
 enum class FileDialogueType {
 	Open, SaveAs
@@ -33,12 +109,491 @@ enum class FileDialogueType {
 
 vector<string> filePath = {""};
 
+// Quick open (Ctrl+P): files under the working directory, crawled the first time it is opened.
+static const int quickOpenResultsNum = 12;
+static const double quickOpenCrawlRankInterval = .25; // seconds between rankings while the crawl finds files
+FileIndex fileIndex;
+// Shared with the ranking job; what the crawler finds waits until no job holds it.
+shared_ptr<FuzzyMatcher> fileMatcher = make_shared<FuzzyMatcher>();
+vector<IndexedFileChange> indexChanges;
+vector<string> quickOpenQuery = {""};
+vector<FuzzyMatch> quickOpenResults;
+shared_ptr<const FuzzyCandidates> quickOpenCandidates; // of the last ranking done
+CancellationSource quickOpenRankings;
+bool quickOpenRanking = false;
+bool quickOpenEnterPressed = false; // while ranking, to open the best match once it is known
+double quickOpenRankedAt = 0;
+
 shared_ptr<UI::VerticalBox> window;
 shared_ptr<UI::VerticalBox> fileDialogue;
 shared_ptr<UI::UIWidget> activeWidget;
 shared_ptr<UI::Button> fileDialogueButton;
 shared_ptr<UI::Input> textarea;
+shared_ptr<UI::Input> filePathInput;
+shared_ptr<UI::VerticalBox> profilerOverlay;
+shared_ptr<UI::HorizontalBox> tabBar;
+shared_ptr<UI::HorizontalBox> findBar;
+shared_ptr<UI::VerticalBox> projectSearchPanel;
+shared_ptr<UI::Input> projectSearchInput;
+shared_ptr<UI::ListView> projectResultsList;
+shared_ptr<UI::VerticalBox> quickOpen;
+shared_ptr<UI::Input> quickOpenInput;
+vector<shared_ptr<UI::Button>> quickOpenButtons;
+shared_ptr<UI::ListView> completionList;
+shared_ptr<UI::VerticalBox> goToSymbol;
+shared_ptr<UI::Input> goToSymbolInput;
+shared_ptr<UI::ListView> symbolResultsList;
 FileDialogueType fileDialogueType = FileDialogueType::Open;
+bool layoutRequested = false;
+
+vector<string> searchQuery = {""};
+vector<string> replaceText = {""};
+bool searchIsRegex = false;
+Search documentSearch;
+
+// Find in files (Ctrl+Shift+F): searches the files under the working directory.
+static const int projectResultRowsNum = 10;
+ProjectSearch projectSearch;
+vector<string> projectSearchQuery = {""};
+string projectSearchRoot;
+vector<ProjectSearchResult> projectResults;
+vector<pair<size_t, size_t>> projectResultRows; // result and match shown in every row of the list
+
+// Completion (Ctrl+Space) and go to symbol (Ctrl+T): the identifiers of the open file, indexed as it is edited, and
+// of the C and C++ sources under the working directory, lexed in the background the first time either is used.
+static const int completionsNum = 50;
+static const int completionRowsNum = 8;
+static const int symbolResultsNum = 200;
+static const int symbolResultRowsNum = 12;
+static const int symbolSweepBudget = 5'000; // lines of the open file indexed per frame after it was loaded
+static const int symbolMergeBudget = 5'000; // occurrences of lexed files added per frame
+SymbolIndex symbolIndex;
+SymbolIndexer symbolIndexer;
+bool symbolIndexerStarted = false;
+vector<SymbolCompletion> completions;
+size_t completionPrefixLength = 0;
+vector<string> goToSymbolQuery = {""};
+vector<SymbolCompletion> symbolResults;
+
+void RestartSearch() {
+	documentSearch.Cancel();
+	if (!textarea || !findBar)
+		return;
+	textarea->highlights.clear();
+	if (findBar->visibility == UI::Visibility::Visible)
+		documentSearch.Start(fileInfo.lines, searchQuery[0], searchIsRegex);
+}
+
+void ToggleFindBar() {
+	findBar->visibility = findBar->visibility == UI::Visibility::Visible
+						  ? UI::Visibility::Collapsed : UI::Visibility::Visible;
+	layoutRequested = true;
+	RestartSearch();
+}
+
+void StartProjectSearch() {
+	projectResults.clear();
+	projectResultRows.clear();
+	projectResultsList->firstItem = 0;
+	projectSearchRoot = current_path().string();
+	projectSearch.Start(projectSearchRoot, projectSearchQuery[0]);
+}
+
+void ToggleProjectSearch() {
+	auto visible = projectSearchPanel->visibility == UI::Visibility::Visible;
+	projectSearchPanel->visibility = visible ? UI::Visibility::Collapsed : UI::Visibility::Visible;
+	layoutRequested = true;
+	if (visible)
+		projectSearch.Cancel();
+	UI::SetActiveInput(visible ? textarea : projectSearchInput);
+}
+
+// Adds the files searched since the last call to the list; returns whether there were any with matches.
+bool ApplyProjectSearchResults() {
+	auto first = projectResults.size();
+	if (!projectSearch.TakeResults(projectResults))
+		return false;
+	for (auto result = first; result < projectResults.size(); result++)
+		for (size_t match = 0; match < projectResults[result].matches.size(); match++)
+			projectResultRows.emplace_back(result, match);
+	return true;
+}
+
+FrameString ProjectResultText(int row) {
+	auto [result, match] = projectResultRows[static_cast<size_t>(row)];
+	const auto& found = projectResults[result].matches[match];
+	return FrameFormat("{}:{}: {}", projectResults[result].path, found.line + 1, found.text);
+}
+
+// A regex is matched against a copy of the lines on the JobPool, and its edits applied only if the document was not
+// edited meanwhile; literal matches are found fast enough to replace at once.
+void ReplaceAll() {
+	documentSearch.Cancel();
+	auto edits = vector<TextEdit>();
+	if (!searchIsRegex) {
+		if (BuildReplaceAllEdits(fileInfo.lines, searchQuery[0], false, replaceText[0], edits, documentSearch.error))
+			textarea->ApplyEdits(edits);
+		return;
+	}
+	struct Replacement {
+		vector<TextEdit> edits;
+		string error;
+		bool built = false;
+	};
+	auto document = documents[activeDocument].get();
+	auto lifetime = document->lifetime.Token();
+	RunJob(TaskPriority::Visible, document->edits.Token(), [lines = fileInfo.lines, pattern = searchQuery[0],
+															 replacement = replaceText[0]]() {
+		auto result = Replacement();
+		result.built = BuildReplaceAllEdits(lines, pattern, true, replacement, result.edits, result.error);
+		return result;
+	}, [document, lifetime](Replacement result) {
+		if (lifetime.IsCancelled() || documents[activeDocument].get() != document)
+			return;
+		if (result.built)
+			textarea->ApplyEdits(result.edits);
+		else
+			documentSearch.error = std::move(result.error);
+	});
+}
+
+// The change gutter compares against the saved lines; call whenever `originalLines` is replaced.
+void ResetBaseline(vector<uint64_t> hashes = {}) {
+	if (textarea && textarea->diff)
+		textarea->diff->Reset(LineDiff::Baseline, fileInfo.originalLines, std::move(hashes));
+}
+
+// Brings the document in step with what changed on disk, unless it has unsaved changes of its own.
+bool ApplyFileChanges() {
+	if (!fileWatch.TakeChanges(fileChanges))
+		return false;
+	PROFILE_SCOPE("File::ApplyChanges");
+	for (auto& change: fileChanges) {
+		fileInfo.stamp = FileStamp();
+		fileInfo.blockLines.clear();
+		if (fileInfo.wasModified || fileInfo.changedOnDisk) {
+			fileInfo.changedOnDisk = true;
+			continue;
+		}
+		// A cursor on the last line follows what is appended, like tail -f.
+		auto following = textarea->CursorLine() == static_cast<int>(fileInfo.lines.size()) - 1;
+		if (change.whole) {
+			documents[activeDocument]->edits.Cancel();
+			fileInfo.lines = std::move(change.addedLines);
+			if (fileInfo.lines.empty())
+				fileInfo.lines.push_back("");
+			fileInfo.originalLines = fileInfo.lines;
+			ResetBaseline();
+			textarea->OnLinesReplaced();
+		}
+		else {
+			auto edits = vector<TextEdit> {
+				ReplaceLinesEdit(fileInfo.lines, change.firstLine, change.removedLines, change.addedLines)
+			};
+			reloadingFromDisk = true;
+			textarea->ApplyEditsToLines(edits);
+			reloadingFromDisk = false;
+			auto changes = vector<LineChange>();
+			ApplyEdits(fileInfo.originalLines, edits, &changes);
+			textarea->diff->ApplyLineChanges(LineDiff::Baseline, fileInfo.originalLines, changes);
+		}
+		journalOutdated = true;
+		if (following) {
+			textarea->SetCursorLine(static_cast<int>(fileInfo.lines.size()) - 1);
+			textarea->SetCursorColumn(static_cast<int>(fileInfo.lines.back().size()));
+			textarea->ScrollToCursor();
+		}
+	}
+	fileChanges.clear();
+	RestartSearch();
+	return true;
+}
+
+void OpenFile(const string& path, function<void()> then = nullptr);
+
+void OpenQuickOpenResult(size_t index);
+
+void ShowQuickOpenResults() {
+	for (size_t i = 0; i < quickOpenButtons.size(); i++) {
+		quickOpenButtons[i]->visibility = i < quickOpenResults.size() ? UI::Visibility::Visible : UI::Visibility::Collapsed;
+		quickOpenButtons[i]->text = i < quickOpenResults.size() ? quickOpenResults[i].path : "";
+	}
+	layoutRequested = true;
+}
+
+// Ranks the files for the query on the JobPool, in place of a ranking still under way; the palette shows the results
+// once they are in. A query typed on from the last one ranked only scores the files that matched it.
+void UpdateQuickOpenResults() {
+	quickOpenRankings.Cancel();
+	quickOpenRanking = true;
+	quickOpenRankedAt = GetTime();
+	auto token = quickOpenRankings.Token();
+	RunJob(TaskPriority::Visible, token, [token, query = quickOpenQuery[0], matcher = shared_ptr<const FuzzyMatcher>(fileMatcher),
+										  previous = quickOpenCandidates]() {
+		auto results = vector<FuzzyMatch>();
+		auto candidates = make_shared<FuzzyCandidates>();
+		matcher->Find(query, quickOpenResultsNum, results, token, previous.get(), candidates.get());
+		return pair(std::move(results), shared_ptr<const FuzzyCandidates>(std::move(candidates)));
+	}, [](pair<vector<FuzzyMatch>, shared_ptr<const FuzzyCandidates>> ranked) {
+		quickOpenResults = std::move(ranked.first);
+		quickOpenCandidates = std::move(ranked.second);
+		quickOpenRanking = false;
+		ShowQuickOpenResults();
+		if (quickOpenEnterPressed) {
+			quickOpenEnterPressed = false;
+			OpenQuickOpenResult(0);
+		}
+	});
+}
+
+// Moves what the crawler found into the matcher; returns whether the open palette changed.
+bool ApplyIndexChanges() {
+	// While the crawl runs, the open palette is ranked again a few times a second rather than for every batch.
+	auto shown = activeWidget == quickOpen;
+	if (shown && fileIndex.IsCrawling() && GetTime() - quickOpenRankedAt < quickOpenCrawlRankInterval)
+		return false;
+	// A ranking job still holds the matcher; it is let go as soon as the job ran.
+	if (fileMatcher.use_count() > 1 || !fileIndex.TakeChanges(indexChanges))
+		return false;
+	PROFILE_SCOPE("QuickOpen::ApplyIndexChanges");
+	for (auto& change: indexChanges)
+		if (change.removed)
+			fileMatcher->Remove(change.path);
+		else
+			fileMatcher->Add(std::move(change.path));
+	indexChanges.clear();
+	if (!shown)
+		return false;
+	UpdateQuickOpenResults();
+	return true;
+}
+
+void OpenQuickOpen() {
+	if (!fileIndex.IsRunning())
+		fileIndex.Start(current_path().string());
+	quickOpenQuery = {""};
+	quickOpenInput->OnLinesReplaced();
+	activeWidget = quickOpen;
+	UI::SetActiveInput(quickOpenInput);
+	quickOpenResults.clear();
+	ShowQuickOpenResults();
+	UpdateQuickOpenResults();
+}
+
+void CloseQuickOpen() {
+	quickOpenRankings.Cancel();
+	quickOpenRanking = quickOpenEnterPressed = false;
+	activeWidget = window;
+	UI::SetActiveInput(textarea);
+}
+
+void OpenQuickOpenResult(size_t index) {
+	if (index >= quickOpenResults.size())
+		return;
+	OpenFile((path(fileIndex.Root()) / quickOpenResults[index].path).string());
+	CloseQuickOpen();
+}
+
+void CloseSymbolDocument() {
+	auto& document = textarea->symbolsFile;
+	if (document < 0)
+		return;
+	// A file on disk stays indexed as it was last edited; a new file never saved leaves nothing behind.
+	if (symbolIndex.Path(document).empty())
+		symbolIndex.ResetDocument(document, 0);
+	symbolIndex.CloseDocument(document);
+	document = -1;
+}
+
+// Makes the open file the document the symbol index follows; call before the input's OnLinesReplaced(), or after it
+// when `unchanged`: the lines are those the document had when it was hidden, so what was indexed of them is kept.
+void OpenSymbolDocument(bool unchanged = false) {
+	auto key = string();
+	if (fileInfo.path) {
+		auto error = error_code();
+		key = weakly_canonical(fileInfo.path.value(), error).string();
+	}
+	auto& document = textarea->symbolsFile;
+	if (document >= 0 && symbolIndex.Path(document) == key)
+		return;
+	CloseSymbolDocument();
+	document = symbolIndex.OpenDocument(key, static_cast<int>(fileInfo.lines.size()), unchanged);
+}
+
+void StartSymbolIndexer() {
+	if (symbolIndexerStarted)
+		return;
+	symbolIndexerStarted = true;
+	auto error = error_code();
+	auto root = canonical(current_path(), error);
+	if (!error)
+		symbolIndexer.Start(root.string());
+}
+
+void CloseCompletions() {
+	completions.clear();
+	completionList->visibility = UI::Visibility::Collapsed;
+}
+
+// Completes the identifier before the primary cursor; the popup closes when there is nothing to offer.
+void UpdateCompletions() {
+	const auto& line = textarea->Line();
+	auto end = static_cast<size_t>(textarea->CursorColumn());
+	auto begin = end;
+	while (begin > 0 && (isalnum(static_cast<unsigned char>(line[begin - 1])) || line[begin - 1] == '_'))
+		begin--;
+	auto prefix = string_view(line).substr(begin, end - begin);
+	if (prefix.empty()) {
+		CloseCompletions();
+		return;
+	}
+	symbolIndex.Complete(prefix, completionsNum + 1, completions);
+	// The word being typed is indexed as well; offering it back is no help.
+	erase_if(completions, [&](const SymbolCompletion& completion) { return completion.name == prefix; });
+	if (completions.size() > static_cast<size_t>(completionsNum))
+		completions.resize(static_cast<size_t>(completionsNum));
+	if (completions.empty()) {
+		CloseCompletions();
+		return;
+	}
+	completionPrefixLength = prefix.size();
+	completionList->visibility = UI::Visibility::Visible;
+	completionList->firstItem = 0;
+	completionList->Select(0);
+
+	auto rowsNum = min(static_cast<int>(completions.size()), completionRowsNum);
+	for (auto i = 0; i < completionRowsNum; i++)
+		completionList->slots[static_cast<size_t>(i)]->widget->visibility = i < rowsNum ? UI::Visibility::Visible : UI::Visibility::Collapsed;
+	auto width = 0.f;
+	for (const auto& completion: completions)
+		width = max(width, UI::MeasureText(completion.name).x);
+	auto size = completionList->MinSize();
+	size.x = max(size.x, width + 10);
+	// Under the start of the word, or above it when there is no room below.
+	auto point = textarea->PointOf(TextPosition {textarea->CursorLine(), static_cast<int>(begin)});
+	auto y = point.y + UI::fontMetrics.lineHeight;
+	if (y + size.y > static_cast<float>(GetScreenHeight()))
+		y = point.y - size.y;
+	completionList->LayoutWidget(Rectangle {point.x, y, size.x, size.y});
+}
+
+void AcceptCompletion(int item) {
+	if (item < 0 || item >= static_cast<int>(completions.size()))
+		return;
+	auto suffix = string(completions[static_cast<size_t>(item)].name.substr(completionPrefixLength));
+	CloseCompletions();
+	textarea->InsertAtCursors(suffix);
+	textarea->ScrollToCursor();
+}
+
+// Keys the text area passes on while the completion popup is open; returns whether the popup took the key.
+bool HandleCompletionKey(int key) {
+	if (UI::IsCommandKeyDown() && key == KEY_SPACE) {
+		StartSymbolIndexer();
+		UpdateCompletions();
+		return true;
+	}
+	if (completionList->visibility != UI::Visibility::Visible)
+		return false;
+	auto count = static_cast<int>(completions.size());
+	switch (key) {
+		case KEY_DOWN:
+			completionList->Select((completionList->selectedItem + 1) % count);
+			return true;
+		case KEY_UP:
+			completionList->Select((completionList->selectedItem + count - 1) % count);
+			return true;
+		case KEY_ENTER:
+		case KEY_TAB:
+			AcceptCompletion(completionList->selectedItem);
+			return true;
+		case KEY_ESCAPE:
+			CloseCompletions();
+			return true;
+		case KEY_LEFT:
+		case KEY_RIGHT:
+		case KEY_HOME:
+		case KEY_END:
+		case KEY_PAGE_UP:
+		case KEY_PAGE_DOWN:
+			CloseCompletions();
+			return false;
+		default:
+			return false;
+	}
+}
+
+void UpdateSymbolResults() {
+	symbolIndex.Complete(goToSymbolQuery[0], symbolResultsNum, symbolResults);
+	auto count = static_cast<int>(symbolResults.size());
+	symbolResultsList->Scroll(0);
+	symbolResultsList->Select(count == 0 ? -1 : clamp(symbolResultsList->selectedItem, 0, count - 1));
+}
+
+void OpenGoToSymbol() {
+	StartSymbolIndexer();
+	goToSymbolQuery = {""};
+	goToSymbolInput->OnLinesReplaced();
+	symbolResultsList->firstItem = 0;
+	symbolResultsList->selectedItem = 0;
+	activeWidget = goToSymbol;
+	UI::SetActiveInput(goToSymbolInput);
+	UpdateSymbolResults();
+}
+
+void CloseGoToSymbol() {
+	activeWidget = window;
+	UI::SetActiveInput(textarea);
+}
+
+// Jumps to the first place the symbol occurs, in the open file when it occurs there.
+void GoToSymbol(int item) {
+	if (item < 0 || item >= static_cast<int>(symbolResults.size()))
+		return;
+	auto locations = vector<SymbolLocation>();
+	symbolIndex.Locations(symbolResults[static_cast<size_t>(item)].symbol, 1, locations, textarea->symbolsFile);
+	CloseGoToSymbol();
+	if (locations.empty())
+		return;
+	auto goTo = [location = locations.front()]() {
+		textarea->ClearExtraCursors();
+		textarea->SetCursorLine(location.line);
+		textarea->SetCursorColumn(location.column);
+		textarea->ScrollToCursor();
+	};
+	if (locations.front().file != textarea->symbolsFile)
+		OpenFile(symbolIndex.Path(locations.front().file), goTo);
+	else
+		goTo();
+}
+
+// Indexes a slice of the open file and of the lexed files; returns whether the go to symbol palette changed.
+bool UpdateSymbolIndex() {
+	symbolIndex.Sweep(textarea->symbolsFile, fileInfo.lines, textarea->lexer.get(), symbolSweepBudget);
+	if (!symbolIndexer.MergeInto(symbolIndex, symbolMergeBudget) || activeWidget != goToSymbol)
+		return false;
+	UpdateSymbolResults();
+	return true;
+}
+
+void OpenProjectSearchResult(int row) {
+	auto [result, match] = projectResultRows[static_cast<size_t>(row)];
+	auto filename = path(projectSearchRoot) / projectResults[result].path;
+	// The open file keeps its unsaved edits; the match may have moved since, but the cursor goes near it.
+	const auto& found = projectResults[result].matches[match];
+	auto goTo = [line = found.line, column = found.column]() {
+		textarea->ClearExtraCursors();
+		textarea->SetCursorLine(line);
+		textarea->SetCursorColumn(column);
+		textarea->ScrollToCursor();
+		UI::SetActiveInput(textarea);
+	};
+	auto error = error_code();
+	if (!fileInfo.path || !equivalent(filename, fileInfo.path.value(), error))
+		OpenFile(filename.string(), goTo);
+	else
+		goTo();
+}
 
 void OpenDialogue(FileDialogueType type) {
 	fileDialogueType = type;
@@ -46,49 +601,607 @@ void OpenDialogue(FileDialogueType type) {
 	activeWidget = fileDialogue;
 	filePath.clear();
 	filePath.push_back(fileInfo.path.has_value() ? fileInfo.path.value() : "");
+	if (filePathInput)
+		filePathInput->OnLinesReplaced();
 }
 
-void PerformFileDialogueAction() {
-	auto path = filePath[0];
-	if (fileDialogueType == FileDialogueType::Open) {
-		std::ifstream file(path);
+// Reads the file at `path` into `info`, as the lines both edited and saved, counting lines again only if the file
+// changed since `info` was stamped; returns false, leaving `info` alone, when it cannot be read.
+bool ReadFile(const string& path, FileInfo& info) {
+	return ReadLines(path, JobPool(), info.lines, info.stamp, info.blockLines, &info.originalLines);
+}
+
+// Journals the file just read into `fileInfo`, which replays the edits an earlier session left unsaved.
+void OpenJournal() {
+	const auto& path = fileInfo.path.value();
+	auto recovered = editJournal->Open(path, fileInfo.lines);
+	if (recovered < 0)
+		std::cerr << "Failed to open edit journal: " << EditJournal::JournalPathOf(path) << std::endl;
+	else if (recovered > 0)
+		std::cerr << "Recovered " << recovered << " unsaved edits of " << path << std::endl;
+	fileInfo.wasModified = fileInfo.lines != fileInfo.originalLines;
+	fileInfo.changedOnDisk = false;
+	journalOutdated = false;
+}
+
+// Whether `positions` all lie within `lines`, as they must when kept from a session with a file that changed since.
+bool FitLines(const vector<TextPosition>& positions, const vector<string>& lines) {
+	return all_of(positions.begin(), positions.end(), [&](const TextPosition& position) {
+		return position.line >= 0 && static_cast<size_t>(position.line) < lines.size() && position.column >= 0 &&
+			   static_cast<size_t>(position.column) <= lines[static_cast<size_t>(position.line)].size();
+	});
+}
+
+bool IsDocumentAt(const FileInfo& info, const string& path) {
+	auto error = error_code();
+	return info.path && equivalent(info.path.value(), path, error);
+}
+
+// Drawn on the tab every frame, so the file name is cut from the path rather than parsed.
+FrameString DocumentTitle(size_t index) {
+	const auto& info = index == activeDocument ? fileInfo : documents[index]->info;
+	auto title = FrameString("<New File>");
+	if (info.path) {
+		auto name = string_view(info.path.value());
+		title = name.substr(name.find_last_of(path::preferred_separator == '\\' ? "/\\" : "/") + 1);
+	}
+	if (info.wasModified)
+		title += '*';
+	return title;
+}
+
+// The hidden documents likely to be shown next: the tabs Ctrl+Tab and Ctrl+Shift+Tab go to, and the one shown last.
+vector<Document *> NextDocuments() {
+	auto next = vector<Document *>();
+	auto add = [&](size_t index) {
+		if (index != activeDocument && find(next.begin(), next.end(), documents[index].get()) == next.end())
+			next.push_back(documents[index].get());
+	};
+	add((activeDocument + 1) % documents.size());
+	add((activeDocument + documents.size() - 1) % documents.size());
+	auto last = activeDocument;
+	for (size_t i = 0; i < documents.size(); i++)
+		if (i != activeDocument && (last == activeDocument || documents[i]->lastShown > documents[last]->lastShown))
+			last = i;
+	add(last);
+	return next;
+}
+
+void CompressHiddenDocuments() {
+	auto next = NextDocuments();
+	auto hidden = vector<Document *>();
+	for (size_t i = 0; i < documents.size(); i++)
+		if (i != activeDocument && find(next.begin(), next.end(), documents[i].get()) == next.end())
+			hidden.push_back(documents[i].get());
+	sort(hidden.begin(), hidden.end(), [](const Document *a, const Document *b) { return a->lastShown > b->lastShown; });
+	auto bytes = size_t(0);
+	for (auto document: hidden) {
+		if (document->lines.IsCompressing())
+			continue;
+		bytes += document->lines.Bytes() + document->originalLines.Bytes();
+		if (bytes <= uncompressedTextBudget)
+			continue;
+		document->lines.Compress(JobPool());
+		if (document->originalIsLines)
+			document->originalLines.Drop(JobPool());
+		else
+			document->originalLines.Compress(JobPool());
+		document->lineHashes = {};
+		document->originalHashes = {};
+	}
+}
+
+void HideDocument();
+
+void ShowDocument(size_t index);
+
+// Cancelled by every document shown, so the file of a restored one is only taken while it is the one shown.
+CancellationSource documentReads;
+
+void ReadRestoredDocument();
+
+// Decompresses the hidden document's lines on the JobPool, hashes them for the diff, and copies them as the saved
+// lines when those were dropped for being the same, so showing it only moves them. `documentToShow` is shown once
+// they are.
+void WakeDocument(Document& document, TaskPriority priority) {
+	auto lineHashes = make_shared<vector<uint64_t>>(), originalHashes = make_shared<vector<uint64_t>>();
+	auto originalLines = shared_ptr<vector<string>>();
+	if (document.originalIsLines && document.originalLines.Bytes() == 0)
+		originalLines = make_shared<vector<string>>();
+	auto wakeLines = document.lines.WakeAhead(JobPool(), [lineHashes, originalLines](const vector<string>& lines) {
+		*lineHashes = LineDiff::HashLines(lines);
+		if (originalLines)
+			*originalLines = lines;
+	});
+	auto wakeOriginalLines = document.originalLines.WakeAhead(JobPool(), [originalHashes](const vector<string>& lines) {
+		*originalHashes = LineDiff::HashLines(lines);
+	});
+	if (!wakeLines && !wakeOriginalLines)
+		return;
+	RunJob(priority, document.lifetime.Token(), [wakeLines, wakeOriginalLines]() {
+		PROFILE_SCOPE("Document::Wake");
+		if (wakeLines)
+			wakeLines();
+		if (wakeOriginalLines)
+			wakeOriginalLines();
+		return true;
+	}, [document = &document, lastShown = document.lastShown, lineHashes, originalHashes, originalLines](bool) {
+		// Shown meanwhile, it was woken then, and its lines may have changed since.
+		if (document->lastShown != lastShown)
+			return;
+		// Compressed again before they were woken, the hashes go with the lines.
+		if (!lineHashes->empty() && !document->lines.IsCompressed()) {
+			document->lineHashes = std::move(*lineHashes);
+			if (originalLines && document->originalLines.Bytes() == 0) {
+				document->originalLines.Hibernate(std::move(*originalLines));
+				document->originalHashes = document->lineHashes;
+			}
+		}
+		if (!originalHashes->empty() && !document->originalLines.IsCompressed())
+			document->originalHashes = std::move(*originalHashes);
+		if (document != documentToShow)
+			return;
+		for (size_t i = 0; i < documents.size(); i++)
+			if (documents[i].get() == document) {
+				HideDocument();
+				ShowDocument(i);
+				return;
+			}
+	});
+}
+
+void HideDocument() {
+	PROFILE_SCOPE("Document::Hide");
+	documentSearch.Cancel();
+	CloseCompletions();
+	auto& document = *documents[activeDocument];
+	if (!document.loaded) {
+		// Still being read, it showed nothing of its own; it is read again when shown again.
+		documentReads.Cancel();
 		fileInfo.lines.clear();
 		fileInfo.originalLines.clear();
-		if (file.is_open()) {
-			string line;
-			while (getline(file, line)) {
-				fileInfo.lines.push_back(line);
-				fileInfo.originalLines.push_back(line);
+		document.info = std::move(fileInfo);
+		return;
+	}
+	document.cursors = textarea->Cursors(&document.primaryCursor);
+	document.topOffset = textarea->TopOffset();
+	document.leftOffset = textarea->LeftOffset();
+	document.lexerCheckpoints = textarea->lexerCheckpoints.Verified();
+	document.lineHashes = textarea->diff->Hashes(LineDiff::Buffer);
+	document.originalHashes = textarea->diff->Hashes(LineDiff::Baseline);
+	document.journal = std::move(editJournal);
+	document.journalOutdated = journalOutdated;
+	fileWatch.Stop();
+	if (fileInfo.path) {
+		auto error = error_code();
+		document.diskTime = last_write_time(fileInfo.path.value(), error);
+		document.diskSize = file_size(fileInfo.path.value(), error);
+	}
+	// Lines still being diffed count as modified, so a document that is not is exactly as saved.
+	document.originalIsLines = !fileInfo.wasModified;
+	document.lines.Hibernate(std::move(fileInfo.lines));
+	document.originalLines.Hibernate(std::move(fileInfo.originalLines));
+	document.info = std::move(fileInfo);
+}
+
+// Where the document was left: its cursors, scroll position and lexer checkpoints, once its lines are shown.
+void RestoreDocumentView(Document& document) {
+	if (FitLines(document.lexerCheckpoints, fileInfo.lines))
+		textarea->lexerCheckpoints.Restore(std::move(document.lexerCheckpoints));
+	document.lexerCheckpoints.clear();
+	textarea->SetCursors(std::move(document.cursors), document.primaryCursor);
+	textarea->SetTopOffset(document.topOffset);
+	textarea->SetLeftOffset(document.leftOffset);
+}
+
+// Reads the lines a restored document was left showing ahead of the rest, while the file is as the session found it,
+// so the first frame shows them where they were; the lines above are left empty, from the last lexer checkpoint
+// before them on. Returns the first line read, or -1.
+int PreviewRestoredDocument(const Document& document) {
+	auto top = static_cast<int>(document.topOffset / UI::fontMetrics.lineHeight);
+	auto from = top - previewLexedLines - 1;
+	for (const auto& checkpoint: document.lexerCheckpoints)
+		if (checkpoint.line <= top)
+			from = max(from, checkpoint.line);
+	if (from < top - previewLexedLines)
+		from = top;
+	auto to = top + static_cast<int>(static_cast<float>(GetScreenHeight()) / UI::fontMetrics.lineHeight) + 1;
+	auto lines = vector<string>();
+	if (!ReadLineRange(fileInfo.path.value(), fileInfo.stamp, fileInfo.blockLines, static_cast<uint64_t>(from),
+					   static_cast<uint64_t>(to), lines) || lines.empty())
+		return -1;
+	fileInfo.lines.resize(static_cast<size_t>(from));
+	move(lines.begin(), lines.end(), back_inserter(fileInfo.lines));
+	fileInfo.originalLines = fileInfo.lines;
+	return from;
+}
+
+void ShowDocument(size_t index) {
+	PROFILE_SCOPE("Document::Show");
+	activeDocument = index;
+	tabsChanged = true;
+	discardRequested = false;
+	documentToShow = nullptr;
+	auto& document = *documents[index];
+	document.lastShown = ++documentsShown;
+	fileInfo = std::move(document.info);
+	auto restored = document.lines.Wake(JobPool(), fileInfo.lines);
+	restored = document.originalLines.Wake(JobPool(), fileInfo.originalLines) && restored;
+	if (fileInfo.originalLines.empty() && document.originalIsLines) {
+		fileInfo.originalLines = fileInfo.lines;
+		document.originalHashes = document.lineHashes;
+	}
+	if (!restored)
+		std::cerr << "Failed to restore hibernated document: " << DocumentTitle(index) << std::endl;
+	if (fileInfo.lines.empty())
+		fileInfo.lines.push_back("");
+	if (fileInfo.originalLines.empty())
+		fileInfo.originalLines.push_back("");
+	editJournal = document.journal ? std::move(document.journal) : make_unique<EditJournal>();
+	journalOutdated = document.journalOutdated;
+	// The lines are those it was hidden with.
+	auto unchanged = document.loaded && restored;
+	documentReads.Cancel();
+	textarea->locked = !document.loaded;
+	auto previewFrom = -1;
+	if (!document.loaded) {
+		previewFrom = PreviewRestoredDocument(document);
+		ReadRestoredDocument();
+	}
+	else if (fileInfo.path) {
+		// What changed on disk while hidden is taken as the watcher would have: reloaded, unless modified here.
+		auto error = error_code();
+		const auto& path = fileInfo.path.value();
+		if (last_write_time(path, error) != document.diskTime || file_size(path, error) != document.diskSize) {
+			fileInfo.stamp = FileStamp();
+			fileInfo.blockLines.clear();
+			if (fileInfo.wasModified || fileInfo.changedOnDisk)
+				fileInfo.changedOnDisk = true;
+			else if (ReadFile(path, fileInfo)) {
+				document.edits.Cancel();
+				document.lineHashes = document.originalHashes = {};
+				document.lexerCheckpoints.clear();
+				journalOutdated = true;
+				unchanged = false;
 			}
-			file.close();
-			fileInfo.path = path;
-			fileInfo.wasModified = false;
+		}
+	}
+	if (fileInfo.path && document.loaded)
+		fileWatch.Start(fileInfo.path.value());
+	ResetBaseline(std::move(document.originalHashes));
+	CloseSymbolDocument();
+	textarea->OnLinesReplaced(std::move(document.lineHashes));
+	OpenSymbolDocument(unchanged);
+	document.lineHashes = document.originalHashes = {};
+	if (document.loaded)
+		RestoreDocumentView(document);
+	else if (previewFrom >= 0) {
+		auto checkpoints = vector<TextPosition>();
+		for (const auto& checkpoint: document.lexerCheckpoints)
+			if (checkpoint.line >= previewFrom && FitLines({checkpoint}, fileInfo.lines))
+				checkpoints.push_back(checkpoint);
+		textarea->lexerCheckpoints.Restore(std::move(checkpoints));
+		textarea->SetTopOffset(document.topOffset);
+		textarea->SetLeftOffset(document.leftOffset);
+	}
+	RestartSearch();
+	CompressHiddenDocuments();
+	for (auto next: NextDocuments())
+		WakeDocument(*next, TaskPriority::Normal);
+}
+
+// A tab whose lines were compressed is shown once they are woken on the JobPool; the one shown stays until then.
+void SwitchToDocument(size_t index) {
+	documentToShow = nullptr;
+	if (index == activeDocument || index >= documents.size())
+		return;
+	auto& document = *documents[index];
+	if (document.lines.IsCompressed() || document.originalLines.IsCompressed()) {
+		documentToShow = &document;
+		WakeDocument(document, TaskPriority::Visible);
+		return;
+	}
+	HideDocument();
+	ShowDocument(index);
+}
+
+void NewDocument() {
+	HideDocument();
+	documents.push_back(make_unique<Document>());
+	ShowDocument(documents.size() - 1);
+}
+
+// Unsaved edits are discarded, as when the window is closed; closing the last document leaves a new one.
+void CloseDocument() {
+	documentSearch.Cancel();
+	editJournal->Close();
+	fileWatch.Stop();
+	documents[activeDocument]->lifetime.Cancel();
+	documents.erase(documents.begin() + static_cast<ptrdiff_t>(activeDocument));
+	if (documents.empty())
+		documents.push_back(make_unique<Document>());
+	ShowDocument(min(activeDocument, documents.size() - 1));
+}
+
+// Files are read and written on the JobPool one at a time, so a file is never read while it is being written.
+mutex fileMutex;
+// Cancelled by every file opened, so only the last one asked for opens.
+CancellationSource fileOpens;
+// Cancelled by every save, so one that has not started writing when another follows writes nothing.
+CancellationSource fileSaves;
+
+// Opens the file at `path` in the shown document if it is a new file with nothing in it yet, else in a tab of its
+// own, or switches to the tab that has it; then calls `then`, e.g. to put the cursor somewhere. The file is read on
+// the JobPool; nothing happens when it cannot be read or another file was opened before it was.
+void OpenFile(const string& path, function<void()> then) {
+	fileOpens.Cancel();
+	for (size_t i = 0; i < documents.size(); i++)
+		if (i != activeDocument && IsDocumentAt(documents[i]->info, path)) {
+			SwitchToDocument(i);
 			activeWidget = window;
+			if (then)
+				then();
+			return;
 		}
+	RunJob(TaskPriority::Visible, fileOpens.Token(), [path]() {
+		PROFILE_SCOPE("File::Load");
+		lock_guard lock(fileMutex);
+		auto read = optional<FileInfo>(FileInfo());
+		if (!ReadFile(path, *read))
+			read = nullopt;
+		return read;
+	}, [path, then](optional<FileInfo> read) {
+		if (!read) {
+			std::cerr << "Failed to open file: " << path << std::endl;
+			return;
+		}
+		if ((fileInfo.path || fileInfo.wasModified) && !IsDocumentAt(fileInfo, path))
+			NewDocument();
 		else {
+			documents[activeDocument]->lifetime.Cancel();
+			// A restored document still being read takes this read instead.
+			documentReads.Cancel();
+			documents[activeDocument]->loaded = true;
+			textarea->locked = false;
+		}
+		documentSearch.Cancel();
+		read->path = path;
+		fileInfo = std::move(*read);
+		OpenJournal();
+		fileWatch.Start(path);
+		activeWidget = window;
+		tabsChanged = true;
+		ResetBaseline();
+		if (textarea) {
+			OpenSymbolDocument();
+			textarea->OnLinesReplaced();
+		}
+		RestartSearch();
+		if (then)
+			then();
+	});
+}
+
+// Reads the file of the document shown, restored from the last session, on the JobPool; until then it is shown empty
+// and takes no keys. What the session derived from the file holds if it is still exactly as then.
+void ReadRestoredDocument() {
+	auto path = fileInfo.path.value();
+	auto read = FileInfo();
+	read.stamp = fileInfo.stamp;
+	read.blockLines = fileInfo.blockLines;
+	RunJob(TaskPriority::Visible, documentReads.Token(), [path, read = std::move(read)]() mutable {
+		PROFILE_SCOPE("File::Load");
+		lock_guard lock(fileMutex);
+		return ReadFile(path, read) ? optional<FileInfo>(std::move(read)) : nullopt;
+	}, [path](optional<FileInfo> read) {
+		auto& document = *documents[activeDocument];
+		document.loaded = true;
+		textarea->locked = false;
+		auto sessionStamp = fileInfo.stamp;
+		if (read) {
+			read->path = path;
+			fileInfo = std::move(*read);
+			OpenJournal();
+		}
+		else
 			std::cerr << "Failed to open file: " << path << std::endl;
+		if (fileInfo.stamp != sessionStamp || !sessionStamp.IsKnown() || fileInfo.wasModified)
+			document.lexerCheckpoints.clear();
+		for (auto& cursor: document.cursors)
+			if (!FitLines({cursor.head, cursor.anchor}, fileInfo.lines))
+				cursor = UI::Cursor();
+		fileWatch.Start(path);
+		tabsChanged = true;
+		ResetBaseline();
+		textarea->OnLinesReplaced();
+		RestoreDocumentView(document);
+		RestartSearch();
+	});
+}
+
+// Writes the lines as they are now to `path` on the JobPool. Once written, the document is kept under that name and
+// the file becomes its saved lines, the baseline of its diff and what its journal applies to, even when it was
+// hidden meanwhile. It counts as unmodified only when it was not edited meanwhile; the journal keeps those edits.
+void SaveFile(const string& path) {
+	// Still being read, a restored document has nothing to save yet.
+	if (!documents[activeDocument]->loaded)
+		return;
+	fileSaves.Cancel();
+	// Our own write is not a change to follow; watching starts again once it is done.
+	fileWatch.Stop();
+	auto resumeWatching = []() {
+		if (!fileWatch.IsWatching() && fileInfo.path)
+			fileWatch.Start(fileInfo.path.value());
+	};
+	auto document = documents[activeDocument].get();
+	auto save = fileSaves.Token(), edits = document->edits.Token(), lifetime = document->lifetime.Token();
+	auto journalMark = editJournal->Mark();
+	JobPool().Submit(TaskPriority::Visible, [=, lines = fileInfo.lines]() mutable {
+		PROFILE_SCOPE("File::Save");
+		auto stamp = FileStamp();
+		auto blockLines = vector<uint64_t>();
+		{
+			lock_guard lock(fileMutex);
+			if (save.IsCancelled())
+				return;
+			if (!WriteLines(path, lines, stamp, blockLines)) {
+				PostCompletion([path, resumeWatching]() {
+					std::cerr << "Failed to save file: " << path << std::endl;
+					resumeWatching();
+				});
+				return;
+			}
 		}
+		PostCompletion([=, lines = std::move(lines), blockLines = std::move(blockLines)]() mutable {
+			if (lifetime.IsCancelled()) {
+				resumeWatching();
+				return;
+			}
+			auto active = documents[activeDocument].get() == document;
+			auto& info = active ? fileInfo : document->info;
+			auto& journal = active ? editJournal : document->journal;
+			auto edited = edits.IsCancelled();
+			info.path = path;
+			info.stamp = stamp;
+			info.blockLines = std::move(blockLines);
+			info.changedOnDisk = false;
+			if (!edited)
+				info.wasModified = false;
+			if (active) {
+				info.originalLines = std::move(lines);
+				if (edited)
+					ResetBaseline();
+				else
+					textarea->diff->MarkSaved();
+				// Saved under another name, it is indexed under that one from now on.
+				OpenSymbolDocument();
+				fileWatch.Start(path);
+				activeWidget = window;
+			}
+			else {
+				// Unedited, the saved lines are the lines, so they are taken from those when shown.
+				if (edited)
+					document->originalLines.Hibernate(std::move(lines));
+				else
+					document->originalLines.Drop(JobPool());
+				document->originalHashes = edited ? vector<uint64_t>() : document->lineHashes;
+				document->originalIsLines = !edited;
+				auto error = error_code();
+				document->diskTime = last_write_time(path, error);
+				document->diskSize = file_size(path, error);
+			}
+			// Everything journaled up to the save is in the file now.
+			if (journal && !journal->Compact(path, journalMark))
+				std::cerr << "Failed to open edit journal: " << EditJournal::JournalPathOf(path) << std::endl;
+			if (active)
+				journalOutdated = false;
+			else
+				document->journalOutdated = false;
+		});
+	});
+}
+
+void PerformFileDialogueAction() {
+	if (fileDialogueType == FileDialogueType::Open)
+		OpenFile(filePath[0]);
+	else
+		SaveFile(filePath[0]);
+}
+
+// The documents with a file, and for those as saved, what was derived from the file.
+Session CurrentSession() {
+	auto session = Session();
+	for (size_t i = 0; i < documents.size(); i++) {
+		const auto& document = *documents[i];
+		auto active = i == activeDocument;
+		// Shown while it is read, it keeps where it was left until then.
+		auto shown = active && document.loaded;
+		const auto& info = active ? fileInfo : document.info;
+		if (!info.path)
+			continue;
+		if (active)
+			session.activeDocument = session.documents.size();
+		auto& saved = session.documents.emplace_back();
+		saved.path = info.path.value();
+		auto primaryCursor = document.primaryCursor;
+		auto cursors = shown ? textarea->Cursors(&primaryCursor) : document.cursors;
+		rotate(cursors.begin(), cursors.begin() + primaryCursor, cursors.end());
+		for (const auto& cursor: cursors)
+			saved.cursors.emplace_back(cursor.head, cursor.anchor);
+		saved.topOffset = shown ? textarea->TopOffset() : document.topOffset;
+		saved.leftOffset = shown ? textarea->LeftOffset() : document.leftOffset;
+		if (info.wasModified || info.changedOnDisk || !info.stamp.IsKnown())
+			continue;
+		saved.stamp = info.stamp;
+		saved.blockLines = info.blockLines;
+		saved.lexerCheckpoints = shown ? textarea->lexerCheckpoints.Verified() : document.lexerCheckpoints;
 	}
-	else {
-		std::ofstream file(path, std::ios::out | std::ios::trunc);
-		if (file.is_open()) {
-			for (const auto& line: fileInfo.lines)
-				file << line << "\n";
-			file.close();
-			fileInfo.path = path;
-			fileInfo.wasModified = false;
-			activeWidget = window;
-		}
-		else {
-			std::cerr << "Failed to save file: " << path << std::endl;
+	return session;
+}
+
+// Reopens the documents of the last session, but for files gone since, without reading any until it is shown.
+bool RestoreSession() {
+	auto session = Session();
+	if (!ReadSession(sessionPath, session))
+		return false;
+	PROFILE_SCOPE("Session::Restore");
+	for (size_t i = 0; i < session.documents.size(); i++) {
+		auto& saved = session.documents[i];
+		auto error = error_code();
+		if (!is_regular_file(saved.path, error))
+			continue;
+		if (i <= session.activeDocument)
+			activeDocument = documents.size();
+		auto document = make_unique<Document>();
+		document->loaded = false;
+		document->info.path = saved.path;
+		document->info.stamp = saved.stamp;
+		document->info.blockLines = std::move(saved.blockLines);
+		document->lexerCheckpoints = std::move(saved.lexerCheckpoints);
+		if (!saved.cursors.empty()) {
+			document->cursors.clear();
+			for (const auto& [head, anchor]: saved.cursors)
+				document->cursors.push_back(UI::Cursor {head, anchor});
 		}
+		document->topOffset = saved.topOffset;
+		document->leftOffset = saved.leftOffset;
+		documents.push_back(std::move(document));
 	}
+	return !documents.empty();
+}
+
+void UpdateTabs() {
+	tabsChanged = false;
+	tabBar->slots.clear();
+	for (size_t i = 0; i < documents.size(); i++) {
+		auto button = make_shared<UI::Button>("");
+		button->textLambda = [i]() { return DocumentTitle(i); };
+		button->isSelected = i == activeDocument;
+		button->onClick = [i]() { SwitchToDocument(i); };
+		tabBar->AddSlot(button);
+	}
+	auto label = make_shared<UI::Label>("");
+	label->textLambda = []() -> FrameString {
+		if (discardRequested)
+			return FrameFormat("Unsaved changes: Ctrl+W again discards them");
+		auto bytes = size_t(0);
+		for (const auto& document: documents)
+			bytes += document->lines.Bytes() + document->originalLines.Bytes();
+		return FrameFormat("{} open, {:.1f} MB hibernated", documents.size(), static_cast<double>(bytes) / (1 << 20));
+	};
+	label->backgroundColor = RAYWHITE;
+	tabBar->AddSlot(label)->expandRatio = 1;
+	layoutRequested = true;
 }
 
 int main() {
 
-	filePath[0] = "/Users/user/file.cpp";
-	PerformFileDialogueAction();
+	sessionPath = (current_path() / sessionFileName).string();
+	auto sessionRestored = RestoreSession();
+	if (!sessionRestored) {
+		documents.push_back(make_unique<Document>());
+		OpenFile("/Users/user/file.cpp");
+	}
 
 	SetConfigFlags(FLAG_WINDOW_RESIZABLE);
 	InitWindow(screenWidth, screenHeight, windowTitle);
@@ -96,7 +1209,10 @@ int main() {
 	SetExitKey(0);
 
 	path currentDirectory = GetApplicationDirectory();
-	UI::font = LoadFontEx((currentDirectory / "Inconsolata-Regular.ttf").c_str(), 16 * GetWindowScaleDPI().y, nullptr, 0);
+	auto fontPath = currentDirectory / "Inconsolata-Regular.ttf";
+	if (!UI::glyphAtlas.Load(fontPath.string(), static_cast<int>(16 * GetWindowScaleDPI().y)))
+		std::cerr << "Failed to load font: " << fontPath << std::endl;
+	UI::UpdateFontMetrics();
 
 	window = make_shared<UI::VerticalBox>();
 	{
@@ -104,7 +1220,7 @@ int main() {
 		auto slot = window->AddSlot(horizontalBox);
 		{
 			auto button = make_shared<UI::Button>("New");
-			button->onClick = []() { fileInfo = FileInfo(); };
+			button->onClick = []() { NewDocument(); };
 			auto slot = horizontalBox->AddSlot(button);
 		}
 		{
@@ -117,11 +1233,23 @@ int main() {
 			button->onClick = []() { OpenDialogue(FileDialogueType::SaveAs); };
 			auto slot = horizontalBox->AddSlot(button);
 		}
+		{
+			auto button = make_shared<UI::Button>("Wrap: Off");
+			button->onClick = [button = button.get()]() {
+				textarea->softWrap = !textarea->softWrap;
+				button->text = textarea->softWrap ? "Wrap: On" : "Wrap: Off";
+				textarea->SetTopOffset(textarea->TopOffset());
+			};
+			auto slot = horizontalBox->AddSlot(button);
+		}
 		{
 			auto label = make_shared<UI::Label>("File info");
-			label->textLambda = []() -> string {
-				auto modifiedSuffix = fileInfo.wasModified ? " (modified)" : "";
-				return (fileInfo.path.has_value() ? fileInfo.path.value() : "<New File>") + modifiedSuffix;
+			label->textLambda = []() -> FrameString {
+				auto modifiedSuffix = fileInfo.changedOnDisk ? " (modified, changed on disk)"
+									  : fileInfo.wasModified ? " (modified)" : "";
+				auto journalSuffix = editJournal->Failed() ? " (journal failed)" : "";
+				auto text = FrameString(fileInfo.path ? string_view(fileInfo.path.value()) : "<New File>");
+				return text.append(modifiedSuffix).append(journalSuffix);
 			};
 			label->backgroundColor = RAYWHITE;
 			auto slot = horizontalBox->AddSlot(label);
@@ -131,22 +1259,181 @@ int main() {
 			//auto slot = horizontalBox->AddSlot(make_shared<UI::Label>("[info]"));
 		}
 	}
+	{
+		tabBar = make_shared<UI::HorizontalBox>();
+		window->AddSlot(tabBar);
+	}
 	{
 		textarea = make_shared<UI::Input>(fileInfo.lines, BLACK, UI::Margin {10, 10, 10, 10});
+		textarea->diff = make_unique<LineDiff>();
+		ResetBaseline();
+		textarea->diff->Reset(LineDiff::Buffer, fileInfo.lines);
 		textarea->onChange = []() {
-			fileInfo.wasModified = fileInfo.lines != fileInfo.originalLines;
+			// Lines still being diffed in the background count as modified.
+			textarea->diff->Update();
+			fileInfo.wasModified = !textarea->diff->Hunks().empty();
+			RestartSearch();
+			if (completionList->visibility == UI::Visibility::Visible)
+				UpdateCompletions();
+		};
+		textarea->onBeforeEdit = []() { documentSearch.Cancel(); };
+		textarea->onEdit = [](const vector<TextEdit>& edits) {
+			documents[activeDocument]->edits.Cancel();
+			discardRequested = false;
+			if (reloadingFromDisk)
+				return;
+			if (journalOutdated && fileInfo.path) {
+				editJournal->Compact(fileInfo.path.value());
+				journalOutdated = false;
+			}
+			editJournal->Append(edits);
 		};
 		textarea->lexer = make_unique<CppLexer>();
-		auto slot = window->AddSlot(textarea);
+		textarea->folds = make_unique<FoldIndex>();
+		textarea->symbols = &symbolIndex;
+		OpenSymbolDocument();
+		// Ctrl+Tab switches documents in the main loop rather than indenting.
+		textarea->onKey = [](int key) { return (key == KEY_TAB && UI::IsCommandKeyDown()) || HandleCompletionKey(key); };
+		auto horizontalBox = make_shared<UI::HorizontalBox>();
+		auto slot = window->AddSlot(horizontalBox);
 		slot->expandRatio = 1;
+		horizontalBox->AddSlot(textarea)->expandRatio = 1;
+		horizontalBox->AddSlot(make_shared<UI::Minimap>(*textarea));
+	}
+	{
+		findBar = make_shared<UI::HorizontalBox>();
+		findBar->visibility = UI::Visibility::Collapsed;
+		window->AddSlot(findBar);
+		{
+			findBar->AddSlot(make_shared<UI::Label>("Find"));
+		}
+		{
+			auto input = make_shared<UI::Input>(searchQuery, BLACK);
+			input->onChange = []() { RestartSearch(); };
+			auto slot = findBar->AddSlot(input);
+			slot->expandRatio = .5f;
+		}
+		{
+			auto button = make_shared<UI::Button>("Regex: Off");
+			button->onClick = [button = button.get()]() {
+				searchIsRegex = !searchIsRegex;
+				button->text = searchIsRegex ? "Regex: On" : "Regex: Off";
+				RestartSearch();
+			};
+			findBar->AddSlot(button);
+		}
+		{
+			findBar->AddSlot(make_shared<UI::Label>("Replace"));
+		}
+		{
+			auto slot = findBar->AddSlot(make_shared<UI::Input>(replaceText, BLACK));
+			slot->expandRatio = .5f;
+		}
+		{
+			auto button = make_shared<UI::Button>("Replace All");
+			button->onClick = []() { ReplaceAll(); };
+			findBar->AddSlot(button);
+		}
+		{
+			auto label = make_shared<UI::Label>("");
+			label->textLambda = []() -> FrameString {
+				if (!documentSearch.error.empty())
+					return FrameString(documentSearch.error);
+				return FrameFormat("{} matches{}", textarea->highlights.size(), documentSearch.IsRunning() ? "..." : "");
+			};
+			label->backgroundColor = RAYWHITE;
+			findBar->AddSlot(label);
+		}
+		{
+			auto button = make_shared<UI::Button>("Close");
+			button->onClick = []() { ToggleFindBar(); };
+			findBar->AddSlot(button);
+		}
+	}
+	{
+		projectSearchPanel = make_shared<UI::VerticalBox>();
+		projectSearchPanel->visibility = UI::Visibility::Collapsed;
+		window->AddSlot(projectSearchPanel);
+		auto horizontalBox = make_shared<UI::HorizontalBox>();
+		projectSearchPanel->AddSlot(horizontalBox);
+		{
+			horizontalBox->AddSlot(make_shared<UI::Label>("Find in files"));
+		}
+		{
+			projectSearchInput = make_shared<UI::Input>(projectSearchQuery, BLACK);
+			projectSearchInput->onEnter = []() { StartProjectSearch(); };
+			auto slot = horizontalBox->AddSlot(projectSearchInput);
+			slot->expandRatio = 1;
+		}
+		{
+			auto button = make_shared<UI::Button>("Search");
+			button->onClick = []() { StartProjectSearch(); };
+			horizontalBox->AddSlot(button);
+		}
+		{
+			auto button = make_shared<UI::Button>("Stop");
+			button->onClick = []() { projectSearch.Cancel(); };
+			horizontalBox->AddSlot(button);
+		}
+		{
+			auto label = make_shared<UI::Label>("");
+			label->textLambda = []() -> FrameString {
+				return FrameFormat("{} matches in {} files, {} files searched ({} MB){}", projectResultRows.size(),
+								   projectResults.size(), projectSearch.FilesSearched(), projectSearch.BytesSearched() >> 20,
+								   projectSearch.IsRunning() ? "..." : projectSearch.IsTruncated() ? ", stopped" : "");
+			};
+			label->backgroundColor = RAYWHITE;
+			horizontalBox->AddSlot(label);
+		}
+		{
+			auto button = make_shared<UI::Button>("Close");
+			button->onClick = []() { ToggleProjectSearch(); };
+			horizontalBox->AddSlot(button);
+		}
+		projectResultsList = make_shared<UI::ListView>(projectResultRowsNum);
+		projectResultsList->itemsNum = []() { return static_cast<int>(projectResultRows.size()); };
+		projectResultsList->itemText = [](int row) { return ProjectResultText(row); };
+		projectResultsList->onItemClick = [](int row) { OpenProjectSearchResult(row); };
+		projectSearchPanel->AddSlot(projectResultsList);
 	}
 	{
 		auto label = make_shared<UI::Label>("");
-		label->textLambda = []() -> string {
-			return std::format("Line {}/{} : Column {}", textarea->CursorLine() + 1, textarea->lines.size(), textarea->CursorColumn() + 1);
+		label->textLambda = []() -> FrameString {
+			return FrameFormat("Line {}/{} : Column {}", textarea->CursorLine() + 1, textarea->lines.size(),
+							   textarea->columnIndex.ColumnOf(textarea->CursorLine(), textarea->CursorColumn()) + 1);
 		};
 		window->AddSlot(label);
 	}
+#ifdef TEXTED_PROFILE
+	{
+		profilerOverlay = make_shared<UI::VerticalBox>();
+		auto label = make_shared<UI::Label>("");
+		label->textLambda = []() -> FrameString {
+			return FrameFormat("Frame time p50 {:.2f} ms, p95 {:.2f} ms, p99 {:.2f} ms ({} frames) - F3: hide, F12: write {}",
+							   Profiler::FrameTimePercentile(50), Profiler::FrameTimePercentile(95),
+							   Profiler::FrameTimePercentile(99), Profiler::FrameCount(), traceFilePath);
+		};
+		label->backgroundColor = RAYWHITE;
+		profilerOverlay->AddSlot(label);
+		label = make_shared<UI::Label>("");
+		label->textLambda = []() -> FrameString {
+			auto last = Profiler::LastFrameAllocations();
+			auto text = FrameFormat("Allocations last frame {} ({} KB), p95 {}, idle frame {}", last.count,
+									last.bytes >> 10, Profiler::FrameAllocationsPercentile(95),
+									Profiler::LastIdleFrameAllocations().count);
+			Profiler::ScopeAllocations scopes[3];
+			auto scopesNum = Profiler::LastFrameAllocationScopes(scopes, 3);
+			for (auto i = 0; i < scopesNum; i++)
+				format_to(back_inserter(text), "{} {} {}", i == 0 ? " - in" : ",",
+						  scopes[i].scope ? scopes[i].scope : "no scope", scopes[i].allocations.count);
+			return text;
+		};
+		label->backgroundColor = RAYWHITE;
+		profilerOverlay->AddSlot(label);
+		profilerOverlay->visibility = UI::Visibility::Collapsed;
+		window->AddSlot(profilerOverlay);
+	}
+#endif
 
 	fileDialogue = make_shared<UI::VerticalBox>();
 	{
@@ -163,8 +1450,8 @@ int main() {
 		{
 			auto horizontalBox2 = make_shared<UI::HorizontalBox>();
 			{
-				auto input = make_shared<UI::Input>(filePath, BLACK);
-				auto slot = horizontalBox2->AddSlot(input);
+				filePathInput = make_shared<UI::Input>(filePath, BLACK);
+				auto slot = horizontalBox2->AddSlot(filePathInput);
 				slot->expandRatio = 1;
 			}
 			{
@@ -190,43 +1477,229 @@ int main() {
 		slot->expandRatio = .5f;
 	}
 
+	quickOpen = make_shared<UI::VerticalBox>();
+	{
+		auto horizontalBox = make_shared<UI::HorizontalBox>();
+		quickOpen->AddSlot(horizontalBox);
+		horizontalBox->AddSlot(make_shared<UI::NullWidget>())->expandRatio = .2f;
+		auto panel = make_shared<UI::VerticalBox>();
+		horizontalBox->AddSlot(panel)->expandRatio = .6f;
+		horizontalBox->AddSlot(make_shared<UI::NullWidget>())->expandRatio = .2f;
+		{
+			quickOpenInput = make_shared<UI::Input>(quickOpenQuery, BLACK);
+			quickOpenInput->onChange = []() { UpdateQuickOpenResults(); };
+			quickOpenInput->onEnter = []() {
+				if (quickOpenRanking)
+					quickOpenEnterPressed = true;
+				else
+					OpenQuickOpenResult(0);
+			};
+			panel->AddSlot(quickOpenInput);
+		}
+		{
+			auto label = make_shared<UI::Label>("");
+			label->textLambda = []() -> FrameString {
+				return FrameFormat("{} files{}", fileMatcher->Size(), fileIndex.IsCrawling() ? ", indexing..." : "");
+			};
+			label->backgroundColor = RAYWHITE;
+			panel->AddSlot(label);
+		}
+		for (auto i = 0; i < quickOpenResultsNum; i++) {
+			auto button = make_shared<UI::Button>("");
+			button->onClick = [i]() { OpenQuickOpenResult(static_cast<size_t>(i)); };
+			button->visibility = UI::Visibility::Collapsed;
+			quickOpenButtons.push_back(button);
+			panel->AddSlot(button);
+		}
+	}
+	quickOpen->AddSlot(make_shared<UI::NullWidget>())->expandRatio = 1;
+
+	// Laid out at the cursor whenever it opens, and driven by the keys the text area passes on.
+	completionList = make_shared<UI::ListView>(completionRowsNum);
+	completionList->visibility = UI::Visibility::Collapsed;
+	completionList->itemsNum = []() { return static_cast<int>(completions.size()); };
+	completionList->itemText = [](int item) { return FrameString(completions[static_cast<size_t>(item)].name); };
+
+	goToSymbol = make_shared<UI::VerticalBox>();
+	{
+		auto horizontalBox = make_shared<UI::HorizontalBox>();
+		goToSymbol->AddSlot(horizontalBox);
+		horizontalBox->AddSlot(make_shared<UI::NullWidget>())->expandRatio = .2f;
+		auto panel = make_shared<UI::VerticalBox>();
+		horizontalBox->AddSlot(panel)->expandRatio = .6f;
+		horizontalBox->AddSlot(make_shared<UI::NullWidget>())->expandRatio = .2f;
+		{
+			goToSymbolInput = make_shared<UI::Input>(goToSymbolQuery, BLACK);
+			goToSymbolInput->onChange = []() {
+				symbolResultsList->firstItem = 0;
+				symbolResultsList->selectedItem = 0;
+				UpdateSymbolResults();
+			};
+			goToSymbolInput->onEnter = []() { GoToSymbol(symbolResultsList->selectedItem); };
+			goToSymbolInput->onKey = [](int key) {
+				auto count = static_cast<int>(symbolResults.size());
+				if (count == 0 || (key != KEY_DOWN && key != KEY_UP))
+					return false;
+				symbolResultsList->Select(clamp(symbolResultsList->selectedItem + (key == KEY_DOWN ? 1 : -1), 0, count - 1));
+				return true;
+			};
+			panel->AddSlot(goToSymbolInput);
+		}
+		{
+			auto label = make_shared<UI::Label>("");
+			label->textLambda = []() -> FrameString {
+				return FrameFormat("{} symbols in {} files{}", symbolIndex.SymbolsNum(), symbolIndex.FilesNum(),
+								   symbolIndexer.IsRunning() ? ", indexing..." : "");
+			};
+			label->backgroundColor = RAYWHITE;
+			panel->AddSlot(label);
+		}
+		symbolResultsList = make_shared<UI::ListView>(symbolResultRowsNum);
+		symbolResultsList->itemsNum = []() { return static_cast<int>(symbolResults.size()); };
+		symbolResultsList->itemText = [](int item) {
+			const auto& result = symbolResults[static_cast<size_t>(item)];
+			return FrameFormat("{}  ({})", result.name, result.count);
+		};
+		symbolResultsList->onItemClick = [](int item) { GoToSymbol(item); };
+		panel->AddSlot(symbolResultsList);
+	}
+	goToSymbol->AddSlot(make_shared<UI::NullWidget>())->expandRatio = 1;
+
 	activeWidget = window;
+	if (sessionRestored)
+		ShowDocument(activeDocument);
+	sessionWriter.Start(sessionPath);
+	auto lastSessionWrite = GetTime();
 
 	auto firstFrame = true;
 
 	while (!WindowShouldClose()) {
 
+		PROFILE_FRAME_BEGIN();
+
 		auto screen = Rectangle {0, 0, static_cast<float>(GetScreenWidth()), static_cast<float>(GetScreenHeight())};
 
-		if (IsWindowResized() || firstFrame) {
+		if (UI::IsCommandKeyDown() && IsKeyPressed(KEY_F) && activeWidget == window) {
+			if (UI::IsShiftKeyDown())
+				ToggleProjectSearch();
+			else
+				ToggleFindBar();
+		}
+		if (UI::IsCommandKeyDown() && IsKeyPressed(KEY_P) && activeWidget == window)
+			OpenQuickOpen();
+		else if (IsKeyPressed(KEY_ESCAPE) && activeWidget == quickOpen)
+			CloseQuickOpen();
+		if (UI::IsCommandKeyDown() && IsKeyPressed(KEY_T) && activeWidget == window)
+			OpenGoToSymbol();
+		else if (IsKeyPressed(KEY_ESCAPE) && activeWidget == goToSymbol)
+			CloseGoToSymbol();
+		// The popup belongs to the cursor; a click anywhere moves on.
+		if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && completionList->visibility == UI::Visibility::Visible) {
+			CloseCompletions();
+			layoutRequested = true;
+		}
+#ifdef TEXTED_PROFILE
+		if (IsKeyPressed(KEY_F3)) {
+			profilerOverlay->visibility = profilerOverlay->visibility == UI::Visibility::Collapsed
+										  ? UI::Visibility::Visible : UI::Visibility::Collapsed;
+			layoutRequested = true;
+		}
+		if (IsKeyPressed(KEY_F12) && !Profiler::WriteChromeTrace(traceFilePath))
+			std::cerr << "Failed to write trace: " << traceFilePath << std::endl;
+#endif
+
+		if (UI::IsCommandKeyDown() && IsKeyPressed(KEY_TAB) && activeWidget == window)
+			SwitchToDocument((activeDocument + (UI::IsShiftKeyDown() ? documents.size() - 1 : 1)) % documents.size());
+		if (UI::IsCommandKeyDown() && IsKeyPressed(KEY_W) && activeWidget == window) {
+			if (fileInfo.wasModified && !discardRequested)
+				discardRequested = true;
+			else
+				CloseDocument();
+		}
+		if (tabsChanged)
+			UpdateTabs();
+
+		auto needLayout = IsWindowResized() || firstFrame || layoutRequested;
+		layoutRequested = false;
+		if (needLayout) {
+			PROFILE_SCOPE("Layout");
 			window->LayoutWidget(screen);
 			fileDialogue->LayoutWidget(screen);
-			cout << "Layout updated." << endl;
+			quickOpen->LayoutWidget(screen);
+			goToSymbol->LayoutWidget(screen);
+			if (completionList->visibility == UI::Visibility::Visible)
+				UpdateCompletions();
 		}
 
-		if (UI::Tick(activeWidget) || firstFrame || IsWindowResized()) {
+		auto wasSearching = documentSearch.IsRunning();
+		auto wasIndexing = fileIndex.IsCrawling();
+		auto wasSearchingFiles = projectSearch.IsRunning();
+		auto wasIndexingSymbols = symbolIndexer.IsRunning();
+		auto needRedraw = UI::Tick(activeWidget) || needLayout;
+		// Matches stream in from the background scan; draw each batch as it arrives.
+		needRedraw = ApplyFileChanges() || needRedraw;
+		needRedraw = ApplyProjectSearchResults() || (wasSearchingFiles && !projectSearch.IsRunning()) || needRedraw;
+		needRedraw = ApplyIndexChanges() || (wasIndexing && !fileIndex.IsCrawling()) || needRedraw;
+		needRedraw = UpdateSymbolIndex() || (wasIndexingSymbols && !symbolIndexer.IsRunning()) || needRedraw;
+		needRedraw = documentSearch.TakeMatches(textarea->highlights) || (wasSearching && !documentSearch.IsRunning()) || needRedraw;
+
+		if (needRedraw) {
 
 			BeginDrawing();
 			ClearBackground(RAYWHITE);
 
 			window->Draw();
+			completionList->Draw();
 
 			if (activeWidget == fileDialogue) {
 				DrawRectangleRec(screen, Fade(BLACK, 0.25f)); // semi-transparent background
 				fileDialogue->Draw();
 			}
+			else if (activeWidget == quickOpen) {
+				DrawRectangleRec(screen, Fade(BLACK, 0.25f));
+				quickOpen->Draw();
+			}
+			else if (activeWidget == goToSymbol) {
+				DrawRectangleRec(screen, Fade(BLACK, 0.25f));
+				goToSymbol->Draw();
+			}
 
+			PROFILE_FRAME_END();
 			EndDrawing();
 
 			//cout << "Redrawing UI..." << endl;
 		}
+		frameArena.Reset();
 
 		if (firstFrame)
 			firstFrame = false;
 
+		if (GetTime() - lastSessionWrite >= sessionWriteInterval) {
+			sessionWriter.Write(CurrentSession());
+			lastSessionWrite = GetTime();
+		}
+
 		PollInputEvents();
 	}
 
+#ifdef TEXTED_PROFILE
+	Profiler::WriteChromeTrace(traceFilePath);
+#endif
+
+	sessionWriter.Write(CurrentSession());
+	sessionWriter.Stop();
+	if (sessionWriter.Failed())
+		std::cerr << "Failed to write session: " << sessionPath << std::endl;
+	// Closing the window discards unsaved edits; only a crash leaves the journal behind.
+	editJournal->Close();
+	for (const auto& document: documents)
+		if (document->journal)
+			document->journal->Close();
+	fileWatch.Stop();
+	fileIndex.Stop();
+	projectSearch.Cancel();
+	symbolIndexer.Cancel();
+	UI::glyphAtlas.Unload();
 	CloseWindow();
 
 	return 0;